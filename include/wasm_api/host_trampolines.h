@@ -0,0 +1,176 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/error.h"
+
+#include <concepts>
+#include <cstdint>
+#include <type_traits>
+
+extern "C"
+{
+    // Returned from a host function:
+    // panic has type HostFnError
+    struct TrampolineResult
+    {
+        uint64_t result;
+        uint8_t panic;
+    };
+}
+
+namespace wasm_api
+{
+
+struct HostCallContext;
+
+/**
+ * Gas charged for each call to a linked host function:
+ * base, plus per_byte times the value of argument len_arg
+ * (i.e. the length in a (pointer, length) argument pair).
+ *
+ * Each engine charges this from its own gas counter,
+ * before calling into the host function, as consume_gas() would.
+ * If there is not enough gas, the call traps with
+ * OUT_OF_GAS without calling the host function.
+ */
+struct HostFnGasCost
+{
+    uint64_t base = 0;
+    uint64_t per_byte = 0;
+    uint8_t len_arg = 0;
+
+    constexpr static HostFnGasCost fixed(uint64_t gas)
+    {
+        return HostFnGasCost{ .base = gas };
+    }
+
+    constexpr bool is_free() const
+    {
+        return base == 0 && per_byte == 0;
+    }
+
+    // For a host function with nargs arguments
+    constexpr bool valid_for(uint8_t nargs) const
+    {
+        return per_byte == 0 || len_arg < nargs;
+    }
+
+    // Saturates at UINT64_MAX.  Requires valid_for(sizeof...(args)).
+    template<std::same_as<uint64_t>... Args>
+    constexpr uint64_t cost(Args... args) const
+    {
+        if (per_byte == 0) {
+            return base;
+        }
+        const uint64_t arg_values[] = { args..., 0 };
+        const uint64_t len = arg_values[len_arg];
+        if (len != 0 && per_byte > (UINT64_MAX - base) / len) {
+            return UINT64_MAX;
+        }
+        return base + per_byte * len;
+    }
+};
+
+namespace detail
+{
+
+/**
+ * Every engine calls a linked host function through a trampoline
+ * of this type (one uint64_t per wasm argument), which is stored
+ * alongside the (type-erased) host function pointer when the function
+ * is linked.  Same type whether or not the host function returns a value.
+ *
+ * Rust calls these too (see wasmi_lib/src/external_call.rs),
+ * so the signature is part of the FFI.
+ */
+template<std::same_as<uint64_t>... Args>
+using HostTrampoline = TrampolineResult (*)(void* fn_pointer,
+                                            void* host_call_context,
+                                            Args... args) noexcept;
+
+// Out of line, as these are the unlikely paths
+TrampolineResult host_fn_error(HostFnError error) noexcept;
+TrampolineResult host_fn_exception() noexcept;
+
+template<typename ret_type>
+TrampolineResult to_trampoline_result(HostFnStatus<ret_type> const& result) noexcept
+{
+    if (result) [[likely]] {
+        if constexpr (std::is_void_v<ret_type>) {
+            return TrampolineResult{ 0, static_cast<uint8_t>(HostFnError::NONE_OR_RECOVERABLE) };
+        } else {
+            return TrampolineResult{ *result, static_cast<uint8_t>(HostFnError::NONE_OR_RECOVERABLE) };
+        }
+    }
+    return host_fn_error(result.error());
+}
+
+// For functions linked with WasmContext::link_fn(f):
+// fn_pointer is f.
+template<typename ret_type, std::same_as<uint64_t>... Args>
+TrampolineResult host_trampoline(void* fn_pointer,
+                                 void* host_call_context,
+                                 Args... args) noexcept
+{
+    auto* f = reinterpret_cast<HostFnStatus<ret_type>(*)(HostCallContext*, Args...)>(fn_pointer);
+    try
+    {
+        return to_trampoline_result((*f)(static_cast<HostCallContext*>(host_call_context), args...));
+    }
+    catch (...)
+    {
+        return host_fn_exception();
+    }
+}
+
+template<auto F>
+struct DirectHostFn;
+
+// For functions linked with WasmContext::link_fn<F>():
+// F is called directly (and can be inlined into its trampoline),
+// and fn_pointer is unused.  noexcept functions skip the try/catch.
+template<typename ret, std::same_as<uint64_t>... Args, bool is_noexcept,
+         HostFnStatus<ret> (*F)(HostCallContext*, Args...) noexcept(is_noexcept)>
+struct DirectHostFn<F>
+{
+    using ret_type = ret;
+    constexpr static uint8_t nargs = sizeof...(Args);
+
+    static TrampolineResult trampoline(void*,
+                                       void* host_call_context,
+                                       Args... args) noexcept
+    {
+        auto* ctx = static_cast<HostCallContext*>(host_call_context);
+        if constexpr (is_noexcept) {
+            return to_trampoline_result(F(ctx, args...));
+        } else {
+            try
+            {
+                return to_trampoline_result(F(ctx, args...));
+            }
+            catch (...)
+            {
+                return host_fn_exception();
+            }
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace wasm_api
@@ -0,0 +1,151 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace wasm_api
+{
+
+struct RuntimePoolConfig {
+  // ready runtimes kept per script
+  uint32_t runtimes_per_script = 4;
+  // scripts not acquired for this long are dropped, with their runtimes
+  std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(60);
+  // when more scripts are added, the least recently acquired is dropped
+  uint32_t max_scripts = 1024;
+};
+
+struct RuntimePoolStats {
+  uint64_t acquired_warm = 0;
+  uint64_t acquired_cold = 0;
+  uint64_t scripts = 0;
+  uint64_t ready_runtimes = 0;
+};
+
+/**
+ * Keeps a few instantiated runtimes ready for each (hot) script,
+ * so that acquire() is a deque pop rather than an instantiation.
+ *
+ * A background thread instantiates runtimes to refill each script's
+ * pool, resets released runtimes for reuse, and drops idle scripts.
+ *
+ * Threadsafe.  Runtimes are created on the background thread
+ * and handed to whichever thread calls acquire().
+ */
+class RuntimePool {
+public:
+  RuntimePool(WasmContext const& context, RuntimePoolConfig config = {});
+
+  ~RuntimePool();
+
+  /**
+   * Start keeping runtimes ready for this script.  Compiles
+   * synchronously (through the context's module cache), and returns
+   * false if the script is invalid.  No-op if already added.
+   */
+  bool add_script(Hash const& script_identifier, Script const& script);
+  bool add_script(Hash const& script_identifier, CompiledModule const& module);
+
+  /**
+   * Returns a ready runtime if there is one, and otherwise
+   * instantiates one inline.  Returns nullptr if the script
+   * was not added (or has since been dropped).
+   */
+  std::unique_ptr<WasmRuntime> acquire(Hash const& script_identifier, void *ctxp);
+
+  /**
+   * Hand a runtime (from acquire() with the same identifier) back.
+   * It is reset in the background and reused if its script
+   * is still pooled and below target, and destroyed otherwise.
+   */
+  void release(Hash const& script_identifier, std::unique_ptr<WasmRuntime> runtime);
+
+  RuntimePoolStats get_stats() const;
+
+private:
+  struct HashHasher {
+    std::size_t operator()(Hash const& h) const {
+      std::size_t out;
+      std::memcpy(&out, h.data(), sizeof(out));
+      return out;
+    }
+  };
+
+  struct Entry {
+    CompiledModule module;
+    std::deque<std::unique_ptr<WasmRuntime>> ready;
+    // runtimes being instantiated or reset for this entry
+    uint32_t in_progress = 0;
+    std::chrono::steady_clock::time_point last_used;
+    // Unique per entry, so that work finished without mtx held
+    // is not credited to a new entry for the same script
+    // (if the old one was dropped in the meantime)
+    uint64_t generation;
+  };
+
+  struct ResetJob {
+    Hash script_identifier;
+    uint64_t generation;
+    std::unique_ptr<WasmRuntime> runtime;
+  };
+
+  const RuntimePoolConfig config;
+  WasmContext context;
+
+  mutable std::mutex mtx;
+  std::condition_variable cv;
+  bool shutdown = false;
+
+  std::unordered_map<Hash, Entry, HashHasher> entries;
+  std::deque<ResetJob> to_reset;
+  std::deque<Hash> to_refill;
+  uint64_t next_generation = 0;
+
+  RuntimePoolStats stats;
+
+  std::thread worker;
+
+  void run_worker();
+
+  // all below require mtx held
+  void request_refill(Hash const& script_identifier, Entry& entry);
+  // nullptr if the entry was dropped (or replaced)
+  Entry* find_entry(Hash const& script_identifier, uint64_t generation);
+  // Evicted entries are moved to dropped, for the caller to destroy
+  // after releasing mtx (tearing down their runtimes is slow,
+  // and would otherwise block acquire())
+  void evict_idle(std::chrono::steady_clock::time_point now,
+                  std::deque<Entry>& dropped);
+  void evict_to_max_scripts(std::deque<Entry>& dropped);
+
+  RuntimePool(RuntimePool const&) = delete;
+  RuntimePool(RuntimePool&&) = delete;
+};
+
+} // namespace wasm_api
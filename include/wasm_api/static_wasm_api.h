@@ -0,0 +1,250 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+
+namespace wasm_api
+{
+
+class Wasm3_WasmRuntime;
+class Stitch_WasmRuntime;
+class Wasmi_WasmRuntime;
+class Fizzy_WasmRuntime;
+class Wasmtime_WasmRuntime;
+
+namespace detail
+{
+
+template<SupportedWasmEngine engine>
+struct StaticRuntimeImpl;
+
+template<>
+struct StaticRuntimeImpl<SupportedWasmEngine::WASM3> {
+  using type = Wasm3_WasmRuntime;
+};
+
+template<>
+struct StaticRuntimeImpl<SupportedWasmEngine::MAKEPAD_STITCH> {
+  using type = Stitch_WasmRuntime;
+};
+
+template<>
+struct StaticRuntimeImpl<SupportedWasmEngine::WASMI> {
+  using type = Wasmi_WasmRuntime;
+};
+
+template<>
+struct StaticRuntimeImpl<SupportedWasmEngine::FIZZY> {
+  using type = Fizzy_WasmRuntime;
+};
+
+// cranelift and winch differ only in how the module is compiled
+template<>
+struct StaticRuntimeImpl<SupportedWasmEngine::WASMTIME_CRANELIFT> {
+  using type = Wasmtime_WasmRuntime;
+};
+
+template<>
+struct StaticRuntimeImpl<SupportedWasmEngine::WASMTIME_WINCH> {
+  using type = Wasmtime_WasmRuntime;
+};
+
+// wasm3 and stitch keep the runtime's gas counter
+// in the WasmRuntime's HostCallContext
+template<SupportedWasmEngine engine>
+constexpr static bool gas_in_host_call_context
+  = (engine == SupportedWasmEngine::WASM3 || engine == SupportedWasmEngine::MAKEPAD_STITCH);
+
+} // namespace detail
+
+/**
+ * A WasmRuntime whose engine is known at compile time.
+ *
+ * invoke(), the gas methods, and get_memory() call the engine's
+ * (final) runtime class directly, rather than through the virtual
+ * WasmRuntimeImpl interface.  These calls are not inline (they are
+ * defined, for each engine, in static_wasm_api.cc), except for
+ * the gas methods of wasm3 and stitch, which read and write
+ * the runtime's HostCallContext here.
+ *
+ * Behaves exactly as the underlying WasmRuntime, which remains
+ * available (through dynamic()) for everything else.
+ */
+template<SupportedWasmEngine engine>
+class StaticWasmRuntime {
+public:
+  using impl_type = typename detail::StaticRuntimeImpl<engine>::type;
+
+  StaticWasmRuntime() = default;
+
+  /**
+   * Takes ownership of runtime.  Evaluates to false
+   * if runtime is null or is not of this engine.
+   */
+  explicit StaticWasmRuntime(std::unique_ptr<WasmRuntime> runtime);
+
+  explicit operator bool() const {
+    return !!runtime;
+  }
+
+  // Same as WasmRuntime::invoke()
+  MeteredReturn invoke(MethodHandle const &method,
+                       uint64_t gas_limit = UINT64_MAX);
+  MeteredReturn invoke(std::string_view method_name,
+                       uint64_t gas_limit = UINT64_MAX);
+
+  MethodHandle prepare(std::string_view method_name) const {
+    return runtime->prepare(method_name);
+  }
+
+  bool __attribute__((warn_unused_result)) consume_gas(uint64_t gas) {
+    if constexpr (detail::gas_in_host_call_context<engine>) {
+      return runtime->impl && runtime->host_call_context.consume_gas(gas);
+    } else {
+      return engine_consume_gas(gas);
+    }
+  }
+
+  uint64_t get_available_gas() const {
+    if constexpr (detail::gas_in_host_call_context<engine>) {
+      return runtime->impl ? runtime->host_call_context.available_gas : 0;
+    } else {
+      return engine_get_available_gas();
+    }
+  }
+
+  void set_available_gas(uint64_t gas) {
+    if constexpr (detail::gas_in_host_call_context<engine>) {
+      if (runtime->impl) {
+        runtime->host_call_context.available_gas = gas;
+      }
+    } else {
+      engine_set_available_gas(gas);
+    }
+  }
+
+  std::span<std::byte> get_memory();
+  std::span<const std::byte> get_memory() const;
+
+  bool __attribute__((warn_unused_result)) reset() {
+    return runtime->reset();
+  }
+
+  /**
+   * For host functions linked into a runtime of this engine.
+   * Same as context->consume_gas(gas), for every engine.
+   */
+  static bool __attribute__((warn_unused_result))
+  consume_gas(HostCallContext *context, uint64_t gas) {
+    return context->consume_gas(gas);
+  }
+
+  WasmRuntime &dynamic() {
+    return *runtime;
+  }
+
+  WasmRuntime const &dynamic() const {
+    return *runtime;
+  }
+
+  std::unique_ptr<WasmRuntime> release() {
+    return std::move(runtime);
+  }
+
+private:
+  std::unique_ptr<WasmRuntime> runtime;
+
+  // Not cached, as reset() can replace the runtime's impl.
+  // nullptr if the runtime is unusable.
+  static impl_type *get_impl(WasmRuntime const &runtime);
+
+  // The gas methods of engines whose gas is not in the HostCallContext
+  bool engine_consume_gas(uint64_t gas);
+  uint64_t engine_get_available_gas() const;
+  void engine_set_available_gas(uint64_t gas);
+};
+
+/**
+ * A WasmContext for exactly one engine, which instantiates
+ * StaticWasmRuntimes of that engine.  dynamic() is the
+ * underlying WasmContext, which can be copied and used
+ * (i.e. with a RuntimePool) as any other.
+ */
+template<SupportedWasmEngine engine>
+class StaticWasmContext {
+public:
+  StaticWasmContext(const uint32_t MAX_STACK_BYTES,
+                    uint32_t compile_threads = 0)
+    : context(MAX_STACK_BYTES, engine, compile_threads)
+    {}
+
+  template<typename ret_type, std::same_as<uint64_t>... Args>
+  bool link_fn(std::string const& module_name, std::string const& fn_name,
+               HostFnStatus<ret_type> (*f)(HostCallContext *, Args...),
+               HostFnGasCost const& gas = HostFnGasCost{})
+  {
+    return context.link_fn(module_name, fn_name, f, gas);
+  }
+
+  template<auto F>
+  bool link_fn(std::string const& module_name, std::string const& fn_name,
+               HostFnGasCost const& gas = HostFnGasCost{})
+  {
+    return context.template link_fn<F>(module_name, fn_name, gas);
+  }
+
+  void freeze_links() {
+    context.freeze_links();
+  }
+
+  CompiledModule compile(Script const &script,
+                         const Hash* script_identifier = nullptr) {
+    return context.compile(script, script_identifier);
+  }
+
+  StaticWasmRuntime<engine> new_runtime_instance(Script const &script,
+                                                 void *ctxp,
+                                                 const Hash* script_identifier = nullptr) {
+    return StaticWasmRuntime<engine>(context.new_runtime_instance(script, ctxp, script_identifier));
+  }
+
+  // module must be from a context of this engine
+  StaticWasmRuntime<engine> instantiate(CompiledModule const &module, void *ctxp) const {
+    return StaticWasmRuntime<engine>(module.instantiate(ctxp));
+  }
+
+  WasmContext &dynamic() {
+    return context;
+  }
+
+  WasmContext const &dynamic() const {
+    return context;
+  }
+
+private:
+  WasmContext context;
+};
+
+} // namespace wasm_api
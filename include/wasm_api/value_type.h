@@ -21,9 +21,16 @@
 namespace wasm_api
 {
 
+// Host functions take U64s and return U64 or VOID.
+// Exported functions may also take and return I32s (see TypedMethodHandle).
 enum class WasmValueType : uint8_t {
     VOID = 0,
     U64 = 1,
+    I32 = 2,
 };
 
+// Most arguments (or results) of a typed invoke,
+// so that they fit in arrays on the stack.
+constexpr static uint32_t MAX_TYPED_INVOKE_VALUES = 16;
+
 } // namespace wasm_api
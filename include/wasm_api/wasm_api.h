@@ -17,18 +17,28 @@
  */
 
 #include "wasm_api/error.h"
+#include "wasm_api/host_trampolines.h"
 #include "wasm_api/value_type.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 #include <span>
+#include <string>
+#include <string_view>
 
 namespace wasm_api {
 
@@ -42,11 +52,82 @@ struct Script {
 
 constexpr static Script null_script = Script{.data = nullptr, .len = 0};
 
+/* Shares ownership of the underlying (immutable) memory,
+ * so engines that need the bytes after compile() can keep them
+ * without a copy.  data can point into any owner
+ * (via shared_ptr's aliasing constructor). */
+struct SharedScript {
+  std::shared_ptr<const uint8_t> data;
+  uint32_t len;
+
+  Script get() const { return Script{.data = data.get(), .len = len}; }
+};
+
 class WasmRuntime;
 
 struct HostCallContext {
   WasmRuntime *runtime = nullptr;
   void *user_ctx = nullptr;
+
+  /**
+   * The runtime's gas, as seen by a host function while it runs.
+   * For wasm3 and stitch, this is the runtime's gas counter.
+   * The other engines copy their fuel here before calling
+   * a host function, and deduct whatever the host function
+   * consumed from it once the host function returns.
+   *
+   * Host functions should use consume_gas() below
+   * rather than runtime->consume_gas(), which is a virtual
+   * (and for wasmi and wasmtime, FFI) call.
+   * Only meaningful during a host function call.
+   */
+  uint64_t available_gas = 0;
+
+  bool __attribute__((warn_unused_result)) consume_gas(uint64_t gas) {
+    if (gas > available_gas) [[unlikely]] {
+      available_gas = 0;
+      return false;
+    }
+    available_gas -= gas;
+    return true;
+  }
+};
+
+// available_gas is read and written from rust (see HostCallContext
+// in wasmi_lib/src/external_call.rs)
+static_assert(offsetof(HostCallContext, available_gas) == 2 * sizeof(void*));
+
+/**
+ * Gas metering import, (import "env" "gas" (func (param i64))),
+ * as inserted by wasm-instrument and similar instrumentation passes.
+ *
+ * wasm3 links this itself, to a native decrement of the runtime's
+ * gas counter (no host function call), which traps with OUT_OF_GAS
+ * once the counter runs out.  For a context with gas instrumentation
+ * (see WasmContext::set_gas_instrumentation()), stitch links a builtin
+ * host function that calls HostCallContext::consume_gas() -- still
+ * a host call (through the trampoline) per metered block.
+ * Otherwise, link a host function that calls consume_gas()
+ * under this name.  A host function linked under this name
+ * replaces the builtin.
+ */
+constexpr static const char* GAS_INTRINSIC_MODULE = "env";
+constexpr static const char* GAS_INTRINSIC_FN = "gas";
+
+// See WasmContext::set_gas_instrumentation()
+struct GasInstrumentationConfig {
+  // Charged per wasm instruction
+  uint64_t instruction_cost = 1;
+
+  /**
+   * Charge each function without loops its worst-case cost
+   * (i.e. that of its most expensive path) once, on entry,
+   * after which it runs unmetered, instead of charging
+   * each basic block as it runs.  Still deterministic,
+   * but overcharges (see WasmContext::set_gas_instrumentation()),
+   * so off by default.
+   */
+  bool static_bounds = false;
 };
 
 struct MeteredReturn {
@@ -54,6 +135,39 @@ struct MeteredReturn {
   uint64_t gas_consumed;
 };
 
+template<typename... Rets>
+struct TypedMeteredReturn {
+  InvokeStatus<std::tuple<Rets...>> result;
+  uint64_t gas_consumed;
+};
+
+// When WasmRuntime::invoke_batch() stops early.
+// RETURN is never an error here -- it only ends its own call.
+enum class BatchErrorPolicy : uint8_t {
+  // stop after the first call that fails
+  STOP_ON_ANY_ERROR = 0,
+  // keep going after deterministic errors (incl. running out of gas),
+  // and stop only after an UNRECOVERABLE error
+  STOP_ON_UNRECOVERABLE = 1,
+};
+
+struct InvokeRequest;
+
+/**
+ * Counters for a WasmContext's cache of compiled modules
+ * (only scripts instantiated with a script identifier are cached).
+ * bytes is the size of compiled code for wasmtime,
+ * and the size of the input wasm for every other engine.
+ */
+struct ModuleCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+  uint64_t budget_bytes = 0;
+};
+
 namespace detail {
 
 template<typename T>
@@ -69,50 +183,178 @@ struct WasmValueTypeLookup<uint64_t> {
     constexpr static WasmValueType VAL = WasmValueType::U64;
 };
 
+template<>
+struct WasmValueTypeLookup<uint32_t> {
+    constexpr static WasmValueType VAL = WasmValueType::I32;
+};
+
+// Types that can be passed to and returned from a typed invoke
+template<typename T>
+concept TypedInvokeValue = std::same_as<T, uint32_t> || std::same_as<T, uint64_t>;
+
 struct DefaultLinkEntry {
     std::string module_name;
     std::string fn_name;
+    // nullptr if the trampoline calls the function directly
     void* fn;
+    // HostTrampoline<nargs uint64_t>
+    void* trampoline;
     uint8_t nargs;
     WasmValueType ret_type;
+    HostFnGasCost gas;
+    // position in the context's link entries, so that engines
+    // can key what they link by entry instead of by name
+    uint32_t index;
+};
+
+// Host functions that a particular module imports,
+// resolved against a context's (frozen) link entries.
+using LinkTable = std::vector<DefaultLinkEntry const*>;
+
+// wasm_api/module_cache.h
+template<typename V>
+class ModuleCache;
+
+// Only I32 and U64 (i64) params and results are representable.
+struct FunctionSignature {
+    std::vector<WasmValueType> params;
+    std::vector<WasmValueType> results;
+};
+
+struct ExportedFunction {
+    std::string name;
+    // nullopt if the function has params or results
+    // of other types (i.e. floats)
+    std::optional<FunctionSignature> signature;
+};
+
+// A module's function exports, in export order.
+// MethodHandles are indices into this.
+using ExportTable = std::vector<ExportedFunction>;
+
+// Computed once per module (per script identifier),
+// rather than on every compile() and instantiation.
+struct ModuleTables {
+    // nullptr if links were not frozen when this was made
+    std::shared_ptr<const LinkTable> link_table;
+    std::shared_ptr<const ExportTable> exports;
 };
 
 class WasmRuntimeImpl;
+
+class CompilePool;
+
+inline bool
+batch_should_stop(InvokeStatus<uint64_t> const& res, BatchErrorPolicy policy)
+{
+  if (res || res.error() == InvokeError::RETURN) {
+    return false;
+  }
+  return res.error() == InvokeError::UNRECOVERABLE
+    || policy == BatchErrorPolicy::STOP_ON_ANY_ERROR;
+}
+
+class CompiledModuleImpl {
+public:
+  // Threadsafe.  Returns nullptr on failure.
+  // Links only what the engine links at compile time --
+  // caller must call finish_link() on the result.
+  virtual std::unique_ptr<WasmRuntimeImpl>
+  instantiate(HostCallContext *host_call_context) = 0;
+
+  virtual ~CompiledModuleImpl() {}
+
+protected:
+  CompiledModuleImpl() = default;
+
+private:
+  CompiledModuleImpl(CompiledModuleImpl const &) = delete;
+  CompiledModuleImpl(CompiledModuleImpl &&) = delete;
+};
+
 class WasmContextImpl {
 public:
 
-  virtual std::unique_ptr<WasmRuntime>
-  new_runtime_instance(Script const &contract, void *ctxp, const Hash* script_identifier) = 0;
+  // Returns nullptr if the script is invalid.
+  virtual std::shared_ptr<CompiledModuleImpl>
+  compile(Script const &contract, const Hash* script_identifier) = 0;
 
-  virtual ~WasmContextImpl() {}
+  // Only engines that keep the script bytes implement this.
+  virtual std::shared_ptr<CompiledModuleImpl>
+  compile_shared(SharedScript const &contract, const Hash* script_identifier) {
+    return compile(contract.get(), script_identifier);
+  }
+
+  virtual ~WasmContextImpl();
 
   // Expected function signature: HostFnStatus<uint64_t>(HostCallContext*, nargs repeated uint64)
+  // Engines charge gas, and then call trampoline(fn, host_call_context, args...)
   virtual bool link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs,
-    WasmValueType ret_type) {
+    WasmValueType ret_type,
+    HostFnGasCost const& gas) {
       std::lock_guard lock(link_entry_mutex);
+      if (links_frozen) {
+        return false;
+      }
         link_entries.emplace_back(
             module_name,
             fn_name,
             fn,
+            trampoline,
             nargs,
-            ret_type);
+            ret_type,
+            gas,
+            static_cast<uint32_t>(link_entries.size()));
     return true;
   }
 
   virtual bool init_success() { return true; }
 
-  virtual bool finish_link(std::unique_ptr<WasmRuntime>& pre_link);
+  // Only engines that compile ahead of time implement this.
+  virtual bool set_disk_cache_dir(std::string const& dir) { return false; }
+
+  // Only engines without native fuel metering implement this.
+  virtual bool set_gas_instrumentation(GasInstrumentationConfig const& config) { return false; }
+
+  virtual ModuleCacheStats get_module_cache_stats() const = 0;
+  virtual void set_module_cache_budget(uint64_t budget_bytes) = 0;
+
+  // link_table is nullptr if links were not frozen when
+  // the module was compiled, in which case every entry is linked.
+  virtual bool finish_link(WasmRuntime& pre_link, LinkTable const* link_table);
+
+  void freeze_links() {
+    std::lock_guard lock(link_entry_mutex);
+    links_frozen = true;
+  }
+
+  bool are_links_frozen() const {
+    return links_frozen;
+  }
+
+  // Cached by script_identifier, unless that is nullptr.  Threadsafe.
+  std::shared_ptr<const ModuleTables> get_module_tables(Script const& contract,
+                                                        const Hash* script_identifier);
 
 protected:
-  WasmContextImpl() = default;
+  WasmContextImpl();
 
   std::mutex link_entry_mutex;
 
 private:
+  // Immutable (and so readable without link_entry_mutex) once links_frozen
   std::vector<DefaultLinkEntry> link_entries;
+  std::atomic<bool> links_frozen = false;
+
+  std::unique_ptr<ModuleCache<std::shared_ptr<const ModuleTables>>> module_tables;
+
+  // nullptr if links are not frozen
+  std::shared_ptr<const LinkTable> make_link_table(Script const& contract);
+  std::shared_ptr<const ModuleTables> make_module_tables(Script const& contract);
 
   WasmContextImpl(WasmContextImpl const &) = delete;
   WasmContextImpl(WasmContextImpl &&) = delete;
@@ -125,6 +367,43 @@ public:
 
   virtual InvokeStatus<uint64_t> invoke(std::string const &method_name) = 0;
 
+  // method_index is the method's index in the module's ExportTable,
+  // the same for every runtime of the module.  Engines cache the
+  // function they look up for it.
+  virtual InvokeStatus<uint64_t> invoke_prepared(uint32_t method_index,
+                                                 std::string const &method_name) {
+    return invoke(method_name);
+  }
+
+  // Same as invoke_prepared() with gas_limit as the available gas,
+  // with the gas from before restored afterwards.  Engines implement
+  // this in one step; the default is the sequence of virtual calls.
+  virtual MeteredReturn invoke_metered(uint32_t method_index,
+                                       std::string const &method_name,
+                                       uint64_t gas_limit);
+
+  // Same, but for a method whose signature has already been checked
+  // against args and results (one uint64_t per value, I32s zero-extended).
+  // The result field holds no value (just 0) on success;
+  // results are written to results.
+  virtual MeteredReturn invoke_typed(uint32_t method_index,
+                                     ExportedFunction const &method,
+                                     uint64_t gas_limit,
+                                     std::span<const uint64_t> args,
+                                     std::span<uint64_t> results) {
+    return { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
+  }
+
+  // Runs requests in order (each with gas set to its gas_limit, and
+  // the gas from before the batch restored after), until one fails
+  // per policy.  Every request's method is from this runtime's module.
+  // Returns the number run; results are written for each of those.
+  // Engines whose gas lives across an FFI boundary override this
+  // to cross it once per batch.
+  virtual size_t invoke_batch(std::span<const InvokeRequest> requests,
+                              std::span<MeteredReturn> results,
+                              BatchErrorPolicy policy);
+
   virtual bool __attribute__((warn_unused_result))
   consume_gas(uint64_t gas) = 0;
 
@@ -134,14 +413,47 @@ public:
   virtual bool link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs,
-    WasmValueType ret_type) = 0;
+    WasmValueType ret_type,
+    HostFnGasCost const& gas) = 0;
+
+  // entry is one of the owning context's link entries
+  virtual bool link_entry(DefaultLinkEntry const& entry) {
+    return link_fn_nargs(entry.module_name, entry.fn_name, entry.fn,
+        entry.trampoline, entry.nargs, entry.ret_type, entry.gas);
+  }
+
+  // Restore memory, globals, and tables to their state
+  // just after instantiation, without creating a new runtime
+  // (and relinking it).  Returns false if unsupported (or on failure),
+  // in which case WasmRuntime::reset() re-instantiates.
+  virtual bool reset() { return false; }
 
   virtual ~WasmRuntimeImpl() {}
 
 protected:
   WasmRuntimeImpl() = default;
 
+  // gas_remaining more than gas_limit means the engine's gas accounting is broken
+  static MeteredReturn metered_return(InvokeStatus<uint64_t> const& res,
+                                      uint64_t gas_limit,
+                                      uint64_t gas_remaining) {
+    if (gas_limit < gas_remaining) {
+      return { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
+    }
+    return { .result = res, .gas_consumed = gas_limit - gas_remaining };
+  }
+
+  // for invoke_typed(), where the result holds no value (just 0) on success
+  static MeteredReturn metered_return(InvokeStatus<void> const& res,
+                                      uint64_t gas_limit,
+                                      uint64_t gas_remaining) {
+    return metered_return(res ? InvokeStatus<uint64_t>(0)
+                              : InvokeStatus<uint64_t>(std::unexpect_t{}, res.error()),
+                          gas_limit, gas_remaining);
+  }
+
 private:
   WasmRuntimeImpl(WasmRuntimeImpl const &) = delete;
   WasmRuntimeImpl(WasmRuntimeImpl &&) = delete;
@@ -166,6 +478,134 @@ enum class SupportedWasmEngine {
 
 class WasmContext;
 
+// static_wasm_api.h
+template<SupportedWasmEngine engine>
+class StaticWasmRuntime;
+
+/**
+ * A script that has been parsed and validated (and, for engines
+ * that compile ahead of time, compiled), and can be instantiated
+ * any number of times without the original script bytes.
+ *
+ * This is a wrapper around a shared_ptr, so can be copied/moved/etc,
+ * and is threadsafe.  Keeps its WasmContext's internals alive.
+ */
+class CompiledModule {
+public:
+  CompiledModule() = default;
+
+  // Returns nullptr on failure (i.e. a missing import).
+  std::unique_ptr<WasmRuntime> instantiate(void *ctxp) const;
+
+  explicit operator bool() const {
+    return !!impl;
+  }
+
+private:
+  friend class WasmContext;
+  friend class WasmRuntime;
+  template<SupportedWasmEngine> friend class StaticWasmRuntime;
+
+  CompiledModule(std::shared_ptr<detail::WasmContextImpl> context,
+                 std::shared_ptr<detail::CompiledModuleImpl> impl,
+                 std::shared_ptr<const detail::LinkTable> link_table,
+                 std::shared_ptr<const detail::ExportTable> exports)
+    : context(std::move(context))
+    , impl(std::move(impl))
+    , link_table(std::move(link_table))
+    , exports(std::move(exports))
+    {}
+
+  // declaration order matters: impl must be destroyed before context
+  std::shared_ptr<detail::WasmContextImpl> context;
+  std::shared_ptr<detail::CompiledModuleImpl> impl;
+  std::shared_ptr<const detail::LinkTable> link_table;
+  std::shared_ptr<const detail::ExportTable> exports;
+};
+
+/**
+ * An exported function, looked up once by WasmRuntime::prepare()
+ * and then invoked without any lookup by name.
+ *
+ * Valid for every runtime instantiated from the same CompiledModule
+ * (and across reset()), for as long as that CompiledModule exists.
+ * Cheap to copy.
+ */
+class MethodHandle {
+public:
+  MethodHandle() = default;
+
+  explicit operator bool() const {
+    return exports != nullptr;
+  }
+
+  // index in the module's export table (for engines' caches)
+  uint32_t get_index() const {
+    return index;
+  }
+
+  // requires a valid handle
+  std::string const& get_name() const {
+    return (*exports)[index].name;
+  }
+
+private:
+  friend class WasmRuntime;
+  template<SupportedWasmEngine> friend class StaticWasmRuntime;
+
+  MethodHandle(detail::ExportTable const* exports, uint32_t index)
+    : exports(exports)
+    , index(index)
+    {}
+
+  // identifies the module, for checking that a handle is used
+  // with a runtime of the module it came from
+  detail::ExportTable const* exports = nullptr;
+  uint32_t index = 0;
+};
+
+// One call of WasmRuntime::invoke_batch()
+struct InvokeRequest {
+  MethodHandle method;
+  uint64_t gas_limit;
+};
+
+template<typename Signature>
+class TypedMethodHandle;
+
+/**
+ * A MethodHandle whose export's signature has been checked
+ * (once, by WasmRuntime::prepare<Signature>()) to be
+ * std::tuple<Rets...>(Args...), where every type is uint32_t (i32)
+ * or uint64_t (i64).  Signatures with floats are not supported.
+ */
+template<detail::TypedInvokeValue... Rets, detail::TypedInvokeValue... Args>
+class TypedMethodHandle<std::tuple<Rets...>(Args...)> {
+  static_assert(sizeof...(Rets) <= MAX_TYPED_INVOKE_VALUES);
+  static_assert(sizeof...(Args) <= MAX_TYPED_INVOKE_VALUES);
+
+public:
+  TypedMethodHandle() = default;
+
+  explicit operator bool() const {
+    return !!method;
+  }
+
+  constexpr static std::array<WasmValueType, sizeof...(Args)> param_types
+    = { detail::WasmValueTypeLookup<Args>::VAL... };
+  constexpr static std::array<WasmValueType, sizeof...(Rets)> result_types
+    = { detail::WasmValueTypeLookup<Rets>::VAL... };
+
+private:
+  friend class WasmRuntime;
+
+  explicit TypedMethodHandle(MethodHandle method)
+    : method(method)
+    {}
+
+  MethodHandle method;
+};
+
 std::string engine_to_string(SupportedWasmEngine engine);
 std::string engine_to_string(std::variant<SupportedWasmEngine, WasmContext> engine);
 
@@ -176,29 +616,171 @@ std::string engine_to_string(std::variant<SupportedWasmEngine, WasmContext> engi
 // then nothing within a WasmContext implementation can affect a WasmRuntime's operation.
 class WasmContext {
 public:
+  // compile_threads: size of the pool used by compile_async().
+  // 0 picks a default based on the number of cores.
   WasmContext(const uint32_t MAX_STACK_BYTES,
-              SupportedWasmEngine engine = SupportedWasmEngine::WASM3);
+              SupportedWasmEngine engine = SupportedWasmEngine::WASM3,
+              uint32_t compile_threads = 0);
 
   std::unique_ptr<WasmRuntime> new_runtime_instance(Script const &script,
                                                     void *ctxp,
                                                     const Hash* script_identifier = nullptr);
 
+  /**
+   * Parse and validate (and compile, if applicable) a script
+   * once, for repeated instantiation.  Evaluates to false
+   * if the script is invalid.
+   * script need not outlive the returned CompiledModule.
+   */
+  CompiledModule compile(Script const &script,
+                         const Hash* script_identifier = nullptr);
+
+  /**
+   * Same as above, but engines that refer to the script bytes
+   * after compilation (wasm3) share script instead of copying it.
+   */
+  CompiledModule compile(SharedScript const &script,
+                         const Hash* script_identifier = nullptr);
+
+  /**
+   * Same as compile(), but runs on a background thread pool
+   * (shared by all copies of this WasmContext).
+   * Higher priority compilations start first.
+   *
+   * The script bytes are copied, so script need not outlive this call.
+   * If the last copy of this WasmContext is destroyed before the
+   * compilation starts, the result is an empty CompiledModule.
+   */
+  std::future<CompiledModule> compile_async(Script const &script,
+                                            const Hash* script_identifier = nullptr,
+                                            int32_t priority = 0);
+
+  // Does not copy script.
+  std::future<CompiledModule> compile_async(SharedScript const &script,
+                                            const Hash* script_identifier = nullptr,
+                                            int32_t priority = 0);
+
+  /**
+   * Each call to f is charged gas (see HostFnGasCost) before
+   * f is called, so f need not call consume_gas() itself.
+   */
   template<typename ret_type, std::same_as<uint64_t>... Args>
   bool link_fn(std::string const& module_name, std::string const& fn_name,
-               HostFnStatus<ret_type> (*f)(HostCallContext *, Args...))
+               HostFnStatus<ret_type> (*f)(HostCallContext *, Args...),
+               HostFnGasCost const& gas = HostFnGasCost{})
   {
-    if (!impl) {
+    constexpr uint8_t nargs = (kArgCount<Args>() + ... + 0);
+    if (!impl || impl -> are_links_frozen() || !gas.valid_for(nargs)) {
         return false;
     }
     return impl -> link_fn_nargs(module_name, fn_name, reinterpret_cast<void *>(f),
-                         (kArgCount<Args>() + ... + 0),
-                         detail::WasmValueTypeLookup<ret_type>::VAL);
+                         reinterpret_cast<void *>(&detail::host_trampoline<ret_type, Args...>),
+                         nargs,
+                         detail::WasmValueTypeLookup<ret_type>::VAL,
+                         gas);
+  }
+
+  /**
+   * Same as link_fn(module_name, fn_name, F), but with F known
+   * at compile time, so every engine calls a trampoline
+   * that calls F directly.  If F is noexcept, there is no
+   * exception handling around the call.
+   *
+   * F has type HostFnStatus<ret_type> (*)(HostCallContext*, uint64_t...).
+   */
+  template<auto F>
+  bool link_fn(std::string const& module_name, std::string const& fn_name,
+               HostFnGasCost const& gas = HostFnGasCost{})
+  {
+    using host_fn = detail::DirectHostFn<F>;
+    if (!impl || impl -> are_links_frozen() || !gas.valid_for(host_fn::nargs)) {
+        return false;
+    }
+    return impl -> link_fn_nargs(module_name, fn_name, nullptr,
+                         reinterpret_cast<void *>(&host_fn::trampoline),
+                         host_fn::nargs,
+                         detail::WasmValueTypeLookup<typename host_fn::ret_type>::VAL,
+                         gas);
+  }
+
+  /**
+   * After this, link_fn() fails, and modules compiled from then on
+   * link only the host functions they import, resolved once at
+   * compile time, without taking a lock on instantiation.
+   * Call once all host functions are linked.
+   */
+  void freeze_links() {
+    if (impl) {
+      impl -> freeze_links();
+    }
   }
 
   std::string engine() const {
     return engine_to_string(engine_type);
   }
 
+  /**
+   * Persist compiled modules (keyed by script identifier)
+   * in dir, so that they survive a process restart.
+   * Only supported by the wasmtime engines; returns false otherwise,
+   * or if dir cannot be created.
+   *
+   * Compiled artifacts are loaded without validation,
+   * so dir must not be writable by untrusted parties.
+   * Not threadsafe -- call before creating any runtimes.
+   */
+  bool set_disk_cache_dir(std::string const& dir) {
+    if (!impl) {
+      return false;
+    }
+    return impl -> set_disk_cache_dir(dir);
+  }
+
+  /**
+   * Instrument every script compiled from then on with calls
+   * to the gas import (see GAS_INTRINSIC_MODULE), charging
+   * config.instruction_cost per wasm instruction, one charge
+   * per basic block (see GasInstrumentationConfig for
+   * functions without loops).  Instrumented scripts are cached by
+   * script identifier.  Scripts that already import the gas
+   * import are assumed to be instrumented already.
+   *
+   * With config.static_bounds, every function without loops is
+   * charged its most expensive path on entry, exported or not,
+   * whichever path it takes.  So a call can cost more than
+   * without it: a function that returns early, or takes its
+   * cheaper branch, pays for the rest anyway, and a loop that
+   * calls such a function pays that worst case every iteration.
+   *
+   * Only supported by the engines without native fuel metering
+   * (wasm3 and stitch); returns false otherwise.
+   * Not threadsafe -- call before compiling any scripts.
+   */
+  bool set_gas_instrumentation(GasInstrumentationConfig const& config = GasInstrumentationConfig{}) {
+    if (!impl) {
+      return false;
+    }
+    return impl -> set_gas_instrumentation(config);
+  }
+
+  ModuleCacheStats get_module_cache_stats() const {
+    if (!impl) {
+      return {};
+    }
+    return impl -> get_module_cache_stats();
+  }
+
+  /**
+   * Cached modules are evicted (by greedy-dual-size-frequency,
+   * which weighs compile time and hit count against size)
+   * until the cache fits within budget_bytes.
+   */
+  void set_module_cache_budget(uint64_t budget_bytes) {
+    if (impl) {
+      impl -> set_module_cache_budget(budget_bytes);
+    }
+  }
+
   ~WasmContext() = default;
 
 private:
@@ -206,6 +788,15 @@ private:
 
   const SupportedWasmEngine engine_type;
 
+  static CompiledModule compile(std::shared_ptr<detail::WasmContextImpl> const& impl,
+                                Script const& script,
+                                const Hash* script_identifier);
+  static CompiledModule compile(std::shared_ptr<detail::WasmContextImpl> const& impl,
+                                SharedScript const& script,
+                                const Hash* script_identifier);
+
+  std::shared_ptr<detail::CompilePool> compile_pool;
+
   template<typename T> constexpr static auto kArgCount = [] { return 1; };
 };
 
@@ -225,16 +816,105 @@ public:
    * In most use-cases, caller should then deduct (return_value).gas_consumed
    * from some other gas limit.
    **/
-  MeteredReturn invoke(std::string const &method_name,
-                               uint64_t gas_limit = UINT64_MAX);
+  MeteredReturn invoke(std::string_view method_name,
+                       uint64_t gas_limit = UINT64_MAX);
+
+  /**
+   * Same as above, but with user_ctx as the HostCallContext's
+   * user_ctx for the duration of the call.
+   * The previous user_ctx is restored afterwards.
+   */
+  MeteredReturn invoke(std::string_view method_name,
+                       uint64_t gas_limit,
+                       void *user_ctx);
+
+  /**
+   * Look up an exported function once, for repeated invocation
+   * (on this runtime, or on any other of the same CompiledModule).
+   * Evaluates to false if there is no such export.
+   */
+  MethodHandle prepare(std::string_view method_name) const;
+
+  // Same as invoke() by name.  A handle from another module
+  // is an UNRECOVERABLE error.
+  MeteredReturn invoke(MethodHandle const &method,
+                       uint64_t gas_limit = UINT64_MAX);
+
+  /**
+   * Same as invoke(request.method, request.gas_limit) for each request,
+   * in order, but the Rust-backed engines run the whole sequence
+   * with a single FFI call (and a single save/restore of the gas).
+   *
+   * Stops early after a call that fails, per policy.  Returns the
+   * number of requests run (at most results.size()); results[i] is
+   * written for each.  A handle from another module is an
+   * UNRECOVERABLE error, and so always stops the batch.
+   */
+  size_t invoke_batch(std::span<const InvokeRequest> requests,
+                      std::span<MeteredReturn> results,
+                      BatchErrorPolicy policy = BatchErrorPolicy::STOP_ON_ANY_ERROR);
+
+  /**
+   * Same as prepare(), but also checks that the export's signature
+   * is Signature (i.e. std::tuple<uint64_t, uint32_t>(uint64_t)),
+   * so that it can be invoked with arguments, and return
+   * any number of results, without further checks.
+   */
+  template<typename Signature>
+  TypedMethodHandle<Signature> prepare(std::string_view method_name) const
+  {
+    MethodHandle method = prepare(method_name);
+    if (!method) {
+      return {};
+    }
+    auto const& sig = (*method.exports)[method.index].signature;
+    if (!sig
+        || !std::ranges::equal(sig->params, TypedMethodHandle<Signature>::param_types)
+        || !std::ranges::equal(sig->results, TypedMethodHandle<Signature>::result_types)) {
+      return {};
+    }
+    return TypedMethodHandle<Signature>(method);
+  }
+
+  // Arguments and results are passed natively (not through memory),
+  // without allocating.
+  template<typename... Rets, typename... Args>
+  TypedMeteredReturn<Rets...> invoke(TypedMethodHandle<std::tuple<Rets...>(Args...)> const &method,
+                                     uint64_t gas_limit,
+                                     std::type_identity_t<Args>... args)
+  {
+    const std::array<uint64_t, sizeof...(Args)> arg_values = { static_cast<uint64_t>(args)... };
+    std::array<uint64_t, sizeof...(Rets)> result_values = {};
+
+    auto res = invoke_typed(method.method, gas_limit, arg_values, result_values);
+    if (!res.result) {
+      return { .result = InvokeStatus<std::tuple<Rets...>>(std::unexpect_t{}, res.result.error()),
+               .gas_consumed = res.gas_consumed };
+    }
+
+    return {
+      .result = [&] <std::size_t... I> (std::index_sequence<I...>) {
+          return std::tuple<Rets...>(static_cast<Rets>(result_values[I])...);
+        } (std::index_sequence_for<Rets...>{}),
+      .gas_consumed = res.gas_consumed
+    };
+  }
+
+  /**
+   * Replace the user_ctx seen by host functions.
+   * Every engine reaches user_ctx through this runtime's
+   * HostCallContext, so this is just a store.
+   */
+  void rebind(void *user_ctx) {
+    host_call_context.user_ctx = user_ctx;
+  }
 
   bool link_fn(detail::DefaultLinkEntry const& entry)
   {
     if (!impl) {
         return false;
     }
-    return impl -> link_fn_nargs(entry.module_name, entry.fn_name, reinterpret_cast<void *>(entry.fn),
-        entry.nargs, entry.ret_type);
+    return impl -> link_entry(entry);
   }
 
   std::span<std::byte> get_memory();
@@ -254,12 +934,50 @@ public:
     }
   }
 
+  /**
+   * Restore this runtime to the state it was in just after
+   * instantiation (memory, globals, tables), so that it can be
+   * reused for another invocation of the same contract.
+   * Available gas and the user context pointer are unchanged.
+   *
+   * How cheap this is depends on the engine:
+   *  - wasm3 restores a snapshot of memory and globals, rewriting
+   *    only the pages that changed (unless the module has a start
+   *    function or grew its memory).
+   *  - wasmtime swaps in a new store, reusing the same pooled
+   *    instance slot, which resets only the pages that were touched.
+   *  - fizzy drops its instance but keeps its links; the next
+   *    invocation instantiates the module again.
+   *  - Otherwise (wasmi, stitch, and the cases above that cannot
+   *    be restored), this costs about as much as a new instance:
+   *    it re-instantiates from the CompiledModule this runtime
+   *    came from, and relinks.
+   * Returns false on failure, after which the runtime is unusable.
+   */
+  bool __attribute__((warn_unused_result)) reset();
+
   ~WasmRuntime();
 
 private:
+  friend class CompiledModule;
+  template<SupportedWasmEngine> friend class StaticWasmRuntime;
+
   detail::WasmRuntimeImpl *impl;
   HostCallContext host_call_context;
 
+  // what this runtime was instantiated from, for reset()
+  // (and for prepare())
+  CompiledModule origin;
+
+  template<typename F>
+  MeteredReturn metered_invoke(F&& invoke_impl, uint64_t gas_limit);
+
+  // result holds no value (just 0) on success
+  MeteredReturn invoke_typed(MethodHandle const &method,
+                             uint64_t gas_limit,
+                             std::span<const uint64_t> args,
+                             std::span<uint64_t> results);
+
   WasmRuntime(const WasmRuntime &) = delete;
   WasmRuntime(WasmRuntime &&) = delete;
   WasmRuntime &operator=(const WasmRuntime &) = delete;
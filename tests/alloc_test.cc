@@ -0,0 +1,273 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+
+#include "wasm_api/wasm_api.h"
+
+#include "tests/load_wasm.h"
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Checks that a steady-state invoke performs no heap allocations.
+ *
+ * Built as its own program, because it replaces malloc and friends
+ * for the whole process.  wasmi_lib uses Rust's default (System)
+ * global allocator, which allocates through these same functions,
+ * so this also counts allocations on the Rust side.
+ *
+ * Only successful calls are checked: traps allocate an error
+ * inside wasmi and wasmtime.
+ */
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace
+{
+
+// constant-initialized, so reading these never allocates
+thread_local bool counting = false;
+thread_local uint64_t allocations = 0;
+
+void
+note_allocation()
+{
+  if (counting) {
+    allocations++;
+  }
+}
+
+} // anonymous namespace
+
+extern "C" {
+
+void*
+malloc(size_t size)
+{
+  note_allocation();
+  return __libc_malloc(size);
+}
+
+void*
+calloc(size_t n, size_t size)
+{
+  note_allocation();
+  return __libc_calloc(n, size);
+}
+
+void*
+realloc(void* p, size_t size)
+{
+  note_allocation();
+  return __libc_realloc(p, size);
+}
+
+void*
+memalign(size_t alignment, size_t size)
+{
+  note_allocation();
+  return __libc_memalign(alignment, size);
+}
+
+void*
+aligned_alloc(size_t alignment, size_t size)
+{
+  note_allocation();
+  return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void** out, size_t alignment, size_t size)
+{
+  note_allocation();
+  *out = __libc_memalign(alignment, size);
+  return (*out == nullptr) ? ENOMEM : 0;
+}
+
+} // extern "C"
+
+namespace wasm_api
+{
+
+using namespace test;
+
+template<typename F>
+uint64_t
+count_allocations(F&& f)
+{
+  allocations = 0;
+  counting = true;
+  f();
+  counting = false;
+  return allocations;
+}
+
+HostFnStatus<uint64_t>
+metered_host_fn(HostCallContext* ctxp)
+{
+  if (!ctxp->runtime->consume_gas(10)) {
+    return HostFnStatus<uint64_t>{std::unexpect_t{}, HostFnError::OUT_OF_GAS};
+  }
+  return 7;
+}
+
+class AllocTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+    ASSERT_TRUE(ctx->link_fn("test", "external_call", &metered_host_fn));
+    ASSERT_TRUE(ctx->link_fn("test", "good_call", &metered_host_fn));
+  }
+
+  std::unique_ptr<WasmRuntime> instantiate(const char* filename) {
+    contracts.push_back(load_wasm_from_file(filename));
+    auto const& c = contracts.back();
+    Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+    return ctx->new_runtime_instance(s, nullptr);
+  }
+
+  // steady state, i.e. after the engine has filled its caches
+  constexpr static int WARMUP = 3;
+  constexpr static int ITERS = 100;
+
+  std::unique_ptr<WasmContext> ctx;
+  std::vector<std::unique_ptr<std::vector<uint8_t>>> contracts;
+};
+
+TEST_P(AllocTests, prepared_invoke)
+{
+  auto runtime = instantiate("tests/wat/test_reset.wasm");
+  ASSERT_TRUE(!!runtime);
+  auto bump = runtime->prepare("bump");
+  ASSERT_TRUE(!!bump);
+
+  for (int i = 0; i < WARMUP; i++) {
+    ASSERT_TRUE(!!runtime->invoke(bump, UINT64_MAX).result);
+  }
+
+  bool ok = true;
+  EXPECT_EQ(count_allocations([&] {
+    for (int i = 0; i < ITERS; i++) {
+      ok &= !!runtime->invoke(bump, UINT64_MAX).result;
+    }
+  }), 0u);
+  EXPECT_TRUE(ok);
+}
+
+TEST_P(AllocTests, invoke_by_name)
+{
+  auto runtime = instantiate("tests/wat/test_reset.wasm");
+  ASSERT_TRUE(!!runtime);
+
+  for (int i = 0; i < WARMUP; i++) {
+    ASSERT_TRUE(!!runtime->invoke("bump", UINT64_MAX).result);
+  }
+
+  bool ok = true;
+  EXPECT_EQ(count_allocations([&] {
+    for (int i = 0; i < ITERS; i++) {
+      ok &= !!runtime->invoke("bump", UINT64_MAX).result;
+    }
+  }), 0u);
+  EXPECT_TRUE(ok);
+}
+
+TEST_P(AllocTests, host_call)
+{
+  auto runtime = instantiate("tests/wat/test_error_handling.wasm");
+  ASSERT_TRUE(!!runtime);
+  auto call1 = runtime->prepare("call1");
+  ASSERT_TRUE(!!call1);
+
+  for (int i = 0; i < WARMUP; i++) {
+    ASSERT_TRUE(!!runtime->invoke(call1, 1000).result);
+  }
+
+  bool ok = true;
+  EXPECT_EQ(count_allocations([&] {
+    for (int i = 0; i < ITERS; i++) {
+      auto res = runtime->invoke(call1, 1000);
+      ok &= (res.result == 7u) && (res.gas_consumed >= 10);
+    }
+  }), 0u);
+  EXPECT_TRUE(ok);
+}
+
+TEST_P(AllocTests, typed_invoke)
+{
+  auto runtime = instantiate("tests/wat/test_typed_invoke.wasm");
+  ASSERT_TRUE(!!runtime);
+  auto add = runtime->prepare<std::tuple<uint64_t>(uint64_t, uint32_t)>("add");
+  ASSERT_TRUE(!!add);
+
+  for (int i = 0; i < WARMUP; i++) {
+    ASSERT_TRUE(!!runtime->invoke(add, UINT64_MAX, 1, 2).result);
+  }
+
+  bool ok = true;
+  EXPECT_EQ(count_allocations([&] {
+    for (int i = 0; i < ITERS; i++) {
+      auto res = runtime->invoke(add, UINT64_MAX, i, 1);
+      ok &= !!res.result && std::get<0>(*res.result) == static_cast<uint64_t>(i) + 1;
+    }
+  }), 0u);
+  EXPECT_TRUE(ok);
+}
+
+TEST_P(AllocTests, batch_invoke)
+{
+  auto runtime = instantiate("tests/wat/test_error_handling.wasm");
+  ASSERT_TRUE(!!runtime);
+  auto call1 = runtime->prepare("call1");
+  ASSERT_TRUE(!!call1);
+
+  std::array<InvokeRequest, 8> requests;
+  requests.fill(InvokeRequest{.method = call1, .gas_limit = 1000});
+  std::array<MeteredReturn, 8> results;
+
+  for (int i = 0; i < WARMUP; i++) {
+    ASSERT_EQ(runtime->invoke_batch(requests, results), requests.size());
+  }
+
+  bool ok = true;
+  EXPECT_EQ(count_allocations([&] {
+    for (int i = 0; i < ITERS; i++) {
+      ok &= (runtime->invoke_batch(requests, results) == requests.size());
+    }
+  }), 0u);
+  EXPECT_TRUE(ok);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, AllocTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+} /* wasm_api */
@@ -0,0 +1,127 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "wasm_api/wasm_api.h"
+
+#include "tests/load_wasm.h"
+
+#include <filesystem>
+
+namespace wasm_api
+{
+
+using namespace test;
+
+static HostFnStatus<uint64_t> double_fn(HostCallContext*, uint64_t arg) {
+  return 2*arg;
+}
+
+class DiskCacheTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    contract = load_wasm_from_file("tests/wat/test_invoke.wasm");
+
+    dir = std::filesystem::temp_directory_path()
+      / ("wasm_api_disk_cache_test_" + std::to_string(static_cast<int>(GetParam())));
+    std::filesystem::remove_all(dir);
+
+    id.fill(0);
+    id[0] = 0xCD;
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(dir);
+  }
+
+  bool is_wasmtime() const {
+    return GetParam() == SupportedWasmEngine::WASMTIME_CRANELIFT
+      || GetParam() == SupportedWasmEngine::WASMTIME_WINCH;
+  }
+
+  std::unique_ptr<WasmContext> make_context() {
+    auto ctx = std::make_unique<WasmContext>(65536, GetParam());
+    EXPECT_TRUE(ctx -> link_fn("test", "redir_call", &double_fn));
+    EXPECT_EQ(ctx -> set_disk_cache_dir(dir.string()), is_wasmtime());
+    return ctx;
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> contract;
+  std::filesystem::path dir;
+  Hash id;
+};
+
+TEST_P(DiskCacheTests, survives_context)
+{
+  Script s {.data = contract->data(), .len = static_cast<uint32_t>(contract->size())};
+
+  {
+    auto ctx = make_context();
+    auto runtime = ctx -> new_runtime_instance(s, nullptr, &id);
+    ASSERT_TRUE(!!runtime);
+  }
+
+  if (is_wasmtime()) {
+    ASSERT_FALSE(std::filesystem::is_empty(dir));
+  }
+
+  // fresh context has an empty in-memory cache
+  auto ctx = make_context();
+  auto runtime = ctx -> new_runtime_instance(s, nullptr, &id);
+  ASSERT_TRUE(!!runtime);
+
+  auto res = runtime -> invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 24u);
+}
+
+TEST_P(DiskCacheTests, corrupt_artifact_recompiles)
+{
+  if (!is_wasmtime()) {
+    return;
+  }
+
+  Script s {.data = contract->data(), .len = static_cast<uint32_t>(contract->size())};
+
+  {
+    auto ctx = make_context();
+    ASSERT_TRUE(!!ctx -> new_runtime_instance(s, nullptr, &id));
+  }
+
+  for (auto const& entry : std::filesystem::directory_iterator(dir)) {
+    std::filesystem::resize_file(entry.path(), 16);
+  }
+
+  auto ctx = make_context();
+  auto runtime = ctx -> new_runtime_instance(s, nullptr, &id);
+  ASSERT_TRUE(!!runtime);
+
+  auto res = runtime -> invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 24u);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, DiskCacheTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+} /* wasm_api */
@@ -28,6 +28,27 @@ consume_gas_call2(HostCallContext* ctxp)
     return 0;
 }
 
+HostFnStatus<uint64_t>
+context_consume_gas_call(HostCallContext* ctxp)
+{
+    if (!ctxp -> consume_gas(100))
+    {
+        return HostFnStatus<uint64_t>{std::unexpect_t{}, HostFnError::OUT_OF_GAS};
+    }
+    return 0;
+}
+
+// half through the runtime, half through the context
+HostFnStatus<uint64_t>
+mixed_consume_gas_call(HostCallContext* ctxp)
+{
+    if (!ctxp -> runtime -> consume_gas(50) || !ctxp -> consume_gas(50))
+    {
+        return HostFnStatus<uint64_t>{std::unexpect_t{}, HostFnError::OUT_OF_GAS};
+    }
+    return 0;
+}
+
 class GasApiTest : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
  protected:
   void SetUp() override {
@@ -100,6 +121,215 @@ TEST_P(GasApiTest, invoke_resets_gas)
     EXPECT_EQ(res.gas_consumed, 80u);
 }
 
+TEST_P(GasApiTest, prepared_invoke_resets_gas)
+{
+    auto call1 = runtime -> prepare("call1");
+    ASSERT_TRUE(!!call1);
+
+    runtime -> set_available_gas(5000);
+
+    auto res = runtime -> invoke(call1, 300);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_GE(res.gas_consumed, 100u);
+    EXPECT_EQ(runtime->get_available_gas(), 5000u);
+
+    ERROR_GUARD
+
+    // out of gas does not stop the batch under STOP_ON_UNRECOVERABLE
+    std::vector<InvokeRequest> requests = {
+        {.method = call1, .gas_limit = 80},
+        {.method = call1, .gas_limit = 300},
+    };
+    std::vector<MeteredReturn> results(requests.size());
+    ASSERT_EQ(runtime -> invoke_batch(requests, results, BatchErrorPolicy::STOP_ON_UNRECOVERABLE), 2u);
+
+    ASSERT_FALSE(!!results[0].result);
+    EXPECT_EQ(results[0].result.error(), InvokeError::OUT_OF_GAS_ERROR);
+    EXPECT_EQ(results[0].gas_consumed, 80u);
+    ASSERT_TRUE(!!results[1].result);
+    EXPECT_EQ(results[1].gas_consumed, res.gas_consumed);
+
+    EXPECT_EQ(runtime->get_available_gas(), 5000u);
+}
+
+TEST_P(GasApiTest, host_call_context_gas)
+{
+    auto expect = runtime -> invoke("call1", 300);
+    ASSERT_TRUE(!!expect.result);
+
+    for (auto* f : {&context_consume_gas_call, &mixed_consume_gas_call})
+    {
+        WasmContext ctx2(65536, GetParam());
+        ASSERT_TRUE(ctx2.link_fn("test", "good_call", &consume_gas_call2));
+        ASSERT_TRUE(ctx2.link_fn("test", "external_call", f));
+
+        auto runtime2 = ctx2.new_runtime_instance(script, nullptr);
+        ASSERT_TRUE(!!runtime2);
+
+        runtime2 -> set_available_gas(5000);
+
+        auto res = runtime2 -> invoke("call1", 300);
+        ASSERT_TRUE(!!res.result);
+        EXPECT_EQ(res.gas_consumed, expect.gas_consumed);
+        EXPECT_EQ(runtime2 -> get_available_gas(), 5000u);
+
+        if (no_error_handling_shame()) {
+            continue;
+        }
+
+        res = runtime2 -> invoke("call1", 80);
+        ASSERT_FALSE(!!res.result);
+        EXPECT_EQ(res.result.error(), InvokeError::OUT_OF_GAS_ERROR);
+        EXPECT_EQ(res.gas_consumed, 80u);
+    }
+}
+
+uint32_t free_calls = 0;
+
+HostFnStatus<uint64_t>
+free_call(HostCallContext*)
+{
+    free_calls++;
+    return 0;
+}
+
+TEST_P(GasApiTest, host_fn_gas_cost)
+{
+    // same as consume_gas_call, but charged by the engine
+    WasmContext ctx2(65536, GetParam());
+    ASSERT_TRUE(ctx2.link_fn("test", "good_call", &consume_gas_call2));
+    ASSERT_TRUE(ctx2.link_fn("test", "external_call", &free_call, HostFnGasCost::fixed(100)));
+
+    auto runtime2 = ctx2.new_runtime_instance(script, nullptr);
+    ASSERT_TRUE(!!runtime2);
+
+    free_calls = 0;
+
+    auto expect = runtime -> invoke("call1", 300);
+    ASSERT_TRUE(!!expect.result);
+
+    auto res = runtime2 -> invoke("call1", 300);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(res.gas_consumed, expect.gas_consumed);
+    EXPECT_EQ(free_calls, 1u);
+
+    ERROR_GUARD
+
+    // host fn is not called
+    res = runtime2 -> invoke("call1", 80);
+    ASSERT_FALSE(!!res.result);
+    EXPECT_EQ(res.result.error(), InvokeError::OUT_OF_GAS_ERROR);
+    EXPECT_EQ(res.gas_consumed, 80u);
+    EXPECT_EQ(free_calls, 1u);
+}
+
+uint32_t write_calls = 0;
+
+HostFnStatus<void>
+write_call(HostCallContext*, uint64_t ptr, uint64_t len) noexcept
+{
+    write_calls++;
+    return {};
+}
+
+TEST_P(GasApiTest, host_fn_gas_cost_per_byte)
+{
+    auto c = load_wasm_from_file("tests/wat/test_host_fn_gas.wasm");
+    Script s{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    constexpr HostFnGasCost cost{.base = 50, .per_byte = 7, .len_arg = 1};
+
+    WasmContext ctx2(65536, GetParam());
+    // no third argument
+    EXPECT_FALSE(ctx2.link_fn<&write_call>("test", "write", HostFnGasCost{.per_byte = 1, .len_arg = 2}));
+    ASSERT_TRUE(ctx2.link_fn<&write_call>("test", "write", cost));
+
+    auto runtime2 = ctx2.new_runtime_instance(s, nullptr);
+    ASSERT_TRUE(!!runtime2);
+
+    write_calls = 0;
+
+    auto res0 = runtime2 -> invoke("write0", 1000);
+    ASSERT_TRUE(!!res0.result);
+    EXPECT_GE(res0.gas_consumed, 50u);
+
+    auto res10 = runtime2 -> invoke("write10", 1000);
+    ASSERT_TRUE(!!res10.result);
+    EXPECT_EQ(res10.gas_consumed, res0.gas_consumed + 70);
+    EXPECT_EQ(write_calls, 2u);
+
+    ERROR_GUARD
+
+    auto res_max = runtime2 -> invoke("write_max", 1000);
+    ASSERT_FALSE(!!res_max.result);
+    EXPECT_EQ(res_max.result.error(), InvokeError::OUT_OF_GAS_ERROR);
+    EXPECT_EQ(write_calls, 2u);
+}
+
+HostFnStatus<void>
+gas_import_call(HostCallContext* ctxp, uint64_t gas) noexcept
+{
+    if (!ctxp -> consume_gas(gas))
+    {
+        return HostFnStatus<void>{std::unexpect_t{}, HostFnError::OUT_OF_GAS};
+    }
+    return {};
+}
+
+HostFnStatus<void>
+double_gas_import_call(HostCallContext* ctxp, uint64_t gas) noexcept
+{
+    return gas_import_call(ctxp, 2 * gas);
+}
+
+TEST_P(GasApiTest, gas_intrinsic)
+{
+    auto c = load_wasm_from_file("tests/wat/test_gas_intrinsic.wasm");
+    Script s{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    // wasm3 links the gas import itself
+    const bool builtin = (GetParam() == SupportedWasmEngine::WASM3);
+
+    WasmContext ctx2(65536, GetParam());
+    if (!builtin) {
+        ASSERT_TRUE(ctx2.link_fn<&gas_import_call>(GAS_INTRINSIC_MODULE, GAS_INTRINSIC_FN));
+    }
+
+    auto runtime2 = ctx2.new_runtime_instance(s, nullptr);
+    ASSERT_TRUE(!!runtime2);
+
+    runtime2 -> set_available_gas(5000);
+
+    auto res = runtime2 -> invoke("metered", 300);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 1u);
+    if (builtin) {
+        EXPECT_EQ(res.gas_consumed, 100u);
+    } else {
+        EXPECT_GE(res.gas_consumed, 100u);
+    }
+    EXPECT_EQ(runtime2 -> get_available_gas(), 5000u);
+
+    if (builtin) {
+        // a linked host function replaces the builtin
+        WasmContext ctx3(65536, GetParam());
+        ASSERT_TRUE(ctx3.link_fn<&double_gas_import_call>(GAS_INTRINSIC_MODULE, GAS_INTRINSIC_FN));
+        auto runtime3 = ctx3.new_runtime_instance(s, nullptr);
+        ASSERT_TRUE(!!runtime3);
+
+        auto res3 = runtime3 -> invoke("metered", 300);
+        ASSERT_TRUE(!!res3.result);
+        EXPECT_EQ(res3.gas_consumed, 200u);
+    }
+
+    ERROR_GUARD
+
+    res = runtime2 -> invoke("metered", 80);
+    ASSERT_FALSE(!!res.result);
+    EXPECT_EQ(res.result.error(), InvokeError::OUT_OF_GAS_ERROR);
+    EXPECT_EQ(res.gas_consumed, 80u);
+}
+
 INSTANTIATE_TEST_SUITE_P(AllEngines, GasApiTest,
                         ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
                             wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
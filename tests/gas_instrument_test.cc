@@ -0,0 +1,229 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "wasm_api/wasm_api.h"
+#include "wasm_api/error.h"
+#include "wasm_api/gas_instrument.h"
+#include "wasm_api/wasm_imports.h"
+
+#include "tests/load_wasm.h"
+
+namespace wasm_api
+{
+
+using namespace test;
+
+HostFnStatus<uint64_t>
+id_call(HostCallContext*, uint64_t x) noexcept
+{
+    return x;
+}
+
+class GasInstrumentTest : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+ protected:
+  void SetUp() override {
+    contract = load_wasm_from_file("tests/wat/test_gas_instrument.wasm");
+    script = Script{.data = contract->data(), .len = static_cast<uint32_t>(contract->size())};
+  }
+
+  bool has_native_fuel() const {
+    return GetParam() != SupportedWasmEngine::WASM3
+        && GetParam() != SupportedWasmEngine::MAKEPAD_STITCH;
+  }
+
+  bool no_error_handling_shame() {
+    if (GetParam() == wasm_api::SupportedWasmEngine::MAKEPAD_STITCH) {
+        std::printf("SHAME: error handling not supported in MAKEPAD_STITCH, aborting test\n");
+        return true;
+    }
+    return false;
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> contract;
+  Script script;
+};
+
+#define ERROR_GUARD if (no_error_handling_shame()) return;
+
+TEST_P(GasInstrumentTest, metered_blocks)
+{
+    WasmContext ctx(65536, GetParam());
+    if (has_native_fuel()) {
+        EXPECT_FALSE(ctx.set_gas_instrumentation());
+        return;
+    }
+    ASSERT_TRUE(ctx.set_gas_instrumentation());
+    ASSERT_TRUE(ctx.link_fn<&id_call>("test", "id"));
+
+    auto runtime = ctx.new_runtime_instance(script, nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    // exact, as neither engine meters anything else
+    auto expect = [&] (const char* method, uint64_t result, uint64_t gas) {
+        auto res = runtime -> invoke(method, 1000);
+        ASSERT_TRUE(!!res.result) << method;
+        EXPECT_EQ(*res.result, result) << method;
+        EXPECT_EQ(res.gas_consumed, gas) << method;
+    };
+
+    // 2 for loop10, 2 for count, plus 8 per iteration
+    expect("loop10", 10, 84);
+    expect("loop20", 20, 164);
+    expect("straight", 3, 4);
+    // only the branch taken
+    expect("if_else", 1, 4);
+    expect("early_return", 6, 4);
+    expect("call_import", 7, 2);
+    expect("indirect", 10, 85);
+}
+
+TEST_P(GasInstrumentTest, static_bounds)
+{
+    WasmContext ctx(65536, GetParam());
+    if (!ctx.set_gas_instrumentation(GasInstrumentationConfig{.static_bounds = true})) {
+        return;
+    }
+    ASSERT_TRUE(ctx.link_fn<&id_call>("test", "id"));
+
+    auto runtime = ctx.new_runtime_instance(script, nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    auto expect = [&] (const char* method, uint64_t result, uint64_t gas) {
+        auto res = runtime -> invoke(method, 1000);
+        ASSERT_TRUE(!!res.result) << method;
+        EXPECT_EQ(*res.result, result) << method;
+        EXPECT_EQ(res.gas_consumed, gas) << method;
+    };
+
+    // count has a loop, so is still metered
+    expect("loop10", 10, 84);
+    expect("loop20", 20, 164);
+    expect("straight", 3, 4);
+    // the more expensive branch, whichever is taken
+    expect("if_else", 1, 6);
+    expect("early_return", 6, 5);
+    expect("call_import", 7, 2);
+    expect("indirect", 10, 85);
+}
+
+TEST_P(GasInstrumentTest, out_of_gas)
+{
+    WasmContext ctx(65536, GetParam());
+    if (!ctx.set_gas_instrumentation(GasInstrumentationConfig{.instruction_cost = 10})) {
+        return;
+    }
+    ASSERT_TRUE(ctx.link_fn<&id_call>("test", "id"));
+
+    Hash h;
+    h.fill(0x11);
+
+    auto runtime = ctx.new_runtime_instance(script, nullptr, &h);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime -> invoke("loop10", 1000);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(res.gas_consumed, 840u);
+
+    // from the cache
+    auto runtime2 = ctx.new_runtime_instance(script, nullptr, &h);
+    ASSERT_TRUE(!!runtime2);
+    auto res2 = runtime2 -> invoke("loop10", 1000);
+    ASSERT_TRUE(!!res2.result);
+    EXPECT_EQ(res2.gas_consumed, 840u);
+
+    ERROR_GUARD
+
+    res = runtime -> invoke("loop20", 1000);
+    ASSERT_FALSE(!!res.result);
+    EXPECT_EQ(res.result.error(), InvokeError::OUT_OF_GAS_ERROR);
+    EXPECT_EQ(res.gas_consumed, 1000u);
+}
+
+TEST_P(GasInstrumentTest, already_instrumented)
+{
+    auto c = load_wasm_from_file("tests/wat/test_gas_intrinsic.wasm");
+    Script s{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    WasmContext ctx(65536, GetParam());
+    if (!ctx.set_gas_instrumentation()) {
+        return;
+    }
+
+    auto runtime = ctx.new_runtime_instance(s, nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime -> invoke("metered", 1000);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(res.gas_consumed, 100u);
+}
+
+TEST(GasInstrumentTests, adds_gas_import)
+{
+    auto c = load_wasm_from_file("tests/wat/test_gas_instrument.wasm");
+    Script s{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    auto instrumented = detail::instrument_gas(s, GasInstrumentationConfig{});
+    ASSERT_TRUE(!!instrumented);
+
+    Script s2{.data = instrumented->data(), .len = static_cast<uint32_t>(instrumented->size())};
+    auto imports = detail::parse_function_imports(s2);
+    ASSERT_TRUE(!!imports);
+    ASSERT_EQ(imports->size(), 2u);
+    EXPECT_EQ(imports->back(), detail::FunctionImport(GAS_INTRINSIC_MODULE, GAS_INTRINSIC_FN));
+
+    // exports are unchanged
+    auto exports = detail::parse_function_exports(s);
+    auto exports2 = detail::parse_function_exports(s2);
+    ASSERT_TRUE(!!exports && !!exports2);
+    ASSERT_EQ(exports->size(), exports2->size());
+    for (size_t i = 0; i < exports->size(); i++) {
+        EXPECT_EQ((*exports)[i].name, (*exports2)[i].name);
+    }
+
+    // and instrumenting again changes nothing
+    auto again = detail::instrument_gas(s2, GasInstrumentationConfig{});
+    ASSERT_TRUE(!!again);
+    EXPECT_EQ(*again, *instrumented);
+
+    // SIMD, which cannot be metered
+    const uint8_t garbage[] = { 0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x04, 0x01, 0x02, 0x00, 0xfd };
+    EXPECT_FALSE(!!detail::instrument_gas(Script{.data = garbage, .len = sizeof(garbage)}, GasInstrumentationConfig{}));
+}
+
+TEST(GasInstrumentTests, static_gas_bounds)
+{
+    auto c = load_wasm_from_file("tests/wat/test_gas_instrument.wasm");
+    Script s{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    auto bounds = detail::static_gas_bounds(s, 1);
+    ASSERT_TRUE(!!bounds);
+
+    // count, loop10, loop20, straight, if_else, early_return, call_import, indirect
+    std::vector<std::optional<uint64_t>> expect = { std::nullopt, 2, 2, 4, 6, 5, 2, 3 };
+    EXPECT_EQ(*bounds, expect);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, GasInstrumentTest,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3,
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+} // namespace wasm_api
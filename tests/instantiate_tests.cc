@@ -17,9 +17,16 @@
 #include <gtest/gtest.h>
 
 #include "wasm_api/wasm_api.h"
+#include "wasm_api/compile_pool.h"
+#include "wasm_api/wasm_imports.h"
 
 #include "tests/load_wasm.h"
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace wasm_api
 {
 
@@ -104,4 +111,723 @@ INSTANTIATE_TEST_SUITE_P(AllEngines, UnnecessaryImportedFnTests,
                             wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
                             wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
 
+class CachedInstantiateTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+
+    ASSERT_TRUE(ctx -> link_fn("test", "redir_call", &import_fn));
+
+    id.fill(0);
+    id[0] = 0xAB;
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> c;
+  std::unique_ptr<WasmContext> ctx;
+  Hash id;
+}; 
+
+TEST_P(CachedInstantiateTests, repeated_instantiate)
+{
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+  for (int i = 0; i < 3; i++) {
+    auto runtime = ctx->new_runtime_instance(s, nullptr, &id);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+  }
+}
+
+TEST_P(CachedInstantiateTests, cached_instance_outlives_script)
+{
+  {
+    auto copy = *c;
+    Script s {.data = copy.data(), .len = static_cast<uint32_t>(copy.size())};
+    ASSERT_TRUE(!!ctx->new_runtime_instance(s, nullptr, &id));
+  }
+
+  // cache hit should not touch the (now freed) script bytes
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  auto runtime = ctx->new_runtime_instance(s, nullptr, &id);
+  ASSERT_TRUE(!!runtime);
+
+  auto res = runtime->invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 24u);
+}
+
+TEST_P(CachedInstantiateTests, concurrent_instantiate)
+{
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+  std::vector<std::thread> threads;
+  std::atomic<uint32_t> successes = 0;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 10; i++) {
+        auto runtime = ctx->new_runtime_instance(s, nullptr, &id);
+        if (!runtime) {
+          continue;
+        }
+        auto res = runtime->invoke("calltest");
+        if (res.result && *res.result == 24u) {
+          successes++;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(successes.load(), 80u);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, CachedInstantiateTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+class CompiledModuleTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+
+    ASSERT_TRUE(ctx -> link_fn("test", "redir_call", &import_fn));
+
+    auto c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+    Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    module = ctx->compile(s);
+    ASSERT_TRUE(!!module);
+    // script bytes are freed here; module must not refer to them
+  }
+
+  std::unique_ptr<WasmContext> ctx;
+  CompiledModule module;
+}; 
+
+TEST_P(CompiledModuleTests, instantiate_many)
+{
+  for (int i = 0; i < 3; i++) {
+    auto runtime = module.instantiate(nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+  }
+}
+
+TEST_P(CompiledModuleTests, outlives_context)
+{
+  ctx.reset();
+
+  auto runtime = module.instantiate(nullptr);
+  ASSERT_TRUE(!!runtime);
+
+  auto res = runtime->invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 24u);
+}
+
+TEST_P(CompiledModuleTests, shared_script)
+{
+  std::shared_ptr<const std::vector<uint8_t>> c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+  SharedScript s {.data = std::shared_ptr<const uint8_t>(c, c->data()), .len = static_cast<uint32_t>(c->size())};
+  c.reset();
+
+  auto shared_module = ctx->compile(s);
+  ASSERT_TRUE(!!shared_module);
+  // engines may keep the bytes, but only through s.data
+  s.data.reset();
+
+  for (int i = 0; i < 2; i++) {
+    auto runtime = shared_module.instantiate(nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+  }
+}
+
+TEST_P(CompiledModuleTests, prepared_method)
+{
+  auto r1 = module.instantiate(nullptr);
+  auto r2 = module.instantiate(nullptr);
+  ASSERT_TRUE(!!r1 && !!r2);
+
+  auto method = r1->prepare("calltest");
+  ASSERT_TRUE(!!method);
+  EXPECT_FALSE(!!r1->prepare("nexist"));
+
+  // valid for every runtime of the module
+  for (int i = 0; i < 3; i++) {
+    for (auto* r : {r1.get(), r2.get()}) {
+      auto res = r->invoke(method);
+      ASSERT_TRUE(!!res.result);
+      EXPECT_EQ(*res.result, 24u);
+    }
+  }
+
+  auto res = r1->invoke(MethodHandle());
+  ASSERT_FALSE(!!res.result);
+  EXPECT_EQ(res.result.error(), InvokeError::UNRECOVERABLE);
+
+  auto c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  auto other = ctx->compile(s).instantiate(nullptr);
+  ASSERT_TRUE(!!other);
+
+  res = other->invoke(method);
+  ASSERT_FALSE(!!res.result);
+  EXPECT_EQ(res.result.error(), InvokeError::UNRECOVERABLE);
+}
+
+TEST_P(CompiledModuleTests, export_table_cached)
+{
+  auto c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  Hash id;
+  id.fill(0xE0);
+
+  // built once, and shared by every compile() of the same script
+  auto r1 = ctx->compile(s, &id).instantiate(nullptr);
+  auto r2 = ctx->compile(s, &id).instantiate(nullptr);
+  ASSERT_TRUE(!!r1 && !!r2);
+
+  auto method = r1->prepare("calltest");
+  ASSERT_TRUE(!!method);
+  auto res = r2->invoke(method);
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 24u);
+}
+
+TEST_P(CompiledModuleTests, invalid_script)
+{
+  std::vector<uint8_t> garbage = {0x00, 0x61, 0x73, 0x6d, 0xFF, 0xFF};
+  Script s {.data = garbage.data(), .len = static_cast<uint32_t>(garbage.size())};
+
+  EXPECT_FALSE(!!ctx->compile(s));
+  EXPECT_FALSE(!!CompiledModule().instantiate(nullptr));
+}
+
+TEST_P(CompiledModuleTests, compile_async)
+{
+  auto c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+
+  std::vector<std::future<CompiledModule>> futures;
+  for (int32_t i = 0; i < 8; i++) {
+    Hash id;
+    id.fill(0);
+    id[0] = 0xC0 + (i % 2);
+    Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+    futures.push_back(ctx->compile_async(s, &id, i));
+  }
+  // bytes are copied by compile_async
+  c.reset();
+
+  for (auto& f : futures) {
+    auto m = f.get();
+    ASSERT_TRUE(!!m);
+
+    auto runtime = m.instantiate(nullptr);
+    ASSERT_TRUE(!!runtime);
+    auto res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+  }
+
+  std::vector<uint8_t> garbage = {0x00, 0x61, 0x73, 0x6d, 0xFF, 0xFF};
+  Script s {.data = garbage.data(), .len = static_cast<uint32_t>(garbage.size())};
+  EXPECT_FALSE(!!ctx->compile_async(s).get());
+}
+
+TEST(CompilePoolTests, highest_priority_first)
+{
+  detail::CompilePool pool(1);
+
+  // occupy the only thread, so that everything after queues up
+  std::promise<void> started;
+  std::promise<void> release;
+  auto blocker = pool.submit([&] {
+    started.set_value();
+    release.get_future().wait();
+    return CompiledModule();
+  }, 0);
+  started.get_future().wait();
+
+  std::mutex mtx;
+  std::vector<int32_t> order;
+  std::vector<std::future<CompiledModule>> futures;
+  for (int32_t priority : {1, -5, 10, 3, 10, 0, 7}) {
+    futures.push_back(pool.submit([&, priority] {
+      std::lock_guard lock(mtx);
+      order.push_back(priority);
+      return CompiledModule();
+    }, priority));
+  }
+
+  release.set_value();
+  blocker.get();
+  for (auto& f : futures) {
+    f.get();
+  }
+
+  std::vector<int32_t> expect = {10, 10, 7, 3, 1, 0, -5};
+  EXPECT_EQ(order, expect);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, CompiledModuleTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+class ResetTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    auto c = load_wasm_from_file("tests/wat/test_reset.wasm");
+    Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+
+    runtime = ctx->new_runtime_instance(s, nullptr);
+    ASSERT_TRUE(!!runtime);
+  }
+
+  std::unique_ptr<WasmContext> ctx;
+  std::unique_ptr<WasmRuntime> runtime;
+}; 
+
+TEST_P(ResetTests, reset_restores_globals_and_memory)
+{
+  for (int i = 0; i < 3; i++) {
+    // global starts at 0, memory[8] at 100
+    auto res = runtime->invoke("bump");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 102u);
+
+    res = runtime->invoke("bump");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 104u);
+
+    auto mem = runtime->get_memory();
+    ASSERT_GE(mem.size(), 65536u);
+    mem[1000] = std::byte{0xFF};
+
+    ASSERT_TRUE(runtime->reset());
+
+    mem = runtime->get_memory();
+    EXPECT_EQ(mem[1000], std::byte{0});
+    EXPECT_EQ(mem[8], std::byte{100});
+  }
+}
+
+TEST_P(ResetTests, prepared_method_across_reset)
+{
+  auto bump = runtime->prepare("bump");
+  ASSERT_TRUE(!!bump);
+
+  for (int i = 0; i < 3; i++) {
+    auto res = runtime->invoke(bump);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 102u);
+
+    ASSERT_TRUE(runtime->reset());
+  }
+}
+
+TEST_P(ResetTests, reset_keeps_gas)
+{
+  runtime->set_available_gas(12345);
+  ASSERT_TRUE(runtime->reset());
+  EXPECT_EQ(runtime->get_available_gas(), 12345u);
+}
+
+TEST_P(ResetTests, reinstantiate_after_drop)
+{
+  auto c = load_wasm_from_file("tests/wat/test_reset.wasm");
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  Hash id;
+  id.fill(0x07);
+
+  // engines may reuse the dropped runtime,
+  // which must not leak its state into the next
+  for (int i = 0; i < 3; i++) {
+    auto r = ctx->new_runtime_instance(s, &id);
+    ASSERT_TRUE(!!r);
+
+    auto res = r->invoke("bump");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 102u);
+
+    r->get_memory()[1000] = std::byte{0xFF};
+  }
+
+  auto r1 = ctx->new_runtime_instance(s, &id);
+  auto r2 = ctx->new_runtime_instance(s, &id);
+  ASSERT_TRUE(!!r1 && !!r2);
+  EXPECT_EQ(r1->get_memory()[1000], std::byte{0});
+  EXPECT_EQ(r2->get_memory()[1000], std::byte{0});
+  EXPECT_EQ(*r1->invoke("bump").result, 102u);
+  EXPECT_EQ(*r2->invoke("bump").result, 102u);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, ResetTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+class BatchInvokeTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    c = load_wasm_from_file("tests/wat/test_reset.wasm");
+    Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+    runtime = ctx->new_runtime_instance(s, nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    bump = runtime->prepare("bump");
+    trap = runtime->prepare("trap");
+    ASSERT_TRUE(!!bump && !!trap);
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> c;
+  std::unique_ptr<WasmContext> ctx;
+  std::unique_ptr<WasmRuntime> runtime;
+  MethodHandle bump, trap;
+};
+
+TEST_P(BatchInvokeTests, all_succeed)
+{
+  runtime->set_available_gas(12345);
+
+  std::vector<InvokeRequest> requests(40, InvokeRequest{.method = bump, .gas_limit = UINT64_MAX});
+  std::vector<MeteredReturn> results(requests.size());
+
+  ASSERT_EQ(runtime->invoke_batch(requests, results), requests.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    ASSERT_TRUE(!!results[i].result);
+    EXPECT_EQ(*results[i].result, 102u + 2 * i);
+  }
+
+  EXPECT_EQ(runtime->get_available_gas(), 12345u);
+}
+
+TEST_P(BatchInvokeTests, error_policy)
+{
+  std::vector<InvokeRequest> requests = {
+    {.method = bump, .gas_limit = UINT64_MAX},
+    {.method = trap, .gas_limit = UINT64_MAX},
+    {.method = bump, .gas_limit = UINT64_MAX},
+  };
+  std::vector<MeteredReturn> results(requests.size());
+
+  ASSERT_EQ(runtime->invoke_batch(requests, results, BatchErrorPolicy::STOP_ON_ANY_ERROR), 2u);
+  EXPECT_EQ(*results[0].result, 102u);
+  ASSERT_FALSE(!!results[1].result);
+  EXPECT_EQ(results[1].result.error(), InvokeError::DETERMINISTIC_ERROR);
+
+  ASSERT_EQ(runtime->invoke_batch(requests, results, BatchErrorPolicy::STOP_ON_UNRECOVERABLE), 3u);
+  EXPECT_EQ(*results[0].result, 104u);
+  ASSERT_FALSE(!!results[1].result);
+  EXPECT_EQ(*results[2].result, 106u);
+}
+
+TEST_P(BatchInvokeTests, other_module_stops)
+{
+  auto other = load_wasm_from_file("tests/wat/test_typed_invoke.wasm");
+  Script s {.data = other->data(), .len = static_cast<uint32_t>(other->size())};
+  auto other_runtime = ctx->compile(s).instantiate(nullptr);
+  ASSERT_TRUE(!!other_runtime);
+  auto other_method = other_runtime->prepare("load");
+  ASSERT_TRUE(!!other_method);
+
+  std::vector<InvokeRequest> requests = {
+    {.method = bump, .gas_limit = UINT64_MAX},
+    {.method = other_method, .gas_limit = UINT64_MAX},
+    {.method = bump, .gas_limit = UINT64_MAX},
+  };
+  std::vector<MeteredReturn> results(requests.size());
+
+  ASSERT_EQ(runtime->invoke_batch(requests, results, BatchErrorPolicy::STOP_ON_UNRECOVERABLE), 2u);
+  EXPECT_EQ(*results[0].result, 102u);
+  ASSERT_FALSE(!!results[1].result);
+  EXPECT_EQ(results[1].result.error(), InvokeError::UNRECOVERABLE);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, BatchInvokeTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+class FrozenLinkTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> c;
+  std::unique_ptr<WasmContext> ctx;
+}; 
+
+TEST_P(FrozenLinkTests, link_after_freeze_fails)
+{
+  ASSERT_TRUE(ctx -> link_fn("test", "redir_call", &import_fn));
+  ASSERT_TRUE(ctx -> link_fn("test", "nexist", &import_fn));
+  ctx -> freeze_links();
+  EXPECT_FALSE(ctx -> link_fn("test", "other", &import_fn));
+
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  auto module = ctx -> compile(s);
+  ASSERT_TRUE(!!module);
+
+  for (int i = 0; i < 3; i++) {
+    auto runtime = module.instantiate(nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+
+    ASSERT_TRUE(runtime->reset());
+    res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+  }
+}
+
+TEST_P(FrozenLinkTests, cached_across_freeze)
+{
+  ASSERT_TRUE(ctx -> link_fn("test", "redir_call", &import_fn));
+
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  Hash id;
+  id.fill(0x0F);
+
+  // cached before links are frozen, and then used after
+  ASSERT_TRUE(!!ctx -> compile(s, &id));
+  ctx -> freeze_links();
+
+  for (int i = 0; i < 3; i++) {
+    auto runtime = ctx->new_runtime_instance(s, nullptr, &id);
+    ASSERT_TRUE(!!runtime);
+
+    auto res = runtime->invoke("calltest");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 24u);
+  }
+}
+
+TEST_P(FrozenLinkTests, missing_import_still_fails)
+{
+  ctx -> freeze_links();
+
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  auto runtime = ctx->new_runtime_instance(s, nullptr);
+  if (runtime) {
+    auto res = runtime->invoke("calltest");
+    ASSERT_FALSE(!!res.result);
+    EXPECT_EQ(res.result.error(), InvokeError::DETERMINISTIC_ERROR);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, FrozenLinkTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+class TypedInvokeTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    c = load_wasm_from_file("tests/wat/test_typed_invoke.wasm");
+    Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+    runtime = ctx->new_runtime_instance(s, nullptr);
+    ASSERT_TRUE(!!runtime);
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> c;
+  std::unique_ptr<WasmContext> ctx;
+  std::unique_ptr<WasmRuntime> runtime;
+};
+
+TEST_P(TypedInvokeTests, signature_mismatch)
+{
+  EXPECT_FALSE(!!runtime->prepare<std::tuple<uint64_t>(uint64_t, uint64_t)>("add"));
+  EXPECT_FALSE(!!runtime->prepare<std::tuple<uint64_t>(uint64_t)>("low"));
+  EXPECT_FALSE(!!runtime->prepare<std::tuple<>(uint32_t)>("fneg"));
+  EXPECT_FALSE(!!runtime->prepare<std::tuple<uint64_t>()>("nexist"));
+
+  EXPECT_TRUE(!!runtime->prepare<std::tuple<uint64_t>(uint64_t, uint32_t)>("add"));
+}
+
+TEST_P(TypedInvokeTests, args_and_results)
+{
+  auto add = runtime->prepare<std::tuple<uint64_t>(uint64_t, uint32_t)>("add");
+  auto low = runtime->prepare<std::tuple<uint32_t>(uint64_t)>("low");
+  ASSERT_TRUE(!!add && !!low);
+
+  for (int i = 0; i < 3; i++) {
+    auto res = runtime->invoke(add, UINT64_MAX, 0x1'0000'0000, 0xFFFF'FFFF);
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(std::get<0>(*res.result), 0x1'FFFF'FFFFu);
+
+    auto res2 = runtime->invoke(low, UINT64_MAX, 0x1234'5678'9ABC'DEF0);
+    ASSERT_TRUE(!!res2.result);
+    EXPECT_EQ(std::get<0>(*res2.result), 0x9ABC'DEF0u);
+  }
+}
+
+TEST_P(TypedInvokeTests, no_results)
+{
+  auto store = runtime->prepare<std::tuple<>(uint32_t, uint64_t)>("store");
+  auto load = runtime->prepare<std::tuple<uint64_t>()>("load");
+  ASSERT_TRUE(!!store && !!load);
+
+  ASSERT_TRUE(!!runtime->invoke(store, UINT64_MAX, 8, 77).result);
+
+  auto res = runtime->invoke(load, UINT64_MAX);
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(std::get<0>(*res.result), 77u);
+
+  // out of bounds
+  auto err = runtime->invoke(store, UINT64_MAX, 65536, 77);
+  ASSERT_FALSE(!!err.result);
+  EXPECT_EQ(err.result.error(), InvokeError::DETERMINISTIC_ERROR);
+}
+
+TEST_P(TypedInvokeTests, untyped_invoke_wrong_signature)
+{
+  // invoke() by name is only for () -> i64 exports
+  for (int i = 0; i < 2; i++) {
+    auto res = runtime->invoke("add");
+    ASSERT_FALSE(!!res.result);
+    if (GetParam() == wasm_api::SupportedWasmEngine::WASMI
+        || GetParam() == wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT
+        || GetParam() == wasm_api::SupportedWasmEngine::WASMTIME_WINCH) {
+      // the engine rejects the call (no args), as it always has
+      EXPECT_EQ(res.result.error(), InvokeError::UNRECOVERABLE);
+    }
+
+    auto missing = runtime->invoke("nexist");
+    ASSERT_FALSE(!!missing.result);
+    EXPECT_EQ(missing.result.error(), InvokeError::DETERMINISTIC_ERROR);
+  }
+
+  auto res = runtime->invoke("load");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 0u);
+}
+
+TEST_P(TypedInvokeTests, multi_value)
+{
+  if (GetParam() == wasm_api::SupportedWasmEngine::FIZZY) {
+    std::printf("SHAME: multi-value not supported in FIZZY, aborting test\n");
+    return;
+  }
+
+  auto mv = load_wasm_from_file("tests/wat/test_multi_value.wasm");
+  Script s {.data = mv->data(), .len = static_cast<uint32_t>(mv->size())};
+  auto r = ctx->new_runtime_instance(s, nullptr);
+  ASSERT_TRUE(!!r);
+
+  auto swap = r->prepare<std::tuple<uint64_t, uint32_t>(uint32_t, uint64_t)>("swap");
+  ASSERT_TRUE(!!swap);
+
+  auto res = r->invoke(swap, UINT64_MAX, 7, 0xAAAA'BBBB'CCCC'DDDD);
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(std::get<0>(*res.result), 0xAAAA'BBBB'CCCC'DDDDu);
+  EXPECT_EQ(std::get<1>(*res.result), 7u);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, TypedInvokeTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+TEST(ParseImportsTests, test_invoke_imports)
+{
+  auto c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+  auto imports = detail::parse_function_imports(s);
+  ASSERT_TRUE(imports.has_value());
+  ASSERT_EQ(imports->size(), 1u);
+  EXPECT_EQ((*imports)[0].first, "test");
+  EXPECT_EQ((*imports)[0].second, "redir_call");
+
+  // truncated before the import section ends
+  Script truncated {.data = c->data(), .len = 16};
+  EXPECT_FALSE(detail::parse_function_imports(truncated).has_value());
+}
+
+TEST(ParseImportsTests, test_invoke_exports)
+{
+  auto c = load_wasm_from_file("tests/wat/test_invoke.wasm");
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+  // the memory export is not a function
+  auto exports = detail::parse_function_exports(s);
+  ASSERT_TRUE(exports.has_value());
+  ASSERT_EQ(exports->size(), 1u);
+  EXPECT_EQ((*exports)[0].name, "calltest");
+
+  ASSERT_TRUE((*exports)[0].signature.has_value());
+  EXPECT_TRUE((*exports)[0].signature->params.empty());
+  EXPECT_EQ((*exports)[0].signature->results, std::vector<WasmValueType>{WasmValueType::U64});
+}
+
+TEST(ParseImportsTests, test_typed_invoke_exports)
+{
+  auto c = load_wasm_from_file("tests/wat/test_typed_invoke.wasm");
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+  auto exports = detail::parse_function_exports(s);
+  ASSERT_TRUE(exports.has_value());
+  ASSERT_EQ(exports->size(), 5u);
+
+  EXPECT_EQ((*exports)[0].name, "add");
+  ASSERT_TRUE((*exports)[0].signature.has_value());
+  EXPECT_EQ((*exports)[0].signature->params,
+            (std::vector<WasmValueType>{WasmValueType::U64, WasmValueType::I32}));
+
+  // floats are not representable
+  EXPECT_EQ((*exports)[4].name, "fneg");
+  EXPECT_FALSE((*exports)[4].signature.has_value());
+}
+
 } /* wasm_api */
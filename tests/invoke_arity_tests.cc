@@ -27,6 +27,10 @@ HostFnStatus<uint64_t> arity0(HostCallContext* ctx) {
   return 100;
 }
 
+HostFnStatus<uint64_t> arity0_noexcept(HostCallContext* ctx) noexcept {
+  return 100;
+}
+
 HostFnStatus<uint64_t> arity1(HostCallContext* ctx, uint64_t arg0)
 {
   if (arg0 != 1) {
@@ -333,4 +337,72 @@ INSTANTIATE_TEST_SUITE_P(AllEngines, InvokeArityTests,
                             wasm_api::SupportedWasmEngine::FIZZY,
                             wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
                             wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+// Same functions, linked with link_fn<F>()
+class DirectLinkArityTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    auto c = load_wasm_from_file("tests/wat/test_invoke_arity.wasm");
+    uint32_t len = c->size();
+
+    Script s {.data = c->data(), .len = len};
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+
+    ASSERT_TRUE(ctx->link_fn<&arity0_noexcept>("test", "arg0"));
+    ASSERT_TRUE(ctx->link_fn<&arity1>("test", "arg1"));
+    ASSERT_TRUE(ctx->link_fn<&arity2>("test", "arg2"));
+    ASSERT_TRUE(ctx->link_fn<&arity3>("test", "arg3"));
+    ASSERT_TRUE(ctx->link_fn<&arity4>("test", "arg4"));
+    ASSERT_TRUE(ctx->link_fn<&arity5>("test", "arg5"));
+    ASSERT_TRUE(ctx->link_fn<&arity6>("test", "arg6"));
+    ASSERT_TRUE(ctx->link_fn<&arity7>("test", "arg7"));
+    ASSERT_TRUE(ctx->link_fn<&arity8>("test", "arg8"));
+
+    ASSERT_TRUE(ctx->link_fn<&noret_arity0>("test", "noret_arg0"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity1>("test", "noret_arg1"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity2>("test", "noret_arg2"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity3>("test", "noret_arg3"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity4>("test", "noret_arg4"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity5>("test", "noret_arg5"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity6>("test", "noret_arg6"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity7>("test", "noret_arg7"));
+    ASSERT_TRUE(ctx->link_fn<&noret_arity8>("test", "noret_arg8"));
+
+    runtime = ctx->new_runtime_instance(s, nullptr);
+
+    ASSERT_TRUE(!!runtime);
+  }
+
+  std::unique_ptr<WasmContext> ctx;
+  std::unique_ptr<WasmRuntime> runtime;
+};
+
+TEST_P(DirectLinkArityTests, all_arities)
+{
+  for (uint64_t i = 0; i <= 8; i++) {
+    auto res = runtime->invoke("calltest" + std::to_string(i));
+    ASSERT_TRUE(!!res.result) << i;
+    EXPECT_EQ(*res.result, 100u + i);
+  }
+}
+
+TEST_P(DirectLinkArityTests, all_arities_noret)
+{
+  noret_called = false;
+  for (uint64_t i = 0; i <= 8; i++) {
+    auto res = runtime->invoke("callnoret" + std::to_string(i));
+    EXPECT_TRUE(!!res.result) << i;
+  }
+  EXPECT_TRUE(noret_called);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, DirectLinkArityTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3,
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
 } /* wasm_api */
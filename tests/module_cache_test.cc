@@ -0,0 +1,214 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "wasm_api/wasm_api.h"
+#include "wasm_api/module_cache.h"
+
+#include "tests/load_wasm.h"
+
+#include <atomic>
+#include <thread>
+
+namespace wasm_api
+{
+
+using namespace test;
+using namespace std::chrono_literals;
+
+static Hash make_hash(uint8_t i)
+{
+  Hash out;
+  out.fill(0);
+  out[0] = i;
+  return out;
+}
+
+TEST(ModuleCacheTests, evicts_cheap_and_cold_first)
+{
+  detail::ModuleCache<int> cache(100);
+
+  cache.put(make_hash(1), 1, 50, 10ms);
+  cache.put(make_hash(2), 2, 50, 1ms);
+
+  ASSERT_TRUE(cache.get(make_hash(1)).has_value());
+
+  cache.put(make_hash(3), 3, 50, 1ms);
+
+  EXPECT_TRUE(cache.get(make_hash(1)).has_value());
+  EXPECT_FALSE(cache.get(make_hash(2)).has_value());
+  EXPECT_TRUE(cache.get(make_hash(3)).has_value());
+
+  auto stats = cache.get_stats();
+  EXPECT_EQ(stats.evictions, 1u);
+  EXPECT_EQ(stats.entries, 2u);
+  EXPECT_EQ(stats.bytes, 100u);
+}
+
+TEST(ModuleCacheTests, oversized_not_cached)
+{
+  detail::ModuleCache<int> cache(100);
+
+  cache.put(make_hash(1), 1, 101, 1ms);
+  EXPECT_FALSE(cache.get(make_hash(1)).has_value());
+  EXPECT_EQ(cache.get_stats().entries, 0u);
+}
+
+TEST(ModuleCacheTests, resize)
+{
+  detail::ModuleCache<int> cache(100);
+
+  cache.put(make_hash(1), 1, 30, 10ms);
+  cache.put(make_hash(2), 2, 30, 1ms);
+
+  // only if the entry still holds that value
+  EXPECT_FALSE(cache.resize(make_hash(1), 5, 40));
+  EXPECT_FALSE(cache.resize(make_hash(3), 3, 40));
+
+  EXPECT_TRUE(cache.resize(make_hash(1), 1, 60));
+  EXPECT_EQ(cache.get_stats().bytes, 90u);
+
+  // evicts the cheaper entry to fit
+  EXPECT_TRUE(cache.resize(make_hash(1), 1, 80));
+  EXPECT_FALSE(cache.get(make_hash(2)).has_value());
+  EXPECT_EQ(cache.get_stats().bytes, 80u);
+
+  EXPECT_FALSE(cache.resize(make_hash(1), 1, 101));
+  EXPECT_EQ(cache.get_stats().entries, 0u);
+  EXPECT_EQ(cache.get_stats().bytes, 0u);
+}
+
+static HostFnStatus<uint64_t> double_fn(HostCallContext*, uint64_t arg) {
+  return 2*arg;
+}
+
+class ModuleCacheStatsTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    contract = load_wasm_from_file("tests/wat/test_invoke.wasm");
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+
+    ASSERT_TRUE(ctx -> link_fn("test", "redir_call", &double_fn));
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> contract;
+  std::unique_ptr<WasmContext> ctx;
+};
+
+TEST_P(ModuleCacheStatsTests, hit_miss_evict)
+{
+  Script s {.data = contract->data(), .len = static_cast<uint32_t>(contract->size())};
+  Hash id = make_hash(0xEF);
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(!!ctx -> new_runtime_instance(s, nullptr, &id));
+  }
+
+  // no identifier, not cached
+  ASSERT_TRUE(!!ctx -> new_runtime_instance(s, nullptr));
+
+  auto stats = ctx -> get_module_cache_stats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.hits, 2u);
+  EXPECT_EQ(stats.entries, 1u);
+  EXPECT_GT(stats.bytes, 0u);
+  EXPECT_EQ(stats.evictions, 0u);
+
+  ctx -> set_module_cache_budget(0);
+
+  stats = ctx -> get_module_cache_stats();
+  EXPECT_EQ(stats.entries, 0u);
+  EXPECT_EQ(stats.bytes, 0u);
+  EXPECT_EQ(stats.evictions, 1u);
+  EXPECT_EQ(stats.budget_bytes, 0u);
+
+  auto runtime = ctx -> new_runtime_instance(s, nullptr, &id);
+  ASSERT_TRUE(!!runtime);
+  auto res = runtime -> invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 24u);
+}
+
+TEST_P(ModuleCacheStatsTests, idle_instances_charged)
+{
+  if (GetParam() != SupportedWasmEngine::WASM3) {
+    return;
+  }
+
+  Script s {.data = contract->data(), .len = static_cast<uint32_t>(contract->size())};
+  Hash id = make_hash(0x34);
+
+  auto runtime = ctx -> new_runtime_instance(s, nullptr, &id);
+  ASSERT_TRUE(!!runtime);
+  const uint64_t with_snapshot = ctx -> get_module_cache_stats().bytes;
+  EXPECT_GT(with_snapshot, contract->size());
+
+  // wasm3 keeps the dropped runtime's instance for reuse
+  runtime.reset();
+  const uint64_t with_idle = ctx -> get_module_cache_stats().bytes;
+  EXPECT_GE(with_idle, with_snapshot + 65536);
+
+  // which is dropped along with the cache entry
+  ctx -> set_module_cache_budget(0);
+  EXPECT_EQ(ctx -> get_module_cache_stats().bytes, 0u);
+  ASSERT_TRUE(!!ctx -> new_runtime_instance(s, nullptr, &id));
+}
+
+TEST_P(ModuleCacheStatsTests, concurrent_miss_compiles_once)
+{
+  Script s {.data = contract->data(), .len = static_cast<uint32_t>(contract->size())};
+  Hash id = make_hash(0x12);
+
+  constexpr int num_threads = 8;
+  std::atomic<int> successes = 0;
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&] () {
+      auto runtime = ctx -> new_runtime_instance(s, nullptr, &id);
+      if (!runtime) {
+        return;
+      }
+      auto res = runtime -> invoke("calltest");
+      if (res.result && *res.result == 24u) {
+        successes++;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_EQ(successes, num_threads);
+
+  auto stats = ctx -> get_module_cache_stats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.hits, static_cast<uint64_t>(num_threads - 1));
+  EXPECT_EQ(stats.entries, 1u);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, ModuleCacheStatsTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+} /* wasm_api */
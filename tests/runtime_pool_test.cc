@@ -0,0 +1,122 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "wasm_api/wasm_api.h"
+#include "wasm_api/runtime_pool.h"
+
+#include "tests/load_wasm.h"
+
+#include <chrono>
+#include <thread>
+
+namespace wasm_api
+{
+
+using namespace test;
+
+class RuntimePoolTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {
+
+ protected:
+  void SetUp() override {
+    c = load_wasm_from_file("tests/wat/test_reset.wasm");
+
+    ctx = std::make_unique<WasmContext>(65536, GetParam());
+
+    id.fill(0);
+    id[0] = 0x11;
+  }
+
+  // the background thread fills the pool eventually
+  void wait_for_ready(RuntimePool& pool, uint64_t count) {
+    for (int i = 0; i < 1000 && pool.get_stats().ready_runtimes < count; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ASSERT_GE(pool.get_stats().ready_runtimes, count);
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> c;
+  std::unique_ptr<WasmContext> ctx;
+  Hash id;
+}; 
+
+TEST_P(RuntimePoolTests, unknown_script)
+{
+  RuntimePool pool(*ctx);
+  EXPECT_FALSE(!!pool.acquire(id, nullptr));
+
+  std::vector<uint8_t> garbage = {0x00, 0x61, 0x73, 0x6d, 0xFF, 0xFF};
+  Script s {.data = garbage.data(), .len = static_cast<uint32_t>(garbage.size())};
+  EXPECT_FALSE(pool.add_script(id, s));
+}
+
+TEST_P(RuntimePoolTests, acquire_release)
+{
+  RuntimePool pool(*ctx, RuntimePoolConfig { .runtimes_per_script = 2 });
+
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  ASSERT_TRUE(pool.add_script(id, s));
+
+  wait_for_ready(pool, 2);
+
+  int user_ctx = 0;
+  for (int i = 0; i < 5; i++) {
+    auto runtime = pool.acquire(id, &user_ctx);
+    ASSERT_TRUE(!!runtime);
+    EXPECT_EQ(runtime->get_host_call_context()->user_ctx, &user_ctx);
+
+    // fresh (or reset) runtime every time
+    auto res = runtime->invoke("bump");
+    ASSERT_TRUE(!!res.result);
+    EXPECT_EQ(*res.result, 102u);
+
+    pool.release(id, std::move(runtime));
+    wait_for_ready(pool, 2);
+  }
+
+  auto stats = pool.get_stats();
+  EXPECT_EQ(stats.acquired_warm, 5u);
+  EXPECT_EQ(stats.acquired_cold, 0u);
+  EXPECT_EQ(stats.scripts, 1u);
+}
+
+TEST_P(RuntimePoolTests, idle_eviction)
+{
+  RuntimePool pool(*ctx, RuntimePoolConfig {
+    .runtimes_per_script = 1,
+    .idle_timeout = std::chrono::milliseconds(10)
+  });
+
+  Script s {.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+  ASSERT_TRUE(pool.add_script(id, s));
+
+  for (int i = 0; i < 1000 && pool.get_stats().scripts > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(pool.get_stats().scripts, 0u);
+  EXPECT_FALSE(!!pool.acquire(id, nullptr));
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, RuntimePoolTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+} /* wasm_api */
@@ -0,0 +1,201 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "wasm_api/wasm_api.h"
+#include "wasm_api/error.h"
+#include "wasm_api/static_wasm_api.h"
+
+#include "tests/load_wasm.h"
+
+#include <type_traits>
+
+namespace wasm_api
+{
+
+using namespace test;
+
+template<SupportedWasmEngine engine>
+HostFnStatus<uint64_t>
+static_consume_gas_call(HostCallContext* ctxp)
+{
+    if (!StaticWasmRuntime<engine>::consume_gas(ctxp, 100))
+    {
+        return HostFnStatus<uint64_t>{std::unexpect_t{}, HostFnError::OUT_OF_GAS};
+    }
+    return 0;
+}
+
+HostFnStatus<uint64_t>
+static_good_call(HostCallContext*)
+{
+    return 0;
+}
+
+// calls f with std::integral_constant<SupportedWasmEngine, engine>
+template<typename F>
+void with_static_engine(SupportedWasmEngine engine, F&& f)
+{
+    switch (engine) {
+      case SupportedWasmEngine::WASM3:
+        return f(std::integral_constant<SupportedWasmEngine, SupportedWasmEngine::WASM3>{});
+      case SupportedWasmEngine::MAKEPAD_STITCH:
+        return f(std::integral_constant<SupportedWasmEngine, SupportedWasmEngine::MAKEPAD_STITCH>{});
+      case SupportedWasmEngine::WASMI:
+        return f(std::integral_constant<SupportedWasmEngine, SupportedWasmEngine::WASMI>{});
+      case SupportedWasmEngine::FIZZY:
+        return f(std::integral_constant<SupportedWasmEngine, SupportedWasmEngine::FIZZY>{});
+      case SupportedWasmEngine::WASMTIME_CRANELIFT:
+        return f(std::integral_constant<SupportedWasmEngine, SupportedWasmEngine::WASMTIME_CRANELIFT>{});
+      case SupportedWasmEngine::WASMTIME_WINCH:
+        return f(std::integral_constant<SupportedWasmEngine, SupportedWasmEngine::WASMTIME_WINCH>{});
+    }
+    FAIL() << "unknown engine";
+}
+
+class StaticWasmApiTests : public ::testing::TestWithParam<wasm_api::SupportedWasmEngine> {};
+
+TEST_P(StaticWasmApiTests, invoke_and_gas)
+{
+    auto c = load_wasm_from_file("tests/wat/test_error_handling.wasm");
+    Script script{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    with_static_engine(GetParam(), [&] (auto e) {
+        constexpr SupportedWasmEngine engine = decltype(e)::value;
+
+        StaticWasmContext<engine> ctx(65536);
+        ASSERT_TRUE(ctx.link_fn("test", "external_call", &static_consume_gas_call<engine>));
+        ASSERT_TRUE(ctx.link_fn("test", "good_call", &static_good_call));
+
+        auto runtime = ctx.new_runtime_instance(script, nullptr);
+        ASSERT_TRUE(!!runtime);
+
+        runtime.set_available_gas(5000);
+
+        auto res = runtime.invoke("call1", 300);
+        ASSERT_TRUE(!!res.result);
+        EXPECT_GE(res.gas_consumed, 100u);
+        EXPECT_EQ(runtime.get_available_gas(), 5000u);
+
+        auto call1 = runtime.prepare("call1");
+        ASSERT_TRUE(!!call1);
+        auto res2 = runtime.invoke(call1, 300);
+        ASSERT_TRUE(!!res2.result);
+        EXPECT_EQ(res2.gas_consumed, res.gas_consumed);
+
+        // same as the dynamic api
+        auto res3 = runtime.dynamic().invoke(call1, 300);
+        ASSERT_TRUE(!!res3.result);
+        EXPECT_EQ(res3.gas_consumed, res.gas_consumed);
+
+        runtime.set_available_gas(100);
+        EXPECT_TRUE(runtime.consume_gas(60));
+        EXPECT_EQ(runtime.get_available_gas(), 40u);
+        EXPECT_FALSE(runtime.consume_gas(50));
+        EXPECT_EQ(runtime.get_available_gas(), 0u);
+        EXPECT_EQ(runtime.dynamic().get_available_gas(), 0u);
+    });
+}
+
+TEST_P(StaticWasmApiTests, memory_and_reset)
+{
+    auto c = load_wasm_from_file("tests/wat/test_reset.wasm");
+    Script script{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    with_static_engine(GetParam(), [&] (auto e) {
+        constexpr SupportedWasmEngine engine = decltype(e)::value;
+
+        StaticWasmContext<engine> ctx(65536);
+        auto module = ctx.compile(script);
+        ASSERT_TRUE(!!module);
+
+        auto runtime = ctx.instantiate(module, nullptr);
+        ASSERT_TRUE(!!runtime);
+
+        auto bump = runtime.prepare("bump");
+        ASSERT_TRUE(!!bump);
+
+        auto res = runtime.invoke(bump);
+        ASSERT_TRUE(!!res.result);
+        EXPECT_EQ(*res.result, 102u);
+        EXPECT_EQ(runtime.get_memory()[8], std::byte{0x65});
+
+        ASSERT_TRUE(runtime.reset());
+        EXPECT_EQ(runtime.get_memory()[8], std::byte{0x64});
+
+        // handles stay valid across reset()
+        res = runtime.invoke(bump);
+        ASSERT_TRUE(!!res.result);
+        EXPECT_EQ(*res.result, 102u);
+    });
+}
+
+TEST_P(StaticWasmApiTests, other_module_handle)
+{
+    auto c = load_wasm_from_file("tests/wat/test_reset.wasm");
+    Script script{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    with_static_engine(GetParam(), [&] (auto e) {
+        constexpr SupportedWasmEngine engine = decltype(e)::value;
+
+        StaticWasmContext<engine> ctx(65536);
+        auto runtime1 = ctx.new_runtime_instance(script, nullptr);
+        auto runtime2 = ctx.instantiate(ctx.compile(script), nullptr);
+        ASSERT_TRUE(!!runtime1);
+        ASSERT_TRUE(!!runtime2);
+
+        auto bump = runtime1.prepare("bump");
+        ASSERT_TRUE(!!bump);
+
+        auto res = runtime2.invoke(bump);
+        ASSERT_FALSE(!!res.result);
+        EXPECT_EQ(res.result.error(), InvokeError::UNRECOVERABLE);
+    });
+}
+
+TEST_P(StaticWasmApiTests, wrong_engine)
+{
+    auto c = load_wasm_from_file("tests/wat/test_reset.wasm");
+    Script script{.data = c->data(), .len = static_cast<uint32_t>(c->size())};
+
+    // any engine with a different runtime type
+    SupportedWasmEngine other = (GetParam() == SupportedWasmEngine::WASM3)
+        ? SupportedWasmEngine::WASMI
+        : SupportedWasmEngine::WASM3;
+
+    WasmContext ctx(65536, other);
+
+    with_static_engine(GetParam(), [&] (auto e) {
+        constexpr SupportedWasmEngine engine = decltype(e)::value;
+
+        StaticWasmRuntime<engine> runtime(ctx.new_runtime_instance(script, nullptr));
+        EXPECT_FALSE(!!runtime);
+
+        StaticWasmRuntime<engine> empty(nullptr);
+        EXPECT_FALSE(!!empty);
+    });
+}
+
+INSTANTIATE_TEST_SUITE_P(AllEngines, StaticWasmApiTests,
+                        ::testing::Values(wasm_api::SupportedWasmEngine::WASM3,
+                            wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
+                            wasm_api::SupportedWasmEngine::WASMI,
+                            wasm_api::SupportedWasmEngine::FIZZY,
+                            wasm_api::SupportedWasmEngine::WASMTIME_CRANELIFT,
+                            wasm_api::SupportedWasmEngine::WASMTIME_WINCH));
+
+} // namespace wasm_api
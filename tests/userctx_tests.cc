@@ -68,6 +68,38 @@ TEST_P(UserCtxTests, check_userctx_correct)
   EXPECT_EQ(*res.result, 15u);
 }
 
+void* other_ctx_check = (void*) (0x11223344'55667788);
+
+HostFnStatus<uint64_t>
+bar(HostCallContext* ctx, uint64_t value)
+{
+	return (ctx->user_ctx == other_ctx_check) ? 1 : 0;
+}
+
+TEST_P(UserCtxTests, rebind_userctx)
+{
+  WasmContext other_ctx(65536, GetParam());
+  ASSERT_TRUE(other_ctx.link_fn("test", "redir_call", &bar));
+
+  auto other_runtime = other_ctx.new_runtime_instance(script, ctx_check);
+  ASSERT_TRUE(!!other_runtime);
+
+  auto res = other_runtime->invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 0u);
+
+  // only for this call
+  res = other_runtime->invoke("calltest", UINT64_MAX, other_ctx_check);
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 1u);
+  EXPECT_EQ(other_runtime->get_host_call_context()->user_ctx, ctx_check);
+
+  other_runtime->rebind(other_ctx_check);
+  res = other_runtime->invoke("calltest");
+  ASSERT_TRUE(!!res.result);
+  EXPECT_EQ(*res.result, 1u);
+}
+
 INSTANTIATE_TEST_SUITE_P(AllEngines, UserCtxTests,
                         ::testing::Values(wasm_api::SupportedWasmEngine::WASM3, 
                             wasm_api::SupportedWasmEngine::MAKEPAD_STITCH,
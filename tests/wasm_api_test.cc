@@ -153,6 +153,32 @@ TEST_P(ExternalCallTest, host_error)
     EXPECT_EQ(res.result.error(), InvokeError::OUT_OF_GAS_ERROR);
 }
 
+TEST_P(ExternalCallTest, direct_link_runtime_error)
+{
+    ASSERT_TRUE(ctx->link_fn<&throw_runtime_error>("test", "external_call"));
+    runtime = ctx -> new_runtime_instance(script, nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    ERROR_GUARD
+    UNRECOVERABLEGUARD
+    auto res = runtime -> invoke("call1");
+    ASSERT_FALSE(!!res.result);
+    EXPECT_EQ(res.result.error(), InvokeError::UNRECOVERABLE);
+}
+
+TEST_P(ExternalCallTest, direct_link_host_error)
+{
+    ASSERT_TRUE(ctx->link_fn<&throw_host_error>("test", "external_call"));
+    runtime = ctx -> new_runtime_instance(script, nullptr);
+    ASSERT_TRUE(!!runtime);
+
+    ERROR_GUARD
+
+    auto res = runtime -> invoke("call1");
+    ASSERT_FALSE(!!res.result);
+    EXPECT_EQ(res.result.error(), InvokeError::OUT_OF_GAS_ERROR);
+}
+
 TEST_P(ExternalCallTest, other_weird_error)
 {
     ASSERT_TRUE(ctx->link_fn("test", "external_call", &throw_bad_alloc));
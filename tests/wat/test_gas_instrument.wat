@@ -0,0 +1,66 @@
+;;
+;; Copyright 2024 Geoffrey Ramseyer
+;;
+;; Licensed under the Apache License, Version 2.0 (the "License");
+;; you may not use this file except in compliance with the License.
+;; You may obtain a copy of the License at
+;;
+;;     http://www.apache.org/licenses/LICENSE-2.0
+;;
+;; Unless required by applicable law or agreed to in writing, software
+;; distributed under the License is distributed on an "AS IS" BASIS,
+;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;; See the License for the specific language governing permissions and
+;; limitations under the License.
+;;
+
+(module
+  (import "test" "id" (func $id (param i64) (result i64)))
+
+  (type $count_t (func (param i64) (result i64)))
+
+  (table 1 funcref)
+  (elem (i32.const 0) $count)
+
+  (func $count (param $n i64) (result i64)
+    (local $i i64)
+    (loop $l
+      (local.set $i (i64.add (local.get $i) (i64.const 1)))
+      (br_if $l (i64.lt_u (local.get $i) (local.get $n))))
+    (local.get $i)
+  )
+
+  (func (export "loop10") (result i64)
+    (call $count (i64.const 10))
+  )
+
+  (func (export "loop20") (result i64)
+    (call $count (i64.const 20))
+  )
+
+  (func (export "straight") (result i64)
+    (block (result i64)
+      (i64.add (i64.const 1) (i64.const 2)))
+  )
+
+  (func (export "if_else") (result i64)
+    (if (result i64) (i64.eqz (i64.const 0))
+      (then (i64.const 1))
+      (else (i64.add (i64.const 2) (i64.const 3))))
+  )
+
+  (func (export "early_return") (result i64)
+    (block
+      (br_if 0 (i32.const 1))
+      (return (i64.const 5)))
+    (i64.const 6)
+  )
+
+  (func (export "call_import") (result i64)
+    (call $id (i64.const 7))
+  )
+
+  (func (export "indirect") (result i64)
+    (call_indirect (type $count_t) (i64.const 10) (i32.const 0))
+  )
+)
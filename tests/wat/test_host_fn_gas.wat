@@ -0,0 +1,35 @@
+;;
+;; Copyright 2024 Geoffrey Ramseyer
+;;
+;; Licensed under the Apache License, Version 2.0 (the "License");
+;; you may not use this file except in compliance with the License.
+;; You may obtain a copy of the License at
+;;
+;;     http://www.apache.org/licenses/LICENSE-2.0
+;;
+;; Unless required by applicable law or agreed to in writing, software
+;; distributed under the License is distributed on an "AS IS" BASIS,
+;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;; See the License for the specific language governing permissions and
+;; limitations under the License.
+;;
+
+(module
+  ;; (pointer, length)
+  (import "test" "write" (func $write (param i64 i64)))
+
+  (func (export "write0") (result i64)
+    (call $write (i64.const 0) (i64.const 0))
+    (i64.const 0)
+  )
+
+  (func (export "write10") (result i64)
+    (call $write (i64.const 0) (i64.const 10))
+    (i64.const 0)
+  )
+
+  (func (export "write_max") (result i64)
+    (call $write (i64.const 0) (i64.const -1))
+    (i64.const 0)
+  )
+)
@@ -0,0 +1,24 @@
+;;
+;; Copyright 2024 Geoffrey Ramseyer
+;;
+;; Licensed under the Apache License, Version 2.0 (the "License");
+;; you may not use this file except in compliance with the License.
+;; You may obtain a copy of the License at
+;;
+;;     http://www.apache.org/licenses/LICENSE-2.0
+;;
+;; Unless required by applicable law or agreed to in writing, software
+;; distributed under the License is distributed on an "AS IS" BASIS,
+;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;; See the License for the specific language governing permissions and
+;; limitations under the License.
+;;
+
+
+;; multi-value returns, which fizzy does not support
+(module
+  (func (export "swap") (param i32 i64) (result i64 i32)
+    (local.get 1)
+    (local.get 0)
+  )
+)
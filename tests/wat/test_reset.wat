@@ -0,0 +1,33 @@
+;;
+;; Copyright 2024 Geoffrey Ramseyer
+;;
+;; Licensed under the Apache License, Version 2.0 (the "License");
+;; you may not use this file except in compliance with the License.
+;; You may obtain a copy of the License at
+;;
+;;     http://www.apache.org/licenses/LICENSE-2.0
+;;
+;; Unless required by applicable law or agreed to in writing, software
+;; distributed under the License is distributed on an "AS IS" BASIS,
+;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;; See the License for the specific language governing permissions and
+;; limitations under the License.
+;;
+
+(module
+  (global $counter (mut i64) (i64.const 0))
+
+  ;; increments both a global and a value in memory,
+  ;; returns their sum
+  (func (export "bump") (result i64)
+    (global.set $counter (i64.add (global.get $counter) (i64.const 1)))
+    (i64.store (i32.const 8) (i64.add (i64.load (i32.const 8)) (i64.const 1)))
+    (i64.add (global.get $counter) (i64.load (i32.const 8)))
+  )
+  (func (export "trap") (result i64)
+    (unreachable)
+  )
+  (memory 1 1)
+  (data (i32.const 8) "\64")
+  (export "memory" (memory 0))
+)
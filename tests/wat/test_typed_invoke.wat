@@ -0,0 +1,37 @@
+;;
+;; Copyright 2024 Geoffrey Ramseyer
+;;
+;; Licensed under the Apache License, Version 2.0 (the "License");
+;; you may not use this file except in compliance with the License.
+;; You may obtain a copy of the License at
+;;
+;;     http://www.apache.org/licenses/LICENSE-2.0
+;;
+;; Unless required by applicable law or agreed to in writing, software
+;; distributed under the License is distributed on an "AS IS" BASIS,
+;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;; See the License for the specific language governing permissions and
+;; limitations under the License.
+;;
+
+
+(module
+  (func (export "add") (param i64 i32) (result i64)
+    (i64.add (local.get 0) (i64.extend_i32_u (local.get 1)))
+  )
+  (func (export "low") (param i64) (result i32)
+    (i32.wrap_i64 (local.get 0))
+  )
+  (func (export "store") (param i32 i64)
+    (i64.store (local.get 0) (local.get 1))
+  )
+  (func (export "load") (result i64)
+    (i64.load (i32.const 8))
+  )
+  ;; not callable by typed invoke
+  (func (export "fneg") (param f32) (result f32)
+    (f32.neg (local.get 0))
+  )
+  (memory 1 1)
+  (export "memory" (memory 0))
+)
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/compile_pool.h"
+
+#include <algorithm>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+CompilePool::CompilePool(uint32_t num_threads)
+    : num_threads(std::max<uint32_t>(num_threads, 1))
+{}
+
+CompilePool::~CompilePool()
+{
+    std::map<std::pair<int64_t, uint64_t>, Task> dropped;
+    {
+        std::lock_guard lock(mtx);
+        shutdown = true;
+        dropped.swap(queue);
+    }
+    cv.notify_all();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (auto& [_, task] : dropped) {
+        task.promise.set_value(CompiledModule());
+    }
+}
+
+std::future<CompiledModule>
+CompilePool::submit(std::function<CompiledModule()> task, int32_t priority)
+{
+    std::future<CompiledModule> out;
+    {
+        std::lock_guard lock(mtx);
+        if (threads.empty()) {
+            for (uint32_t i = 0; i < num_threads; i++) {
+                threads.emplace_back([this] { run_worker(); });
+            }
+        }
+
+        auto [it, _] = queue.emplace(
+            std::make_pair(-static_cast<int64_t>(priority), seq++),
+            Task { .run = std::move(task), .promise = {} });
+        out = it->second.promise.get_future();
+    }
+    cv.notify_one();
+    return out;
+}
+
+void
+CompilePool::run_worker()
+{
+    while (true) {
+        Task task;
+        {
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [this] { return shutdown || !queue.empty(); });
+            if (shutdown) {
+                return;
+            }
+            auto node = queue.extract(queue.begin());
+            task = std::move(node.mapped());
+        }
+
+        try {
+            task.promise.set_value(task.run());
+        } catch (...) {
+            task.promise.set_exception(std::current_exception());
+        }
+    }
+}
+
+} // namespace detail
+
+} // namespace wasm_api
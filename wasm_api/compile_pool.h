@@ -0,0 +1,85 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+/**
+ * Fixed-size pool of threads that run compilations in
+ * priority order (highest first, FIFO among equal priorities).
+ *
+ * Threads are started on the first submit(), so that contexts
+ * which never compile asynchronously cost nothing.
+ *
+ * Destroying the pool waits for running compilations to finish;
+ * compilations still queued are dropped, and their futures
+ * resolve to an empty CompiledModule.
+ */
+class CompilePool
+{
+public:
+    CompilePool(uint32_t num_threads);
+
+    ~CompilePool();
+
+    std::future<CompiledModule>
+    submit(std::function<CompiledModule()> task, int32_t priority);
+
+private:
+    struct Task
+    {
+        std::function<CompiledModule()> run;
+        std::promise<CompiledModule> promise;
+    };
+
+    const uint32_t num_threads;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool shutdown = false;
+
+    // (-priority, submission sequence number)
+    std::map<std::pair<int64_t, uint64_t>, Task> queue;
+    uint64_t seq = 0;
+
+    std::vector<std::thread> threads;
+
+    void run_worker();
+
+    CompilePool(CompilePool const&) = delete;
+    CompilePool(CompilePool&&) = delete;
+};
+
+} // namespace detail
+
+} // namespace wasm_api
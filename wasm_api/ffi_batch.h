@@ -0,0 +1,99 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include "wasm_api/bindings.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+// Calls per *_invoke_batch FFI call, so that the
+// FFI-side arrays fit on the stack.
+constexpr static size_t FFI_BATCH_CHUNK = 32;
+
+inline MeteredReturn
+metered_return_from_ffi(FFIMeteredResult const& res)
+{
+    InvokeError err = static_cast<InvokeError>(res.result.error);
+    return MeteredReturn {
+        .result = (err == InvokeError::NONE)
+            ? InvokeStatus<uint64_t>(res.result.result)
+            : InvokeStatus<uint64_t>(std::unexpect_t{}, err),
+        .gas_consumed = res.gas_consumed
+    };
+}
+
+/**
+ * WasmRuntimeImpl::invoke_batch() for the engines in wasmi_lib,
+ * through their *_invoke_batch (which runs FFI_BATCH_CHUNK calls
+ * per FFI crossing, and saves/restores the gas once per crossing).
+ */
+template<auto ffi_invoke_batch>
+size_t
+ffi_invoke_batch_chunked(void* runtime_pointer,
+                         std::span<const InvokeRequest> requests,
+                         std::span<MeteredReturn> results,
+                         BatchErrorPolicy policy)
+{
+    size_t ran = 0;
+    while (ran < requests.size()) {
+        const size_t n = std::min(FFI_BATCH_CHUNK, requests.size() - ran);
+
+        FFIBatchCall calls[FFI_BATCH_CHUNK];
+        FFIMeteredResult ffi_results[FFI_BATCH_CHUNK];
+        for (size_t i = 0; i < n; i++) {
+            auto const& request = requests[ran + i];
+            auto const& name = request.method.get_name();
+            calls[i] = FFIBatchCall {
+                .method_index = request.method.get_index(),
+                .method_name = reinterpret_cast<const uint8_t*>(name.c_str()),
+                .method_name_len = static_cast<uint32_t>(name.size()),
+                .gas_limit = request.gas_limit
+            };
+        }
+
+        const uint32_t chunk_ran = ffi_invoke_batch(runtime_pointer,
+                                                    calls,
+                                                    ffi_results,
+                                                    static_cast<uint32_t>(n),
+                                                    static_cast<uint8_t>(policy));
+
+        for (size_t i = 0; i < chunk_ran; i++) {
+            results[ran + i] = metered_return_from_ffi(ffi_results[i]);
+        }
+        ran += chunk_ran;
+
+        if (chunk_ran < n || batch_should_stop(results[ran - 1].result, policy)) {
+            break;
+        }
+    }
+    return ran;
+}
+
+} // namespace detail
+
+} // namespace wasm_api
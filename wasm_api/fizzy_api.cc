@@ -1,7 +1,7 @@
 #include "wasm_api/fizzy_api.h"
 
 #include "wasm_api/error.h"
-#include "wasm_api/ffi_trampolines.h"
+#include "wasm_api/host_trampolines.h"
 
 #include <fizzy/fizzy.h>
 
@@ -57,265 +57,118 @@ handle_trampoline_result(TrampolineResult result, HostFnError* ctx_errno)
   }
 }
 
-// again, for convenience, we assume all args are uint64
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_0args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
+// Same as Fizzy_WasmRuntime::consume_gas(), on the ticks of an execution context
+static bool
+charge_ticks(int64_t* ticks, uint64_t gas)
 {
-
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
-
-
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_0args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context);
-  } else {
-    host_fn_result 
-        = c_call_0args(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context);
-  }
-  
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
-}
-
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_1args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
-{
-
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
-
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_1args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64);
-  } else {
-    host_fn_result 
-        = c_call_1args(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64);
+  if (gas > INT64_MAX || *ticks < static_cast<int64_t>(gas)) {
+    *ticks = 0;
+    return false;
   }
-  
-
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
+  *ticks -= gas;
+  return true;
 }
 
-template<FizzyValueType ret_type>
+// again, for convenience, we assume all args are uint64
+template<FizzyValueType ret_type, size_t... I>
 FizzyExecutionResult
-fizzy_trampoline_2args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
+fizzy_trampoline(void *host_ctx, FizzyInstance *instance,
+                 const FizzyValue *args,
+                 FizzyExecutionContext *ctx) noexcept
 {
 
   FizzyTrampolineHostContext *fizzy_host_ctx =
       reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
 
+  int64_t* ticks = fizzy_get_execution_context_ticks(ctx);
 
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_2args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64);
-  } else {
-    host_fn_result 
-      = c_call_2args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64);
+  auto const& gas = fizzy_host_ctx -> gas;
+  if (!gas.is_free() && !charge_ticks(ticks, gas.cost(args[I].i64...))) {
+    return handle_trampoline_result<ret_type>(
+      TrampolineResult{ 0, static_cast<uint8_t>(HostFnError::OUT_OF_GAS) },
+      fizzy_host_ctx -> errno_);
   }
-  
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
-}
 
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_3args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
-{
+  // The host function consumes gas from its HostCallContext,
+  // which is deducted from ticks afterwards
+  HostCallContext* host_call_context = fizzy_host_ctx -> real_context;
+  const uint64_t available_gas = (*ticks < 0) ? 0 : *ticks;
+  host_call_context -> available_gas = available_gas;
 
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
+  auto trampoline = reinterpret_cast<detail::HostTrampoline<decltype(args[I].i64)...>>(
+    fizzy_host_ctx -> trampoline);
 
+  TrampolineResult host_fn_result = trampoline(fizzy_host_ctx -> fn_pointer,
+    host_call_context, args[I].i64...);
 
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_3args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64);
-  } else {
-    host_fn_result 
-      = c_call_3args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64);
+  // Can fail if the host function also consumed gas through the runtime
+  if (host_call_context -> available_gas < available_gas
+      && !charge_ticks(ticks, available_gas - host_call_context -> available_gas)
+      && host_fn_result.panic == static_cast<uint8_t>(HostFnError::NONE_OR_RECOVERABLE)) {
+    host_fn_result = TrampolineResult{ 0, static_cast<uint8_t>(HostFnError::OUT_OF_GAS) };
   }
 
   return handle_trampoline_result<ret_type>(host_fn_result,
     fizzy_host_ctx -> errno_);
 }
 
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_4args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
+template<FizzyValueType ret_type, size_t nargs>
+constexpr FizzyExternalFn
+fizzy_trampoline_nargs()
 {
-
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
-
-
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_4args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64);
-  } else {
-    host_fn_result 
-      = c_call_4args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64);
-  }
-
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
-}
-
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_5args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
-{
-
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
-
-
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_5args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64);
-  } else {
-    host_fn_result 
-      = c_call_5args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64);
-  }
-
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
+  return [] <size_t... I> (std::index_sequence<I...>) -> FizzyExternalFn {
+    return &fizzy_trampoline<ret_type, I...>;
+  } (std::make_index_sequence<nargs>{});
 }
 
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_6args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
-{
-
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
-
-
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_6args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64, args[5].i64);
-  } else {
-    host_fn_result 
-      = c_call_6args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64, args[5].i64);
-  }
-
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
-}
 
+Fizzy_WasmContext::Fizzy_WasmContext(uint32_t max_stack_bytes)
+{}
+Fizzy_WasmContext::~Fizzy_WasmContext()
+{}
 
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_7args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
+std::shared_ptr<detail::CompiledModuleImpl>
+Fizzy_WasmContext::compile(Script const &contract, const Hash* script_identifier)
 {
+  auto parse = [&] () -> std::optional<std::pair<std::shared_ptr<const FizzyModule>, uint64_t>> {
+    FizzyError error;
+    const FizzyModule* parsed = fizzy_parse(contract.data, contract.len, &error);
 
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
-
-
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_7args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64, args[5].i64, args[6].i64);
-  } else {
-    host_fn_result 
-      = c_call_7args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64, args[5].i64, args[6].i64);
-  }
-
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
-}
-
+    throw_unrecoverable_errors(error);
 
-template<FizzyValueType ret_type>
-FizzyExecutionResult
-fizzy_trampoline_8args(void *host_ctx, FizzyInstance *instance,
-                       const FizzyValue *args,
-                       FizzyExecutionContext *ctx) noexcept
-{
-
-  FizzyTrampolineHostContext *fizzy_host_ctx =
-      reinterpret_cast<FizzyTrampolineHostContext *>(host_ctx);
+    if (parsed == nullptr) {
+      return std::nullopt;
+    }
+    return std::make_pair(
+      std::shared_ptr<const FizzyModule>(parsed, fizzy_free_module), contract.len);
+  };
 
+  auto module = (script_identifier != nullptr)
+    ? module_cache.get_or_insert(*script_identifier, parse)
+    : parse().transform([] (auto const& p) { return p.first; });
 
-  TrampolineResult host_fn_result;
-  if constexpr(ret_type == FizzyValueTypeVoid) {
-    host_fn_result 
-        = c_call_8args_noret(fizzy_host_ctx -> fn_pointer,
-        fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64, args[5].i64, args[6].i64, args[7].i64);
-  } else {
-    host_fn_result 
-      = c_call_8args(fizzy_host_ctx -> fn_pointer,
-      fizzy_host_ctx -> real_context, args[0].i64, args[1].i64, args[2].i64, args[3].i64, args[4].i64, args[5].i64, args[6].i64, args[7].i64);
+  if (!module) {
+    return nullptr;
   }
 
-  return handle_trampoline_result<ret_type>(host_fn_result,
-    fizzy_host_ctx -> errno_);
+  return std::make_shared<Fizzy_CompiledModule>(std::move(*module));
 }
 
-
-Fizzy_WasmContext::Fizzy_WasmContext(uint32_t max_stack_bytes)
-{}
-Fizzy_WasmContext::~Fizzy_WasmContext()
-{}
-
-std::unique_ptr<WasmRuntime>
-Fizzy_WasmContext::new_runtime_instance(Script const &contract, void *ctxp, const Hash* /*unused*/)
+std::unique_ptr<detail::WasmRuntimeImpl>
+Fizzy_CompiledModule::instantiate(HostCallContext *host_call_context)
 {
-  std::unique_ptr<WasmRuntime> out = std::make_unique<WasmRuntime>(ctxp);
-
   auto fizzy_runtime =
-      std::make_unique<Fizzy_WasmRuntime>(out->get_host_call_context());
+      std::make_unique<Fizzy_WasmRuntime>(host_call_context);
 
-  if (!fizzy_runtime->initialize(contract)) {
+  const FizzyModule* clone = fizzy_clone_module(module.get());
+  if (clone == nullptr) {
+    throw std::runtime_error("fizzy malloc failed");
+  }
+  if (!fizzy_runtime->initialize(clone)) {
     return nullptr;
   }
 
-  out->initialize(fizzy_runtime.get());
-  fizzy_runtime.release();
-
-  return out;
+  return fizzy_runtime;
 }
 
 Fizzy_WasmRuntime::Fizzy_WasmRuntime(HostCallContext *host_call_context)
@@ -338,16 +191,9 @@ Fizzy_WasmRuntime::~Fizzy_WasmRuntime()
 }
 
 bool __attribute__((warn_unused_result))
-Fizzy_WasmRuntime::initialize(Script const &data)
+Fizzy_WasmRuntime::initialize(const FizzyModule* module)
 {
-  FizzyError error;
-  m_module = fizzy_parse(data.data, data.len, &error);
-
-  throw_unrecoverable_errors(error);
-
-  if (m_module == nullptr) {
-    return false;
-  }
+  m_module = module;
 
   if (fizzy_module_has_start_function(m_module)) {
     return false;
@@ -399,6 +245,28 @@ Fizzy_WasmRuntime::lazy_link()
   return (m_instance != nullptr);
 }
 
+bool
+Fizzy_WasmRuntime::reset()
+{
+  if (m_instance == nullptr) {
+    // never instantiated, or instantiation failed (and would again)
+    return !link_tried;
+  }
+
+  // fizzy does not expose non-exported globals, so there is no
+  // snapshot to restore -- the instance owns m_module, so clone it first
+  const FizzyModule* clone = fizzy_clone_module(fizzy_get_instance_module(m_instance));
+  if (clone == nullptr) {
+    throw std::runtime_error("fizzy malloc failed");
+  }
+
+  fizzy_free_instance(m_instance);
+  m_instance = nullptr;
+  m_module = clone;
+  link_tried = false;
+  return true;
+}
+
 InvokeStatus<uint64_t>
 Fizzy_WasmRuntime::invoke(std::string const &method_name)
 {
@@ -412,39 +280,172 @@ Fizzy_WasmRuntime::invoke(std::string const &method_name)
     return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
   }
 
+  return execute(fn_index);
+}
+
+InvokeStatus<uint64_t>
+Fizzy_WasmRuntime::invoke_prepared(uint32_t method_index, std::string const &method_name)
+{
+  if (!lazy_link()) {
+    return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+  }
+
+  auto fn_index = find_prepared(method_index, method_name);
+  if (!fn_index) {
+    return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+  }
+
+  return execute(*fn_index);
+}
+
+MeteredReturn
+Fizzy_WasmRuntime::invoke_metered(uint32_t method_index,
+                                  std::string const &method_name,
+                                  uint64_t gas_limit)
+{
+  // same clamping as set/get_available_gas
+  int64_t* ticks = fizzy_get_execution_context_ticks(exec_ctx);
+  const int64_t ticks_backup = *ticks;
+
+  *ticks = (gas_limit < INT64_MAX) ? static_cast<int64_t>(gas_limit) : INT64_MAX;
+  auto res = Fizzy_WasmRuntime::invoke_prepared(method_index, method_name);
+  const uint64_t gas_remaining = (*ticks < 0) ? 0 : *ticks;
+
+  *ticks = ticks_backup;
+  return metered_return(res, gas_limit, gas_remaining);
+}
+
+MeteredReturn
+Fizzy_WasmRuntime::invoke_typed(uint32_t method_index,
+                                detail::ExportedFunction const &method,
+                                uint64_t gas_limit,
+                                std::span<const uint64_t> args,
+                                std::span<uint64_t> results)
+{
+  // same clamping as set/get_available_gas
+  int64_t* ticks = fizzy_get_execution_context_ticks(exec_ctx);
+  const int64_t ticks_backup = *ticks;
+
+  *ticks = (gas_limit < INT64_MAX) ? static_cast<int64_t>(gas_limit) : INT64_MAX;
+  auto res = execute_typed(method_index, method, args, results);
+  const uint64_t gas_remaining = (*ticks < 0) ? 0 : *ticks;
+
+  *ticks = ticks_backup;
+  return metered_return(res, gas_limit, gas_remaining);
+}
+
+InvokeStatus<void>
+Fizzy_WasmRuntime::execute_typed(uint32_t method_index,
+                                 detail::ExportedFunction const &method,
+                                 std::span<const uint64_t> args,
+                                 std::span<uint64_t> results)
+{
+  if (!lazy_link()) {
+    return InvokeStatus<void>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+  }
+
+  auto fn_index = find_prepared(method_index, method.name);
+  if (!fn_index) {
+    return InvokeStatus<void>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+  }
+
+  // fizzy does not implement multi-value (such modules fail to compile)
+  if (!method.signature || args.size() > MAX_TYPED_INVOKE_VALUES || results.size() > 1) {
+    return InvokeStatus<void>{std::unexpect_t{}, InvokeError::UNRECOVERABLE};
+  }
+  auto const& sig = *method.signature;
+
+  FizzyValue fizzy_args[MAX_TYPED_INVOKE_VALUES];
+  for (size_t i = 0; i < args.size(); i++) {
+    if (sig.params[i] == WasmValueType::I32) {
+      fizzy_args[i].i32 = static_cast<uint32_t>(args[i]);
+    } else {
+      fizzy_args[i].i64 = args[i];
+    }
+  }
+
+  auto result = execute_raw(*fn_index, fizzy_args);
+  if (!result) {
+    return InvokeStatus<void>{std::unexpect_t{}, result.error()};
+  }
+
+  if (results.size() == 1) {
+    if (!result->has_value) {
+      throw std::runtime_error("invalid return from invoke");
+    }
+    results[0] = (sig.results[0] == WasmValueType::I32)
+      ? result->value.i32
+      : result->value.i64;
+  }
+  return {};
+}
+
+std::optional<uint32_t>
+Fizzy_WasmRuntime::find_prepared(uint32_t method_index, std::string const &method_name)
+{
+  if (method_index >= prepared.size()) {
+    prepared.resize(method_index + 1);
+  }
+  if (!prepared[method_index]) {
+    uint32_t fn_index;
+    if (!fizzy_find_exported_function_index(m_module, method_name.c_str(),
+                                            &fn_index)) {
+      return std::nullopt;
+    }
+    prepared[method_index] = fn_index;
+  }
+  return prepared[method_index];
+}
+
+InvokeStatus<FizzyExecutionResult>
+Fizzy_WasmRuntime::execute_raw(uint32_t fn_index, const FizzyValue* args)
+{
   const FizzyExecutionResult result =
-      fizzy_execute(m_instance, fn_index, NULL, exec_ctx);
+      fizzy_execute(m_instance, fn_index, args, exec_ctx);
 
   if (result.trapped) {
     switch(errno_last_call_) {
     case HostFnError::NONE_OR_RECOVERABLE:
       // trap must be from some source within wasm
-      return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+      return InvokeStatus<FizzyExecutionResult>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
     case HostFnError::OUT_OF_GAS:
-      return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::OUT_OF_GAS_ERROR};
+      return InvokeStatus<FizzyExecutionResult>{std::unexpect_t{}, InvokeError::OUT_OF_GAS_ERROR};
     case HostFnError::UNRECOVERABLE:
-      return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::UNRECOVERABLE};
+      return InvokeStatus<FizzyExecutionResult>{std::unexpect_t{}, InvokeError::UNRECOVERABLE};
     case HostFnError::RETURN_SUCCESS:
-      return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::RETURN};
+      return InvokeStatus<FizzyExecutionResult>{std::unexpect_t{}, InvokeError::RETURN};
     case HostFnError::DETERMINISTIC_ERROR:
-      return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+      return InvokeStatus<FizzyExecutionResult>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
     }
     throw std::runtime_error("unreachable");
   }
 
-  if (!result.has_value) {
+  return result;
+}
+
+InvokeStatus<uint64_t>
+Fizzy_WasmRuntime::execute(uint32_t fn_index)
+{
+  auto result = execute_raw(fn_index, NULL);
+  if (!result) {
+    return InvokeStatus<uint64_t>{std::unexpect_t{}, result.error()};
+  }
+
+  if (!result->has_value) {
     throw std::runtime_error("invalid return from invoke");
   }
 
-  return result.value.i64;
+  return result->value.i64;
 }
 
 bool 
 Fizzy_WasmRuntime::link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs,
-    WasmValueType ret_type)
+    WasmValueType ret_type,
+    HostFnGasCost const& gas)
 {
   if (nargs > 8) {
     //unimplemented
@@ -470,7 +471,7 @@ Fizzy_WasmRuntime::link_fn_nargs(std::string const& module_name,
     .inputs = std::vector<FizzyValueType>(nargs, FizzyValueTypeI64),
     .output = output,
     .trampoline_ctx = 
-      std::make_unique<FizzyTrampolineHostContext>(fn, host_call_context, &errno_last_call_)
+      std::make_unique<FizzyTrampolineHostContext>(fn, trampoline, gas, host_call_context, &errno_last_call_)
   };
   imported_functions.emplace_back(std::move(import));
 
@@ -484,46 +485,46 @@ get_trampoline_fn(size_t args, FizzyValueType output)
   case FizzyValueTypeVoid:
     switch (args) {
     case 0:
-      return fizzy_trampoline_0args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 0>();
     case 1:
-      return fizzy_trampoline_1args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 1>();
     case 2:
-      return fizzy_trampoline_2args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 2>();
     case 3:
-      return fizzy_trampoline_3args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 3>();
     case 4:
-      return fizzy_trampoline_4args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 4>();
     case 5:
-      return fizzy_trampoline_5args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 5>();
     case 6:
-      return fizzy_trampoline_6args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 6>();
     case 7:
-      return fizzy_trampoline_7args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 7>();
     case 8:
-      return fizzy_trampoline_8args<FizzyValueTypeVoid>;
+      return fizzy_trampoline_nargs<FizzyValueTypeVoid, 8>();
     default:
       std::terminate();
     }
   case FizzyValueTypeI64:
     switch (args) {
     case 0:
-      return fizzy_trampoline_0args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 0>();
     case 1:
-      return fizzy_trampoline_1args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 1>();
     case 2:
-      return fizzy_trampoline_2args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 2>();
     case 3:
-      return fizzy_trampoline_3args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 3>();
     case 4:
-      return fizzy_trampoline_4args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 4>();
     case 5:
-      return fizzy_trampoline_5args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 5>();
     case 6:
-      return fizzy_trampoline_6args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 6>();
     case 7:
-      return fizzy_trampoline_7args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 7>();
     case 8:
-      return fizzy_trampoline_8args<FizzyValueTypeI64>;
+      return fizzy_trampoline_nargs<FizzyValueTypeI64, 8>();
     default:
       std::terminate();
     }
@@ -549,19 +550,7 @@ FizzyLazyFunctionImport::to_imported_function() const
 bool __attribute__((warn_unused_result))
 Fizzy_WasmRuntime::consume_gas(uint64_t gas)
 {
-  int64_t *cur_gas = fizzy_get_execution_context_ticks(exec_ctx);
-
-  if (gas > INT64_MAX) {
-    *cur_gas = 0;
-    return false;
-  }
-
-  if ((*cur_gas) < static_cast<int64_t>(gas)) {
-    *cur_gas = 0;
-    return false;
-  }
-  *cur_gas -= gas;
-  return true;
+  return charge_ticks(fizzy_get_execution_context_ticks(exec_ctx), gas);
 }
 uint64_t
 Fizzy_WasmRuntime::get_available_gas() const
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "wasm_api/wasm_api.h"
+#include "wasm_api/module_cache.h"
 
 #include <memory>
 #include <optional>
@@ -13,6 +14,8 @@ namespace wasm_api {
 
 struct FizzyTrampolineHostContext {
   void *fn_pointer;
+  void *trampoline;
+  HostFnGasCost gas;
   HostCallContext *real_context;
   HostFnError* errno_;
 };
@@ -40,13 +43,36 @@ public:
 
   ~Fizzy_WasmContext();
 
-  std::unique_ptr<WasmRuntime> new_runtime_instance(Script const &contract,
-                                                    void *ctxp, const Hash* /*unused*/);
+  std::shared_ptr<detail::CompiledModuleImpl> compile(Script const &contract,
+                                                      const Hash* script_identifier) override;
+
+  ModuleCacheStats get_module_cache_stats() const override {
+    return module_cache.get_stats();
+  }
+  void set_module_cache_budget(uint64_t budget_bytes) override {
+    module_cache.set_budget(budget_bytes);
+  }
 
 private:
+  // Instances take ownership of their module, so each runtime
+  // gets a clone of the cached (already validated) module.
+  detail::ModuleCache<std::shared_ptr<const FizzyModule>> module_cache;
 };
 
-class Fizzy_WasmRuntime : public detail::WasmRuntimeImpl {
+class Fizzy_CompiledModule : public detail::CompiledModuleImpl {
+public:
+  Fizzy_CompiledModule(std::shared_ptr<const FizzyModule> module)
+    : module(std::move(module)) {}
+
+  std::unique_ptr<detail::WasmRuntimeImpl> instantiate(HostCallContext *host_call_context) override;
+
+private:
+  // Instances take ownership of their module, so each runtime
+  // gets a clone of this one.
+  std::shared_ptr<const FizzyModule> module;
+};
+
+class Fizzy_WasmRuntime final : public detail::WasmRuntimeImpl {
 public:
   Fizzy_WasmRuntime(HostCallContext *host_call_context);
 
@@ -59,21 +85,52 @@ public:
   bool link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs,
-    WasmValueType ret_type) override;
+    WasmValueType ret_type,
+    HostFnGasCost const& gas) override;
 
   InvokeStatus<uint64_t> invoke(std::string const &method_name) override;
+  InvokeStatus<uint64_t> invoke_prepared(uint32_t method_index,
+                                         std::string const &method_name) override;
+  MeteredReturn invoke_metered(uint32_t method_index,
+                               std::string const &method_name,
+                               uint64_t gas_limit) override;
+  MeteredReturn invoke_typed(uint32_t method_index,
+                             detail::ExportedFunction const &method,
+                             uint64_t gas_limit,
+                             std::span<const uint64_t> args,
+                             std::span<uint64_t> results) override;
 
   bool __attribute__((warn_unused_result)) consume_gas(uint64_t gas) override;
   uint64_t get_available_gas() const override;
   void set_available_gas(uint64_t gas) override;
 
-  bool __attribute__((warn_unused_result)) initialize(Script const &data);
+  // Drops the instance, keeping links and prepared methods,
+  // so that the next use instantiates a fresh clone of the module.
+  bool reset() override;
+
+  // takes ownership of module
+  bool __attribute__((warn_unused_result)) initialize(const FizzyModule* module);
 
 private:
   // particular to fizzy -- lazy_link will fail always if it fails once.
   bool __attribute__((warn_unused_result)) lazy_link();
 
+  // maps traps to errors
+  InvokeStatus<FizzyExecutionResult> execute_raw(uint32_t fn_index, const FizzyValue* args);
+  // for a function with no args and an i64 result
+  InvokeStatus<uint64_t> execute(uint32_t fn_index);
+  // invoke_typed(), without the gas save/restore
+  InvokeStatus<void> execute_typed(uint32_t method_index,
+                                   detail::ExportedFunction const &method,
+                                   std::span<const uint64_t> args,
+                                   std::span<uint64_t> results);
+
+  // fizzy function index, by MethodHandle index
+  std::vector<std::optional<uint32_t>> prepared;
+  std::optional<uint32_t> find_prepared(uint32_t method_index, std::string const &method_name);
+
   bool link_tried = false;
   const FizzyModule *m_module;
   FizzyInstance *m_instance;
@@ -0,0 +1,1097 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/gas_instrument.h"
+
+#include "wasm_api/wasm_binary.h"
+#include "wasm_api/wasm_imports.h"
+
+#include <algorithm>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+namespace
+{
+
+constexpr uint8_t OP_BLOCK = 0x02;
+constexpr uint8_t OP_LOOP = 0x03;
+constexpr uint8_t OP_IF = 0x04;
+constexpr uint8_t OP_ELSE = 0x05;
+constexpr uint8_t OP_END = 0x0B;
+constexpr uint8_t OP_BR = 0x0C;
+constexpr uint8_t OP_BR_IF = 0x0D;
+constexpr uint8_t OP_BR_TABLE = 0x0E;
+constexpr uint8_t OP_RETURN = 0x0F;
+constexpr uint8_t OP_CALL = 0x10;
+constexpr uint8_t OP_I64_CONST = 0x42;
+constexpr uint8_t OP_REF_FUNC = 0xD2;
+constexpr uint8_t OP_MISC_PREFIX = 0xFC;
+
+// Sections other than custom sections must appear in this order
+constexpr uint8_t SECTION_ORDER[] = { 1, 2, 3, 4, 5, 13, 6, 7, 8, 9, 12, 10, 11 };
+
+int
+section_rank(uint8_t id)
+{
+    auto it = std::ranges::find(SECTION_ORDER, id);
+    if (it == std::end(SECTION_ORDER)) {
+        return -1;
+    }
+    return static_cast<int>(it - std::begin(SECTION_ORDER));
+}
+
+struct Instrumentation
+{
+    uint64_t instruction_cost;
+    bool static_bounds;
+    // function imports of the original module
+    uint32_t num_func_imports;
+    // index of the gas import, which is the last function import
+    uint32_t gas_fn;
+
+    uint32_t remap(uint32_t fn_index) const
+    {
+        return (fn_index < num_func_imports) ? fn_index : fn_index + 1;
+    }
+};
+
+struct Instruction
+{
+    const uint8_t* begin;
+    const uint8_t* end;
+    uint8_t opcode;
+    // call and ref.func
+    uint32_t func_index;
+    // br, br_if, and br_table: the instruction's
+    // labels are labels[label_begin, label_begin + label_count)
+    uint32_t label_begin;
+    uint32_t label_count;
+};
+
+bool
+block_type(Reader& r)
+{
+    auto t = r.peek();
+    if (!t) {
+        return false;
+    }
+    switch (*t) {
+    case 0x40: // empty
+    case 0x7F: case 0x7E: case 0x7D: case 0x7C: case 0x7B: case 0x70: case 0x6F:
+        r.byte();
+        return true;
+    default:
+        // type index, as a signed 33 bit LEB128
+        return r.skip_leb(5);
+    }
+}
+
+bool
+read_instruction(Reader& r, Instruction& out, std::vector<uint32_t>& labels)
+{
+    out.begin = r.position();
+    out.label_count = 0;
+
+    auto op = r.byte();
+    if (!op) {
+        return false;
+    }
+    out.opcode = *op;
+
+    auto read_label = [&] () {
+        auto label = r.u32();
+        if (label) {
+            labels.push_back(*label);
+            out.label_count++;
+        }
+        return label.has_value();
+    };
+
+    bool ok = true;
+    switch (*op) {
+    case 0x00: // unreachable
+    case 0x01: // nop
+    case OP_ELSE:
+    case OP_END:
+    case OP_RETURN:
+    case 0x1A: // drop
+    case 0x1B: // select
+    case 0xD1: // ref.is_null
+        break;
+    case OP_BLOCK:
+    case OP_LOOP:
+    case OP_IF:
+        ok = block_type(r);
+        break;
+    case OP_BR:
+    case OP_BR_IF:
+        out.label_begin = labels.size();
+        ok = read_label();
+        break;
+    case OP_BR_TABLE:
+    {
+        out.label_begin = labels.size();
+        auto count = r.u32();
+        if (!count) {
+            return false;
+        }
+        // and then the default label
+        for (uint64_t i = 0; ok && i <= *count; i++) {
+            ok = read_label();
+        }
+        break;
+    }
+    case OP_CALL:
+    case OP_REF_FUNC:
+    {
+        auto index = r.u32();
+        ok = index.has_value();
+        out.func_index = index.value_or(0);
+        break;
+    }
+    case 0x11: // call_indirect
+        ok = r.u32() && r.u32();
+        break;
+    case 0x1C: // select t*
+    {
+        auto count = r.u32();
+        ok = count && r.skip(*count);
+        break;
+    }
+    case 0x20: case 0x21: case 0x22: // local.get, local.set, local.tee
+    case 0x23: case 0x24: // global.get, global.set
+    case 0x25: case 0x26: // table.get, table.set
+    case 0x3F: case 0x40: // memory.size, memory.grow
+        ok = r.u32().has_value();
+        break;
+    case 0x41: // i32.const
+        ok = r.skip_leb(5);
+        break;
+    case OP_I64_CONST:
+        ok = r.skip_leb(10);
+        break;
+    case 0x43: // f32.const
+        ok = r.skip(4);
+        break;
+    case 0x44: // f64.const
+        ok = r.skip(8);
+        break;
+    case 0xD0: // ref.null
+        ok = r.byte().has_value();
+        break;
+    case OP_MISC_PREFIX:
+    {
+        auto sub = r.u32();
+        if (!sub) {
+            return false;
+        }
+        switch (*sub) {
+        case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
+            // saturating truncations
+            break;
+        case 9: // data.drop
+        case 11: // memory.fill
+        case 13: // elem.drop
+        case 15: case 16: case 17: // table.grow, table.size, table.fill
+            ok = r.u32().has_value();
+            break;
+        case 8: // memory.init
+        case 10: // memory.copy
+        case 12: // table.init
+        case 14: // table.copy
+            ok = r.u32() && r.u32();
+            break;
+        default:
+            return false;
+        }
+        break;
+    }
+    default:
+        if (*op >= 0x28 && *op <= 0x3E) {
+            // loads and stores
+            ok = r.u32() && r.u32();
+        } else if (*op < 0x45 || *op > 0xC4) {
+            // not a numeric instruction
+            return false;
+        }
+    }
+
+    out.end = r.position();
+    return ok;
+}
+
+void
+write_instruction(std::vector<uint8_t>& out, Instruction const& ins, Instrumentation const& ctx)
+{
+    if (ins.opcode == OP_CALL || ins.opcode == OP_REF_FUNC) {
+        out.push_back(ins.opcode);
+        write_u32(out, ctx.remap(ins.func_index));
+        return;
+    }
+    out.insert(out.end(), ins.begin, ins.end);
+}
+
+// Constant expressions have no blocks, so end at the first end
+bool
+rewrite_const_expr(Reader& r, std::vector<uint8_t>& out, Instrumentation const& ctx)
+{
+    std::vector<uint32_t> labels;
+    Instruction ins;
+    do {
+        if (!read_instruction(r, ins, labels)) {
+            return false;
+        }
+        write_instruction(out, ins, ctx);
+    } while (ins.opcode != OP_END);
+    return true;
+}
+
+struct MeteredBlock
+{
+    // index of the instruction before which gas is charged
+    size_t start;
+    uint64_t cost;
+};
+
+/**
+ * Splits a function into metered blocks, as it is scanned
+ * (see wasm-instrument's gas_metering::Counter).
+ *
+ * Every control block (block, loop, if, and the function itself)
+ * has an active metered block, which ends at each branch,
+ * else, or end, and everything that could be branched to
+ * starts a new one.  A `block`'s metered block starts
+ * at the same place as its parent's, and they are merged
+ * when it ends, unless something in the block might
+ * have branched out of it (and so past the rest of the parent's).
+ */
+class MeteredBlockCounter
+{
+    struct ControlBlock
+    {
+        // lowest (stack) index of a block that something
+        // in this block might branch to the end of
+        size_t lowest_forward_br_target;
+        MeteredBlock active;
+        bool is_loop;
+    };
+
+public:
+    bool empty() const { return stack.empty(); }
+
+    size_t depth() const { return stack.size(); }
+
+    size_t active_start() const { return stack.back().active.start; }
+
+    bool increment(uint64_t cost)
+    {
+        auto& active = stack.back().active;
+        if (cost > UINT64_MAX - active.cost) {
+            return false;
+        }
+        active.cost += cost;
+        return true;
+    }
+
+    void begin_control_block(size_t start, bool is_loop)
+    {
+        stack.push_back(ControlBlock {
+            .lowest_forward_br_target = stack.size(),
+            .active = MeteredBlock { .start = start, .cost = 0 },
+            .is_loop = is_loop
+        });
+    }
+
+    bool finalize_metered_block(size_t cursor)
+    {
+        if (stack.empty()) {
+            return false;
+        }
+        MeteredBlock closing = std::exchange(stack.back().active,
+            MeteredBlock { .start = cursor + 1, .cost = 0 });
+
+        if (stack.size() > 1) {
+            auto& parent = stack[stack.size() - 2].active;
+            if (closing.start == parent.start) {
+                if (closing.cost > UINT64_MAX - parent.cost) {
+                    return false;
+                }
+                parent.cost += closing.cost;
+                return true;
+            }
+        }
+
+        if (closing.cost > 0) {
+            finalized.push_back(closing);
+        }
+        return true;
+    }
+
+    bool finalize_control_block(size_t cursor)
+    {
+        if (!finalize_metered_block(cursor)) {
+            return false;
+        }
+        ControlBlock closing = stack.back();
+        stack.pop_back();
+
+        if (stack.empty()) {
+            return true;
+        }
+
+        auto& parent = stack.back();
+        parent.lowest_forward_br_target = std::min(parent.lowest_forward_br_target,
+                                                   closing.lowest_forward_br_target);
+
+        // Might have branched past the rest of parent's metered block
+        if (closing.lowest_forward_br_target < stack.size()) {
+            return finalize_metered_block(cursor);
+        }
+        return true;
+    }
+
+    bool branch(size_t cursor, std::span<const uint32_t> labels)
+    {
+        if (!finalize_metered_block(cursor)) {
+            return false;
+        }
+        for (uint32_t label : labels) {
+            if (label >= stack.size()) {
+                return false;
+            }
+            size_t target = stack.size() - 1 - label;
+            // branching to a loop goes to its start, which is metered anyways
+            if (stack[target].is_loop) {
+                continue;
+            }
+            stack.back().lowest_forward_br_target = std::min(stack.back().lowest_forward_br_target, target);
+        }
+        return true;
+    }
+
+    std::vector<MeteredBlock> finish()
+    {
+        std::ranges::stable_sort(finalized, {}, &MeteredBlock::start);
+        return std::move(finalized);
+    }
+
+private:
+    std::vector<ControlBlock> stack;
+    std::vector<MeteredBlock> finalized;
+};
+
+std::optional<std::vector<MeteredBlock>>
+metered_blocks(std::span<const Instruction> code,
+               std::span<const uint32_t> labels,
+               uint64_t instruction_cost)
+{
+    MeteredBlockCounter counter;
+    counter.begin_control_block(0, false);
+
+    for (size_t cursor = 0; cursor < code.size(); cursor++) {
+        // anything after the function's end
+        if (counter.empty()) {
+            return std::nullopt;
+        }
+
+        auto const& ins = code[cursor];
+        bool ok = true;
+        switch (ins.opcode) {
+        case OP_BLOCK:
+            ok = counter.increment(instruction_cost);
+            // not a branch target, so metered with its parent
+            counter.begin_control_block(counter.active_start(), false);
+            break;
+        case OP_IF:
+            ok = counter.increment(instruction_cost);
+            counter.begin_control_block(cursor + 1, false);
+            break;
+        case OP_LOOP:
+            ok = counter.increment(instruction_cost);
+            counter.begin_control_block(cursor + 1, true);
+            break;
+        case OP_END:
+            ok = counter.finalize_control_block(cursor);
+            break;
+        case OP_ELSE:
+            ok = counter.finalize_metered_block(cursor);
+            break;
+        case OP_BR:
+        case OP_BR_IF:
+        case OP_BR_TABLE:
+            ok = counter.increment(instruction_cost)
+                && counter.branch(cursor, labels.subspan(ins.label_begin, ins.label_count));
+            break;
+        case OP_RETURN:
+        {
+            // to the end of the function
+            const uint32_t label = counter.depth() - 1;
+            ok = counter.increment(instruction_cost)
+                && counter.branch(cursor, std::span(&label, 1));
+            break;
+        }
+        default:
+            ok = counter.increment(instruction_cost);
+        }
+        if (!ok) {
+            return std::nullopt;
+        }
+    }
+
+    if (!counter.empty()) {
+        return std::nullopt;
+    }
+    return counter.finish();
+}
+
+/**
+ * Worst-case cost of a function without loops, found by carrying
+ * the most expensive cost of reaching each point through the
+ * (structured) control flow.  std::nullopt if the function has a loop,
+ * is malformed, or if the bound overflows.
+ */
+std::optional<uint64_t>
+static_bound(std::span<const Instruction> code,
+             std::span<const uint32_t> labels,
+             uint64_t instruction_cost)
+{
+    // nullopt: unreachable
+    using cost_t = std::optional<uint64_t>;
+
+    struct Frame
+    {
+        // most expensive way to reach the end of the frame by a branch
+        // (or, for an if without an else, by its condition being false)
+        cost_t exit;
+        // cost on entering an if's branches
+        cost_t entry;
+        bool is_if;
+        bool has_else;
+    };
+
+    auto join = [] (cost_t& into, cost_t const& other) {
+        if (other && (!into || *other > *into)) {
+            into = other;
+        }
+    };
+
+    // the function itself
+    std::vector<Frame> frames { Frame { .exit = std::nullopt, .entry = std::nullopt, .is_if = false, .has_else = false } };
+    cost_t cur = 0;
+
+    for (auto const& ins : code) {
+        if (frames.empty()) {
+            return std::nullopt;
+        }
+
+        if (ins.opcode != OP_ELSE && ins.opcode != OP_END && cur) {
+            if (instruction_cost > UINT64_MAX - *cur) {
+                return std::nullopt;
+            }
+            *cur += instruction_cost;
+        }
+
+        switch (ins.opcode) {
+        case OP_LOOP:
+            return std::nullopt;
+        case OP_BLOCK:
+            frames.push_back(Frame { .exit = std::nullopt, .entry = std::nullopt, .is_if = false, .has_else = false });
+            break;
+        case OP_IF:
+            frames.push_back(Frame { .exit = std::nullopt, .entry = cur, .is_if = true, .has_else = false });
+            break;
+        case OP_ELSE:
+        {
+            auto& frame = frames.back();
+            if (!frame.is_if || frame.has_else) {
+                return std::nullopt;
+            }
+            join(frame.exit, cur);
+            cur = frame.entry;
+            frame.has_else = true;
+            break;
+        }
+        case OP_END:
+        {
+            Frame frame = frames.back();
+            frames.pop_back();
+            if (frame.is_if && !frame.has_else) {
+                join(frame.exit, frame.entry);
+            }
+            join(frame.exit, cur);
+            cur = frame.exit;
+            break;
+        }
+        case OP_BR:
+        case OP_BR_IF:
+        case OP_BR_TABLE:
+            for (uint32_t label : labels.subspan(ins.label_begin, ins.label_count)) {
+                if (label >= frames.size()) {
+                    return std::nullopt;
+                }
+                join(frames[frames.size() - 1 - label].exit, cur);
+            }
+            if (ins.opcode != OP_BR_IF) {
+                cur = std::nullopt;
+            }
+            break;
+        case OP_RETURN:
+            join(frames.front().exit, cur);
+            cur = std::nullopt;
+            break;
+        case 0x00: // unreachable
+            cur = std::nullopt;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!frames.empty()) {
+        return std::nullopt;
+    }
+    // nullopt if the function always traps
+    return cur.value_or(0);
+}
+
+void
+charge_gas(std::vector<uint8_t>& out, uint64_t cost, Instrumentation const& ctx)
+{
+    out.push_back(OP_I64_CONST);
+    write_s64(out, static_cast<int64_t>(cost));
+    out.push_back(OP_CALL);
+    write_u32(out, ctx.gas_fn);
+}
+
+// One entry of the code section
+struct FunctionBody
+{
+    // local declarations
+    const uint8_t* locals_begin;
+    const uint8_t* locals_end;
+    std::vector<Instruction> code;
+    std::vector<uint32_t> labels;
+};
+
+bool
+read_function_body(Reader& r, FunctionBody& out)
+{
+    auto size = r.u32();
+    const uint8_t* begin = r.position();
+    if (!size || !r.skip(*size)) {
+        return false;
+    }
+    Reader fr(begin, *size);
+
+    auto local_groups = fr.u32();
+    if (!local_groups) {
+        return false;
+    }
+    for (uint32_t j = 0; j < *local_groups; j++) {
+        if (!fr.u32() || !fr.byte()) {
+            return false;
+        }
+    }
+    out.locals_begin = begin;
+    out.locals_end = fr.position();
+
+    out.code.clear();
+    out.labels.clear();
+    while (!fr.done()) {
+        Instruction ins;
+        if (!read_instruction(fr, ins, out.labels)) {
+            return false;
+        }
+        out.code.push_back(ins);
+    }
+    return true;
+}
+
+std::optional<std::vector<uint8_t>>
+rewrite_code(std::span<const uint8_t> payload, Instrumentation const& ctx)
+{
+    Reader r(payload.data(), payload.size());
+    auto count = r.u32();
+    if (!count) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> out;
+    write_u32(out, *count);
+
+    FunctionBody fn;
+    std::vector<uint8_t> body;
+
+    for (uint32_t i = 0; i < *count; i++) {
+        if (!read_function_body(r, fn)) {
+            return std::nullopt;
+        }
+        body.assign(fn.locals_begin, fn.locals_end);
+
+        std::optional<uint64_t> bound;
+        if (ctx.static_bounds) {
+            bound = static_bound(fn.code, fn.labels, ctx.instruction_cost);
+        }
+
+        if (bound) {
+            // and then the function runs unmetered
+            if (*bound > 0) {
+                charge_gas(body, *bound, ctx);
+            }
+            for (auto const& ins : fn.code) {
+                write_instruction(body, ins, ctx);
+            }
+        } else {
+            auto blocks = metered_blocks(fn.code, fn.labels, ctx.instruction_cost);
+            if (!blocks) {
+                return std::nullopt;
+            }
+
+            auto next = blocks->begin();
+            for (size_t j = 0; j < fn.code.size(); j++) {
+                for (; next != blocks->end() && next->start == j; ++next) {
+                    charge_gas(body, next->cost, ctx);
+                }
+                write_instruction(body, fn.code[j], ctx);
+            }
+        }
+
+        if (body.size() > UINT32_MAX) {
+            return std::nullopt;
+        }
+        write_u32(out, static_cast<uint32_t>(body.size()));
+        out.insert(out.end(), body.begin(), body.end());
+    }
+
+    if (!r.done()) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+// Adds the gas import's type, (param i64), at index gas_type.
+// payload is nullptr if there is no type section.
+std::optional<std::vector<uint8_t>>
+rewrite_types(std::span<const uint8_t> payload, uint32_t& gas_type)
+{
+    uint32_t count = 0;
+    const uint8_t* rest = payload.data();
+    if (!payload.empty()) {
+        Reader r(payload.data(), payload.size());
+        auto c = r.u32();
+        if (!c || *c == UINT32_MAX) {
+            return std::nullopt;
+        }
+        count = *c;
+        rest = r.position();
+    }
+
+    gas_type = count;
+
+    std::vector<uint8_t> out;
+    write_u32(out, count + 1);
+    out.insert(out.end(), rest, payload.data() + payload.size());
+    out.insert(out.end(), { FUNC_TYPE_FORM, 1, VALUE_TYPE_I64, 0 });
+    return out;
+}
+
+// Adds the gas import, after every other import
+std::optional<std::vector<uint8_t>>
+rewrite_imports(std::span<const uint8_t> payload, uint32_t gas_type)
+{
+    uint32_t count = 0;
+    const uint8_t* rest = payload.data();
+    if (!payload.empty()) {
+        Reader r(payload.data(), payload.size());
+        auto c = r.u32();
+        if (!c || *c == UINT32_MAX) {
+            return std::nullopt;
+        }
+        count = *c;
+        rest = r.position();
+    }
+
+    std::vector<uint8_t> out;
+    write_u32(out, count + 1);
+    out.insert(out.end(), rest, payload.data() + payload.size());
+    write_name(out, GAS_INTRINSIC_MODULE);
+    write_name(out, GAS_INTRINSIC_FN);
+    out.push_back(IMPORT_KIND_FUNC);
+    write_u32(out, gas_type);
+    return out;
+}
+
+std::optional<std::vector<uint8_t>>
+rewrite_exports(std::span<const uint8_t> payload, Instrumentation const& ctx)
+{
+    Reader r(payload.data(), payload.size());
+    auto count = r.u32();
+    if (!count) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> out;
+    write_u32(out, *count);
+    for (uint32_t i = 0; i < *count; i++) {
+        auto name = r.name();
+        auto kind = r.byte();
+        auto index = r.u32();
+        if (!name || !kind || !index) {
+            return std::nullopt;
+        }
+        write_name(out, *name);
+        out.push_back(*kind);
+        write_u32(out, (*kind == EXPORT_KIND_FUNC) ? ctx.remap(*index) : *index);
+    }
+    if (!r.done()) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+std::optional<std::vector<uint8_t>>
+rewrite_start(std::span<const uint8_t> payload, Instrumentation const& ctx)
+{
+    Reader r(payload.data(), payload.size());
+    auto index = r.u32();
+    if (!index || !r.done()) {
+        return std::nullopt;
+    }
+    std::vector<uint8_t> out;
+    write_u32(out, ctx.remap(*index));
+    return out;
+}
+
+std::optional<std::vector<uint8_t>>
+rewrite_globals(std::span<const uint8_t> payload, Instrumentation const& ctx)
+{
+    Reader r(payload.data(), payload.size());
+    auto count = r.u32();
+    if (!count) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> out;
+    write_u32(out, *count);
+    for (uint32_t i = 0; i < *count; i++) {
+        auto type = r.byte();
+        auto mut = r.byte();
+        if (!type || !mut) {
+            return std::nullopt;
+        }
+        out.push_back(*type);
+        out.push_back(*mut);
+        if (!rewrite_const_expr(r, out, ctx)) {
+            return std::nullopt;
+        }
+    }
+    if (!r.done()) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+std::optional<std::vector<uint8_t>>
+rewrite_elements(std::span<const uint8_t> payload, Instrumentation const& ctx)
+{
+    Reader r(payload.data(), payload.size());
+    auto count = r.u32();
+    if (!count) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> out;
+    write_u32(out, *count);
+    for (uint32_t i = 0; i < *count; i++) {
+        // bit 0: passive or declarative, bit 1: explicit table index
+        // (or declarative), bit 2: elements are expressions
+        auto flags = r.u32();
+        if (!flags || *flags > 7) {
+            return std::nullopt;
+        }
+        write_u32(out, *flags);
+
+        if ((*flags & 1) == 0) {
+            if (*flags & 2) {
+                auto table = r.u32();
+                if (!table) {
+                    return std::nullopt;
+                }
+                write_u32(out, *table);
+            }
+            // offset
+            if (!rewrite_const_expr(r, out, ctx)) {
+                return std::nullopt;
+            }
+        }
+        if (*flags & 3) {
+            // element kind, or reference type
+            auto kind = r.byte();
+            if (!kind) {
+                return std::nullopt;
+            }
+            out.push_back(*kind);
+        }
+
+        auto n = r.u32();
+        if (!n) {
+            return std::nullopt;
+        }
+        write_u32(out, *n);
+        for (uint32_t j = 0; j < *n; j++) {
+            if (*flags & 4) {
+                if (!rewrite_const_expr(r, out, ctx)) {
+                    return std::nullopt;
+                }
+            } else {
+                auto index = r.u32();
+                if (!index) {
+                    return std::nullopt;
+                }
+                write_u32(out, ctx.remap(*index));
+            }
+        }
+    }
+    if (!r.done()) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+struct Section
+{
+    uint8_t id;
+    std::vector<uint8_t> payload;
+};
+
+// Before the first section that must come after id
+void
+insert_section(std::vector<Section>& sections, uint8_t id, std::vector<uint8_t> payload)
+{
+    auto it = std::ranges::find_if(sections, [&] (Section const& s) {
+        return s.id != CUSTOM_SECTION_ID && section_rank(s.id) > section_rank(id);
+    });
+    sections.insert(it, Section { .id = id, .payload = std::move(payload) });
+}
+
+} // namespace
+
+std::optional<std::vector<uint8_t>>
+instrument_gas(Script const& script, GasInstrumentationConfig const& config)
+{
+    auto imports = parse_function_imports(script);
+    if (!imports) {
+        return std::nullopt;
+    }
+
+    if (std::ranges::any_of(*imports, [] (FunctionImport const& import) {
+            return import.first == GAS_INTRINSIC_MODULE && import.second == GAS_INTRINSIC_FN;
+        }))
+    {
+        return std::vector<uint8_t>(script.data, script.data + script.len);
+    }
+
+    const uint32_t num_func_imports = imports->size();
+    const Instrumentation ctx {
+        .instruction_cost = config.instruction_cost,
+        .static_bounds = config.static_bounds,
+        .num_func_imports = num_func_imports,
+        .gas_fn = num_func_imports
+    };
+
+    Reader r(script.data, script.len);
+    if (!r.skip(WASM_HEADER_LEN)) {
+        return std::nullopt;
+    }
+
+    std::vector<std::pair<uint8_t, std::span<const uint8_t>>> in;
+    while (!r.done()) {
+        auto id = r.byte();
+        auto size = r.u32();
+        const uint8_t* begin = r.position();
+        if (!id || !size || !r.skip(*size)) {
+            return std::nullopt;
+        }
+        if (*id != CUSTOM_SECTION_ID && section_rank(*id) < 0) {
+            return std::nullopt;
+        }
+        in.emplace_back(*id, std::span<const uint8_t>(begin, *size));
+    }
+
+    auto find_section = [&] (uint8_t id) {
+        auto it = std::ranges::find(in, id, &std::pair<uint8_t, std::span<const uint8_t>>::first);
+        return (it == in.end()) ? std::span<const uint8_t>() : it->second;
+    };
+
+    uint32_t gas_type = 0;
+    auto types = rewrite_types(find_section(TYPE_SECTION_ID), gas_type);
+    if (!types) {
+        return std::nullopt;
+    }
+    auto import_section = rewrite_imports(find_section(IMPORT_SECTION_ID), gas_type);
+    if (!import_section) {
+        return std::nullopt;
+    }
+
+    bool has_types = false;
+    bool has_imports = false;
+
+    std::vector<Section> sections;
+    for (auto const& [id, payload] : in) {
+        std::optional<std::vector<uint8_t>> rewritten;
+        switch (id) {
+        case CUSTOM_SECTION_ID:
+        {
+            // function indices in the name section are stale
+            Reader name_reader(payload.data(), payload.size());
+            auto name = name_reader.name();
+            if (name && *name == "name") {
+                continue;
+            }
+            rewritten.emplace(payload.begin(), payload.end());
+            break;
+        }
+        case TYPE_SECTION_ID:
+            has_types = true;
+            rewritten = std::move(types);
+            break;
+        case IMPORT_SECTION_ID:
+            has_imports = true;
+            rewritten = std::move(import_section);
+            break;
+        case GLOBAL_SECTION_ID:
+            rewritten = rewrite_globals(payload, ctx);
+            break;
+        case EXPORT_SECTION_ID:
+            rewritten = rewrite_exports(payload, ctx);
+            break;
+        case START_SECTION_ID:
+            rewritten = rewrite_start(payload, ctx);
+            break;
+        case ELEMENT_SECTION_ID:
+            rewritten = rewrite_elements(payload, ctx);
+            break;
+        case CODE_SECTION_ID:
+            rewritten = rewrite_code(payload, ctx);
+            break;
+        default:
+            rewritten.emplace(payload.begin(), payload.end());
+        }
+        if (!rewritten) {
+            return std::nullopt;
+        }
+        sections.push_back(Section { .id = id, .payload = std::move(*rewritten) });
+    }
+
+    if (!has_types) {
+        insert_section(sections, TYPE_SECTION_ID, std::move(*types));
+    }
+    if (!has_imports) {
+        insert_section(sections, IMPORT_SECTION_ID, std::move(*import_section));
+    }
+
+    std::vector<uint8_t> out(script.data, script.data + WASM_HEADER_LEN);
+    for (auto const& section : sections) {
+        if (section.payload.size() > UINT32_MAX) {
+            return std::nullopt;
+        }
+        out.push_back(section.id);
+        write_u32(out, static_cast<uint32_t>(section.payload.size()));
+        out.insert(out.end(), section.payload.begin(), section.payload.end());
+    }
+    return out;
+}
+
+std::optional<std::vector<std::optional<uint64_t>>>
+static_gas_bounds(Script const& script, uint64_t instruction_cost)
+{
+    if (script.data == nullptr) {
+        return std::nullopt;
+    }
+
+    Reader r(script.data, script.len);
+    if (!r.skip(WASM_HEADER_LEN)) {
+        return std::nullopt;
+    }
+
+    std::vector<std::optional<uint64_t>> out;
+    while (!r.done()) {
+        auto id = r.byte();
+        auto size = r.u32();
+        const uint8_t* begin = r.position();
+        if (!id || !size || !r.skip(*size)) {
+            return std::nullopt;
+        }
+        if (*id != CODE_SECTION_ID) {
+            continue;
+        }
+
+        Reader code_reader(begin, *size);
+        auto count = code_reader.u32();
+        if (!count) {
+            return std::nullopt;
+        }
+        FunctionBody fn;
+        for (uint32_t i = 0; i < *count; i++) {
+            if (!read_function_body(code_reader, fn)) {
+                return std::nullopt;
+            }
+            out.push_back(static_bound(fn.code, fn.labels, instruction_cost));
+        }
+        if (!code_reader.done()) {
+            return std::nullopt;
+        }
+    }
+    return out;
+}
+
+SharedScript
+GasInstrumenter::instrument(Script const& script, const Hash* script_identifier)
+{
+    if (script.data == nullptr) {
+        return SharedScript{};
+    }
+
+    auto run = [&] () -> std::optional<std::pair<SharedScript, uint64_t>> {
+        auto bytes = instrument_gas(script, config);
+        if (!bytes || bytes->size() > UINT32_MAX) {
+            return std::nullopt;
+        }
+        auto shared = std::make_shared<const std::vector<uint8_t>>(std::move(*bytes));
+        SharedScript out {
+            .data = std::shared_ptr<const uint8_t>(shared, shared->data()),
+            .len = static_cast<uint32_t>(shared->size())
+        };
+        return std::make_pair(out, out.len);
+    };
+
+    auto res = (script_identifier != nullptr)
+        ? cache.get_or_insert(*script_identifier, run)
+        : run().transform([] (auto const& p) { return p.first; });
+
+    return res.value_or(SharedScript{});
+}
+
+} // namespace detail
+
+} // namespace wasm_api
@@ -0,0 +1,90 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+#include "wasm_api/module_cache.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+/**
+ * Rewrites a wasm binary so that it charges its own gas,
+ * through the GAS_INTRINSIC_MODULE/GAS_INTRINSIC_FN import
+ * (which is added, as the last function import).
+ *
+ * Each function is split into metered blocks -- straight-line
+ * runs of code that end at a branch, or at the start of a branch target --
+ * and each charges instruction_cost per instruction in the block,
+ * with one call to the gas import at the start of the block.
+ * A nested `block` that cannot be branched out of early is charged
+ * as part of the enclosing metered block, rather than separately.
+ * Same algorithm as wasm-instrument's gas_metering.
+ *
+ * With config.static_bounds, a function without loops is
+ * instead charged its bound (see static_gas_bounds()) once, on entry.
+ *
+ * A script that already imports the gas import is assumed
+ * to be instrumented, and is returned unchanged.  The "name"
+ * section is dropped, as function indices change.
+ *
+ * Returns std::nullopt if the binary is malformed, or uses
+ * instructions (i.e. SIMD) that this does not know how to meter.
+ */
+std::optional<std::vector<uint8_t>>
+instrument_gas(Script const& script, GasInstrumentationConfig const& config);
+
+/**
+ * The worst-case cost (at instruction_cost per instruction) of
+ * each function defined in script (i.e. not imports), in order:
+ * the cost of the most expensive path through the function,
+ * not counting the functions it calls.  std::nullopt for
+ * functions with loops, which have no static bound.
+ *
+ * std::nullopt if the binary is malformed, as above.
+ */
+std::optional<std::vector<std::optional<uint64_t>>>
+static_gas_bounds(Script const& script, uint64_t instruction_cost);
+
+/**
+ * instrument_gas(), cached by script identifier.  Threadsafe.
+ */
+class GasInstrumenter
+{
+public:
+    explicit GasInstrumenter(GasInstrumentationConfig const& config)
+        : config(config)
+    {}
+
+    // data is nullptr if script cannot be instrumented
+    SharedScript instrument(Script const& script, const Hash* script_identifier);
+
+private:
+    const GasInstrumentationConfig config;
+    ModuleCache<SharedScript> cache;
+};
+
+} // namespace detail
+
+} // namespace wasm_api
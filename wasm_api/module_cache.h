@@ -0,0 +1,346 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+// Script identifiers are (cryptographic) hashes of the contract,
+// so any 8 bytes make a fine bucket index.
+struct ScriptHashHasher
+{
+    std::size_t operator()(Hash const& h) const
+    {
+        std::size_t out;
+        std::memcpy(&out, h.data(), sizeof(out));
+        return out;
+    }
+};
+
+// Default size of each engine's module cache.
+// Matches DEFAULT_MODULE_CACHE_BYTES in wasmi_lib.
+constexpr static uint64_t DEFAULT_MODULE_CACHE_BYTES = 256 * 1024 * 1024;
+
+/**
+ * Threadsafe cache from a script identifier to some engine-specific
+ * parsed (and validated) module, bounded by (approximate) size in bytes.
+ *
+ * Eviction is by greedy-dual-size-frequency: each entry has priority
+ * clock + hits * cost / size, where cost is the time it took to
+ * produce the module.  The lowest priority entry is evicted first,
+ * and the clock advances to its priority, so unused entries age out.
+ * Same as ModuleCache in wasmi_lib/src/module_cache.rs.
+ *
+ * Hits only bump an atomic counter, under a shared lock.  Priorities
+ * are brought up to date lazily, when an entry that has been hit
+ * reaches the front of the eviction order (so a hit is credited
+ * at the clock of that eviction check, not of the hit itself).
+ *
+ * V should be cheap to copy (i.e. a shared_ptr), as get() returns a copy
+ * so that the value can outlive its eviction from the cache.
+ *
+ * get_or_insert() runs at most one compilation per key at a time;
+ * other threads that miss on the same key wait for its result.
+ */
+template<typename V>
+class ModuleCache
+{
+    // (priority, insertion sequence number)
+    using order_key_t = std::pair<double, uint64_t>;
+
+    struct Entry
+    {
+        Entry(V const& value, uint64_t size, uint64_t cost, order_key_t order_key)
+            : value(value)
+            , size(size)
+            , cost(cost)
+            , freq(1)
+            , ordered_freq(1)
+            , order_key(order_key)
+        {}
+
+        V value;
+        uint64_t size;
+        uint64_t cost;
+        // incremented on hits, under only a shared lock
+        std::atomic<uint64_t> freq;
+        // value of freq when order_key was computed
+        uint64_t ordered_freq;
+        order_key_t order_key;
+    };
+
+public:
+    ModuleCache(uint64_t budget_bytes = DEFAULT_MODULE_CACHE_BYTES)
+        : budget_bytes(budget_bytes)
+    {}
+
+    std::optional<V> get(Hash const& key)
+    {
+        std::shared_lock lock(mtx);
+        auto out = get_locked(key);
+        if (out) {
+            hits++;
+        } else {
+            misses++;
+        }
+        return out;
+    }
+
+    /**
+     * Look up key, or if not present, call compile() and cache its result.
+     * compile() returns the value and its size in bytes, or std::nullopt
+     * on failure (which is not cached, but is returned to every thread
+     * waiting on this compilation).
+     */
+    template<typename F>
+    std::optional<V> get_or_insert(Hash const& key, F&& compile)
+    {
+        {
+            std::shared_lock lock(mtx);
+            if (auto out = get_locked(key)) {
+                hits++;
+                return out;
+            }
+        }
+
+        std::promise<std::optional<V>> promise;
+        std::shared_future<std::optional<V>> wait_on;
+        {
+            std::lock_guard lock(mtx);
+            if (auto out = get_locked(key)) {
+                hits++;
+                return out;
+            }
+            auto it = in_flight.find(key);
+            if (it != in_flight.end()) {
+                hits++;
+                wait_on = it->second;
+            } else {
+                misses++;
+                in_flight.emplace(key, promise.get_future().share());
+            }
+        }
+
+        if (wait_on.valid()) {
+            return wait_on.get();
+        }
+
+        std::optional<V> result;
+        try {
+            auto start = std::chrono::steady_clock::now();
+            std::optional<std::pair<V, uint64_t>> compiled = compile();
+            if (compiled) {
+                result = compiled->first;
+                put(key, compiled->first, compiled->second,
+                    std::chrono::steady_clock::now() - start);
+            }
+        } catch (...) {
+            finish_in_flight(key, promise, std::nullopt);
+            throw;
+        }
+        finish_in_flight(key, promise, result);
+        return result;
+    }
+
+    // size: bytes of memory held by the value
+    // cost: time it took to produce the value
+    void put(Hash const& key,
+             V const& value,
+             uint64_t size,
+             std::chrono::steady_clock::duration cost)
+    {
+        uint64_t cost_micros = std::chrono::duration_cast<std::chrono::microseconds>(cost).count();
+        size = std::max<uint64_t>(size, 1);
+        cost_micros = std::max<uint64_t>(cost_micros, 1);
+
+        std::lock_guard lock(mtx);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            order.erase(it->second.order_key);
+            bytes -= it->second.size;
+            entries.erase(it);
+        }
+
+        if (size > budget_bytes) {
+            return;
+        }
+
+        auto order_key = next_order_key(1, cost_micros, size);
+        order.emplace(order_key, key);
+        entries.try_emplace(key, value, size, cost_micros, order_key);
+        bytes += size;
+
+        evict_to_budget();
+    }
+
+    // Whether key's entry holds value (without counting as a hit)
+    bool contains(Hash const& key, V const& value) const
+    {
+        std::shared_lock lock(mtx);
+        auto it = entries.find(key);
+        return it != entries.end() && it->second.value == value;
+    }
+
+    /**
+     * Update the size of key's entry, if it (still) holds value,
+     * for values that grow after they are cached.  Returns false
+     * if the entry is not (or, after evicting to the budget,
+     * no longer) in the cache.
+     */
+    bool resize(Hash const& key, V const& value, uint64_t size)
+    {
+        size = std::max<uint64_t>(size, 1);
+
+        std::lock_guard lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end() || !(it->second.value == value)) {
+            return false;
+        }
+
+        Entry& e = it->second;
+        bytes = bytes - e.size + size;
+        e.size = size;
+        order.erase(e.order_key);
+        e.ordered_freq = e.freq.load(std::memory_order_relaxed);
+        e.order_key = next_order_key(e.ordered_freq, e.cost, e.size);
+        order.emplace(e.order_key, key);
+
+        evict_to_budget();
+        return entries.contains(key);
+    }
+
+    void set_budget(uint64_t new_budget_bytes)
+    {
+        std::lock_guard lock(mtx);
+        budget_bytes = new_budget_bytes;
+        evict_to_budget();
+    }
+
+    ModuleCacheStats get_stats() const
+    {
+        std::shared_lock lock(mtx);
+        ModuleCacheStats out = stats;
+        out.hits = hits;
+        out.misses = misses;
+        out.entries = entries.size();
+        out.bytes = bytes;
+        out.budget_bytes = budget_bytes;
+        return out;
+    }
+
+private:
+    mutable std::shared_mutex mtx;
+
+    std::unordered_map<Hash, Entry, ScriptHashHasher> entries;
+    std::map<order_key_t, Hash> order;
+    double clock = 0;
+    uint64_t seq = 0;
+
+    uint64_t bytes = 0;
+    uint64_t budget_bytes;
+
+    // hits and misses are counted under a shared lock, so are kept here
+    // instead of in stats
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    ModuleCacheStats stats;
+
+    std::unordered_map<Hash, std::shared_future<std::optional<V>>, ScriptHashHasher>
+        in_flight;
+
+    // Needs (at least) a shared lock
+    std::optional<V> get_locked(Hash const& key)
+    {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return std::nullopt;
+        }
+
+        it->second.freq.fetch_add(1, std::memory_order_relaxed);
+        return it->second.value;
+    }
+
+    // result is in the cache (if it will ever be) before in_flight is cleared,
+    // so a thread that finds neither can safely start a new compilation.
+    void finish_in_flight(Hash const& key,
+                          std::promise<std::optional<V>>& promise,
+                          std::optional<V> const& result)
+    {
+        {
+            std::lock_guard lock(mtx);
+            in_flight.erase(key);
+        }
+        promise.set_value(result);
+    }
+
+    order_key_t next_order_key(uint64_t freq, uint64_t cost, uint64_t size)
+    {
+        return { clock + static_cast<double>(freq) * static_cast<double>(cost) / static_cast<double>(size),
+                 seq++ };
+    }
+
+    void evict_to_budget()
+    {
+        while (bytes > budget_bytes && !order.empty()) {
+            auto it = order.begin();
+            auto e_it = entries.find(it->second);
+
+            Entry& e = e_it->second;
+            uint64_t freq = e.freq.load(std::memory_order_relaxed);
+            if (freq != e.ordered_freq) {
+                // hit since its priority was computed -- reorder and retry
+                order.erase(it);
+                e.ordered_freq = freq;
+                e.order_key = next_order_key(freq, e.cost, e.size);
+                order.emplace(e.order_key, e_it->first);
+                continue;
+            }
+
+            bytes -= e.size;
+            clock = it->first.first;
+            entries.erase(e_it);
+            order.erase(it);
+            stats.evictions++;
+        }
+    }
+
+    ModuleCache(ModuleCache const&) = delete;
+    ModuleCache(ModuleCache&&) = delete;
+};
+
+} // namespace detail
+
+} // namespace wasm_api
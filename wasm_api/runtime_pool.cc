@@ -0,0 +1,267 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/runtime_pool.h"
+
+#include <algorithm>
+
+namespace wasm_api
+{
+
+RuntimePool::RuntimePool(WasmContext const& context, RuntimePoolConfig config)
+    : config(config)
+    , context(context)
+    , worker([this] { run_worker(); })
+{}
+
+RuntimePool::~RuntimePool()
+{
+    {
+        std::lock_guard lock(mtx);
+        shutdown = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+bool
+RuntimePool::add_script(Hash const& script_identifier, Script const& script)
+{
+    {
+        std::lock_guard lock(mtx);
+        if (entries.contains(script_identifier)) {
+            return true;
+        }
+    }
+    return add_script(script_identifier, context.compile(script, &script_identifier));
+}
+
+bool
+RuntimePool::add_script(Hash const& script_identifier, CompiledModule const& module)
+{
+    if (!module) {
+        return false;
+    }
+
+    // destroyed after lock
+    std::deque<Entry> dropped;
+
+    std::lock_guard lock(mtx);
+    auto [it, inserted] = entries.try_emplace(script_identifier);
+    if (inserted) {
+        it->second.module = module;
+        it->second.last_used = std::chrono::steady_clock::now();
+        it->second.generation = next_generation++;
+        request_refill(script_identifier, it->second);
+        evict_to_max_scripts(dropped);
+    }
+    return true;
+}
+
+std::unique_ptr<WasmRuntime>
+RuntimePool::acquire(Hash const& script_identifier, void* ctxp)
+{
+    CompiledModule module;
+    {
+        std::lock_guard lock(mtx);
+        auto it = entries.find(script_identifier);
+        if (it == entries.end()) {
+            return nullptr;
+        }
+        Entry& entry = it->second;
+        entry.last_used = std::chrono::steady_clock::now();
+
+        if (!entry.ready.empty()) {
+            auto out = std::move(entry.ready.front());
+            entry.ready.pop_front();
+            request_refill(script_identifier, entry);
+            stats.acquired_warm++;
+
+            out->rebind(ctxp);
+            return out;
+        }
+
+        request_refill(script_identifier, entry);
+        stats.acquired_cold++;
+        module = entry.module;
+    }
+    return module.instantiate(ctxp);
+}
+
+void
+RuntimePool::release(Hash const& script_identifier, std::unique_ptr<WasmRuntime> runtime)
+{
+    if (!runtime) {
+        return;
+    }
+
+    std::lock_guard lock(mtx);
+    auto it = entries.find(script_identifier);
+    if (it == entries.end()) {
+        return;
+    }
+    Entry& entry = it->second;
+    if (entry.ready.size() + entry.in_progress >= config.runtimes_per_script) {
+        return;
+    }
+
+    runtime->rebind(nullptr);
+    entry.in_progress++;
+    to_reset.push_back(ResetJob {
+        .script_identifier = script_identifier,
+        .generation = entry.generation,
+        .runtime = std::move(runtime)
+    });
+    cv.notify_one();
+}
+
+RuntimePoolStats
+RuntimePool::get_stats() const
+{
+    std::lock_guard lock(mtx);
+    RuntimePoolStats out = stats;
+    out.scripts = entries.size();
+    for (auto const& [_, entry] : entries) {
+        out.ready_runtimes += entry.ready.size();
+    }
+    return out;
+}
+
+void
+RuntimePool::request_refill(Hash const& script_identifier, Entry& entry)
+{
+    if (entry.ready.size() + entry.in_progress < config.runtimes_per_script) {
+        to_refill.push_back(script_identifier);
+        cv.notify_one();
+    }
+}
+
+RuntimePool::Entry*
+RuntimePool::find_entry(Hash const& script_identifier, uint64_t generation)
+{
+    auto it = entries.find(script_identifier);
+    if (it == entries.end() || it->second.generation != generation) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void
+RuntimePool::evict_idle(std::chrono::steady_clock::time_point now,
+                        std::deque<Entry>& dropped)
+{
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (now - it->second.last_used > config.idle_timeout) {
+            dropped.push_back(std::move(it->second));
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+RuntimePool::evict_to_max_scripts(std::deque<Entry>& dropped)
+{
+    while (entries.size() > config.max_scripts) {
+        auto lru = std::min_element(entries.begin(), entries.end(),
+            [] (auto const& a, auto const& b) {
+                return a.second.last_used < b.second.last_used;
+            });
+        dropped.push_back(std::move(lru->second));
+        entries.erase(lru);
+    }
+}
+
+void
+RuntimePool::run_worker()
+{
+    const auto idle_check_interval = std::max<std::chrono::steady_clock::duration>(
+        config.idle_timeout / 2, std::chrono::milliseconds(1));
+
+    while (true) {
+        // Declared before lock, so destroyed after it is released:
+        // tearing down runtimes (and their modules) is slow,
+        // and would otherwise block acquire().
+        std::deque<Entry> dropped;
+        std::unique_ptr<WasmRuntime> runtime;
+        CompiledModule module;
+
+        std::unique_lock lock(mtx);
+        cv.wait_for(lock, idle_check_interval, [this] {
+            return shutdown || !to_reset.empty() || !to_refill.empty();
+        });
+        if (shutdown) {
+            return;
+        }
+
+        evict_idle(std::chrono::steady_clock::now(), dropped);
+
+        // Resets first, as they are (usually) cheaper than instantiations
+        if (!to_reset.empty()) {
+            const Hash script_identifier = to_reset.front().script_identifier;
+            const uint64_t generation = to_reset.front().generation;
+            runtime = std::move(to_reset.front().runtime);
+            to_reset.pop_front();
+
+            lock.unlock();
+            bool ok = runtime->reset();
+            lock.lock();
+
+            Entry* entry = find_entry(script_identifier, generation);
+            if (entry == nullptr) {
+                continue;
+            }
+            entry->in_progress--;
+            if (ok) {
+                entry->ready.push_back(std::move(runtime));
+            }
+            continue;
+        }
+
+        if (!to_refill.empty()) {
+            Hash script_identifier = to_refill.front();
+            to_refill.pop_front();
+
+            auto it = entries.find(script_identifier);
+            if (it == entries.end()) {
+                continue;
+            }
+            if (it->second.ready.size() + it->second.in_progress >= config.runtimes_per_script) {
+                continue;
+            }
+            it->second.in_progress++;
+            module = it->second.module;
+            const uint64_t generation = it->second.generation;
+
+            lock.unlock();
+            runtime = module.instantiate(nullptr);
+            lock.lock();
+
+            Entry* entry = find_entry(script_identifier, generation);
+            if (entry == nullptr) {
+                continue;
+            }
+            entry->in_progress--;
+            if (runtime) {
+                entry->ready.push_back(std::move(runtime));
+                request_refill(script_identifier, *entry);
+            }
+        }
+    }
+}
+
+} // namespace wasm_api
@@ -0,0 +1,125 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/static_wasm_api.h"
+
+#include "wasm_api/stitch_api.h"
+#include "wasm_api/wasm3_api.h"
+#include "wasm_api/wasmi_api.h"
+#include "wasm_api/fizzy_api.h"
+#include "wasm_api/wasmtime_api.h"
+
+namespace wasm_api
+{
+
+// The engine runtime classes are final, so every call
+// through impl_type below is a direct call.
+
+template<SupportedWasmEngine engine>
+StaticWasmRuntime<engine>::StaticWasmRuntime(std::unique_ptr<WasmRuntime> runtime)
+    : runtime(std::move(runtime))
+{
+    if (this->runtime && !dynamic_cast<impl_type*>(this->runtime->impl)) {
+        this->runtime.reset();
+    }
+}
+
+template<SupportedWasmEngine engine>
+typename StaticWasmRuntime<engine>::impl_type*
+StaticWasmRuntime<engine>::get_impl(WasmRuntime const& runtime)
+{
+    return static_cast<impl_type*>(runtime.impl);
+}
+
+template<SupportedWasmEngine engine>
+MeteredReturn
+StaticWasmRuntime<engine>::invoke(MethodHandle const& method, uint64_t gas_limit)
+{
+    auto* impl = get_impl(*runtime);
+    if (!impl || !method || method.exports != runtime->origin.exports.get()) {
+        return { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
+    }
+    return impl->invoke_metered(method.index, method.get_name(), gas_limit);
+}
+
+template<SupportedWasmEngine engine>
+MeteredReturn
+StaticWasmRuntime<engine>::invoke(std::string_view method_name, uint64_t gas_limit)
+{
+    if (auto method = prepare(method_name)) {
+        return invoke(method, gas_limit);
+    }
+    // not an export, so this is an error anyways
+    return runtime->invoke(method_name, gas_limit);
+}
+
+template<SupportedWasmEngine engine>
+bool
+StaticWasmRuntime<engine>::engine_consume_gas(uint64_t gas)
+{
+    if (auto* impl = get_impl(*runtime)) {
+        return impl->consume_gas(gas);
+    }
+    return false;
+}
+
+template<SupportedWasmEngine engine>
+uint64_t
+StaticWasmRuntime<engine>::engine_get_available_gas() const
+{
+    if (auto* impl = get_impl(*runtime)) {
+        return impl->get_available_gas();
+    }
+    return 0;
+}
+
+template<SupportedWasmEngine engine>
+void
+StaticWasmRuntime<engine>::engine_set_available_gas(uint64_t gas)
+{
+    if (auto* impl = get_impl(*runtime)) {
+        impl->set_available_gas(gas);
+    }
+}
+
+template<SupportedWasmEngine engine>
+std::span<std::byte>
+StaticWasmRuntime<engine>::get_memory()
+{
+    if (auto* impl = get_impl(*runtime)) {
+        return impl->get_memory();
+    }
+    return std::span<std::byte>();
+}
+
+template<SupportedWasmEngine engine>
+std::span<const std::byte>
+StaticWasmRuntime<engine>::get_memory() const
+{
+    if (auto const* impl = get_impl(*runtime)) {
+        return impl->get_memory();
+    }
+    return std::span<const std::byte>();
+}
+
+template class StaticWasmRuntime<SupportedWasmEngine::WASM3>;
+template class StaticWasmRuntime<SupportedWasmEngine::MAKEPAD_STITCH>;
+template class StaticWasmRuntime<SupportedWasmEngine::WASMI>;
+template class StaticWasmRuntime<SupportedWasmEngine::FIZZY>;
+template class StaticWasmRuntime<SupportedWasmEngine::WASMTIME_CRANELIFT>;
+template class StaticWasmRuntime<SupportedWasmEngine::WASMTIME_WINCH>;
+
+} // namespace wasm_api
@@ -16,32 +16,99 @@ Stitch_WasmContext::~Stitch_WasmContext()
     free_stitch_context(context_pointer);
 }
 
-Stitch_WasmRuntime::Stitch_WasmRuntime(Script const& data,
-                                       void* context_pointer,
-                                       void* userctx)
-    : runtime_pointer(
-          new_stitch_runtime(data.data, data.len, context_pointer, userctx))
-{}
+Stitch_CompiledModule::~Stitch_CompiledModule()
+{
+    free_stitch_compiled(compiled_pointer);
+}
 
 Stitch_WasmRuntime::~Stitch_WasmRuntime()
 {
     free_stitch_runtime(runtime_pointer);
 }
 
-std::unique_ptr<WasmRuntime>
-Stitch_WasmContext::new_runtime_instance(Script const& contract, void* ctxp, const Hash* /*unused*/)
+ModuleCacheStats
+Stitch_WasmContext::get_module_cache_stats() const
 {
-    std::unique_ptr<WasmRuntime> out = std::make_unique<WasmRuntime>(ctxp);
+    auto stats = stitch_get_cache_stats(context_pointer);
+    return ModuleCacheStats {
+        .hits = stats.hits,
+        .misses = stats.misses,
+        .evictions = stats.evictions,
+        .entries = stats.entries,
+        .bytes = stats.bytes,
+        .budget_bytes = stats.budget_bytes
+    };
+}
 
-    auto* stitch_runtime = new Stitch_WasmRuntime(
-        contract, context_pointer, out->get_host_call_context());
+void
+Stitch_WasmContext::set_module_cache_budget(uint64_t budget_bytes)
+{
+    stitch_set_cache_budget(context_pointer, budget_bytes);
+}
 
-    if (!stitch_runtime -> has_valid_runtime_pointer()) {
+bool
+Stitch_WasmContext::set_gas_instrumentation(GasInstrumentationConfig const& config)
+{
+    gas_instrumenter = std::make_unique<detail::GasInstrumenter>(config);
+    return true;
+}
+
+std::shared_ptr<detail::CompiledModuleImpl>
+Stitch_WasmContext::compile(Script const& contract, const Hash* script_identifier)
+{
+    // Cached (by script_identifier) separately from the compiled module,
+    // which is cached on the rust side
+    SharedScript instrumented;
+    Script bytes = contract;
+    if (gas_instrumenter) {
+        instrumented = gas_instrumenter->instrument(contract, script_identifier);
+        if (!instrumented.data) {
+            return nullptr;
+        }
+        bytes = instrumented.get();
+    }
+
+    void* compiled = stitch_compile(bytes.data, bytes.len, context_pointer,
+        (script_identifier == nullptr) ? nullptr : script_identifier -> data());
+
+    if (compiled == nullptr) {
         return nullptr;
     }
 
-    out->initialize(stitch_runtime);
+    return std::make_shared<Stitch_CompiledModule>(compiled, context_pointer, !!gas_instrumenter);
+}
 
+namespace
+{
+
+HostFnStatus<void>
+gas_intrinsic(HostCallContext* ctx, uint64_t gas) noexcept
+{
+    if (!ctx->consume_gas(gas)) {
+        return HostFnStatus<void>(std::unexpect_t{}, HostFnError::OUT_OF_GAS);
+    }
+    return {};
+}
+
+} // namespace
+
+std::unique_ptr<detail::WasmRuntimeImpl>
+Stitch_CompiledModule::instantiate(HostCallContext* host_call_context)
+{
+    auto out = std::make_unique<Stitch_WasmRuntime>(
+        new_stitch_runtime(compiled_pointer, context_pointer, host_call_context),
+        host_call_context);
+
+    // Before any user links, so that those can replace it
+    if (link_gas_intrinsic) {
+        using host_fn = detail::DirectHostFn<&gas_intrinsic>;
+        if (!out->link_fn_nargs(GAS_INTRINSIC_MODULE, GAS_INTRINSIC_FN, nullptr,
+                reinterpret_cast<void*>(&host_fn::trampoline), host_fn::nargs,
+                WasmValueType::VOID, HostFnGasCost{}))
+        {
+            return nullptr;
+        }
+    }
     return out;
 }
 
@@ -74,12 +141,79 @@ Stitch_WasmRuntime::invoke(std::string const& method_name)
     return InvokeStatus<uint64_t>(std::unexpect_t{}, err);
 }
 
+InvokeStatus<uint64_t>
+Stitch_WasmRuntime::invoke_prepared(uint32_t method_index, std::string const& method_name)
+{
+    auto invoke_res
+        = ::stitch_invoke_prepared(runtime_pointer,
+                                   method_index,
+                                   reinterpret_cast<const uint8_t*>(method_name.c_str()),
+                                   static_cast<uint32_t>(method_name.size()));
+
+    InvokeError err = static_cast<InvokeError>(invoke_res.error);
+    if (err == InvokeError::NONE) {
+        return invoke_res.result;
+    }
+
+    return InvokeStatus<uint64_t>(std::unexpect_t{}, err);
+}
+
+MeteredReturn
+Stitch_WasmRuntime::invoke_metered(uint32_t method_index,
+                                   std::string const& method_name,
+                                   uint64_t gas_limit)
+{
+    const uint64_t gas_backup = available_gas;
+
+    available_gas = gas_limit;
+    auto res = Stitch_WasmRuntime::invoke_prepared(method_index, method_name);
+    const uint64_t gas_remaining = available_gas;
+
+    available_gas = gas_backup;
+    return metered_return(res, gas_limit, gas_remaining);
+}
+
+MeteredReturn
+Stitch_WasmRuntime::invoke_typed(uint32_t method_index,
+                                 detail::ExportedFunction const& method,
+                                 uint64_t gas_limit,
+                                 std::span<const uint64_t> args,
+                                 std::span<uint64_t> results)
+{
+    auto const& sig = *method.signature;
+    const uint64_t gas_backup = available_gas;
+
+    available_gas = gas_limit;
+    auto invoke_res
+        = ::stitch_invoke_typed(runtime_pointer,
+                                method_index,
+                                reinterpret_cast<const uint8_t*>(method.name.c_str()),
+                                static_cast<uint32_t>(method.name.size()),
+                                args.data(),
+                                reinterpret_cast<const uint8_t*>(sig.params.data()),
+                                static_cast<uint32_t>(args.size()),
+                                results.data(),
+                                reinterpret_cast<const uint8_t*>(sig.results.data()),
+                                static_cast<uint32_t>(results.size()));
+    const uint64_t gas_remaining = available_gas;
+
+    available_gas = gas_backup;
+
+    InvokeError err = static_cast<InvokeError>(invoke_res.error);
+    if (err == InvokeError::NONE) {
+        return metered_return(InvokeStatus<void>{}, gas_limit, gas_remaining);
+    }
+    return metered_return(InvokeStatus<void>(std::unexpect_t{}, err), gas_limit, gas_remaining);
+}
+
 bool 
 Stitch_WasmRuntime::link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs, 
-    WasmValueType ret_type) 
+    WasmValueType ret_type,
+    HostFnGasCost const& gas) 
 {
     return stitch_link_nargs(
         runtime_pointer,
@@ -88,33 +222,12 @@ Stitch_WasmRuntime::link_fn_nargs(std::string const& module_name,
         (const uint8_t*)fn_name.c_str(),
         fn_name.size(),
         (void*)fn,
+        trampoline,
         nargs,
-        static_cast<uint8_t>(ret_type));
-}
-
-bool
-__attribute__((warn_unused_result))
-Stitch_WasmRuntime::consume_gas(uint64_t gas)
-{
-    if (gas > available_gas)
-    {
-        available_gas = 0;
-        return false;
-    }
-    available_gas -= gas;
-    return true;
-}
-
-uint64_t
-Stitch_WasmRuntime::get_available_gas() const
-{
-    return available_gas;
-}
-
-void
-Stitch_WasmRuntime::set_available_gas(uint64_t gas)
-{
-    available_gas = gas;
+        static_cast<uint8_t>(ret_type),
+        gas.base,
+        gas.per_byte,
+        gas.len_arg);
 }
 
 } // namespace wasm_api
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "wasm_api/wasm_api.h"
 
+#include "wasm_api/gas_instrument.h"
+
 /**
  * Editorial:
  *
@@ -36,19 +38,48 @@ public:
 
     ~Stitch_WasmContext();
 
-    std::unique_ptr<WasmRuntime> new_runtime_instance(Script const& contract,
-                                                      void* ctxp, const Hash* /*unused*/);
+    std::shared_ptr<detail::CompiledModuleImpl> compile(Script const& contract,
+                                                        const Hash* script_identifier) override;
+
+    ModuleCacheStats get_module_cache_stats() const override;
+    void set_module_cache_budget(uint64_t budget_bytes) override;
+
+    bool set_gas_instrumentation(GasInstrumentationConfig const& config) override;
+
+private:
+    void* context_pointer;
+
+    // nullptr unless set_gas_instrumentation() was called
+    std::unique_ptr<detail::GasInstrumenter> gas_instrumenter;
+};
+
+class Stitch_CompiledModule : public detail::CompiledModuleImpl
+{
+public:
+    Stitch_CompiledModule(void* compiled_pointer, void* context_pointer, bool link_gas_intrinsic)
+        : compiled_pointer(compiled_pointer)
+        , context_pointer(context_pointer)
+        , link_gas_intrinsic(link_gas_intrinsic)
+    {}
+
+    ~Stitch_CompiledModule();
+
+    std::unique_ptr<detail::WasmRuntimeImpl> instantiate(HostCallContext* host_call_context) override;
 
 private:
+    void* compiled_pointer;
     void* context_pointer;
+    // the module was instrumented, so link GAS_INTRINSIC_FN
+    const bool link_gas_intrinsic;
 };
 
-class Stitch_WasmRuntime : public detail::WasmRuntimeImpl
+class Stitch_WasmRuntime final : public detail::WasmRuntimeImpl
 {
 public:
-    Stitch_WasmRuntime(Script const& data,
-                       void* context_pointer,
-                       void* userctx);
+    Stitch_WasmRuntime(void* runtime_pointer, HostCallContext* host_call_context)
+        : runtime_pointer(runtime_pointer)
+        , available_gas(host_call_context->available_gas)
+    {}
 
     ~Stitch_WasmRuntime();
 
@@ -59,24 +90,51 @@ public:
     bool link_fn_nargs(std::string const& module_name,
         std::string const& fn_name,
         void* fn,
+        void* trampoline,
         uint8_t nargs,
-        WasmValueType ret_type) override;
+        WasmValueType ret_type,
+        HostFnGasCost const& gas) override;
 
     InvokeStatus<uint64_t> invoke(std::string const &method_name) override;
+    InvokeStatus<uint64_t> invoke_prepared(uint32_t method_index,
+                                           std::string const &method_name) override;
+    MeteredReturn invoke_metered(uint32_t method_index,
+                                 std::string const &method_name,
+                                 uint64_t gas_limit) override;
+    MeteredReturn invoke_typed(uint32_t method_index,
+                               detail::ExportedFunction const& method,
+                               uint64_t gas_limit,
+                               std::span<const uint64_t> args,
+                               std::span<uint64_t> results) override;
 
     bool
     __attribute__((warn_unused_result))
-    consume_gas(uint64_t gas) override;
-    uint64_t get_available_gas() const override;
-    void set_available_gas(uint64_t gas) override;
+    consume_gas(uint64_t gas) override
+    {
+        if (gas > available_gas)
+        {
+            available_gas = 0;
+            return false;
+        }
+        available_gas -= gas;
+        return true;
+    }
+
+    uint64_t get_available_gas() const override
+    {
+        return available_gas;
+    }
 
-    bool has_valid_runtime_pointer() const {
-        return runtime_pointer != nullptr;
+    void set_available_gas(uint64_t gas) override
+    {
+        available_gas = gas;
     }
 
 private:
     void* runtime_pointer;
-    uint64_t available_gas = 0;
+    // Lives in the owning WasmRuntime's HostCallContext, where host
+    // functions (and host function gas costs, from rust) consume it
+    uint64_t& available_gas;
 };
 
 } // namespace wasm_api
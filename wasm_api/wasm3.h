@@ -60,18 +60,23 @@ SOFTWARE.
 
 #include "wasm_api/error.h"
 #include "wasm_api/value_type.h"
+#include "wasm_api/wasm_api.h"
 
 #include "wasm3/source/wasm3.h"
+// for the module and runtime internals used to recycle runtimes
+#include "wasm3/source/m3_env.h"
 
-#include "wasm_api/ffi_trampolines.h"
-
-namespace wasm_api {
-
-struct HostCallContext;
+namespace wasm3 {
 
-}
+// userdata of a linked host function.
+// Must outlive the module it is linked into.
+struct linked_host_fn {
+  // nullptr if trampoline calls the host function directly
+  void* fn;
+  void* trampoline;
+  wasm_api::HostFnGasCost gas;
+};
 
-namespace wasm3 {
 /** @cond */
 namespace detail {
 
@@ -144,7 +149,30 @@ get_args_from_stack(stack_type &sp, mem_type mem, std::tuple<Args...> &tuple)
              tuple);
 }
 
-template<typename ret_type, std::same_as<uint64_t>... Args>
+// direct: the host function was linked with WasmContext::link_fn<F>(),
+// and is called through its own trampoline.  Otherwise the
+// trampoline for a host function of its type is known statically.
+template<bool direct, typename ret_type, std::same_as<uint64_t>... Args>
+TrampolineResult
+call_host_fn(void* userdata, void* host_call_context, Args... args)
+{
+    auto const* f = static_cast<linked_host_fn const*>(userdata);
+    auto* ctx = static_cast<wasm_api::HostCallContext*>(host_call_context);
+
+    // ctx->available_gas is the runtime's gas counter
+    if (!f->gas.is_free() && !ctx->consume_gas(f->gas.cost(args...))) {
+        return wasm_api::detail::host_fn_error(wasm_api::HostFnError::OUT_OF_GAS);
+    }
+
+    if constexpr (direct) {
+        auto trampoline = reinterpret_cast<wasm_api::detail::HostTrampoline<Args...>>(f->trampoline);
+        return trampoline(nullptr, host_call_context, args...);
+    } else {
+        return wasm_api::detail::host_trampoline<ret_type, Args...>(f->fn, host_call_context, args...);
+    }
+}
+
+template<bool direct, typename ret_type, std::same_as<uint64_t>... Args>
 const void*
 wrap_fn_return(IM3Runtime rt, IM3ImportContext _ctx, stack_type _sp, mem_type mem)
 {
@@ -157,33 +185,9 @@ wrap_fn_return(IM3Runtime rt, IM3ImportContext _ctx, stack_type _sp, mem_type me
 
     get_args_from_stack(_sp, mem, args);
 
-    void* fn_pointer = _ctx -> userdata;
-
-    constexpr size_t nargs = std::tuple_size_v<args_tuple_t>;
-
-    TrampolineResult result;
-
-    if constexpr (nargs == 0) {
-        result = c_call_0args(fn_pointer, m3_GetUserData(rt));
-    } else if constexpr (nargs == 1) {
-        result = c_call_1args(fn_pointer, m3_GetUserData(rt), std::get<0>(args));
-    } else if constexpr (nargs == 2) {
-        result = c_call_2args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args));
-    } else if constexpr (nargs == 3) {
-        result = c_call_3args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args));
-    } else if constexpr (nargs == 4) {
-        result = c_call_4args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args));
-    } else if constexpr (nargs == 5) {
-        result = c_call_5args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args));
-    } else if constexpr (nargs == 6) {
-        result = c_call_6args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args));
-    } else if constexpr (nargs == 7) {
-        result = c_call_7args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args), std::get<6>(args));
-    } else if constexpr (nargs == 8) {
-        result = c_call_8args(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args), std::get<6>(args), std::get<7>(args));
-    } else {
-        std::terminate();
-    }
+    TrampolineResult result = std::apply([&] (auto... arg) {
+        return call_host_fn<direct, ret_type>(_ctx -> userdata, m3_GetUserData(rt), arg...);
+    }, args);
 
     switch (result.panic) {
       case static_cast<uint8_t>(wasm_api::HostFnError::NONE_OR_RECOVERABLE):
@@ -202,7 +206,7 @@ wrap_fn_return(IM3Runtime rt, IM3ImportContext _ctx, stack_type _sp, mem_type me
     }
 }
 
-template<std::same_as<uint64_t>... Args>
+template<bool direct, std::same_as<uint64_t>... Args>
 const void*
 wrap_fn_noreturn(IM3Runtime rt, IM3ImportContext _ctx, stack_type _sp, mem_type mem)
 {    
@@ -212,33 +216,9 @@ wrap_fn_noreturn(IM3Runtime rt, IM3ImportContext _ctx, stack_type _sp, mem_type
 
     get_args_from_stack(_sp, mem, args);
 
-    void* fn_pointer = _ctx -> userdata;
-
-    constexpr size_t nargs = std::tuple_size_v<args_tuple_t>;
-
-    TrampolineResult result;
-
-    if constexpr (nargs == 0) {
-        result = c_call_0args_noret(fn_pointer, m3_GetUserData(rt));
-    } else if constexpr (nargs == 1) {
-        result = c_call_1args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args));
-    } else if constexpr (nargs == 2) {
-        result = c_call_2args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args));
-    } else if constexpr (nargs == 3) {
-        result = c_call_3args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args));
-    } else if constexpr (nargs == 4) {
-        result = c_call_4args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args));
-    } else if constexpr (nargs == 5) {
-        result = c_call_5args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args));
-    } else if constexpr (nargs == 6) {
-        result = c_call_6args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args));
-    } else if constexpr (nargs == 7) {
-        result = c_call_7args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args), std::get<6>(args));
-    } else if constexpr (nargs == 8) {
-        result = c_call_8args_noret(fn_pointer, m3_GetUserData(rt), std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args), std::get<6>(args), std::get<7>(args));
-    } else {
-        std::terminate();
-    }
+    TrampolineResult result = std::apply([&] (auto... arg) {
+        return call_host_fn<direct, void>(_ctx -> userdata, m3_GetUserData(rt), arg...);
+    }, args);
 
     switch (result.panic) {
       case static_cast<uint8_t>(wasm_api::HostFnError::NONE_OR_RECOVERABLE):
@@ -257,6 +237,20 @@ wrap_fn_noreturn(IM3Runtime rt, IM3ImportContext _ctx, stack_type _sp, mem_type
     }
 }
 
+// Linked to wasm_api::GAS_INTRINSIC_MODULE/GAS_INTRINSIC_FN.
+// Decrements the runtime's gas counter (in its HostCallContext) in place,
+// without going through call_host_fn() and a trampoline.
+inline const void*
+consume_gas_intrinsic(IM3Runtime rt, IM3ImportContext, stack_type _sp, mem_type)
+{
+    m3ApiGetArg(uint64_t, gas);
+
+    auto* ctx = static_cast<wasm_api::HostCallContext*>(m3_GetUserData(rt));
+    if (!ctx->consume_gas(gas)) [[unlikely]] {
+        m3ApiTrap(m3Err_outOfGasError);
+    }
+    m3ApiSuccess();
+}
 
 static void
 throw_nondeterministic_errors(M3Result result) {
@@ -268,117 +262,143 @@ throw_nondeterministic_errors(M3Result result) {
     }
 }
 
-} // namespace detail
-/** @endcond */
-
-static bool
-static_link_nargs(IM3Module io_module, const char *const i_moduleName,
-           const char *const i_functionName,
-           void *function, // expects signature of
-                           // HostFnStatus<uint64_t>(HostCallContext*, nargs
-                           // repeated uint64)
-           uint8_t nargs,
-           wasm_api::WasmValueType ret_type)
+template<bool direct>
+static decltype(&wrap_fn_noreturn<direct>)
+wrapped_fn_nargs(uint8_t nargs, wasm_api::WasmValueType ret_type)
 {
   using enum wasm_api::WasmValueType;
-  auto arg_sig = [&nargs, &ret_type] () -> std::string {
-    std::string out;
-    switch(ret_type) {
-    case VOID:
-        out += "v";
-        break;
-    case U64:
-        out += "I";
-        break;
-    }
-    out += "(";
-    for (auto i = 0u; i < nargs; i++) {
-      out += "I";
-    }
-    out += ")";
-    return out;
-  };
 
-  decltype(&detail::wrap_fn_noreturn<>) wrapped_fn_pointer = nullptr;
+  decltype(&wrap_fn_noreturn<direct>) wrapped_fn_pointer = nullptr;
 
   // gross but it works
   switch(ret_type) {
   case U64:
       switch (nargs) {
       case 0:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t>;
         break;
       case 1:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t>;
         break;
       case 2:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t>;
         break;
       case 3:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 4:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 5:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 6:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 7:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 8:
-        wrapped_fn_pointer = &detail::wrap_fn_return<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_return<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       default:
-        return false;
+        return nullptr;
       }
     break;
   case VOID:
     switch (nargs) {
       case 0:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct>;
         break;
       case 1:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t>;
         break;
       case 2:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t>;
         break;
       case 3:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t, uint64_t>;
         break;
       case 4:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 5:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 6:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 7:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       case 8:
-        wrapped_fn_pointer = &detail::wrap_fn_noreturn<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+        wrapped_fn_pointer = &wrap_fn_noreturn<direct, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
         break;
       default:
         std::printf("invalid void nargs %u\n", nargs);
-        return false;
+        return nullptr;
       }
     break;
   default:
     std::terminate();
   }
 
+  return wrapped_fn_pointer;
+}
+
+} // namespace detail
+/** @endcond */
+
+static bool
+static_link_nargs(IM3Module io_module, const char *const i_moduleName,
+           const char *const i_functionName,
+           linked_host_fn *userdata, // fn expects signature of
+                                     // HostFnStatus<uint64_t>(HostCallContext*, nargs
+                                     // repeated uint64)
+           uint8_t nargs,
+           wasm_api::WasmValueType ret_type)
+{
+  using enum wasm_api::WasmValueType;
+  if (ret_type != VOID && ret_type != U64) {
+    return false;
+  }
+
+  auto arg_sig = [&nargs, &ret_type] () -> std::string {
+    std::string out;
+    switch(ret_type) {
+    case VOID:
+        out += "v";
+        break;
+    case U64:
+        out += "I";
+        break;
+    case I32:
+        out += "i";
+        break;
+    }
+    out += "(";
+    for (auto i = 0u; i < nargs; i++) {
+      out += "I";
+    }
+    out += ")";
+    return out;
+  };
+
+  // see detail::call_host_fn()
+  const bool direct = (userdata->fn == nullptr);
+  auto wrapped_fn_pointer = direct
+    ? detail::wrapped_fn_nargs<true>(nargs, ret_type)
+    : detail::wrapped_fn_nargs<false>(nargs, ret_type);
+  if (wrapped_fn_pointer == nullptr) {
+    return false;
+  }
+
   auto cur_sig = arg_sig();
 
   M3Result result =
       m3_LinkRawFunctionEx(io_module, i_moduleName, i_functionName,
-                           cur_sig.c_str(), wrapped_fn_pointer, function);
+                           cur_sig.c_str(), wrapped_fn_pointer,
+                           userdata);
   return (result == m3Err_none || result == m3Err_functionLookupFailed);
 }
 
@@ -429,6 +449,27 @@ public:
    */
   std::unique_ptr<module> parse_module(const uint8_t *data, size_t size);
 
+  /**
+   * Parse a WASM module from an immutable shared buffer.
+   * The buffer is not copied; the module keeps it alive instead.
+   *
+   * @param data  the binary
+   * @return module object
+   */
+  std::unique_ptr<module>
+  parse_module(std::shared_ptr<const std::vector<uint8_t>> data);
+
+  /**
+   * Same as above, for a binary in memory owned by anything
+   * (use shared_ptr's aliasing constructor to point into the owner).
+   *
+   * @param data  pointer to the start of the binary
+   * @param size  size of the binary
+   * @return module object
+   */
+  std::unique_ptr<module>
+  parse_module(std::shared_ptr<const uint8_t> data, size_t size);
+
 protected:
   std::shared_ptr<struct M3Environment> m_env;
 };
@@ -455,6 +496,10 @@ public:
 
   std::span<std::byte> get_memory();
 
+  // Used when a runtime is recycled for a new WasmRuntime,
+  // whose HostCallContext replaces the one it was created with.
+  void set_user_data(void *ctxp) { m_runtime->userdata = ctxp; }
+
   friend class environment;
 
   runtime(const std::shared_ptr<M3Environment> &env, size_t stack_size_bytes,
@@ -487,7 +532,18 @@ public:
   // expected signature: HostFnStatus<ret_type>(HostCallContext*, uint64t repeated nargs)
   bool
   link_nargs(const char* module, const char* function_name,
-      void* function_pointer, uint8_t nargs, wasm_api::WasmValueType ret_type);
+      linked_host_fn* userdata, uint8_t nargs, wasm_api::WasmValueType ret_type);
+
+  // Links detail::consume_gas_intrinsic, if the module imports it
+  // (with the right type).  Must be called after the module is loaded into a runtime.
+  bool link_gas_intrinsic();
+
+  bool has_start_function() const { return m_module->startFunction >= 0; }
+
+  // Raw values of all globals (wasm3 has no public API
+  // to reach globals that are not exported).
+  std::vector<uint64_t> get_globals() const;
+  void set_globals(std::span<const uint64_t> values);
 
   ~module()
   {
@@ -501,23 +557,50 @@ public:
 
   module(std::istream &in_wasm)
   {
-    in_wasm.unsetf(std::ios::skipws);
-    std::copy(std::istream_iterator<uint8_t>(in_wasm),
-              std::istream_iterator<uint8_t>(),
-              std::back_inserter(m_moduleRawData));
+    auto raw = std::make_shared<std::vector<uint8_t>>();
+    auto start = in_wasm.tellg();
+    if (start != std::streampos(-1) && in_wasm.seekg(0, std::ios::end)) {
+      raw->resize(static_cast<size_t>(in_wasm.tellg() - start));
+      in_wasm.seekg(start);
+      in_wasm.read(reinterpret_cast<char *>(raw->data()), raw->size());
+      raw->resize(static_cast<size_t>(in_wasm.gcount()));
+    } else {
+      // not seekable
+      in_wasm.clear();
+      constexpr size_t chunk = 64 * 1024;
+      while (in_wasm) {
+        size_t sz = raw->size();
+        raw->resize(sz + chunk);
+        in_wasm.read(reinterpret_cast<char *>(raw->data() + sz), chunk);
+        raw->resize(sz + static_cast<size_t>(in_wasm.gcount()));
+      }
+    }
+    m_size = raw->size();
+    m_moduleRawData = std::shared_ptr<const uint8_t>(raw, raw->data());
   }
 
   module(const uint8_t *data, size_t size)
-  {
-    m_moduleRawData = std::vector<uint8_t>{data, data + size};
-  }
+    : module(std::make_shared<const std::vector<uint8_t>>(data, data + size))
+  {}
+
+  // wasm3 compiles functions lazily out of the raw binary,
+  // so the module (not the caller) has to keep the bytes alive.
+  module(std::shared_ptr<const std::vector<uint8_t>> data)
+    : m_moduleRawData(data, data->data())
+    , m_size(data->size())
+  {}
+
+  module(std::shared_ptr<const uint8_t> data, size_t size)
+    : m_moduleRawData(std::move(data))
+    , m_size(size)
+  {}
 
   bool __attribute__((warn_unused_result))
   init(const std::shared_ptr<M3Environment> &env)
   {
     // exists only to extend lifetime of env
     m_env = env;
-    return parse(env.get(), m_moduleRawData.data(), m_moduleRawData.size());
+    return parse(env.get(), m_moduleRawData.get(), m_size);
   }
 
 protected:
@@ -558,7 +641,9 @@ protected:
   IM3Module m_module;
 
   bool m_loaded = false;
-  std::vector<uint8_t> m_moduleRawData{};
+  // never copied, only shared
+  std::shared_ptr<const uint8_t> m_moduleRawData;
+  size_t m_size = 0;
 };
 
 /**
@@ -580,21 +665,8 @@ public:
     const void *arg_ptrs[] = {reinterpret_cast<const void *>(&args)...};
     M3Result res = m3_Call(m_func, sizeof...(args), arg_ptrs);
 
-    if (res == m3Err_mallocFailed || res == m3Err_unrecoverableSystemError)
-    {
-        return wasm_api::InvokeStatus<uint64_t>{std::unexpect_t{}, wasm_api::InvokeError::UNRECOVERABLE};
-    }
-
-    if (res == m3Err_outOfGasError) {
-        return wasm_api::InvokeStatus<uint64_t>{std::unexpect_t{}, wasm_api::InvokeError::OUT_OF_GAS_ERROR};
-    }
-
-    if (res == m3Err_returnSuccessError) {
-        return wasm_api::InvokeStatus<uint64_t>{std::unexpect_t{}, wasm_api::InvokeError::RETURN};
-    }
-
-    if (res != m3Err_none) {
-        return wasm_api::InvokeStatus<uint64_t>{std::unexpect_t{}, wasm_api::InvokeError::DETERMINISTIC_ERROR};
+    if (auto err = call_error(res)) {
+        return wasm_api::InvokeStatus<uint64_t>{std::unexpect_t{}, *err};
     }
 
     uint64_t ret;
@@ -610,6 +682,47 @@ public:
     return wasm_api::InvokeStatus<uint64_t>{std::unexpect_t{}, wasm_api::InvokeError::UNRECOVERABLE};
   }
 
+  /**
+   * Call the function with i32 and i64 arguments and results,
+   * one uint64_t each (i32s zero-extended).  The caller is responsible
+   * for their number and types matching the function's signature.
+   */
+  wasm_api::InvokeStatus<void> call_raw(std::span<const uint64_t> args,
+                                        std::span<uint64_t> results)
+  {
+    if (args.size() > wasm_api::MAX_TYPED_INVOKE_VALUES
+        || results.size() > wasm_api::MAX_TYPED_INVOKE_VALUES) {
+        return wasm_api::InvokeStatus<void>{std::unexpect_t{}, wasm_api::InvokeError::UNRECOVERABLE};
+    }
+
+    // wasm3 reads (and writes) i32s through these as 4 byte values,
+    // which on a little-endian host is the low half of each slot.
+    const void *arg_ptrs[wasm_api::MAX_TYPED_INVOKE_VALUES];
+    for (size_t i = 0; i < args.size(); i++) {
+      arg_ptrs[i] = &args[i];
+    }
+    M3Result res = m3_Call(m_func, args.size(), arg_ptrs);
+
+    if (auto err = call_error(res)) {
+        return wasm_api::InvokeStatus<void>{std::unexpect_t{}, *err};
+    }
+
+    const void *ret_ptrs[wasm_api::MAX_TYPED_INVOKE_VALUES];
+    for (size_t i = 0; i < results.size(); i++) {
+      results[i] = 0;
+      ret_ptrs[i] = &results[i];
+    }
+    res = m3_GetResults(m_func, results.size(), ret_ptrs);
+
+    if (res == m3Err_argumentCountMismatch) {
+        return wasm_api::InvokeStatus<void>{std::unexpect_t{}, wasm_api::InvokeError::DETERMINISTIC_ERROR};
+    }
+    if (res == m3Err_none) {
+      return {};
+    }
+    return wasm_api::InvokeStatus<void>{std::unexpect_t{}, wasm_api::InvokeError::UNRECOVERABLE};
+  }
+
   friend class runtime;
 
   function(const std::shared_ptr<M3Runtime> &runtime) : m_runtime(runtime) {}
@@ -624,6 +737,27 @@ public:
 protected:
   std::shared_ptr<M3Runtime> m_runtime;
   M3Function *m_func = nullptr;
+
+  static std::optional<wasm_api::InvokeError> call_error(M3Result res)
+  {
+    if (res == m3Err_mallocFailed || res == m3Err_unrecoverableSystemError)
+    {
+        return wasm_api::InvokeError::UNRECOVERABLE;
+    }
+
+    if (res == m3Err_outOfGasError) {
+        return wasm_api::InvokeError::OUT_OF_GAS_ERROR;
+    }
+
+    if (res == m3Err_returnSuccessError) {
+        return wasm_api::InvokeError::RETURN;
+    }
+
+    if (res != m3Err_none) {
+        return wasm_api::InvokeError::DETERMINISTIC_ERROR;
+    }
+    return std::nullopt;
+  }
 };
 
 inline std::unique_ptr<runtime>
@@ -652,6 +786,26 @@ environment::parse_module(const uint8_t *data, size_t size)
   return nullptr;
 }
 
+inline std::unique_ptr<module>
+environment::parse_module(std::shared_ptr<const std::vector<uint8_t>> data)
+{
+  auto out = std::make_unique<module>(std::move(data));
+  if (out->init(m_env)) {
+    return out;
+  }
+  return nullptr;
+}
+
+inline std::unique_ptr<module>
+environment::parse_module(std::shared_ptr<const uint8_t> data, size_t size)
+{
+  auto out = std::make_unique<module>(std::move(data), size);
+  if (out->init(m_env)) {
+    return out;
+  }
+  return nullptr;
+}
+
 inline bool __attribute__((warn_unused_result))
 runtime::load(module &mod)
 {
@@ -676,12 +830,45 @@ runtime::get_memory()
   return std::span<std::byte>{reinterpret_cast<std::byte*>(mem), len};
 }
 
+inline std::vector<uint64_t>
+module::get_globals() const
+{
+  std::vector<uint64_t> out;
+  out.reserve(m_module->numGlobals);
+  for (uint32_t i = 0; i < m_module->numGlobals; i++) {
+    out.push_back(static_cast<uint64_t>(m_module->globals[i].i64Value));
+  }
+  return out;
+}
+
+inline void
+module::set_globals(std::span<const uint64_t> values)
+{
+  assert(values.size() == m_module->numGlobals);
+  for (uint32_t i = 0; i < m_module->numGlobals; i++) {
+    m_module->globals[i].i64Value = static_cast<int64_t>(values[i]);
+  }
+}
+
 // expected signature: HostFnStatus<uint64_t>(HostCallContext*, uint64t repeated nargs)
 inline bool
 module::link_nargs(const char* module, const char* function_name,
-    void* function_pointer, uint8_t nargs, wasm_api::WasmValueType ret_type)
+    linked_host_fn* userdata, uint8_t nargs, wasm_api::WasmValueType ret_type)
+{
+    return static_link_nargs(m_module, module, function_name, userdata, nargs, ret_type);
+}
+
+inline bool
+module::link_gas_intrinsic()
 {
-    return static_link_nargs(m_module, module, function_name, function_pointer, nargs, ret_type);
+    M3Result result =
+        m3_LinkRawFunction(m_module, wasm_api::GAS_INTRINSIC_MODULE, wasm_api::GAS_INTRINSIC_FN,
+                           "v(I)", &detail::consume_gas_intrinsic);
+    // An env.gas import of another type is not the intrinsic,
+    // and is left for the user to link.
+    return (result == m3Err_none
+        || result == m3Err_functionLookupFailed
+        || result == m3Err_signatureMismatch);
 }
 
 } // namespace wasm3
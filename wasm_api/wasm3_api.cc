@@ -16,57 +16,326 @@
 
 #include "wasm_api/wasm3_api.h"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
 #include <utility>
 
 namespace wasm_api
 {
 
-Wasm3_WasmRuntime::Wasm3_WasmRuntime(std::unique_ptr<wasm3::runtime> r,
-                                     std::unique_ptr<wasm3::module> m)
-    : runtime(std::move(r))
-    , module(std::move(m))
-    , available_gas_(0)
+Wasm3_WasmRuntime::Wasm3_WasmRuntime(std::shared_ptr<Wasm3_CompiledModule> origin,
+                                     Wasm3_CompiledModule::Instance instance,
+                                     HostCallContext* host_call_context)
+    : origin(std::move(origin))
+    , instance(std::move(instance))
+    , available_gas_(host_call_context->available_gas)
 {}
 
-std::unique_ptr<WasmRuntime>
-Wasm3_WasmContext::new_runtime_instance(Script const& contract, void* ctxp, const Hash* /*unuseds*/)
+Wasm3_WasmRuntime::~Wasm3_WasmRuntime()
+{
+    origin->recycle(std::move(instance));
+}
+
+std::shared_ptr<detail::CompiledModuleImpl>
+Wasm3_WasmContext::compile(Script const& contract, const Hash* script_identifier)
 {
     if (contract.data == nullptr)
     {
     	return nullptr;
-       /* throw UnrecoverableSystemError(
-            "invalid nullptr passed to wasm3_wasmcontext"); */
     }
 
-    std::unique_ptr<WasmRuntime> out = std::make_unique<WasmRuntime>(ctxp);
+    return compile([&] () {
+        auto copy = std::make_shared<const std::vector<uint8_t>>(
+            contract.data, contract.data + contract.len);
+        return SharedScript {
+            .data = std::shared_ptr<const uint8_t>(copy, copy->data()),
+            .len = contract.len
+        };
+    }, script_identifier);
+}
 
-    std::lock_guard lock(mtx);
-    auto module = env.parse_module(contract.data, contract.len);
+std::shared_ptr<detail::CompiledModuleImpl>
+Wasm3_WasmContext::compile_shared(SharedScript const& contract, const Hash* script_identifier)
+{
+    if (contract.data == nullptr)
+    {
+    	return nullptr;
+    }
+
+    return compile([&] () { return contract; }, script_identifier);
+}
+
+std::shared_ptr<detail::CompiledModuleImpl>
+Wasm3_WasmContext::compile(std::function<SharedScript()> const& get_bytes,
+                           const Hash* script_identifier)
+{
+    const size_t shard = this_thread_env_shard();
+
+    auto parse = [&] () -> std::optional<std::pair<std::shared_ptr<Wasm3_CompiledModule>, uint64_t>> {
+        SharedScript bytes = get_bytes();
+        if (gas_instrumenter) {
+            bytes = gas_instrumenter->instrument(bytes.get(), script_identifier);
+            if (!bytes.data) {
+                return std::nullopt;
+            }
+        }
 
-    if (!module) {
+        std::unique_ptr<wasm3::module> module;
+        {
+            std::lock_guard lock(envs[shard].mtx);
+            module = envs[shard].env.parse_module(bytes.data, bytes.len);
+        }
+        if (!module) {
+            return std::nullopt;
+        }
+        return std::make_pair(
+            std::make_shared<Wasm3_CompiledModule>(*this, bytes, std::move(module), shard, script_identifier),
+            bytes.len);
+    };
+
+    auto res = (script_identifier != nullptr)
+        ? module_cache.get_or_insert(*script_identifier, parse)
+        : parse().transform([] (auto const& p) { return p.first; });
+
+    if (!res) {
         return nullptr;
     }
+    return *res;
+}
 
-    auto runtime
-        = env.new_runtime(MAX_STACK_BYTES, out->get_host_call_context());
+size_t
+Wasm3_WasmContext::this_thread_env_shard()
+{
+    return std::hash<std::thread::id>{}(std::this_thread::get_id()) % ENV_SHARDS;
+}
 
-    if (!runtime->load(*module))
+std::unique_ptr<detail::WasmRuntimeImpl>
+Wasm3_CompiledModule::instantiate(HostCallContext* host_call_context)
+{
+    std::unique_ptr<wasm3::module> module;
+    size_t shard = Wasm3_WasmContext::this_thread_env_shard();
     {
-    	return nullptr;
+        std::lock_guard lock(mtx);
+        if (!free_instances.empty()) {
+            Instance instance = std::move(free_instances.back());
+            free_instances.pop_back();
+            instance.runtime->set_user_data(host_call_context);
+            return std::make_unique<Wasm3_WasmRuntime>(shared_from_this(), std::move(instance), host_call_context);
+        }
+        if (parsed) {
+            module = std::move(parsed);
+            shard = parsed_shard;
+        }
     }
 
-    Wasm3_WasmRuntime* new_runtime
-        = new Wasm3_WasmRuntime(std::move(runtime), std::move(module));
+    auto& env_shard = context.envs[shard];
 
-    out->initialize(new_runtime);
+    std::unique_ptr<wasm3::runtime> runtime;
+    {
+        std::lock_guard lock(env_shard.mtx);
+        if (!module) {
+            module = env_shard.env.parse_module(bytes.data, bytes.len);
+        }
 
-    return std::unique_ptr<WasmRuntime>(out.release());
+        if (!module) {
+            return nullptr;
+        }
+
+        runtime = env_shard.env.new_runtime(context.MAX_STACK_BYTES, host_call_context);
+
+        if (!runtime->load(*module))
+        {
+            return nullptr;
+        }
+    }
+
+    // Before any user links (which happen per instance, in
+    // link_fn_nargs()), so that those can replace it.
+    if (!module->link_gas_intrinsic())
+    {
+        return nullptr;
+    }
+
+    std::optional<uint64_t> new_size;
+    {
+        std::lock_guard lock(mtx);
+        if (!snapshot_taken) {
+            snapshot_taken = true;
+            if (!module->has_start_function()) {
+                auto mem = runtime->get_memory();
+                snapshot = Snapshot {
+                    .memory = std::vector<std::byte>(mem.begin(), mem.end()),
+                    .globals = module->get_globals()
+                };
+                new_size = cached_size();
+            }
+        }
+    }
+    if (new_size) {
+        update_cached_size(*new_size);
+    }
+
+    return std::make_unique<Wasm3_WasmRuntime>(shared_from_this(),
+        Instance { .runtime = std::move(runtime), .module = std::move(module), .linked = {}, .prepared = {} },
+        host_call_context);
+}
+
+bool
+Wasm3_CompiledModule::restore(Instance& instance) const
+{
+    if (!snapshot) {
+        return false;
+    }
+
+    auto mem = instance.runtime->get_memory();
+    if (mem.size() != snapshot->memory.size()) {
+        return false;
+    }
+
+    // Most pages of a large memory are typically untouched,
+    // so only rewrite those that differ
+    constexpr size_t CHUNK = 4096;
+    for (size_t i = 0; i < mem.size(); i += CHUNK) {
+        size_t len = std::min(CHUNK, mem.size() - i);
+        if (std::memcmp(mem.data() + i, snapshot->memory.data() + i, len) != 0) {
+            std::memcpy(mem.data() + i, snapshot->memory.data() + i, len);
+        }
+    }
+
+    instance.module->set_globals(snapshot->globals);
+    return true;
+}
+
+void
+Wasm3_CompiledModule::recycle(Instance instance)
+{
+    if (!instance.runtime) {
+        return;
+    }
+
+    // snapshot is written (once, under mtx) before instantiate()
+    // returns any instance, so it is safe to read here without the lock
+    if (!restore(instance)) {
+        return;
+    }
+    instance.runtime->set_user_data(nullptr);
+
+    if (cache_key && !context.module_cache.contains(*cache_key, shared_from_this())) {
+        drop_free_instances();
+        return;
+    }
+
+    std::optional<uint64_t> new_size;
+    {
+        std::lock_guard lock(mtx);
+        if (evicted || free_instances.size() >= MAX_FREE_INSTANCES) {
+            return;
+        }
+        free_instances.push_back(std::move(instance));
+        if (free_instances.size() > max_free_instances_seen) {
+            max_free_instances_seen = free_instances.size();
+            new_size = cached_size();
+        }
+    }
+    if (new_size) {
+        update_cached_size(*new_size);
+    }
+}
+
+uint64_t
+Wasm3_CompiledModule::cached_size() const
+{
+    uint64_t out = bytes.len;
+    if (snapshot) {
+        const uint64_t snapshot_size = snapshot->memory.size()
+            + snapshot->globals.size() * sizeof(uint64_t);
+        // each free instance holds a memory the size of the snapshot's
+        out += snapshot_size
+            + max_free_instances_seen * (snapshot->memory.size() + context.MAX_STACK_BYTES);
+    }
+    return out;
+}
+
+void
+Wasm3_CompiledModule::update_cached_size(uint64_t size)
+{
+    if (!cache_key) {
+        return;
+    }
+    if (!context.module_cache.resize(*cache_key, shared_from_this(), size)) {
+        drop_free_instances();
+    }
+}
+
+void
+Wasm3_CompiledModule::drop_free_instances()
+{
+    // destroyed outside of mtx
+    std::vector<Instance> dropped;
+    std::lock_guard lock(mtx);
+    evicted = true;
+    dropped.swap(free_instances);
+}
+
+bool
+Wasm3_WasmRuntime::link_fn_nargs(
+    std::string const& module_name,
+    std::string const& fn_name,
+    void* fn,
+    void* trampoline,
+    uint8_t nargs,
+    WasmValueType ret_type,
+    HostFnGasCost const& gas)
+{
+    auto& linked_fn = instance.linked_by_name.emplace_back(wasm3::linked_host_fn {
+        .fn = fn,
+        .trampoline = trampoline,
+        .gas = gas
+    });
+
+    if (!instance.module->link_nargs(module_name.c_str(), fn_name.c_str(), &linked_fn, nargs, ret_type)) {
+        instance.linked_by_name.pop_back();
+        return false;
+    }
+    return true;
+}
+
+bool
+Wasm3_WasmRuntime::link_entry(detail::DefaultLinkEntry const& entry)
+{
+    // Linking compiles a trampoline into the runtime's code pages,
+    // so don't do it again when a recycled instance is relinked.
+    // Entries are immutable, so one already linked is linked
+    // exactly as before.
+    auto [it, inserted] = instance.linked.try_emplace(entry.index, wasm3::linked_host_fn {
+        .fn = entry.fn,
+        .trampoline = entry.trampoline,
+        .gas = entry.gas
+    });
+    if (!inserted) {
+        return true;
+    }
+
+    if (!instance.module->link_nargs(entry.module_name.c_str(), entry.fn_name.c_str(),
+            &it->second, entry.nargs, entry.ret_type)) {
+        instance.linked.erase(it);
+        return false;
+    }
+    return true;
+}
+
+bool
+Wasm3_WasmRuntime::reset()
+{
+    return origin->restore(instance);
 }
 
 InvokeStatus<uint64_t>
 Wasm3_WasmRuntime::invoke(std::string const& method_name)
 {
-    auto fn = runtime->find_function(method_name.c_str());
+    auto fn = instance.runtime->find_function(method_name.c_str());
 
     if (!fn){
     	return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
@@ -75,29 +344,68 @@ Wasm3_WasmRuntime::invoke(std::string const& method_name)
     return fn->call();
 }
 
-bool
-__attribute__((warn_unused_result))
-Wasm3_WasmRuntime::consume_gas(uint64_t gas)
+wasm3::function*
+Wasm3_WasmRuntime::find_prepared(uint32_t method_index, std::string const& method_name)
 {
-    if (gas > available_gas_)
-    {
-        available_gas_ = 0;
-        return false;
+    auto& prepared = instance.prepared;
+    if (method_index >= prepared.size()) {
+        prepared.resize(method_index + 1);
     }
-    available_gas_ -= gas;
-    return true;
+    if (!prepared[method_index]) {
+        prepared[method_index] = instance.runtime->find_function(method_name.c_str());
+        if (!prepared[method_index]) {
+            return nullptr;
+        }
+    }
+    return &*prepared[method_index];
 }
 
-void
-Wasm3_WasmRuntime::set_available_gas(uint64_t gas)
+InvokeStatus<uint64_t>
+Wasm3_WasmRuntime::invoke_prepared(uint32_t method_index, std::string const& method_name)
 {
-    available_gas_ = gas;
+    auto* fn = find_prepared(method_index, method_name);
+    if (!fn) {
+        return InvokeStatus<uint64_t>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR};
+    }
+    return fn->call();
 }
 
-uint64_t
-Wasm3_WasmRuntime::get_available_gas() const
+MeteredReturn
+Wasm3_WasmRuntime::invoke_metered(uint32_t method_index,
+                                  std::string const& method_name,
+                                  uint64_t gas_limit)
+{
+    const uint64_t gas_backup = available_gas_;
+
+    available_gas_ = gas_limit;
+    auto res = Wasm3_WasmRuntime::invoke_prepared(method_index, method_name);
+    const uint64_t gas_remaining = available_gas_;
+
+    available_gas_ = gas_backup;
+    return metered_return(res, gas_limit, gas_remaining);
+}
+
+MeteredReturn
+Wasm3_WasmRuntime::invoke_typed(uint32_t method_index,
+                                detail::ExportedFunction const& method,
+                                uint64_t gas_limit,
+                                std::span<const uint64_t> args,
+                                std::span<uint64_t> results)
 {
-    return available_gas_;
+    auto* fn = find_prepared(method_index, method.name);
+    if (!fn) {
+        return metered_return(InvokeStatus<void>{std::unexpect_t{}, InvokeError::DETERMINISTIC_ERROR},
+                              gas_limit, gas_limit);
+    }
+
+    const uint64_t gas_backup = available_gas_;
+
+    available_gas_ = gas_limit;
+    auto res = fn->call_raw(args, results);
+    const uint64_t gas_remaining = available_gas_;
+
+    available_gas_ = gas_backup;
+    return metered_return(res, gas_limit, gas_remaining);
 }
 
 } // namespace wasm_api
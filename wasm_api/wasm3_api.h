@@ -19,11 +19,21 @@
 #include "wasm_api/wasm_api.h"
 
 #include "wasm_api/wasm3.h"
+#include "wasm_api/gas_instrument.h"
+#include "wasm_api/module_cache.h"
+
+#include <functional>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace wasm_api
 {
 
 class Wasm3_WasmRuntime;
+class Wasm3_CompiledModule;
 
 class Wasm3_WasmContext : public detail::WasmContextImpl
 {
@@ -31,63 +41,238 @@ public:
     using runtime_t = Wasm3_WasmRuntime;
 
     Wasm3_WasmContext(uint32_t MAX_STACK_BYTES)
-        : env()
+        : envs()
         , MAX_STACK_BYTES(MAX_STACK_BYTES)
     {}
 
-    std::unique_ptr<WasmRuntime> new_runtime_instance(Script const& contract,
-                                                      void* ctxp,
-                                                      const Hash* /*unused*/) override;
+    std::shared_ptr<detail::CompiledModuleImpl> compile(Script const& contract,
+                                                        const Hash* script_identifier) override;
+
+    std::shared_ptr<detail::CompiledModuleImpl> compile_shared(SharedScript const& contract,
+                                                               const Hash* script_identifier) override;
+
+    ModuleCacheStats get_module_cache_stats() const override {
+        return module_cache.get_stats();
+    }
+    void set_module_cache_budget(uint64_t budget_bytes) override {
+        module_cache.set_budget(budget_bytes);
+    }
+
+    bool set_gas_instrumentation(GasInstrumentationConfig const& config) override {
+        gas_instrumenter = std::make_unique<detail::GasInstrumenter>(config);
+        return true;
+    }
 
 private:
-    std::mutex mtx;
-    wasm3::environment env;
+    friend class Wasm3_CompiledModule;
+
+    // An M3Environment is not threadsafe (parsing a module interns
+    // its function types in the environment), and a module must be loaded
+    // into a runtime from the environment it was parsed in.
+    // So that instantiations on different threads do not all contend
+    // on one lock, each thread uses one of several environments.
+    struct EnvShard
+    {
+        std::mutex mtx;
+        wasm3::environment env;
+    };
+
+    constexpr static size_t ENV_SHARDS = 16;
+
+    std::array<EnvShard, ENV_SHARDS> envs;
     const uint32_t MAX_STACK_BYTES;
+
+    static size_t this_thread_env_shard();
+
+    // get_bytes is only called on a cache miss, so that
+    // a Script is only copied if it has to be parsed.
+    std::shared_ptr<detail::CompiledModuleImpl>
+    compile(std::function<SharedScript()> const& get_bytes,
+            const Hash* script_identifier);
+
+    // wasm3 compiles functions lazily, into code pages owned by
+    // the runtime that a module is loaded into, so compiled code can only
+    // be shared by reusing runtimes.  Cached modules keep their own
+    // pool of runtimes (see Wasm3_CompiledModule).
+    detail::ModuleCache<std::shared_ptr<Wasm3_CompiledModule>> module_cache;
+
+    // nullptr unless set_gas_instrumentation() was called
+    std::unique_ptr<detail::GasInstrumenter> gas_instrumenter;
 };
 
-class Wasm3_WasmRuntime : public detail::WasmRuntimeImpl
+class Wasm3_CompiledModule
+    : public detail::CompiledModuleImpl
+    , public std::enable_shared_from_this<Wasm3_CompiledModule>
 {
 public:
-    Wasm3_WasmRuntime(std::unique_ptr<wasm3::runtime> r,
-                      std::unique_ptr<wasm3::module> m);
+    // cache_key is nullptr if the module is not in context's module cache
+    Wasm3_CompiledModule(Wasm3_WasmContext& context,
+                         SharedScript bytes,
+                         std::unique_ptr<wasm3::module> parsed,
+                         size_t parsed_shard,
+                         const Hash* cache_key)
+        : context(context)
+        , bytes(std::move(bytes))
+        , parsed(std::move(parsed))
+        , parsed_shard(parsed_shard)
+        , cache_key(cache_key ? std::optional<Hash>(*cache_key) : std::nullopt)
+    {}
+
+    std::unique_ptr<detail::WasmRuntimeImpl> instantiate(HostCallContext* host_call_context) override;
+
+private:
+    friend class Wasm3_WasmRuntime;
+
+    // A runtime (and the module loaded into it) whose wasm3 runtime
+    // has already compiled (some of) the module's functions.
+    struct Instance
+    {
+        std::unique_ptr<wasm3::runtime> runtime;
+        std::unique_ptr<wasm3::module> module;
+        // DefaultLinkEntry::index -> host fn linked there.
+        // The values are the linked functions' userdata, so the map's
+        // nodes must not move.
+        std::unordered_map<uint32_t, wasm3::linked_host_fn> linked;
+        // userdata of functions linked by link_fn_nargs() directly
+        // (not from a link entry), which are not reused
+        std::list<wasm3::linked_host_fn> linked_by_name;
+        // by MethodHandle index
+        std::vector<std::optional<wasm3::function>> prepared;
+    };
+
+    // State of an instance just after loading
+    struct Snapshot
+    {
+        std::vector<std::byte> memory;
+        std::vector<uint64_t> globals;
+    };
+
+    // Instances kept for reuse.  Each holds a copy of linear memory
+    // (and a stack), so this stays small.
+    constexpr static size_t MAX_FREE_INSTANCES = 8;
+
+    Wasm3_WasmContext& context;
+    SharedScript bytes;
+
+    // A wasm3 module is consumed by the runtime that loads it,
+    // so each instantiate() parses a new one, except that
+    // the first can use the module parsed (to validate) in compile().
+    std::mutex mtx;
+    std::unique_ptr<wasm3::module> parsed;
+    // environment that parsed belongs to
+    size_t parsed_shard;
+
+    // Instances of dropped (or reset) runtimes are restored to snapshot
+    // and reused, so that their compiled code is not thrown away.
+    // Modules with a start function are never reused (snapshot stays
+    // empty), as the state after loading is not the state after start.
+    std::optional<Snapshot> snapshot;
+    bool snapshot_taken = false;
+    std::vector<Instance> free_instances;
+
+    // A cached module is charged (in the module cache) for its
+    // snapshot and for the most free instances it has held, so that
+    // idle instances count against the cache's budget.  Once evicted,
+    // it stops keeping free instances.
+    const std::optional<Hash> cache_key;
+    size_t max_free_instances_seen = 0;
+    bool evicted = false;
+
+    // Approximate bytes held, as charged to the module cache.  Needs mtx.
+    uint64_t cached_size() const;
+    // Called without mtx held
+    void update_cached_size(uint64_t size);
+    // On eviction from the module cache
+    void drop_free_instances();
+
+    // Returns false if instance cannot be restored
+    // (i.e. its memory was grown).
+    bool restore(Instance& instance) const;
+
+    // Called by ~Wasm3_WasmRuntime
+    void recycle(Instance instance);
+};
+
+class Wasm3_WasmRuntime final : public detail::WasmRuntimeImpl
+{
+public:
+    Wasm3_WasmRuntime(std::shared_ptr<Wasm3_CompiledModule> origin,
+                      Wasm3_CompiledModule::Instance instance,
+                      HostCallContext* host_call_context);
 
     std::span<std::byte> get_memory() override
     {
-        return runtime->get_memory();
+        return instance.runtime->get_memory();
     }
 
     std::span<const std::byte> get_memory() const override
     {
-        return runtime->get_memory();
+        return instance.runtime->get_memory();
     }
 
     bool link_fn_nargs(
         std::string const& module_name,
         std::string const& fn_name,
         void* fn,
+        void* trampoline,
         uint8_t nargs,
-        WasmValueType ret_type) override
-    {
-        return module -> link_nargs(module_name.c_str(), fn_name.c_str(), fn, nargs, ret_type);
-    }
+        WasmValueType ret_type,
+        HostFnGasCost const& gas) override;
+    bool link_entry(detail::DefaultLinkEntry const& entry) override;
 
     InvokeStatus<uint64_t> invoke(std::string const& method_name) override;
+    InvokeStatus<uint64_t> invoke_prepared(uint32_t method_index,
+                                           std::string const& method_name) override;
+    MeteredReturn invoke_metered(uint32_t method_index,
+                                 std::string const &method_name,
+                                 uint64_t gas_limit) override;
+    MeteredReturn invoke_typed(uint32_t method_index,
+                               detail::ExportedFunction const& method,
+                               uint64_t gas_limit,
+                               std::span<const uint64_t> args,
+                               std::span<uint64_t> results) override;
 
     // This version of WasmRuntime requires the wasm to be instrumented
-    // with calls to a "consume gas" function.  Host functions
-    // should also call into this, as necessary.
+    // with calls to the gas import (GAS_INTRINSIC_MODULE/GAS_INTRINSIC_FN),
+    // which is linked to a native decrement of available_gas_.
+    // Host functions should also call into this, as necessary.
     bool
     __attribute__((warn_unused_result))
-    consume_gas(uint64_t gas) override;
+    consume_gas(uint64_t gas) override
+    {
+        if (gas > available_gas_)
+        {
+            available_gas_ = 0;
+            return false;
+        }
+        available_gas_ -= gas;
+        return true;
+    }
+
+    void set_available_gas(uint64_t gas) override
+    {
+        available_gas_ = gas;
+    }
+
+    uint64_t get_available_gas() const override
+    {
+        return available_gas_;
+    }
+
+    bool reset() override;
 
-    void set_available_gas(uint64_t gas) override;
-    uint64_t get_available_gas() const override;
+    ~Wasm3_WasmRuntime();
 
 private:
-    std::unique_ptr<wasm3::runtime> runtime;
-    std::unique_ptr<wasm3::module> module;
+    std::shared_ptr<Wasm3_CompiledModule> origin;
+    Wasm3_CompiledModule::Instance instance;
+
+    // nullptr if there is no such export
+    wasm3::function* find_prepared(uint32_t method_index, std::string const& method_name);
 
-    uint64_t available_gas_;
+    // Lives in the owning WasmRuntime's HostCallContext,
+    // so host functions can consume gas without a virtual call
+    uint64_t& available_gas_;
 };
 
 } // namespace wasm_api
@@ -16,6 +16,9 @@
 
 #include "wasm_api/wasm_api.h"
 
+#include "wasm_api/compile_pool.h"
+#include "wasm_api/module_cache.h"
+#include "wasm_api/wasm_imports.h"
 #include "wasm_api/stitch_api.h"
 #include "wasm_api/wasm3_api.h"
 #include "wasm_api/wasmi_api.h"
@@ -25,8 +28,10 @@
 #include <stdexcept>
 #include <string.h>
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstring>
+#include <thread>
 #include <variant>
 
 namespace wasm_api
@@ -62,7 +67,8 @@ std::string engine_to_string(std::variant<SupportedWasmEngine, WasmContext> engi
 }
 
 WasmContext::WasmContext(const uint32_t MAX_STACK_BYTES,
-                         SupportedWasmEngine engine)
+                         SupportedWasmEngine engine,
+                         uint32_t compile_threads)
     : impl([&]() -> detail::WasmContextImpl* {
         switch (engine)
         {
@@ -83,6 +89,10 @@ WasmContext::WasmContext(const uint32_t MAX_STACK_BYTES,
         }
     }())
     , engine_type(engine)
+    , compile_pool(std::make_shared<detail::CompilePool>(
+        (compile_threads == 0)
+            ? std::max<uint32_t>(std::thread::hardware_concurrency() / 4, 1)
+            : compile_threads))
 {
     if (impl) {
         if (!impl -> init_success()) {
@@ -93,38 +103,273 @@ WasmContext::WasmContext(const uint32_t MAX_STACK_BYTES,
 
 std::unique_ptr<WasmRuntime>
 WasmContext::new_runtime_instance(Script const& contract, void* ctxp, const Hash* script_identifier)
+{
+    return compile(contract, script_identifier).instantiate(ctxp);
+}
+
+CompiledModule
+WasmContext::compile(std::shared_ptr<detail::WasmContextImpl> const& impl,
+                     Script const& contract,
+                     const Hash* script_identifier)
 {
     if (contract.data == nullptr)
     {
-        return nullptr;
+        return {};
     }
     if (!impl) {
+        return {};
+    }
+    auto compiled = impl->compile(contract, script_identifier);
+    if (!compiled) {
+        return {};
+    }
+    auto tables = impl->get_module_tables(contract, script_identifier);
+    return CompiledModule(impl, std::move(compiled), tables->link_table, tables->exports);
+}
+
+CompiledModule
+WasmContext::compile(std::shared_ptr<detail::WasmContextImpl> const& impl,
+                     SharedScript const& contract,
+                     const Hash* script_identifier)
+{
+    if (contract.data == nullptr)
+    {
+        return {};
+    }
+    if (!impl) {
+        return {};
+    }
+    auto compiled = impl->compile_shared(contract, script_identifier);
+    if (!compiled) {
+        return {};
+    }
+    auto tables = impl->get_module_tables(contract.get(), script_identifier);
+    return CompiledModule(impl, std::move(compiled), tables->link_table, tables->exports);
+}
+
+CompiledModule
+WasmContext::compile(Script const& contract, const Hash* script_identifier)
+{
+    return compile(impl, contract, script_identifier);
+}
+
+CompiledModule
+WasmContext::compile(SharedScript const& contract, const Hash* script_identifier)
+{
+    return compile(impl, contract, script_identifier);
+}
+
+std::future<CompiledModule>
+WasmContext::compile_async(Script const& contract, const Hash* script_identifier, int32_t priority)
+{
+    if (contract.data == nullptr)
+    {
+        return compile_async(SharedScript { .data = nullptr, .len = 0 }, script_identifier, priority);
+    }
+
+    auto bytes = std::make_shared<const std::vector<uint8_t>>(
+        contract.data, contract.data + contract.len);
+    return compile_async(
+        SharedScript { .data = std::shared_ptr<const uint8_t>(bytes, bytes -> data()), .len = contract.len },
+        script_identifier,
+        priority);
+}
+
+std::future<CompiledModule>
+WasmContext::compile_async(SharedScript const& contract, const Hash* script_identifier, int32_t priority)
+{
+    if (contract.data == nullptr || !impl)
+    {
+        std::promise<CompiledModule> p;
+        p.set_value({});
+        return p.get_future();
+    }
+
+    std::optional<Hash> id;
+    if (script_identifier != nullptr) {
+        id = *script_identifier;
+    }
+
+    return compile_pool -> submit(
+        [impl = impl, contract, id] () -> CompiledModule {
+            return compile(impl, contract, id ? &*id : nullptr);
+        }, priority);
+}
+
+std::unique_ptr<WasmRuntime>
+CompiledModule::instantiate(void* ctxp) const
+{
+    if (!impl) {
+        return nullptr;
+    }
+    std::unique_ptr<WasmRuntime> out = std::make_unique<WasmRuntime>(ctxp);
+
+    auto runtime_impl = impl->instantiate(out->get_host_call_context());
+    if (!runtime_impl) {
         return nullptr;
     }
-    auto pre_link = impl->new_runtime_instance(contract, ctxp, script_identifier);
-    if (!impl -> finish_link(pre_link)) {
+    out->initialize(runtime_impl.release());
+    out->origin = *this;
+
+    if (!context -> finish_link(*out, link_table.get())) {
         return nullptr;
     }
-    return pre_link;
+    return out;
 }
 
 namespace detail {
+WasmContextImpl::WasmContextImpl()
+    : module_tables(std::make_unique<ModuleCache<std::shared_ptr<const ModuleTables>>>())
+{}
+
+WasmContextImpl::~WasmContextImpl()
+{}
+
 bool 
-WasmContextImpl::finish_link(std::unique_ptr<WasmRuntime>& pre_link)
+WasmContextImpl::finish_link(WasmRuntime& pre_link, LinkTable const* link_table)
 {
-    if (!pre_link) {
-        return false;
+    if (link_table != nullptr) {
+        for (auto const* entry : *link_table)
+        {
+            if (!pre_link.link_fn(*entry))
+            {
+                return false;
+            }
+        }
+        return true;
     }
+
     std::lock_guard lock(link_entry_mutex);
     for (auto const& entry : link_entries)
     {
-        if (!pre_link -> link_fn(entry))
+        if (!pre_link.link_fn(entry))
         {
             return false;
         }
     }
     return true;
 }
+
+std::shared_ptr<const LinkTable>
+WasmContextImpl::make_link_table(Script const& contract)
+{
+    if (!links_frozen) {
+        return nullptr;
+    }
+
+    auto imports = parse_function_imports(contract);
+    if (!imports) {
+        return nullptr;
+    }
+
+    auto out = std::make_shared<LinkTable>();
+    for (auto const& entry : link_entries)
+    {
+        bool imported = std::ranges::any_of(*imports, [&] (FunctionImport const& import) {
+            return import.first == entry.module_name && import.second == entry.fn_name;
+        });
+        if (imported) {
+            out->push_back(&entry);
+        }
+    }
+    return out;
+}
+
+namespace {
+
+// approximate, for the cache's budget
+uint64_t
+module_tables_size(ModuleTables const& tables)
+{
+    uint64_t out = sizeof(ModuleTables);
+    if (tables.link_table) {
+        out += tables.link_table->size() * sizeof(DefaultLinkEntry const*);
+    }
+    for (auto const& e : *tables.exports) {
+        out += sizeof(ExportedFunction) + e.name.size();
+        if (e.signature) {
+            out += e.signature->params.size() + e.signature->results.size();
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+std::shared_ptr<const ModuleTables>
+WasmContextImpl::make_module_tables(Script const& contract)
+{
+    return std::make_shared<const ModuleTables>(ModuleTables {
+        .link_table = make_link_table(contract),
+        .exports = make_export_table(contract)
+    });
+}
+
+std::shared_ptr<const ModuleTables>
+WasmContextImpl::get_module_tables(Script const& contract, const Hash* script_identifier)
+{
+    if (script_identifier == nullptr) {
+        return make_module_tables(contract);
+    }
+
+    auto tables = module_tables->get_or_insert(*script_identifier, [&] () {
+        auto out = make_module_tables(contract);
+        return std::make_optional(std::make_pair(out, module_tables_size(*out)));
+    });
+
+    // made before links were frozen -- links_frozen never goes back
+    // to false, so this happens at most once per module.  The export
+    // table is kept, so that existing MethodHandles stay valid.
+    if (links_frozen && !(*tables)->link_table) {
+        auto start = std::chrono::steady_clock::now();
+        auto out = std::make_shared<const ModuleTables>(ModuleTables {
+            .link_table = make_link_table(contract),
+            .exports = (*tables)->exports
+        });
+        module_tables->put(*script_identifier, out, module_tables_size(*out),
+            std::chrono::steady_clock::now() - start);
+        return out;
+    }
+    return *tables;
+}
+
+MeteredReturn
+WasmRuntimeImpl::invoke_metered(uint32_t method_index,
+                                std::string const& method_name,
+                                uint64_t gas_limit)
+{
+    uint64_t gas_backup = get_available_gas();
+
+    set_available_gas(gas_limit);
+    auto res = invoke_prepared(method_index, method_name);
+    uint64_t gas_remaining = get_available_gas();
+
+    set_available_gas(gas_backup);
+    return metered_return(res, gas_limit, gas_remaining);
+}
+
+size_t
+WasmRuntimeImpl::invoke_batch(std::span<const InvokeRequest> requests,
+                              std::span<MeteredReturn> results,
+                              BatchErrorPolicy policy)
+{
+    uint64_t gas_backup = get_available_gas();
+
+    size_t i = 0;
+    while (i < requests.size()) {
+        auto const& request = requests[i];
+        set_available_gas(request.gas_limit);
+        auto res = invoke_prepared(request.method.get_index(), request.method.get_name());
+        results[i] = metered_return(res, request.gas_limit, get_available_gas());
+
+        if (batch_should_stop(results[i++].result, policy)) {
+            break;
+        }
+    }
+
+    set_available_gas(gas_backup);
+    return i;
+}
 }
 
 WasmRuntime::WasmRuntime(void* ctxp)
@@ -169,9 +414,9 @@ WasmRuntime::get_memory() const
     return std::span<const std::byte>();
 }
 
-MeteredReturn 
-WasmRuntime::invoke(std::string const& method_name,
-                                uint64_t gas_limit)
+template<typename F>
+MeteredReturn
+WasmRuntime::metered_invoke(F&& invoke_impl, uint64_t gas_limit)
 {
     if (!impl) {
         return { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
@@ -179,7 +424,7 @@ WasmRuntime::invoke(std::string const& method_name,
     uint64_t gas_backup = impl -> get_available_gas();
 
     impl -> set_available_gas(gas_limit);
-    auto res = impl->invoke(method_name);
+    auto res = invoke_impl();
     uint64_t gas_remaining = impl -> get_available_gas();
 
     if (gas_limit < gas_remaining) {
@@ -196,6 +441,95 @@ WasmRuntime::invoke(std::string const& method_name,
     };
 }
 
+MeteredReturn 
+WasmRuntime::invoke(std::string_view method_name,
+                    uint64_t gas_limit)
+{
+    // the engines cache what they look up by index,
+    // so later invokes of the same method skip the lookup by name
+    if (auto method = prepare(method_name)) {
+        return invoke(method, gas_limit);
+    }
+    return metered_invoke([&] { return impl->invoke(std::string(method_name)); }, gas_limit);
+}
+
+MethodHandle
+WasmRuntime::prepare(std::string_view method_name) const
+{
+    if (!origin.exports) {
+        return {};
+    }
+    auto const& exports = *origin.exports;
+    auto it = std::find_if(exports.begin(), exports.end(), [&] (detail::ExportedFunction const& e) {
+        return e.name == method_name;
+    });
+    if (it == exports.end()) {
+        return {};
+    }
+    return MethodHandle(&exports, static_cast<uint32_t>(it - exports.begin()));
+}
+
+MeteredReturn
+WasmRuntime::invoke(MethodHandle const& method, uint64_t gas_limit)
+{
+    if (!impl || !method || method.exports != origin.exports.get()) {
+        return { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
+    }
+    return impl->invoke_metered(method.index, method.get_name(), gas_limit);
+}
+
+size_t
+WasmRuntime::invoke_batch(std::span<const InvokeRequest> requests,
+                          std::span<MeteredReturn> results,
+                          BatchErrorPolicy policy)
+{
+    requests = requests.first(std::min(requests.size(), results.size()));
+
+    auto bad = std::find_if(requests.begin(), requests.end(), [this] (InvokeRequest const& r) {
+        return !r.method || r.method.exports != origin.exports.get();
+    });
+    size_t n_valid = bad - requests.begin();
+
+    size_t ran = 0;
+    if (impl && n_valid > 0) {
+        ran = impl->invoke_batch(requests.first(n_valid), results, policy);
+        if (ran < n_valid || detail::batch_should_stop(results[ran - 1].result, policy)) {
+            return ran;
+        }
+    }
+    if (ran < requests.size()) {
+        results[ran] = { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
+        ran++;
+    }
+    return ran;
+}
+
+MeteredReturn
+WasmRuntime::invoke_typed(MethodHandle const& method,
+                          uint64_t gas_limit,
+                          std::span<const uint64_t> args,
+                          std::span<uint64_t> results)
+{
+    if (!impl || !method || method.exports != origin.exports.get()) {
+        return { .result = InvokeStatus<uint64_t>(std::unexpect_t{}, InvokeError::UNRECOVERABLE), .gas_consumed = 0 };
+    }
+    return impl->invoke_typed(method.index, (*method.exports)[method.index], gas_limit, args, results);
+}
+
+MeteredReturn
+WasmRuntime::invoke(std::string_view method_name,
+                    uint64_t gas_limit,
+                    void* user_ctx)
+{
+    void* user_ctx_backup = host_call_context.user_ctx;
+    host_call_context.user_ctx = user_ctx;
+
+    auto res = invoke(method_name, gas_limit);
+
+    host_call_context.user_ctx = user_ctx_backup;
+    return res;
+}
+
 bool
 __attribute__((warn_unused_result))
 WasmRuntime::consume_gas(uint64_t gas)
@@ -206,6 +540,32 @@ WasmRuntime::consume_gas(uint64_t gas)
     return false;
 }
 
+bool
+__attribute__((warn_unused_result))
+WasmRuntime::reset()
+{
+    if (!impl) {
+        return false;
+    }
+    if (impl -> reset()) {
+        return true;
+    }
+    if (!origin.impl) {
+        return false;
+    }
+
+    auto fresh = origin.impl->instantiate(&host_call_context);
+    if (!fresh) {
+        return false;
+    }
+    fresh -> set_available_gas(impl -> get_available_gas());
+
+    delete impl;
+    impl = fresh.release();
+
+    return origin.context -> finish_link(*this, origin.link_table.get());
+}
+
 uint64_t
 WasmRuntime::get_available_gas() const
 {
@@ -0,0 +1,218 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+// Just enough of the wasm binary format for
+// wasm_imports.cc and gas_instrument.cc
+
+constexpr static uint32_t WASM_HEADER_LEN = 8; // magic and version
+
+constexpr static uint8_t CUSTOM_SECTION_ID = 0;
+constexpr static uint8_t TYPE_SECTION_ID = 1;
+constexpr static uint8_t IMPORT_SECTION_ID = 2;
+constexpr static uint8_t FUNCTION_SECTION_ID = 3;
+constexpr static uint8_t GLOBAL_SECTION_ID = 6;
+constexpr static uint8_t EXPORT_SECTION_ID = 7;
+constexpr static uint8_t START_SECTION_ID = 8;
+constexpr static uint8_t ELEMENT_SECTION_ID = 9;
+constexpr static uint8_t CODE_SECTION_ID = 10;
+
+constexpr static uint8_t FUNC_TYPE_FORM = 0x60;
+
+constexpr static uint8_t VALUE_TYPE_I32 = 0x7F;
+constexpr static uint8_t VALUE_TYPE_I64 = 0x7E;
+
+constexpr static uint8_t IMPORT_KIND_FUNC = 0;
+constexpr static uint8_t IMPORT_KIND_TABLE = 1;
+constexpr static uint8_t IMPORT_KIND_MEMORY = 2;
+constexpr static uint8_t IMPORT_KIND_GLOBAL = 3;
+
+constexpr static uint8_t EXPORT_KIND_FUNC = 0;
+
+class Reader
+{
+public:
+    Reader(const uint8_t* data, uint32_t len)
+        : cur(data)
+        , end(data + len)
+    {}
+
+    bool done() const { return cur == end; }
+
+    const uint8_t* position() const { return cur; }
+
+    std::optional<uint8_t> peek() const
+    {
+        if (cur == end) {
+            return std::nullopt;
+        }
+        return *cur;
+    }
+
+    std::optional<uint8_t> byte()
+    {
+        if (cur == end) {
+            return std::nullopt;
+        }
+        return *cur++;
+    }
+
+    // unsigned LEB128, at most 32 bits
+    std::optional<uint32_t> u32()
+    {
+        uint32_t out = 0;
+        for (uint32_t shift = 0; shift < 35; shift += 7) {
+            auto b = byte();
+            if (!b) {
+                return std::nullopt;
+            }
+            out |= static_cast<uint32_t>(*b & 0x7F) << shift;
+            if ((*b & 0x80) == 0) {
+                return out;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Any LEB128 (signed or not) of at most max_bytes bytes
+    bool skip_leb(uint32_t max_bytes)
+    {
+        for (uint32_t i = 0; i < max_bytes; i++) {
+            auto b = byte();
+            if (!b) {
+                return false;
+            }
+            if ((*b & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::optional<std::string_view> name()
+    {
+        auto len = u32();
+        if (!len || *len > static_cast<size_t>(end - cur)) {
+            return std::nullopt;
+        }
+        std::string_view out(reinterpret_cast<const char*>(cur), *len);
+        cur += *len;
+        return out;
+    }
+
+    bool skip(uint32_t len)
+    {
+        if (len > static_cast<size_t>(end - cur)) {
+            return false;
+        }
+        cur += len;
+        return true;
+    }
+
+    // Types other than i32 and i64 are read as VOID
+    bool value_types(std::vector<WasmValueType>& out)
+    {
+        auto count = u32();
+        if (!count) {
+            return false;
+        }
+        for (uint32_t i = 0; i < *count; i++) {
+            auto t = byte();
+            if (!t) {
+                return false;
+            }
+            switch (*t) {
+            case VALUE_TYPE_I32:
+                out.push_back(WasmValueType::I32);
+                break;
+            case VALUE_TYPE_I64:
+                out.push_back(WasmValueType::U64);
+                break;
+            default:
+                out.push_back(WasmValueType::VOID);
+            }
+        }
+        return true;
+    }
+
+    bool limits()
+    {
+        auto flags = byte();
+        if (!flags || !u32()) {
+            return false;
+        }
+        if ((*flags & 0x01) && !u32()) {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const uint8_t* cur;
+    const uint8_t* end;
+};
+
+inline void
+write_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+    do {
+        uint8_t b = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            b |= 0x80;
+        }
+        out.push_back(b);
+    } while (value != 0);
+}
+
+inline void
+write_s64(std::vector<uint8_t>& out, int64_t value)
+{
+    while (true) {
+        uint8_t b = value & 0x7F;
+        value >>= 7;
+        if ((value == 0 && (b & 0x40) == 0) || (value == -1 && (b & 0x40) != 0)) {
+            out.push_back(b);
+            return;
+        }
+        out.push_back(b | 0x80);
+    }
+}
+
+inline void
+write_name(std::vector<uint8_t>& out, std::string_view name)
+{
+    write_u32(out, static_cast<uint32_t>(name.size()));
+    out.insert(out.end(), name.begin(), name.end());
+}
+
+} // namespace detail
+
+} // namespace wasm_api
@@ -0,0 +1,259 @@
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_imports.h"
+
+#include "wasm_api/wasm_binary.h"
+
+#include <algorithm>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+namespace
+{
+
+bool
+is_void(WasmValueType t)
+{
+    return t == WasmValueType::VOID;
+}
+
+// Reads the rest of an import of kind.
+// Sets func_type for a function import.
+bool
+read_import_desc(Reader& r, uint8_t kind, std::optional<uint32_t>& func_type)
+{
+    switch (kind) {
+    case IMPORT_KIND_FUNC:
+        func_type = r.u32();
+        return func_type.has_value();
+    case IMPORT_KIND_TABLE:
+        return r.byte() && r.limits();
+    case IMPORT_KIND_MEMORY:
+        return r.limits();
+    case IMPORT_KIND_GLOBAL:
+        return r.byte() && r.byte();
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+std::optional<std::vector<FunctionImport>>
+parse_function_imports(Script const& script)
+{
+    if (script.data == nullptr) {
+        return std::nullopt;
+    }
+
+    Reader r(script.data, script.len);
+
+    // magic and version
+    if (!r.skip(WASM_HEADER_LEN)) {
+        return std::nullopt;
+    }
+
+    std::vector<FunctionImport> out;
+
+    while (!r.done()) {
+        auto id = r.byte();
+        auto size = r.u32();
+        if (!id || !size) {
+            return std::nullopt;
+        }
+
+        // custom sections (0) can appear anywhere,
+        // and every other section before imports is type (1)
+        if (*id != IMPORT_SECTION_ID) {
+            if (*id > IMPORT_SECTION_ID) {
+                return out;
+            }
+            if (!r.skip(*size)) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        auto count = r.u32();
+        if (!count) {
+            return std::nullopt;
+        }
+        for (uint32_t i = 0; i < *count; i++) {
+            auto module_name = r.name();
+            auto fn_name = r.name();
+            auto kind = r.byte();
+            if (!module_name || !fn_name || !kind) {
+                return std::nullopt;
+            }
+
+            std::optional<uint32_t> func_type;
+            if (!read_import_desc(r, *kind, func_type)) {
+                return std::nullopt;
+            }
+            if (func_type) {
+                out.emplace_back(*module_name, *fn_name);
+            }
+        }
+        return out;
+    }
+    return out;
+}
+
+std::optional<ExportTable>
+parse_function_exports(Script const& script)
+{
+    if (script.data == nullptr) {
+        return std::nullopt;
+    }
+
+    Reader r(script.data, script.len);
+
+    // magic and version
+    if (!r.skip(WASM_HEADER_LEN)) {
+        return std::nullopt;
+    }
+
+    std::vector<std::optional<FunctionSignature>> types;
+    // type index of each function, imports first
+    std::vector<uint32_t> functions;
+
+    auto signature_of = [&] (uint32_t fn_index) -> std::optional<FunctionSignature> {
+        if (fn_index >= functions.size() || functions[fn_index] >= types.size()) {
+            return std::nullopt;
+        }
+        return types[functions[fn_index]];
+    };
+
+    ExportTable out;
+
+    while (!r.done()) {
+        auto id = r.byte();
+        auto size = r.u32();
+        if (!id || !size) {
+            return std::nullopt;
+        }
+
+        switch (*id) {
+        case TYPE_SECTION_ID:
+        {
+            auto count = r.u32();
+            if (!count) {
+                return std::nullopt;
+            }
+            for (uint32_t i = 0; i < *count; i++) {
+                auto form = r.byte();
+                if (!form || *form != FUNC_TYPE_FORM) {
+                    return std::nullopt;
+                }
+                FunctionSignature sig;
+                if (!r.value_types(sig.params) || !r.value_types(sig.results)) {
+                    return std::nullopt;
+                }
+                bool representable = std::ranges::none_of(sig.params, is_void)
+                    && std::ranges::none_of(sig.results, is_void);
+                types.push_back(representable ? std::optional(std::move(sig)) : std::nullopt);
+            }
+            break;
+        }
+        case IMPORT_SECTION_ID:
+        {
+            auto count = r.u32();
+            if (!count) {
+                return std::nullopt;
+            }
+            for (uint32_t i = 0; i < *count; i++) {
+                auto module_name = r.name();
+                auto fn_name = r.name();
+                auto kind = r.byte();
+                std::optional<uint32_t> func_type;
+                if (!module_name || !fn_name) {
+                    return std::nullopt;
+                }
+                if (!kind || !read_import_desc(r, *kind, func_type)) {
+                    return std::nullopt;
+                }
+                if (func_type) {
+                    functions.push_back(*func_type);
+                }
+            }
+            break;
+        }
+        case FUNCTION_SECTION_ID:
+        {
+            auto count = r.u32();
+            if (!count) {
+                return std::nullopt;
+            }
+            for (uint32_t i = 0; i < *count; i++) {
+                auto type_index = r.u32();
+                if (!type_index) {
+                    return std::nullopt;
+                }
+                functions.push_back(*type_index);
+            }
+            break;
+        }
+        case EXPORT_SECTION_ID:
+        {
+            auto count = r.u32();
+            if (!count) {
+                return std::nullopt;
+            }
+            for (uint32_t i = 0; i < *count; i++) {
+                auto name = r.name();
+                auto kind = r.byte();
+                auto index = r.u32();
+                if (!name || !kind || !index) {
+                    return std::nullopt;
+                }
+                if (*kind == EXPORT_KIND_FUNC) {
+                    out.push_back(ExportedFunction {
+                        .name = std::string(*name),
+                        .signature = signature_of(*index)
+                    });
+                }
+            }
+            return out;
+        }
+        default:
+            // Section order is not simply by id (e.g. the data count
+            // section comes before code), so skip until exports are found.
+            if (!r.skip(*size)) {
+                return std::nullopt;
+            }
+        }
+    }
+    return out;
+}
+
+std::shared_ptr<const ExportTable>
+make_export_table(Script const& script)
+{
+    auto exports = parse_function_exports(script);
+    if (!exports) {
+        return std::make_shared<ExportTable>();
+    }
+    return std::make_shared<ExportTable>(std::move(*exports));
+}
+
+} // namespace detail
+
+} // namespace wasm_api
@@ -0,0 +1,61 @@
+#pragma once
+
+/**
+ * Copyright 2024 Geoffrey Ramseyer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasm_api/wasm_api.h"
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace wasm_api
+{
+
+namespace detail
+{
+
+// (module name, function name), pointing into the script
+using FunctionImport = std::pair<std::string_view, std::string_view>;
+
+/**
+ * The function imports of a wasm binary, in import order.
+ * Reads only as far as the import section.
+ *
+ * Returns std::nullopt if the binary is malformed (up to the end
+ * of the import section).  This is not validation -- the engine
+ * still parses the whole binary.
+ */
+std::optional<std::vector<FunctionImport>>
+parse_function_imports(Script const& script);
+
+/**
+ * The function exports of a wasm binary (with their signatures),
+ * in export order.  Reads only as far as the export section.
+ * Same caveats as above.
+ */
+std::optional<ExportTable>
+parse_function_exports(Script const& script);
+
+// Empty if the binary is malformed.
+std::shared_ptr<const ExportTable>
+make_export_table(Script const& script);
+
+} // namespace detail
+
+} // namespace wasm_api
@@ -3,6 +3,7 @@
 #include <utility>
 
 #include "wasm_api/bindings.h"
+#include "wasm_api/ffi_batch.h"
 
 #include <cinttypes>
 #include <cassert>
@@ -30,24 +31,56 @@ Wasmi_WasmRuntime::~Wasmi_WasmRuntime()
     free_wasmi_runtime(runtime_pointer);
 }
 
-std::unique_ptr<WasmRuntime>
-Wasmi_WasmContext::new_runtime_instance(Script const& contract, void* ctxp, const Hash* /*unused*/)
+ModuleCacheStats
+Wasmi_WasmContext::get_module_cache_stats() const
 {
-    std::unique_ptr<WasmRuntime> out = std::make_unique<WasmRuntime>(ctxp);
+    auto stats = wasmi_get_cache_stats(context_pointer);
+    return ModuleCacheStats {
+        .hits = stats.hits,
+        .misses = stats.misses,
+        .evictions = stats.evictions,
+        .entries = stats.entries,
+        .bytes = stats.bytes,
+        .budget_bytes = stats.budget_bytes
+    };
+}
 
-    void* wasmi_runtime_ptr = new_wasmi_runtime(contract.data,
-        contract.len, out -> get_host_call_context(), context_pointer);
+void
+Wasmi_WasmContext::set_module_cache_budget(uint64_t budget_bytes)
+{
+    wasmi_set_cache_budget(context_pointer, budget_bytes);
+}
 
-    if (wasmi_runtime_ptr == nullptr) {
+std::shared_ptr<detail::CompiledModuleImpl>
+Wasmi_WasmContext::compile(Script const& contract, const Hash* script_identifier)
+{
+    const uint8_t* id_ptr = (script_identifier == nullptr) ? nullptr : script_identifier -> data();
+
+    void* compiled_pointer = wasmi_compile(contract.data, contract.len, context_pointer, id_ptr);
+
+    if (compiled_pointer == nullptr) {
         return nullptr;
     }
 
-    Wasmi_WasmRuntime* wasmi_runtime = new Wasmi_WasmRuntime(
-        wasmi_runtime_ptr);
+    return std::make_shared<Wasmi_CompiledModule>(compiled_pointer, context_pointer);
+}
+
+Wasmi_CompiledModule::~Wasmi_CompiledModule()
+{
+    free_wasmi_compiled(compiled_pointer);
+}
 
-    out->initialize(wasmi_runtime);
+std::unique_ptr<detail::WasmRuntimeImpl>
+Wasmi_CompiledModule::instantiate(HostCallContext* host_call_context)
+{
+    void* wasmi_runtime_ptr = new_wasmi_runtime(compiled_pointer,
+        host_call_context, context_pointer);
+
+    if (wasmi_runtime_ptr == nullptr) {
+        return nullptr;
+    }
 
-    return out;
+    return std::make_unique<Wasmi_WasmRuntime>(wasmi_runtime_ptr);
 }
 
 std::span<std::byte>
@@ -67,8 +100,10 @@ bool
 Wasmi_WasmContext::link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs,
-    WasmValueType ret_type)
+    WasmValueType ret_type,
+    HostFnGasCost const& gas)
 {
     std::lock_guard lock(link_entry_mutex);
     return wasmi_link_nargs(context_pointer,
@@ -77,8 +112,12 @@ Wasmi_WasmContext::link_fn_nargs(std::string const& module_name,
                      (const uint8_t*)fn_name.c_str(),
                      fn_name.size(),
                      (void*)fn,
+                     trampoline,
                      nargs,
-                     static_cast<uint8_t>(ret_type));
+                     static_cast<uint8_t>(ret_type),
+                     gas.base,
+                     gas.per_byte,
+                     gas.len_arg);
 }
 
 InvokeStatus<uint64_t> 
@@ -98,6 +137,72 @@ Wasmi_WasmRuntime::invoke(std::string const &method_name)
     return InvokeStatus<uint64_t>(std::unexpect_t{}, err);
 }
 
+InvokeStatus<uint64_t>
+Wasmi_WasmRuntime::invoke_prepared(uint32_t method_index, std::string const &method_name)
+{
+    auto invoke_res
+        = ::wasmi_invoke_prepared(runtime_pointer,
+                                  method_index,
+                                  reinterpret_cast<const uint8_t*>(method_name.c_str()),
+                                  static_cast<uint32_t>(method_name.size()));
+
+    InvokeError err = static_cast<InvokeError>(invoke_res.error);
+    if (err == InvokeError::NONE) {
+        return invoke_res.result;
+    }
+
+    return InvokeStatus<uint64_t>(std::unexpect_t{}, err);
+}
+
+MeteredReturn
+Wasmi_WasmRuntime::invoke_typed(uint32_t method_index,
+                                   detail::ExportedFunction const& method,
+                                   uint64_t gas_limit,
+                                   std::span<const uint64_t> args,
+                                   std::span<uint64_t> results)
+{
+    auto const& sig = *method.signature;
+    auto invoke_res
+        = ::wasmi_invoke_typed(runtime_pointer,
+                               method_index,
+                               reinterpret_cast<const uint8_t*>(method.name.c_str()),
+                               static_cast<uint32_t>(method.name.size()),
+                               args.data(),
+                               reinterpret_cast<const uint8_t*>(sig.params.data()),
+                               static_cast<uint32_t>(args.size()),
+                               results.data(),
+                               reinterpret_cast<const uint8_t*>(sig.results.data()),
+                               static_cast<uint32_t>(results.size()),
+                               gas_limit);
+
+    // the result field is unused by *_invoke_typed
+    InvokeError err = static_cast<InvokeError>(invoke_res.result.error);
+    if (err == InvokeError::NONE) {
+        invoke_res.result.result = 0;
+    }
+    return detail::metered_return_from_ffi(invoke_res);
+}
+
+MeteredReturn
+Wasmi_WasmRuntime::invoke_metered(uint32_t method_index,
+                                     std::string const& method_name,
+                                     uint64_t gas_limit)
+{
+    return detail::metered_return_from_ffi(::wasmi_invoke_metered(runtime_pointer,
+                                                                  method_index,
+                                                                  reinterpret_cast<const uint8_t*>(method_name.c_str()),
+                                                                  static_cast<uint32_t>(method_name.size()),
+                                                                  gas_limit));
+}
+
+size_t
+Wasmi_WasmRuntime::invoke_batch(std::span<const InvokeRequest> requests,
+                                   std::span<MeteredReturn> results,
+                                   BatchErrorPolicy policy)
+{
+    return detail::ffi_invoke_batch_chunked<&::wasmi_invoke_batch>(runtime_pointer, requests, results, policy);
+}
+
 bool
 __attribute__((warn_unused_result))
 Wasmi_WasmRuntime::consume_gas(uint64_t gas)
@@ -3,6 +3,7 @@
 #include <utility>
 
 #include "wasm_api/bindings.h"
+#include "wasm_api/ffi_batch.h"
 
 #include <cinttypes>
 #include <cassert>
@@ -35,26 +36,63 @@ Wasmtime_WasmRuntime::~Wasmtime_WasmRuntime()
     free_wasmtime_runtime(runtime_pointer);
 }
 
-std::unique_ptr<WasmRuntime>
-Wasmtime_WasmContext::new_runtime_instance(Script const& contract, void* ctxp, const Hash* script_identifier)
+bool
+Wasmtime_WasmContext::set_disk_cache_dir(std::string const& dir)
+{
+    return wasmtime_set_disk_cache_dir(context_pointer,
+        reinterpret_cast<const uint8_t*>(dir.c_str()), dir.size());
+}
+
+ModuleCacheStats
+Wasmtime_WasmContext::get_module_cache_stats() const
+{
+    auto stats = wasmtime_get_cache_stats(context_pointer);
+    return ModuleCacheStats {
+        .hits = stats.hits,
+        .misses = stats.misses,
+        .evictions = stats.evictions,
+        .entries = stats.entries,
+        .bytes = stats.bytes,
+        .budget_bytes = stats.budget_bytes
+    };
+}
+
+void
+Wasmtime_WasmContext::set_module_cache_budget(uint64_t budget_bytes)
 {
-    std::unique_ptr<WasmRuntime> out = std::make_unique<WasmRuntime>(ctxp);
+    wasmtime_set_cache_budget(context_pointer, budget_bytes);
+}
 
+std::shared_ptr<detail::CompiledModuleImpl>
+Wasmtime_WasmContext::compile(Script const& contract, const Hash* script_identifier)
+{
     const uint8_t* id_ptr = (script_identifier == nullptr) ? nullptr : script_identifier -> data();
 
-    void* runtime_pointer = new_wasmtime_runtime(contract.data,
-        contract.len, out -> get_host_call_context(), context_pointer, id_ptr);
+    void* compiled_pointer = wasmtime_compile(contract.data, contract.len, context_pointer, id_ptr);
 
-    if (runtime_pointer == nullptr) {
+    if (compiled_pointer == nullptr) {
         return nullptr;
     }
 
-    Wasmtime_WasmRuntime* wasmtime_runtime = new Wasmtime_WasmRuntime(
-        runtime_pointer);
+    return std::make_shared<Wasmtime_CompiledModule>(compiled_pointer, context_pointer);
+}
 
-    out->initialize(wasmtime_runtime);
+Wasmtime_CompiledModule::~Wasmtime_CompiledModule()
+{
+    free_wasmtime_compiled(compiled_pointer);
+}
+
+std::unique_ptr<detail::WasmRuntimeImpl>
+Wasmtime_CompiledModule::instantiate(HostCallContext* host_call_context)
+{
+    void* runtime_pointer = new_wasmtime_runtime(compiled_pointer,
+        host_call_context, context_pointer);
 
-    return out;
+    if (runtime_pointer == nullptr) {
+        return nullptr;
+    }
+
+    return std::make_unique<Wasmtime_WasmRuntime>(runtime_pointer);
 }
 
 std::span<std::byte>
@@ -74,8 +112,10 @@ bool
 Wasmtime_WasmContext::link_fn_nargs(std::string const& module_name,
     std::string const& fn_name,
     void* fn,
+    void* trampoline,
     uint8_t nargs, 
-    WasmValueType ret_type)
+    WasmValueType ret_type,
+    HostFnGasCost const& gas)
 {
     std::lock_guard lock(link_entry_mutex);
     return wasmtime_link_nargs(context_pointer,
@@ -84,8 +124,12 @@ Wasmtime_WasmContext::link_fn_nargs(std::string const& module_name,
                      (const uint8_t*)fn_name.c_str(),
                      fn_name.size(),
                      (void*)fn,
+                     trampoline,
                      nargs,
-                     static_cast<uint8_t>(ret_type));
+                     static_cast<uint8_t>(ret_type),
+                     gas.base,
+                     gas.per_byte,
+                     gas.len_arg);
 }
 
 InvokeStatus<uint64_t> 
@@ -105,6 +149,72 @@ Wasmtime_WasmRuntime::invoke(std::string const &method_name)
     return InvokeStatus<uint64_t>(std::unexpect_t{}, err);
 }
 
+InvokeStatus<uint64_t>
+Wasmtime_WasmRuntime::invoke_prepared(uint32_t method_index, std::string const &method_name)
+{
+    auto invoke_res
+        = ::wasmtime_invoke_prepared(runtime_pointer,
+                                     method_index,
+                                     reinterpret_cast<const uint8_t*>(method_name.c_str()),
+                                     static_cast<uint32_t>(method_name.size()));
+
+    InvokeError err = static_cast<InvokeError>(invoke_res.error);
+    if (err == InvokeError::NONE) {
+        return invoke_res.result;
+    }
+
+    return InvokeStatus<uint64_t>(std::unexpect_t{}, err);
+}
+
+MeteredReturn
+Wasmtime_WasmRuntime::invoke_typed(uint32_t method_index,
+                                      detail::ExportedFunction const& method,
+                                      uint64_t gas_limit,
+                                      std::span<const uint64_t> args,
+                                      std::span<uint64_t> results)
+{
+    auto const& sig = *method.signature;
+    auto invoke_res
+        = ::wasmtime_invoke_typed(runtime_pointer,
+                                  method_index,
+                                  reinterpret_cast<const uint8_t*>(method.name.c_str()),
+                                  static_cast<uint32_t>(method.name.size()),
+                                  args.data(),
+                                  reinterpret_cast<const uint8_t*>(sig.params.data()),
+                                  static_cast<uint32_t>(args.size()),
+                                  results.data(),
+                                  reinterpret_cast<const uint8_t*>(sig.results.data()),
+                                  static_cast<uint32_t>(results.size()),
+                                  gas_limit);
+
+    // the result field is unused by *_invoke_typed
+    InvokeError err = static_cast<InvokeError>(invoke_res.result.error);
+    if (err == InvokeError::NONE) {
+        invoke_res.result.result = 0;
+    }
+    return detail::metered_return_from_ffi(invoke_res);
+}
+
+MeteredReturn
+Wasmtime_WasmRuntime::invoke_metered(uint32_t method_index,
+                                        std::string const& method_name,
+                                        uint64_t gas_limit)
+{
+    return detail::metered_return_from_ffi(::wasmtime_invoke_metered(runtime_pointer,
+                                                                     method_index,
+                                                                     reinterpret_cast<const uint8_t*>(method_name.c_str()),
+                                                                     static_cast<uint32_t>(method_name.size()),
+                                                                     gas_limit));
+}
+
+size_t
+Wasmtime_WasmRuntime::invoke_batch(std::span<const InvokeRequest> requests,
+                                      std::span<MeteredReturn> results,
+                                      BatchErrorPolicy policy)
+{
+    return detail::ffi_invoke_batch_chunked<&::wasmtime_invoke_batch>(runtime_pointer, requests, results, policy);
+}
+
 bool
 __attribute__((warn_unused_result))
 Wasmtime_WasmRuntime::consume_gas(uint64_t gas)
@@ -124,5 +234,10 @@ Wasmtime_WasmRuntime::set_available_gas(uint64_t gas)
     wasmtime_set_available_gas(runtime_pointer, gas);
 }
 
+bool
+Wasmtime_WasmRuntime::reset()
+{
+    return wasmtime_reset(runtime_pointer);
+}
 
 } // namespace wasm_api
\ No newline at end of file
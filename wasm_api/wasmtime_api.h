@@ -16,25 +16,49 @@ public:
 
     ~Wasmtime_WasmContext();
 
-    std::unique_ptr<WasmRuntime> new_runtime_instance(Script const& contract,
-                                                      void* ctxp, const Hash* script_identifier) override;
+    std::shared_ptr<detail::CompiledModuleImpl> compile(Script const& contract,
+                                                        const Hash* script_identifier) override;
 
     // expected signature: HostFnStatus<uint64_t>(HostCallContext*, uint64_t repeated nargs)
     bool link_fn_nargs(std::string const& module_name,
         std::string const& fn_name,
         void* fn,
+        void* trampoline,
         uint8_t nargs,
-        WasmValueType ret_type) override;
+        WasmValueType ret_type,
+        HostFnGasCost const& gas) override;
 
-    bool finish_link(std::unique_ptr<WasmRuntime>& pre_link) override {return true;}
+    bool finish_link(WasmRuntime& pre_link, detail::LinkTable const* link_table) override {return true;}
 
     bool init_success() override { return context_pointer != nullptr; }
 
+    bool set_disk_cache_dir(std::string const& dir) override;
+
+    ModuleCacheStats get_module_cache_stats() const override;
+    void set_module_cache_budget(uint64_t budget_bytes) override;
+
+private:
+    WasmtimeContextPtr context_pointer;
+};
+
+class Wasmtime_CompiledModule : public detail::CompiledModuleImpl
+{
+public:
+    Wasmtime_CompiledModule(void* compiled_pointer, WasmtimeContextPtr context_pointer)
+        : compiled_pointer(compiled_pointer)
+        , context_pointer(context_pointer)
+    {}
+
+    ~Wasmtime_CompiledModule();
+
+    std::unique_ptr<detail::WasmRuntimeImpl> instantiate(HostCallContext* host_call_context) override;
+
 private:
+    void* compiled_pointer;
     WasmtimeContextPtr context_pointer;
 };
 
-class Wasmtime_WasmRuntime : public detail::WasmRuntimeImpl
+class Wasmtime_WasmRuntime final : public detail::WasmRuntimeImpl
 {
 public:
     Wasmtime_WasmRuntime(void* wasmtime_runtime_ptr);
@@ -47,12 +71,28 @@ public:
     bool link_fn_nargs(std::string const& module_name,
         std::string const& fn_name,
         void* fn,
+        void* trampoline,
         uint8_t nargs,
-        WasmValueType ret_type) override {
+        WasmValueType ret_type,
+        HostFnGasCost const& gas) override {
         return false;
     }
 
     InvokeStatus<uint64_t> invoke(std::string const &method_name) override;
+    InvokeStatus<uint64_t> invoke_prepared(uint32_t method_index,
+                                           std::string const &method_name) override;
+    MeteredReturn invoke_typed(uint32_t method_index,
+                               detail::ExportedFunction const& method,
+                               uint64_t gas_limit,
+                               std::span<const uint64_t> args,
+                               std::span<uint64_t> results) override;
+    MeteredReturn invoke_metered(uint32_t method_index,
+                                 std::string const &method_name,
+                                 uint64_t gas_limit) override;
+
+    size_t invoke_batch(std::span<const InvokeRequest> requests,
+                        std::span<MeteredReturn> results,
+                        BatchErrorPolicy policy) override;
 
     bool 
     __attribute__((warn_unused_result))
@@ -60,6 +100,8 @@ public:
     uint64_t get_available_gas() const override;
     void set_available_gas(uint64_t gas) override;
 
+    bool reset() override;
+
 private:
     void* runtime_pointer;
 };
@@ -2,16 +2,35 @@ use core::ffi::c_void;
 use core::slice;
 use core::str::Utf8Error;
 
+use crate::external_call::HostFnGasCost;
+
 // Tells rust that it is safe to send this c_void pointer
 // across lambda boundaries
 #[derive(Clone)]
 pub struct BorrowBypass {
     pub fn_pointer: *mut c_void,
+    pub trampoline: *mut c_void,
+    pub gas: HostFnGasCost,
 }
 
 unsafe impl Send for BorrowBypass {}
 unsafe impl Sync for BorrowBypass {}
 
+pub type CacheKey = [u8; 32]; // sha256(unmetered contract code)
+
+// Script identifiers are passed over FFI as a pointer to 32 bytes,
+// or null if the caller did not provide one.
+pub fn cache_key_from_ptr(script_identifier_ptr: *const u8) -> Option<CacheKey> {
+    if script_identifier_ptr == core::ptr::null() {
+        return None;
+    }
+    let mut out: CacheKey = [0; 32];
+    unsafe {
+        core::ptr::copy_nonoverlapping(script_identifier_ptr, out.as_mut_ptr(), 32);
+    }
+    Some(out)
+}
+
 pub fn string_from_parts(bytes: *const u8, len: u32) -> Result<String, Utf8Error> {
     let slice = unsafe { slice::from_raw_parts(bytes, len as usize) };
     match std::str::from_utf8(&slice) {
@@ -21,9 +40,11 @@ pub fn string_from_parts(bytes: *const u8, len: u32) -> Result<String, Utf8Error
 }
 
 #[repr(u8)]
+#[derive(Clone, Copy, PartialEq)]
 pub enum WasmValueType {
     VOID = 0,
-    U64 = 1
+    U64 = 1,
+    I32 = 2
 }
 
 impl WasmValueType {
@@ -31,7 +52,51 @@ impl WasmValueType {
         match input {
             x if x == WasmValueType::VOID as u8 => {return Some(WasmValueType::VOID);},
             x if x == WasmValueType::U64 as u8 => {return Some(WasmValueType::U64);},
+            x if x == WasmValueType::I32 as u8 => {return Some(WasmValueType::I32);},
             _ => {return None;},
         }
     }
 }
+
+// Most arguments (or results) of a typed invoke,
+// so that they fit in arrays on the stack.
+// Same as MAX_TYPED_INVOKE_VALUES in value_type.h.
+pub const MAX_TYPED_INVOKE_VALUES : usize = 16;
+
+// Arguments and results of a typed invoke, as passed over FFI:
+// each value in a u64 slot, with its WasmValueType alongside.
+pub struct TypedInvokeValues<'a> {
+    pub args : &'a [u64],
+    pub arg_types : &'a [u8],
+    pub results : &'a mut [u64],
+    pub result_types : &'a [u8],
+}
+
+unsafe fn slice_or_empty<'a, T>(p : *const T, len : u32) -> &'a [T] {
+    if len == 0 {
+        return &[];
+    }
+    slice::from_raw_parts(p, len as usize)
+}
+
+// None if there are more than MAX_TYPED_INVOKE_VALUES args or results.
+pub fn typed_invoke_values<'a>(
+    args : *const u64,
+    arg_types : *const u8,
+    nargs : u32,
+    results : *mut u64,
+    result_types : *const u8,
+    nresults : u32,
+) -> Option<TypedInvokeValues<'a>> {
+    if nargs as usize > MAX_TYPED_INVOKE_VALUES || nresults as usize > MAX_TYPED_INVOKE_VALUES {
+        return None;
+    }
+    unsafe {
+        Some(TypedInvokeValues {
+            args : slice_or_empty(args, nargs),
+            arg_types : slice_or_empty(arg_types, nargs),
+            results : if nresults == 0 { &mut [] } else { slice::from_raw_parts_mut(results, nresults as usize) },
+            result_types : slice_or_empty(result_types, nresults),
+        })
+    }
+}
@@ -58,153 +58,57 @@ impl Error for TrampolineError {}
 
 impl HostError for TrampolineError {}
 
-extern "C" {
-    pub fn c_call_0args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-    ) -> TrampolineResult;
-    pub fn c_call_1args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_2args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_3args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_4args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_5args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-    ) -> TrampolineResult;
+// Same layout as HostCallContext in include/wasm_api/wasm_api.h
+// (checked there), which is the userctx of every runtime.
+#[repr(C)]
+pub struct HostCallContext {
+    pub runtime: *mut c_void,
+    pub user_ctx: *mut c_void,
+    pub available_gas: u64,
+}
 
-    pub fn c_call_6args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-        arg6: u64,
-    ) -> TrampolineResult;
+// Host functions are called through a trampoline (one per host function
+// signature, or one per host function linked with WasmContext::link_fn<F>()),
+// passed in alongside the function pointer when the function is linked.
+// See detail::HostTrampoline in include/wasm_api/host_trampolines.h.
+// Same signature whether or not the host function returns a value.
+pub type Trampoline0 = unsafe extern "C" fn(*mut c_void, *mut c_void) -> TrampolineResult;
+pub type Trampoline1 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64) -> TrampolineResult;
+pub type Trampoline2 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64) -> TrampolineResult;
+pub type Trampoline3 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64, u64) -> TrampolineResult;
+pub type Trampoline4 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64, u64, u64) -> TrampolineResult;
+pub type Trampoline5 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64, u64, u64, u64) -> TrampolineResult;
+pub type Trampoline6 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64, u64, u64, u64, u64) -> TrampolineResult;
+pub type Trampoline7 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64, u64, u64, u64, u64, u64) -> TrampolineResult;
+pub type Trampoline8 = unsafe extern "C" fn(*mut c_void, *mut c_void, u64, u64, u64, u64, u64, u64, u64, u64) -> TrampolineResult;
 
-    pub fn c_call_7args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-        arg6: u64,
-        arg7: u64,
-    ) -> TrampolineResult;
+// Gas charged for each call to a host function, before the trampoline
+// is called.  Same as HostFnGasCost in include/wasm_api/host_trampolines.h
+// (passed over FFI field by field).
+#[derive(Clone, Copy)]
+pub struct HostFnGasCost {
+    pub base: u64,
+    pub per_byte: u64,
+    pub len_arg: u8,
+}
 
-    pub fn c_call_8args(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-        arg6: u64,
-        arg7: u64,
-        arg8: u64,
-    ) -> TrampolineResult;
+impl HostFnGasCost {
+    pub fn new(base: u64, per_byte: u64, len_arg: u8) -> Self {
+        Self { base, per_byte, len_arg }
+    }
 
-    pub fn c_call_0args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-    ) -> TrampolineResult;
-    pub fn c_call_1args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_2args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_3args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_4args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_5args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-    ) -> TrampolineResult;
-    pub fn c_call_6args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-        arg6: u64
-    ) -> TrampolineResult;
-    pub fn c_call_7args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-        arg6: u64,
-        arg7: u64
-    ) -> TrampolineResult;
-    pub fn c_call_8args_noret(
-        fn_pointer: *mut c_void,
-        userctx: *mut c_void,
-        arg1: u64,
-        arg2: u64,
-        arg3: u64,
-        arg4: u64,
-        arg5: u64,
-        arg6: u64,
-        arg7: u64,
-        arg8: u64
-    ) -> TrampolineResult;
+    pub fn valid_for(&self, nargs: u8) -> bool {
+        self.per_byte == 0 || self.len_arg < nargs
+    }
+
+    // Saturates at u64::MAX.  Requires valid_for(args.len()).
+    #[inline(always)]
+    pub fn cost(&self, args: &[u64]) -> u64 {
+        if self.per_byte == 0 {
+            return self.base;
+        }
+        self.per_byte
+            .saturating_mul(args[self.len_arg as usize])
+            .saturating_add(self.base)
+    }
 }
@@ -1,5 +1,6 @@
 
 use crate::external_call;
+use core::slice;
 
 // Everything but UnrecoverableSystemError
 // is a deterministic error that can be handled by a smart
@@ -57,3 +58,151 @@ impl FFIInvokeResult {
         }
     }
 }
+
+// Same as BatchErrorPolicy in wasm_api.h
+#[repr(u8)]
+#[allow(non_camel_case_types)]
+pub enum BatchErrorPolicy {
+  STOP_ON_ANY_ERROR = 0,
+  STOP_ON_UNRECOVERABLE = 1,
+}
+
+// One call of a batch.  method_name is only read the first
+// time method_index is used (see *_invoke_prepared).
+#[repr(C)]
+pub struct FFIBatchCall {
+    pub method_index: u32,
+    pub method_name: *const u8,
+    pub method_name_len: u32,
+    pub gas_limit: u64,
+}
+
+// Same as MeteredReturn in wasm_api.h
+#[repr(C)]
+pub struct FFIMeteredResult {
+    pub result: FFIInvokeResult,
+    pub gas_consumed: u64,
+}
+
+impl FFIInvokeResult {
+    // Same as detail::batch_should_stop in wasm_api.h
+    fn batch_should_stop(&self, policy: u8) -> bool {
+        if self.error == InvokeError::NONE as u8 || self.error == InvokeError::RETURN as u8 {
+            return false;
+        }
+        self.error == InvokeError::UNRECOVERABLE as u8
+            || policy == BatchErrorPolicy::STOP_ON_ANY_ERROR as u8
+    }
+}
+
+// Runs calls in order on one runtime, with each call's gas_limit as its fuel,
+// and restores the fuel from before the batch afterwards.
+// Stops after a call that fails, per policy.  Returns the number of calls run.
+pub fn run_batch<R>(
+    runtime: &mut R,
+    calls: *const FFIBatchCall,
+    results: *mut FFIMeteredResult,
+    ncalls: u32,
+    policy: u8,
+    get_fuel: fn(&R) -> u64,
+    set_fuel: fn(&mut R, u64),
+    invoke_prepared: fn(&mut R, u32, &[u8]) -> FFIInvokeResult,
+) -> u32 {
+    if ncalls == 0 {
+        return 0;
+    }
+    let calls = unsafe { slice::from_raw_parts(calls, ncalls as usize) };
+    let results = unsafe { slice::from_raw_parts_mut(results, ncalls as usize) };
+
+    let fuel_backup = get_fuel(runtime);
+
+    let mut ran = 0;
+    for (call, out) in calls.iter().zip(results.iter_mut()) {
+        ran += 1;
+
+        *out = metered_call(
+            runtime,
+            call.method_index,
+            call.method_name,
+            call.method_name_len,
+            call.gas_limit,
+            get_fuel,
+            set_fuel,
+            invoke_prepared,
+        );
+
+        if out.result.batch_should_stop(policy) {
+            break;
+        }
+    }
+
+    set_fuel(runtime, fuel_backup);
+    ran
+}
+
+// Runs one call with gas_limit as its fuel, and restores
+// the fuel from before afterwards.
+pub fn run_metered<R>(
+    runtime: &mut R,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+    gas_limit: u64,
+    get_fuel: fn(&R) -> u64,
+    set_fuel: fn(&mut R, u64),
+    invoke_prepared: fn(&mut R, u32, &[u8]) -> FFIInvokeResult,
+) -> FFIMeteredResult {
+    let fuel_backup = get_fuel(runtime);
+    let out = metered_call(
+        runtime,
+        method_index,
+        method_name,
+        method_name_len,
+        gas_limit,
+        get_fuel,
+        set_fuel,
+        invoke_prepared,
+    );
+    set_fuel(runtime, fuel_backup);
+    out
+}
+
+// Leaves the fuel as the call left it.
+fn metered_call<R>(
+    runtime: &mut R,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+    gas_limit: u64,
+    get_fuel: fn(&R) -> u64,
+    set_fuel: fn(&mut R, u64),
+    invoke_prepared: fn(&mut R, u32, &[u8]) -> FFIInvokeResult,
+) -> FFIMeteredResult {
+    if method_name == core::ptr::null() {
+        return FFIMeteredResult {
+            result: FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR),
+            gas_consumed: 0,
+        };
+    }
+    let name = unsafe { slice::from_raw_parts(method_name, method_name_len as usize) };
+
+    set_fuel(runtime, gas_limit);
+    let result = invoke_prepared(runtime, method_index, name);
+    let remaining = get_fuel(runtime);
+
+    metered_result(result, gas_limit, remaining)
+}
+
+// Same as WasmRuntimeImpl::metered_return() in wasm_api.h.
+pub fn metered_result(result: FFIInvokeResult, gas_limit: u64, remaining: u64) -> FFIMeteredResult {
+    if remaining > gas_limit {
+        return FFIMeteredResult {
+            result: FFIInvokeResult::error(InvokeError::UNRECOVERABLE),
+            gas_consumed: 0,
+        };
+    }
+    FFIMeteredResult {
+        result: result,
+        gas_consumed: gas_limit - remaining,
+    }
+}
@@ -6,9 +6,11 @@ pub mod external_call;
 pub mod invoke_result;
 pub mod wasmi_runtime;
 pub mod wasmtime_runtime;
+pub mod wasmtime_disk_cache;
 pub mod memory;
 pub mod stitch_context;
 pub mod stitch_runtime;
+pub mod module_cache;
 mod common;
 
 use crate::wasmi_runtime::WasmiRuntime;
@@ -0,0 +1,344 @@
+use crate::common::CacheKey;
+
+use std::collections::{BTreeMap, HashMap};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Condvar, Mutex, RwLock};
+
+// Default size of each context's module cache
+pub const DEFAULT_MODULE_CACHE_BYTES: u64 = 256 * 1024 * 1024;
+
+// Shards only split the locking -- the byte budget
+// and the eviction order are shared by all shards.
+const MODULE_CACHE_SHARDS: usize = 16;
+
+#[repr(C)]
+pub struct FFICacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub evictions: u64,
+    pub entries: u64,
+    pub bytes: u64,
+    pub budget_bytes: u64,
+}
+
+struct Entry<V> {
+    value: V,
+    size: u64,
+    cost: u64,
+    // incremented on hits, under only a read lock
+    freq: AtomicU64,
+    // value of freq when order_key was computed
+    ordered_freq: u64,
+    // key into Shard::order
+    order_key: (u64, u64),
+}
+
+// One shard of the cache.  See ModuleCache for the eviction order.
+struct Shard<V: Clone> {
+    entries: HashMap<CacheKey, Entry<V>>,
+    // (priority, insertion sequence number) -> key.
+    // Priorities are nonnegative, finite f64s, and for those,
+    // the order of the bit patterns (as u64) matches the order of the values.
+    order: BTreeMap<(u64, u64), CacheKey>,
+
+    hits: AtomicU64,
+    misses: AtomicU64,
+    evictions: u64,
+}
+
+impl<V: Clone> Shard<V> {
+    fn new() -> Self {
+        Self {
+            entries: HashMap::new(),
+            order: BTreeMap::new(),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            evictions: 0,
+        }
+    }
+
+    fn get(&self, key: &CacheKey) -> Option<V> {
+        let entry = self.entries.get(key)?;
+        entry.freq.fetch_add(1, Ordering::Relaxed);
+        Some(entry.value.clone())
+    }
+}
+
+// A compilation that some thread is currently running.
+// Other threads that miss on the same key wait for its result
+// instead of compiling the same module again.
+struct InFlight<V> {
+    result: Mutex<Option<Option<V>>>,
+    done: Condvar,
+}
+
+// Wakes waiters even if the compiling thread unwinds.
+struct InFlightGuard<'a, V: Clone> {
+    cache: &'a ModuleCache<V>,
+    key: CacheKey,
+    in_flight: Arc<InFlight<V>>,
+    result: Option<V>,
+}
+
+impl<'a, V: Clone> Drop for InFlightGuard<'a, V> {
+    fn drop(&mut self) {
+        self.cache.in_flight[self.cache.shard_index(&self.key)]
+            .lock()
+            .unwrap()
+            .remove(&self.key);
+
+        *self.in_flight.result.lock().unwrap() = Some(self.result.take());
+        self.in_flight.done.notify_all();
+    }
+}
+
+// Module cache bounded by (approximate) size in bytes.
+// Threadsafe, sharded by key, and lookups take only a read lock.
+//
+// Eviction is by Greedy-Dual-Size-Frequency, across all shards.
+// Each entry has priority clock + freq * cost / size,
+// where cost is how long the module took to compile.
+// The lowest priority entry is evicted first, and the clock
+// advances to its priority, so entries that are not used age out
+// relative to newer entries.
+//
+// Hits only bump an atomic counter, so that lookups can share a read lock.
+// Priorities are brought up to date lazily, when an entry
+// reaches the front of the eviction order (so this is an approximation
+// of GDSF, in that a hit is credited at the clock of its next eviction check,
+// not of the hit itself).  Concurrent evictions can also each pick
+// a different shard's front, not strictly the global lowest.
+pub struct ModuleCache<V: Clone> {
+    shards: Vec<RwLock<Shard<V>>>,
+    in_flight: Vec<Mutex<HashMap<CacheKey, Arc<InFlight<V>>>>>,
+
+    // Shared by all shards
+    bytes: AtomicU64,
+    budget_bytes: AtomicU64,
+    // f64 bits (see Shard::order)
+    clock: AtomicU64,
+    seq: AtomicU64,
+}
+
+impl<V: Clone> ModuleCache<V> {
+    pub fn new(budget_bytes: u64) -> Self {
+        Self {
+            shards: (0..MODULE_CACHE_SHARDS)
+                .map(|_| RwLock::new(Shard::new()))
+                .collect(),
+            in_flight: (0..MODULE_CACHE_SHARDS)
+                .map(|_| Mutex::new(HashMap::new()))
+                .collect(),
+            bytes: AtomicU64::new(0),
+            budget_bytes: AtomicU64::new(budget_bytes),
+            clock: AtomicU64::new(0.0f64.to_bits()),
+            seq: AtomicU64::new(0),
+        }
+    }
+
+    fn next_order_key(&self, freq: u64, cost: u64, size: u64) -> (u64, u64) {
+        let clock = f64::from_bits(self.clock.load(Ordering::Relaxed));
+        let priority = clock + (freq as f64) * (cost as f64) / (size as f64);
+        (priority.to_bits(), self.seq.fetch_add(1, Ordering::Relaxed))
+    }
+
+    // Keys are (cryptographic) hashes, so any byte makes a fine shard index
+    fn shard_index(&self, key: &CacheKey) -> usize {
+        (key[0] as usize) % MODULE_CACHE_SHARDS
+    }
+
+    pub fn get(&self, key: &CacheKey) -> Option<V> {
+        let shard = self.shards[self.shard_index(key)].read().unwrap();
+        match shard.get(key) {
+            Some(v) => {
+                shard.hits.fetch_add(1, Ordering::Relaxed);
+                Some(v)
+            }
+            None => {
+                shard.misses.fetch_add(1, Ordering::Relaxed);
+                None
+            }
+        }
+    }
+
+    // size: bytes of memory held by the value
+    // cost: time to recompile the value, in any consistent unit
+    pub fn put(&self, key: &CacheKey, value: V, size: u64, cost: u64) {
+        let size = size.max(1);
+        let cost = cost.max(1);
+
+        {
+            let mut shard = self.shards[self.shard_index(key)].write().unwrap();
+
+            if let Some(old) = shard.entries.remove(key) {
+                shard.order.remove(&old.order_key);
+                self.bytes.fetch_sub(old.size, Ordering::Relaxed);
+            }
+
+            if size > self.budget_bytes.load(Ordering::Relaxed) {
+                return;
+            }
+
+            let order_key = self.next_order_key(1, cost, size);
+            shard.order.insert(order_key, *key);
+            shard.entries.insert(
+                *key,
+                Entry {
+                    value: value,
+                    size: size,
+                    cost: cost,
+                    freq: AtomicU64::new(1),
+                    ordered_freq: 1,
+                    order_key: order_key,
+                },
+            );
+            self.bytes.fetch_add(size, Ordering::Relaxed);
+        }
+
+        self.evict_to_budget();
+    }
+
+    // Takes one shard lock at a time, so must be called with none held.
+    fn evict_to_budget(&self) {
+        while self.bytes.load(Ordering::Relaxed) > self.budget_bytes.load(Ordering::Relaxed) {
+            // the shard whose lowest priority entry is lowest overall
+            let mut lowest: Option<((u64, u64), usize)> = None;
+            for (idx, shard) in self.shards.iter().enumerate() {
+                if let Some((order_key, _)) = shard.read().unwrap().order.first_key_value() {
+                    if lowest.map_or(true, |(lowest_key, _)| *order_key < lowest_key) {
+                        lowest = Some((*order_key, idx));
+                    }
+                }
+            }
+            let idx = match lowest {
+                Some((_, idx)) => idx,
+                None => {
+                    return;
+                }
+            };
+
+            let mut shard = self.shards[idx].write().unwrap();
+            // another thread may have changed the shard since -- if so,
+            // this evicts whatever is now its front
+            let (order_key, key) = match shard.order.pop_first() {
+                Some(v) => v,
+                None => {
+                    continue;
+                }
+            };
+
+            let (freq, ordered_freq, cost, size) = {
+                let entry = shard.entries.get(&key).unwrap();
+                (entry.freq.load(Ordering::Relaxed), entry.ordered_freq, entry.cost, entry.size)
+            };
+
+            if freq != ordered_freq {
+                // hit since its priority was computed -- reorder and retry
+                let new_order_key = self.next_order_key(freq, cost, size);
+                shard.order.insert(new_order_key, key);
+                let entry = shard.entries.get_mut(&key).unwrap();
+                entry.ordered_freq = freq;
+                entry.order_key = new_order_key;
+                continue;
+            }
+
+            shard.entries.remove(&key);
+            shard.evictions += 1;
+            self.bytes.fetch_sub(size, Ordering::Relaxed);
+            self.clock.fetch_max(order_key.0, Ordering::Relaxed);
+        }
+    }
+
+    // Look up key, or if not present, run compile (once, across all threads
+    // that concurrently miss on key) and cache its result.
+    // compile returns (value, size, cost), or None on failure
+    // (which is returned to all waiting threads, and not cached).
+    pub fn get_or_insert_with<F>(&self, key: &CacheKey, compile: F) -> Option<V>
+    where
+        F: FnOnce() -> Option<(V, u64, u64)>,
+    {
+        let idx = self.shard_index(key);
+        {
+            let shard = self.shards[idx].read().unwrap();
+            if let Some(v) = shard.get(key) {
+                shard.hits.fetch_add(1, Ordering::Relaxed);
+                return Some(v);
+            }
+        }
+
+        let in_flight = {
+            let mut in_flight_map = self.in_flight[idx].lock().unwrap();
+
+            // The compiling thread inserts into the cache before
+            // it removes its InFlight, so this recheck is race-free.
+            let shard = self.shards[idx].read().unwrap();
+            if let Some(v) = shard.get(key) {
+                shard.hits.fetch_add(1, Ordering::Relaxed);
+                return Some(v);
+            }
+
+            match in_flight_map.get(key) {
+                Some(existing) => {
+                    shard.hits.fetch_add(1, Ordering::Relaxed);
+                    Err(existing.clone())
+                }
+                None => {
+                    shard.misses.fetch_add(1, Ordering::Relaxed);
+                    let new_in_flight = Arc::new(InFlight {
+                        result: Mutex::new(None),
+                        done: Condvar::new(),
+                    });
+                    in_flight_map.insert(*key, new_in_flight.clone());
+                    Ok(new_in_flight)
+                }
+            }
+        };
+
+        match in_flight {
+            Ok(in_flight) => {
+                let mut guard = InFlightGuard {
+                    cache: self,
+                    key: *key,
+                    in_flight: in_flight,
+                    result: None,
+                };
+                if let Some((value, size, cost)) = compile() {
+                    self.put(key, value.clone(), size, cost);
+                    guard.result = Some(value);
+                }
+                guard.result.clone()
+            }
+            Err(in_flight) => {
+                let mut result = in_flight.result.lock().unwrap();
+                while result.is_none() {
+                    result = in_flight.done.wait(result).unwrap();
+                }
+                result.as_ref().unwrap().clone()
+            }
+        }
+    }
+
+    pub fn set_budget(&self, budget_bytes: u64) {
+        self.budget_bytes.store(budget_bytes, Ordering::Relaxed);
+        self.evict_to_budget();
+    }
+
+    pub fn stats(&self) -> FFICacheStats {
+        let mut out = FFICacheStats {
+            hits: 0,
+            misses: 0,
+            evictions: 0,
+            entries: 0,
+            bytes: self.bytes.load(Ordering::Relaxed),
+            budget_bytes: self.budget_bytes.load(Ordering::Relaxed),
+        };
+        for shard in self.shards.iter() {
+            let s = shard.read().unwrap();
+            out.hits += s.hits.load(Ordering::Relaxed);
+            out.misses += s.misses.load(Ordering::Relaxed);
+            out.evictions += s.evictions;
+            out.entries += s.entries.len() as u64;
+        }
+        out
+    }
+}
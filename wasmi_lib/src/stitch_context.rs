@@ -1,17 +1,24 @@
 
-use makepad_stitch::{Engine};
+use makepad_stitch::{Engine, Module};
 
 use core::ffi::c_void;
 
+use crate::module_cache::{ModuleCache, FFICacheStats, DEFAULT_MODULE_CACHE_BYTES};
+
+use std::sync::Arc;
+
 #[allow(non_camel_case_types)]
 pub struct Stitch_WasmContext {
     pub engine : Engine,
+    // bounded by the size of the input wasm
+    pub module_cache : ModuleCache<Arc<Module>>,
 }
 
 impl Stitch_WasmContext {
     fn new() -> Stitch_WasmContext {
         Self {
             engine : Engine::new(),
+            module_cache : ModuleCache::new(DEFAULT_MODULE_CACHE_BYTES),
         }
     }
 }
@@ -24,6 +31,24 @@ pub extern "C" fn new_stitch_context() -> *mut c_void {
     return unsafe { core::mem::transmute(Box::into_raw(b)) };
 }
 
+#[no_mangle]
+pub extern "C" fn stitch_get_cache_stats(p: *const c_void) -> FFICacheStats {
+    assert!(p != core::ptr::null());
+
+    let context: &Stitch_WasmContext = unsafe { &*core::mem::transmute::<_, *const Stitch_WasmContext>(p) };
+
+    context.module_cache.stats()
+}
+
+#[no_mangle]
+pub extern "C" fn stitch_set_cache_budget(p: *const c_void, budget_bytes: u64) {
+    assert!(p != core::ptr::null());
+
+    let context: &Stitch_WasmContext = unsafe { &*core::mem::transmute::<_, *const Stitch_WasmContext>(p) };
+
+    context.module_cache.set_budget(budget_bytes);
+}
+
 #[no_mangle]
 pub extern "C" fn free_stitch_context(p: *mut c_void) {
     assert!(p != core::ptr::null_mut());
@@ -1,25 +1,34 @@
 use makepad_stitch::{Linker, Module, Store, Instance, Func, Val};
 
-use crate::common::{string_from_parts, WasmValueType};
+use crate::common::{string_from_parts, WasmValueType, CacheKey, cache_key_from_ptr, typed_invoke_values, MAX_TYPED_INVOKE_VALUES};
 
 use core::ffi::c_void;
 use core::slice;
 
 use crate::external_call;
-use crate::external_call::{TrampolineResult, HostFnError};
+use crate::external_call::{TrampolineResult, HostFnError, HostFnGasCost, HostCallContext};
 
 use crate::stitch_context::Stitch_WasmContext;
 use crate::invoke_result::{FFIInvokeResult, InvokeError};
 
+use std::sync::Arc;
+use std::time::Instant;
+
 #[allow(non_camel_case_types)]
 pub struct Stitch_WasmRuntime {
-    module : Module,
+    module : Arc<Module>,
     pub store : Store,
     linker: Linker,
     userctx : *mut c_void,
     pub instance : Option<Instance>,
+    // by MethodHandle index (index in the module's export table)
+    prepared : Vec<Option<Func>>,
 }
 
+// userctx is the owning WasmRuntime's HostCallContext, which moves with it.
+// (stitch's wasm stack is thread-local, but only for the duration of a call)
+unsafe impl Send for Stitch_WasmRuntime {}
+
 fn stitch_handle_trampoline_error(result : &TrampolineResult) {
     match unsafe {std::mem::transmute(result.panic)} {
         HostFnError::NONE_OR_RECOVERABLE => (),
@@ -30,27 +39,66 @@ fn stitch_handle_trampoline_error(result : &TrampolineResult) {
     }
 }
 
+// Charges a host function's gas before calling it.  Stitch has no fuel,
+// so the runtime's gas counter is HostCallContext::available_gas.
+#[inline(always)]
+fn stitch_charge_host_fn_gas(userctx : *mut c_void, gas : u64) {
+    if gas == 0 {
+        return;
+    }
+    let available_gas = unsafe { &mut (*(userctx as *mut HostCallContext)).available_gas };
+    if *available_gas < gas {
+        *available_gas = 0;
+        stitch_handle_trampoline_error(&TrampolineResult { result : 0, panic : HostFnError::OUT_OF_GAS as u8 });
+    }
+    *available_gas -= gas;
+}
+
 #[derive(Clone)]
 pub struct AnnoyingBorrowBypass {
     fn_pointer : *mut c_void,
-    userctx : *mut c_void
+    trampoline : *mut c_void,
+    userctx : *mut c_void,
+    gas : HostFnGasCost,
 }
 
 unsafe impl Send for AnnoyingBorrowBypass {}
 unsafe impl Sync for AnnoyingBorrowBypass {}
 
 
+// Parsed and validated module, shared between runtimes
+#[allow(non_camel_case_types)]
+pub struct Stitch_Compiled {
+    module : Arc<Module>,
+}
+
+impl Stitch_Compiled {
+    pub fn new(context: &Stitch_WasmContext, bytes : &[u8], script_id : &Option<CacheKey>) -> Option<Stitch_Compiled> {
+        let compile = || -> Option<(Arc<Module>, u64, u64)> {
+            let compile_start = Instant::now();
+            let m = Module::new(&context.engine, &bytes).ok()?;
+            let compile_micros = compile_start.elapsed().as_micros() as u64;
+            Some((Arc::new(m), bytes.len() as u64, compile_micros))
+        };
+
+        let module = match &script_id {
+            Some(key) => context.module_cache.get_or_insert_with(key, compile)?,
+            None => compile()?.0,
+        };
+        Some(Self { module : module })
+    }
+}
+
 impl Stitch_WasmRuntime {
-    pub fn new(context: &Stitch_WasmContext, bytes : &[u8], userctx : *mut c_void) -> Option<Stitch_WasmRuntime> {
-        let store = Store::new(context.engine.clone());
-        let module = Module::new(store.engine(), &bytes).ok()?;
-        Some(Self {
-            module : module,
-            store : store,
+    pub fn new(context: &Stitch_WasmContext, compiled : &Stitch_Compiled, userctx : *mut c_void) -> Stitch_WasmRuntime {
+        Self {
+            module : compiled.module.clone(),
+            store : Store::new(context.engine.clone()),
             linker: Linker::new(),
             userctx : userctx,
-            instance : None
-        })
+            instance : None,
+            prepared : Vec::new(),
+        }
     }
     pub fn lazy_link(&mut self) -> Result<(), makepad_stitch::Error>{
         match self.instance {
@@ -67,11 +115,13 @@ impl Stitch_WasmRuntime {
         }
     }
 
-    pub fn link_function_0args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_0args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
         /*
@@ -85,7 +135,8 @@ impl Stitch_WasmRuntime {
                 // This is necessary to stop some part of rust
                 // from complaining
                 let _y = x.clone();
-                let res = unsafe { external_call::c_call_0args(x.fn_pointer, x.userctx) };
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[]));
+                let res = unsafe { core::mem::transmute::<*mut c_void, external_call::Trampoline0>(x.trampoline)(x.fn_pointer, x.userctx) };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
             });
@@ -94,19 +145,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_1args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_1args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1]));
                 let res = unsafe {
-                    external_call::c_call_1args(x.fn_pointer, x.userctx, arg1)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline1>(x.trampoline)(x.fn_pointer, x.userctx, arg1)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -115,19 +169,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_2args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_2args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2]));
                 let res = unsafe {
-                    external_call::c_call_2args(x.fn_pointer, x.userctx, arg1, arg2)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline2>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -136,19 +193,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_3args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_3args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2: u64, arg3: u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3]));
                 let res = unsafe {
-                    external_call::c_call_3args(x.fn_pointer, x.userctx, arg1, arg2, arg3)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline3>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -157,19 +217,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_4args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_4args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3 : u64, arg4 : u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4]));
                 let res = unsafe {
-                    external_call::c_call_4args(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline4>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -178,19 +241,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_5args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_5args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5]));
                 let res = unsafe {
-                    external_call::c_call_5args(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline5>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -199,19 +265,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_6args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_6args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64, arg6: u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6]));
                 let res = unsafe {
-                    external_call::c_call_6args(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline6>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -220,19 +289,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_7args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_7args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64, arg6: u64, arg7: u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7]));
                 let res = unsafe {
-                    external_call::c_call_7args(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline7>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -241,19 +313,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_8args(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_8args(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64, arg6: u64, arg7: u64, arg8: u64| -> u64 {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8]));
                 let res = unsafe {
-                    external_call::c_call_8args(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline8>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8)
                 };
                 stitch_handle_trampoline_error(&res);
                 return res.result;
@@ -262,11 +337,13 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_0args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_0args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
         /*
@@ -280,7 +357,8 @@ impl Stitch_WasmRuntime {
                 // This is necessary to stop some part of rust
                 // from complaining
                 let _y = x.clone();
-                let res = unsafe { external_call::c_call_0args_noret(x.fn_pointer, x.userctx) };
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[]));
+                let res = unsafe { core::mem::transmute::<*mut c_void, external_call::Trampoline0>(x.trampoline)(x.fn_pointer, x.userctx) };
                 stitch_handle_trampoline_error(&res);
             });
         
@@ -288,19 +366,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_1args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_1args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1]));
                 let res = unsafe {
-                    external_call::c_call_1args_noret(x.fn_pointer, x.userctx, arg1)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline1>(x.trampoline)(x.fn_pointer, x.userctx, arg1)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -308,19 +389,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_2args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_2args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2]));
                 let res = unsafe {
-                    external_call::c_call_2args_noret(x.fn_pointer, x.userctx, arg1, arg2)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline2>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -328,19 +412,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_3args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_3args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2: u64, arg3: u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3]));
                 let res = unsafe {
-                    external_call::c_call_3args_noret(x.fn_pointer, x.userctx, arg1, arg2, arg3)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline3>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -348,19 +435,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_4args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_4args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3 : u64, arg4 : u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4]));
                 let res = unsafe {
-                    external_call::c_call_4args_noret(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline4>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -368,19 +458,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_5args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_5args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5]));
                 let res = unsafe {
-                    external_call::c_call_5args_noret(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline5>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -388,19 +481,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_6args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_6args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64, arg6: u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6]));
                 let res = unsafe {
-                    external_call::c_call_6args_noret(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline6>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -408,19 +504,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_7args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_7args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64, arg6: u64, arg7: u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7]));
                 let res = unsafe {
-                    external_call::c_call_7args_noret(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline7>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -428,19 +527,22 @@ impl Stitch_WasmRuntime {
         self.linker.define(import_name, fn_name, func);
     }
 
-    pub fn link_function_8args_noret(&mut self, fn_pointer : *mut c_void, import_name : &str, fn_name : &str)
+    pub fn link_function_8args_noret(&mut self, fn_pointer : *mut c_void, trampoline : *mut c_void, gas : HostFnGasCost, import_name : &str, fn_name : &str)
     {
         let x = AnnoyingBorrowBypass {
             fn_pointer : fn_pointer.clone(),
+            trampoline : trampoline,
             userctx : self.userctx.clone(),
+            gas : gas,
         };
 
 
         let func =
             Func::wrap(&mut self.store, move |arg1: u64, arg2 : u64, arg3:u64, arg4 : u64, arg5: u64, arg6: u64, arg7: u64, arg8: u64| -> () {
                 let _y = x.clone();
+                stitch_charge_host_fn_gas(x.userctx, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8]));
                 let res = unsafe {
-                    external_call::c_call_8args_noret(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8)
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline8>(x.trampoline)(x.fn_pointer, x.userctx, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8)
                 };
                 stitch_handle_trampoline_error(&res);
             });
@@ -457,8 +559,12 @@ pub extern "C" fn stitch_link_nargs(
     method_name : *const u8,
     method_name_len : u32,
     function_pointer: *mut c_void,
+    trampoline: *mut c_void,
     nargs : u8,
-    ret_type: u8) -> bool
+    ret_type: u8,
+    gas_base : u64,
+    gas_per_byte : u64,
+    gas_len_arg : u8) -> bool
 {
     assert!(runtime_void != core::ptr::null_mut());
     let runtime : *mut Stitch_WasmRuntime= unsafe { core::mem::transmute(runtime_void)};
@@ -478,20 +584,25 @@ pub extern "C" fn stitch_link_nargs(
         Some(x) => x
     };
 
+    let gas = HostFnGasCost::new(gas_base, gas_per_byte, gas_len_arg);
+    if !gas.valid_for(nargs) {
+        return false;
+    }
+
     let r = unsafe {&mut *runtime};
 
     match ret_type_enum {
         WasmValueType::U64 => {
             match nargs {
-                0 => r.link_function_0args(function_pointer, &module, &method),
-                1 => r.link_function_1args(function_pointer, &module, &method),
-                2 => r.link_function_2args(function_pointer, &module, &method),
-                3 => r.link_function_3args(function_pointer, &module, &method),
-                4 => r.link_function_4args(function_pointer, &module, &method),
-                5 => r.link_function_5args(function_pointer, &module, &method),
-                6 => r.link_function_6args(function_pointer, &module, &method),
-                7 => r.link_function_7args(function_pointer, &module, &method),
-                8 => r.link_function_8args(function_pointer, &module, &method),
+                0 => r.link_function_0args(function_pointer, trampoline, gas, &module, &method),
+                1 => r.link_function_1args(function_pointer, trampoline, gas, &module, &method),
+                2 => r.link_function_2args(function_pointer, trampoline, gas, &module, &method),
+                3 => r.link_function_3args(function_pointer, trampoline, gas, &module, &method),
+                4 => r.link_function_4args(function_pointer, trampoline, gas, &module, &method),
+                5 => r.link_function_5args(function_pointer, trampoline, gas, &module, &method),
+                6 => r.link_function_6args(function_pointer, trampoline, gas, &module, &method),
+                7 => r.link_function_7args(function_pointer, trampoline, gas, &module, &method),
+                8 => r.link_function_8args(function_pointer, trampoline, gas, &module, &method),
                 _ => {
                     return false;
                 }
@@ -499,36 +610,42 @@ pub extern "C" fn stitch_link_nargs(
         },
         WasmValueType::VOID => {
             match nargs {
-                0 => r.link_function_0args_noret(function_pointer, &module, &method),
-                1 => r.link_function_1args_noret(function_pointer, &module, &method),
-                2 => r.link_function_2args_noret(function_pointer, &module, &method),
-                3 => r.link_function_3args_noret(function_pointer, &module, &method),
-                4 => r.link_function_4args_noret(function_pointer, &module, &method),
-                5 => r.link_function_5args_noret(function_pointer, &module, &method),
-                6 => r.link_function_6args_noret(function_pointer, &module, &method),
-                7 => r.link_function_7args_noret(function_pointer, &module, &method),
-                8 => r.link_function_8args_noret(function_pointer, &module, &method),
+                0 => r.link_function_0args_noret(function_pointer, trampoline, gas, &module, &method),
+                1 => r.link_function_1args_noret(function_pointer, trampoline, gas, &module, &method),
+                2 => r.link_function_2args_noret(function_pointer, trampoline, gas, &module, &method),
+                3 => r.link_function_3args_noret(function_pointer, trampoline, gas, &module, &method),
+                4 => r.link_function_4args_noret(function_pointer, trampoline, gas, &module, &method),
+                5 => r.link_function_5args_noret(function_pointer, trampoline, gas, &module, &method),
+                6 => r.link_function_6args_noret(function_pointer, trampoline, gas, &module, &method),
+                7 => r.link_function_7args_noret(function_pointer, trampoline, gas, &module, &method),
+                8 => r.link_function_8args_noret(function_pointer, trampoline, gas, &module, &method),
                 _ => {
                     return false;
                 }
             }
         },
+        // host functions do not return i32
+        WasmValueType::I32 => {
+            return false;
+        },
     };
     return true;
 }
 
 #[no_mangle]
-pub extern "C" fn new_stitch_runtime(bytes: *const u8, bytes_len : u32, context_void : *mut c_void, userctx : *mut c_void) -> *mut c_void
+pub extern "C" fn stitch_compile(bytes: *const u8, bytes_len : u32, context_void : *mut c_void, script_identifier_ptr : *const u8) -> *mut c_void
 {
 	assert!(context_void != core::ptr::null_mut());
 
 	let context : *mut Stitch_WasmContext = unsafe { core::mem::transmute(context_void)};
 
+    let script_id = cache_key_from_ptr(script_identifier_ptr);
+
     let slice = unsafe { slice::from_raw_parts(bytes, bytes_len as usize) };
 
-    match Stitch_WasmRuntime::new( unsafe{&*context}, &slice, userctx) {
-        Some(r) => {
-            let b = Box::new(r);
+    match Stitch_Compiled::new( unsafe{&*context}, &slice, &script_id) {
+        Some(c) => {
+            let b = Box::new(c);
     		return unsafe { core::mem::transmute(Box::into_raw(b)) };
         },
         None => {
@@ -537,6 +654,28 @@ pub extern "C" fn new_stitch_runtime(bytes: *const u8, bytes_len : u32, context_
     }
 }
 
+#[no_mangle]
+pub extern "C" fn free_stitch_compiled(p : *mut c_void) {
+	assert!(p != core::ptr::null_mut());
+
+	let compiled : *mut Stitch_Compiled = unsafe { core::mem::transmute(p)};
+
+    unsafe { drop(Box::from_raw(compiled)) };
+}
+
+#[no_mangle]
+pub extern "C" fn new_stitch_runtime(compiled_void : *const c_void, context_void : *mut c_void, userctx : *mut c_void) -> *mut c_void
+{
+	assert!(compiled_void != core::ptr::null());
+	assert!(context_void != core::ptr::null_mut());
+
+	let compiled : *const Stitch_Compiled = unsafe { core::mem::transmute(compiled_void)};
+	let context : *mut Stitch_WasmContext = unsafe { core::mem::transmute(context_void)};
+
+    let b = Box::new(Stitch_WasmRuntime::new( unsafe{&*context}, unsafe{&*compiled}, userctx));
+    return unsafe { core::mem::transmute(Box::into_raw(b)) };
+}
+
 #[no_mangle]
 pub extern "C" fn free_stitch_runtime(p : *mut c_void) {
 	assert!(p != core::ptr::null_mut());
@@ -583,9 +722,157 @@ pub extern "C" fn stitch_invoke(runtime_void : *mut c_void, bytes: *const u8, by
         }
     };
 
+    stitch_call(&mut r.store, func)
+}
+
+// Same as stitch_invoke, except that the function looked up for
+// method_index is kept, and later calls with the same index
+// skip the lookup (and the name is not read).
+#[no_mangle]
+pub extern "C" fn stitch_invoke_prepared(runtime_void : *mut c_void, method_index : u32, bytes: *const u8, bytes_len : u32) -> FFIInvokeResult
+{
+	assert!(runtime_void != core::ptr::null_mut());
+
+	let runtime : *mut Stitch_WasmRuntime = unsafe { core::mem::transmute(runtime_void)};
+
+    let r = unsafe {&mut *runtime};
+
+    match r.lazy_link() {
+        Ok(_) => {},
+        Err(_) => { 
+        	return FFIInvokeResult::error(
+                InvokeError::DETERMINISTIC_ERROR,
+            ); 
+        },
+    };
+
+    let func = match stitch_find_prepared(r, method_index, bytes, bytes_len) {
+        Some(f) => f,
+        None => {
+            return FFIInvokeResult::error(
+                InvokeError::DETERMINISTIC_ERROR,
+            );
+        }
+    };
+
+    stitch_call(&mut r.store, func)
+}
+
+// Same as stitch_invoke_prepared, but for a function of any signature
+// (of i32s and i64s).  Each arg and result is in a u64 slot (i32s
+// zero-extended), with its WasmValueType in arg_types/result_types.
+// The result field of the return value is unused.
+#[no_mangle]
+pub extern "C" fn stitch_invoke_typed(
+    runtime_void : *mut c_void,
+    method_index : u32,
+    bytes: *const u8,
+    bytes_len : u32,
+    args : *const u64,
+    arg_types : *const u8,
+    nargs : u32,
+    results : *mut u64,
+    result_types : *const u8,
+    nresults : u32) -> FFIInvokeResult
+{
+	assert!(runtime_void != core::ptr::null_mut());
+
+	let runtime : *mut Stitch_WasmRuntime = unsafe { core::mem::transmute(runtime_void)};
+
+    let r = unsafe {&mut *runtime};
+
+    let values = match typed_invoke_values(args, arg_types, nargs, results, result_types, nresults) {
+        Some(v) => v,
+        None => {
+            return FFIInvokeResult::error(
+                InvokeError::UNRECOVERABLE,
+            );
+        }
+    };
+
+    match r.lazy_link() {
+        Ok(_) => {},
+        Err(_) => {
+            return FFIInvokeResult::error(
+                InvokeError::DETERMINISTIC_ERROR,
+            );
+        },
+    };
+
+    let func = match stitch_find_prepared(r, method_index, bytes, bytes_len) {
+        Some(f) => f,
+        None => {
+            return FFIInvokeResult::error(
+                InvokeError::DETERMINISTIC_ERROR,
+            );
+        }
+    };
+
+    let mut params : [Val; MAX_TYPED_INVOKE_VALUES] = core::array::from_fn(|_| Val::I64(0));
+    for (i, v) in values.args.iter().enumerate() {
+        params[i] = stitch_to_val(*v, values.arg_types[i]);
+    }
+    let mut res : [Val; MAX_TYPED_INVOKE_VALUES] = core::array::from_fn(|_| Val::I64(0));
+    for (i, ty) in values.result_types.iter().enumerate() {
+        res[i] = stitch_to_val(0, *ty);
+    }
+
+    let nresults = values.results.len();
+    // Errors are deterministic, same as in stitch_call
+    match func.call(&mut r.store, &params[..values.args.len()], &mut res[..nresults]) {
+        Ok(_) => {},
+        Err(_) => {
+            return FFIInvokeResult::error(
+                InvokeError::DETERMINISTIC_ERROR,
+            );
+        },
+    };
+
+    for i in 0..nresults {
+        values.results[i] = match res[i] {
+            Val::I32(x) => x as u32 as u64,
+            Val::I64(x) => x as u64,
+            _ => {
+                return FFIInvokeResult::error(
+                    InvokeError::DETERMINISTIC_ERROR,
+                );
+            }
+        };
+    }
+    FFIInvokeResult::success(0)
+}
+
+fn stitch_to_val(v : u64, ty : u8) -> Val
+{
+    if ty == WasmValueType::I32 as u8 {
+        Val::I32(v as u32 as i32)
+    } else {
+        Val::I64(v as i64)
+    }
+}
+
+// requires lazy_link() to have succeeded.
+// bytes are only read the first time method_index is used.
+fn stitch_find_prepared(r : &mut Stitch_WasmRuntime, method_index : u32, bytes : *const u8, bytes_len : u32) -> Option<Func>
+{
+    let idx = method_index as usize;
+    if idx >= r.prepared.len() {
+        r.prepared.resize_with(idx + 1, || None);
+    }
+
+    if r.prepared[idx].is_none() {
+        let slice = unsafe { slice::from_raw_parts(bytes, bytes_len as usize) };
+        let string = std::str::from_utf8(&slice).ok()?;
+        r.prepared[idx] = Some(r.instance.as_mut().expect("lazily linked").exported_func(string)?);
+    }
+    r.prepared[idx].clone()
+}
+
+fn stitch_call(store : &mut Store, func : Func) -> FFIInvokeResult
+{
     let mut res = [Val::I64(0)];
 
-    match func.call(&mut r.store, &[], &mut res) {
+    match func.call(store, &[], &mut res) {
         Ok(_) => { 
             match res[0].to_i64() {
                 Some(v) => { return FFIInvokeResult::success(v as u64); },
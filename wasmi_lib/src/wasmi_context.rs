@@ -1,11 +1,14 @@
-use wasmi::{Caller, Config, Engine, Error, Linker, StackLimits};
+use wasmi::{Caller, Config, Engine, Error, Linker, Module, StackLimits};
 
 use core::ffi::c_void;
 
-use crate::external_call::{HostFnError, TrampolineResult, TrampolineError};
+use crate::external_call::{HostCallContext, HostFnError, HostFnGasCost, TrampolineResult, TrampolineError};
 use crate::external_call;
 
 use crate::common::{string_from_parts, BorrowBypass, WasmValueType};
+use crate::module_cache::{ModuleCache, FFICacheStats, DEFAULT_MODULE_CACHE_BYTES};
+
+use std::sync::Arc;
 
 // A WasmiContext provides shared data structures
 // for multiple Wasmi runtimes.
@@ -20,11 +23,16 @@ use crate::common::{string_from_parts, BorrowBypass, WasmValueType};
 // The WASM official C API spec says that only one ``engine'' should be created
 // per process, although that's more strict than necessary.
 // Linker can be shared between instances.
-// Store and Module and Instance are per-WasmiRuntime structures.
+// Store and Instance are per-WasmiRuntime structures.
+// Modules are immutable once validated, so they are cached
+// here (by script identifier) and shared between runtimes.
 
 pub struct WasmiContext {
     pub engine: Engine,
     pub linker: Linker<*mut c_void>,
+    // wasmi does not expose the size of its internal representation,
+    // so this is bounded by the size of the input wasm
+    pub module_cache : ModuleCache<Arc<Module>>,
 }
 
 pub fn wasmi_handle_trampoline_error(result: TrampolineResult) -> Result<u64, wasmi::Error> {
@@ -43,6 +51,49 @@ pub fn wasmi_handle_trampoline_error_noret(result: TrampolineResult) -> Result<(
     }
 }
 
+// Charges a host function's gas from the store's fuel, and copies
+// the rest into its HostCallContext, where the host function can consume
+// it without calling back into rust.  Returns the gas copied.
+// Out of gas traps the same way as a host function returning OUT_OF_GAS,
+// without calling into the host function.
+#[inline(always)]
+fn wasmi_enter_host_fn(caller: &mut Caller<'_, *mut c_void>, gas: u64) -> Result<u64, wasmi::Error> {
+    let fuel = caller.get_fuel().unwrap();
+    if fuel < gas {
+        caller.set_fuel(0).unwrap();
+        return Err(wasmi::Error::host(TrampolineError { error : HostFnError::OUT_OF_GAS }));
+    }
+    if gas != 0 {
+        caller.set_fuel(fuel - gas).unwrap();
+    }
+    let host_call_context = *caller.data() as *mut HostCallContext;
+    unsafe { (*host_call_context).available_gas = fuel - gas; }
+    Ok(fuel - gas)
+}
+
+// Deducts whatever the host function consumed through its HostCallContext
+// from the store's fuel (which the host function may also have changed
+// directly, through the runtime).  If that is more than is left,
+// a successful call becomes OUT_OF_GAS.
+#[inline(always)]
+fn wasmi_exit_host_fn(caller: &mut Caller<'_, *mut c_void>, available_gas: u64, res: TrampolineResult) -> TrampolineResult {
+    let host_call_context = *caller.data() as *const HostCallContext;
+    let consumed = available_gas.saturating_sub(unsafe { (*host_call_context).available_gas });
+    if consumed == 0 {
+        return res;
+    }
+    let fuel = caller.get_fuel().unwrap();
+    if fuel < consumed {
+        caller.set_fuel(0).unwrap();
+        if res.panic == HostFnError::NONE_OR_RECOVERABLE as u8 {
+            return TrampolineResult { result : 0, panic : HostFnError::OUT_OF_GAS as u8 };
+        }
+        return res;
+    }
+    caller.set_fuel(fuel - consumed).unwrap();
+    res
+}
+
 impl WasmiContext {
     fn new() -> WasmiContext {
         let stack_limit = StackLimits::default();
@@ -57,28 +108,37 @@ impl WasmiContext {
         Self {
             engine: engine.clone(),
             linker: Linker::new(&engine),
+            module_cache: ModuleCache::new(DEFAULT_MODULE_CACHE_BYTES),
         }
     }
 
     fn link_function_0args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>| -> Result<u64, wasmi::Error> {
+            move |mut caller: Caller<'_, *mut c_void>| -> Result<u64, wasmi::Error> {
+
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[]))?;
 
                 let res = unsafe {
-                    external_call::c_call_0args(x.clone().fn_pointer, caller.data().clone())
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline0>(x.trampoline)(x.clone().fn_pointer, caller.data().clone())
                 };
 
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmi_handle_trampoline_error(res);
         }) {
             Ok(_) => Ok(()),
@@ -89,27 +149,34 @@ impl WasmiContext {
     fn link_function_1args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1]))?;
                 let res = unsafe {
-                    external_call::c_call_1args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline1>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                     )
                 };
 
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -121,28 +188,34 @@ impl WasmiContext {
     fn link_function_2args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2]))?;
                 let res = unsafe {
-                    external_call::c_call_2args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline2>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                         arg2,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -154,23 +227,28 @@ impl WasmiContext {
     fn link_function_3args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3]))?;
                 let res = unsafe {
-                    external_call::c_call_3args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline3>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -178,6 +256,7 @@ impl WasmiContext {
                         arg3,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -189,24 +268,29 @@ impl WasmiContext {
     fn link_function_4args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4]))?;
                 let res = unsafe {
-                    external_call::c_call_4args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline4>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -215,6 +299,7 @@ impl WasmiContext {
                         arg4,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -226,25 +311,30 @@ impl WasmiContext {
     fn link_function_5args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64,
                   arg5: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5]))?;
                 let res = unsafe {
-                    external_call::c_call_5args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline5>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -254,6 +344,7 @@ impl WasmiContext {
                         arg5,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -265,17 +356,21 @@ impl WasmiContext {
     fn link_function_6args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -283,8 +378,9 @@ impl WasmiContext {
                   arg5: u64,
                   arg6: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6]))?;
                 let res = unsafe {
-                    external_call::c_call_6args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline6>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -295,6 +391,7 @@ impl WasmiContext {
                         arg6
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -306,17 +403,21 @@ impl WasmiContext {
         fn link_function_7args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -325,8 +426,9 @@ impl WasmiContext {
                   arg6: u64,
                   arg7: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7]))?;
                 let res = unsafe {
-                    external_call::c_call_7args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline7>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -338,6 +440,7 @@ impl WasmiContext {
                         arg7
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -349,17 +452,21 @@ impl WasmiContext {
     fn link_function_8args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -369,8 +476,9 @@ impl WasmiContext {
                   arg7: u64,
                   arg8: u64|
                   -> Result<u64, wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8]))?;
                 let res = unsafe {
-                    external_call::c_call_8args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline8>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -383,6 +491,7 @@ impl WasmiContext {
                         arg8
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error(res);
             },
         ) {
@@ -394,22 +503,30 @@ impl WasmiContext {
         fn link_function_0args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>| -> Result<(), wasmi::Error> {
+            move |mut caller: Caller<'_, *mut c_void>| -> Result<(), wasmi::Error> {
+
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[]))?;
 
                 let res = unsafe {
-                    external_call::c_call_0args_noret(x.clone().fn_pointer, caller.data().clone())
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline0>(x.trampoline)(x.clone().fn_pointer, caller.data().clone())
                 };
 
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmi_handle_trampoline_error_noret(res);
         }) {
             Ok(_) => Ok(()),
@@ -420,27 +537,34 @@ impl WasmiContext {
     fn link_function_1args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1]))?;
                 let res = unsafe {
-                    external_call::c_call_1args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline1>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                     )
                 };
 
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -452,28 +576,34 @@ impl WasmiContext {
     fn link_function_2args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2]))?;
                 let res = unsafe {
-                    external_call::c_call_2args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline2>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                         arg2,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -485,23 +615,28 @@ impl WasmiContext {
     fn link_function_3args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3]))?;
                 let res = unsafe {
-                    external_call::c_call_3args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline3>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -509,6 +644,7 @@ impl WasmiContext {
                         arg3,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -520,24 +656,29 @@ impl WasmiContext {
     fn link_function_4args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4]))?;
                 let res = unsafe {
-                    external_call::c_call_4args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline4>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -546,6 +687,7 @@ impl WasmiContext {
                         arg4,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -557,25 +699,30 @@ impl WasmiContext {
     fn link_function_5args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64,
                   arg5: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5]))?;
                 let res = unsafe {
-                    external_call::c_call_5args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline5>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -585,6 +732,7 @@ impl WasmiContext {
                         arg5,
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -596,17 +744,21 @@ impl WasmiContext {
     fn link_function_6args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -614,8 +766,9 @@ impl WasmiContext {
                   arg5: u64,
                   arg6: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6]))?;
                 let res = unsafe {
-                    external_call::c_call_6args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline6>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -626,6 +779,7 @@ impl WasmiContext {
                         arg6
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -637,17 +791,21 @@ impl WasmiContext {
     fn link_function_7args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -656,8 +814,9 @@ impl WasmiContext {
                   arg6: u64,
                   arg7: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7]))?;
                 let res = unsafe {
-                    external_call::c_call_7args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline7>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -669,6 +828,7 @@ impl WasmiContext {
                         arg7
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -680,17 +840,21 @@ impl WasmiContext {
     fn link_function_8args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -700,8 +864,9 @@ impl WasmiContext {
                   arg7: u64,
                   arg8: u64|
                   -> Result<(), wasmi::Error> {
+                let available_gas = wasmi_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8]))?;
                 let res = unsafe {
-                    external_call::c_call_8args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline8>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -714,6 +879,7 @@ impl WasmiContext {
                         arg8
                     )
                 };
+                let res = wasmi_exit_host_fn(&mut caller, available_gas, res);
                 return wasmi_handle_trampoline_error_noret(res);
             },
         ) {
@@ -731,8 +897,12 @@ pub extern "C" fn wasmi_link_nargs(
     method_name: *const u8,
     method_name_len: u32,
     function_pointer: *mut c_void,
+    trampoline: *mut c_void,
     nargs: u8,
-    ret_type : u8
+    ret_type : u8,
+    gas_base: u64,
+    gas_per_byte: u64,
+    gas_len_arg: u8,
 ) -> bool // true if success
 {
     let context: *mut WasmiContext =
@@ -758,6 +928,11 @@ pub extern "C" fn wasmi_link_nargs(
         Some(x) => x
     };
 
+    let gas = HostFnGasCost::new(gas_base, gas_per_byte, gas_len_arg);
+    if !gas.valid_for(nargs) {
+        return false;
+    }
+
     let method = match string_from_parts(method_name, method_name_len) {
         Ok(x) => x,
         _ => {
@@ -770,15 +945,15 @@ pub extern "C" fn wasmi_link_nargs(
     let res = match ret_type_enum {
         WasmValueType::U64 => {
             match nargs {
-                0 => c.link_function_0args(function_pointer, &module, &method),
-                1 => c.link_function_1args(function_pointer, &module, &method),
-                2 => c.link_function_2args(function_pointer, &module, &method),
-                3 => c.link_function_3args(function_pointer, &module, &method),
-                4 => c.link_function_4args(function_pointer, &module, &method),
-                5 => c.link_function_5args(function_pointer, &module, &method),
-                6 => c.link_function_6args(function_pointer, &module, &method),
-                7 => c.link_function_7args(function_pointer, &module, &method),
-                8 => c.link_function_8args(function_pointer, &module, &method),
+                0 => c.link_function_0args(function_pointer, trampoline, gas, &module, &method),
+                1 => c.link_function_1args(function_pointer, trampoline, gas, &module, &method),
+                2 => c.link_function_2args(function_pointer, trampoline, gas, &module, &method),
+                3 => c.link_function_3args(function_pointer, trampoline, gas, &module, &method),
+                4 => c.link_function_4args(function_pointer, trampoline, gas, &module, &method),
+                5 => c.link_function_5args(function_pointer, trampoline, gas, &module, &method),
+                6 => c.link_function_6args(function_pointer, trampoline, gas, &module, &method),
+                7 => c.link_function_7args(function_pointer, trampoline, gas, &module, &method),
+                8 => c.link_function_8args(function_pointer, trampoline, gas, &module, &method),
                 _ => {
                     return false;
                 }
@@ -786,20 +961,24 @@ pub extern "C" fn wasmi_link_nargs(
         },
         WasmValueType::VOID => {
             match nargs {
-                0 => c.link_function_0args_noret(function_pointer, &module, &method),
-                1 => c.link_function_1args_noret(function_pointer, &module, &method),
-                2 => c.link_function_2args_noret(function_pointer, &module, &method),
-                3 => c.link_function_3args_noret(function_pointer, &module, &method),
-                4 => c.link_function_4args_noret(function_pointer, &module, &method),
-                5 => c.link_function_5args_noret(function_pointer, &module, &method),
-                6 => c.link_function_6args_noret(function_pointer, &module, &method),
-                7 => c.link_function_7args_noret(function_pointer, &module, &method),
-                8 => c.link_function_8args_noret(function_pointer, &module, &method),
+                0 => c.link_function_0args_noret(function_pointer, trampoline, gas, &module, &method),
+                1 => c.link_function_1args_noret(function_pointer, trampoline, gas, &module, &method),
+                2 => c.link_function_2args_noret(function_pointer, trampoline, gas, &module, &method),
+                3 => c.link_function_3args_noret(function_pointer, trampoline, gas, &module, &method),
+                4 => c.link_function_4args_noret(function_pointer, trampoline, gas, &module, &method),
+                5 => c.link_function_5args_noret(function_pointer, trampoline, gas, &module, &method),
+                6 => c.link_function_6args_noret(function_pointer, trampoline, gas, &module, &method),
+                7 => c.link_function_7args_noret(function_pointer, trampoline, gas, &module, &method),
+                8 => c.link_function_8args_noret(function_pointer, trampoline, gas, &module, &method),
                 _ => {
                     return false;
                 }
             }
         },
+        // host functions do not return i32
+        WasmValueType::I32 => {
+            return false;
+        },
     };
 
     match res {
@@ -816,6 +995,28 @@ pub extern "C" fn new_wasmi_context() -> *mut c_void {
     return unsafe { core::mem::transmute(Box::into_raw(b)) };
 }
 
+#[no_mangle]
+pub extern "C" fn wasmi_get_cache_stats(wasmi_context_ptr: *const c_void) -> FFICacheStats {
+    assert!(wasmi_context_ptr != core::ptr::null());
+
+    let wasmi_context: &WasmiContext = unsafe {
+        &*core::mem::transmute::<_, *const WasmiContext>(wasmi_context_ptr)
+    };
+
+    wasmi_context.module_cache.stats()
+}
+
+#[no_mangle]
+pub extern "C" fn wasmi_set_cache_budget(wasmi_context_ptr: *const c_void, budget_bytes: u64) {
+    assert!(wasmi_context_ptr != core::ptr::null());
+
+    let wasmi_context: &WasmiContext = unsafe {
+        &*core::mem::transmute::<_, *const WasmiContext>(wasmi_context_ptr)
+    };
+
+    wasmi_context.module_cache.set_budget(budget_bytes);
+}
+
 #[no_mangle]
 pub extern "C" fn free_wasmi_context(p: *mut c_void) {
     assert!(p != core::ptr::null_mut());
@@ -1,10 +1,13 @@
 use core::ffi::c_void;
 use core::slice;
-use wasmi::{Instance, Module, Store, Val};
+use wasmi::{Func, Instance, Module, Store, TypedFunc, Val};
 
 use crate::wasmi_context::WasmiContext;
+use crate::common::{CacheKey, cache_key_from_ptr, typed_invoke_values, TypedInvokeValues, WasmValueType, MAX_TYPED_INVOKE_VALUES};
+use std::sync::Arc;
+use std::time::Instant;
 use crate::external_call;
-use crate::invoke_result::{InvokeError, FFIInvokeResult};
+use crate::invoke_result::{InvokeError, FFIInvokeResult, FFIBatchCall, FFIMeteredResult, metered_result, run_batch, run_metered};
 
 // A WasmiRuntime implements a single WebAssembly module,
 // with the ability to invoke exported functions and call
@@ -26,8 +29,16 @@ use crate::invoke_result::{InvokeError, FFIInvokeResult};
 pub struct WasmiRuntime {
     pub store: Store<*mut c_void>,
     pub instance: Instance,
+    // by MethodHandle index (index in the module's export table)
+    prepared: Vec<Option<TypedFunc<(), i64>>>,
+    // same, for invoke_typed (whose signatures are only known at runtime)
+    prepared_funcs: Vec<Option<Func>>,
 }
 
+// Same as WasmtimeRuntime -- the store's data is the owning
+// WasmRuntime's HostCallContext, which moves with it.
+unsafe impl Send for WasmiRuntime {}
+
 fn assert_runtime_not_null(runtime: *const WasmiRuntime) {
     assert!(runtime != core::ptr::null());
 }
@@ -48,22 +59,59 @@ fn handle_trap_code(code: wasmi::core::TrapCode) -> FFIInvokeResult {
     }
 }
 
-impl WasmiRuntime {
+// Parsed and validated module, shared between runtimes
+// (and between threads).
+pub struct WasmiCompiled {
+    pub module: Arc<Module>,
+}
+
+impl WasmiCompiled {
     fn new(
         bytes: &[u8],
         context: &WasmiContext,
-        userctx: *mut c_void,
-    ) -> Option<WasmiRuntime> {
-        let module = match Module::new(&context.engine, &bytes) {
-            Ok(m) => m,
-            Err(_) => {
-                return None;
-            }
+        script_id : &Option<CacheKey>
+    ) -> Option<WasmiCompiled> {
+        let compile = || -> Option<(Arc<Module>, u64, u64)> {
+            let compile_start = Instant::now();
+            let m = Module::new(&context.engine, &bytes).ok()?;
+            let compile_micros = compile_start.elapsed().as_micros() as u64;
+            Some((Arc::new(m), bytes.len() as u64, compile_micros))
+        };
+
+        let module = match &script_id {
+            Some(key) => context.module_cache.get_or_insert_with(key, compile)?,
+            None => compile()?.0,
         };
 
+        Some(Self { module: module })
+    }
+}
+
+fn to_val(v: u64, ty: u8) -> Val {
+    if ty == WasmValueType::I32 as u8 {
+        Val::I32(v as u32 as i32)
+    } else {
+        Val::I64(v as i64)
+    }
+}
+
+fn from_val(v: &Val) -> Option<u64> {
+    match v {
+        Val::I32(x) => Some(*x as u32 as u64),
+        Val::I64(x) => Some(*x as u64),
+        _ => None,
+    }
+}
+
+impl WasmiRuntime {
+    fn new(
+        module: &Module,
+        context: &WasmiContext,
+        userctx: *mut c_void,
+    ) -> Option<WasmiRuntime> {
         let mut store = Store::new(&context.engine, userctx);
 
-        let instance = match context.linker.instantiate(&mut store, &module) {
+        let instance = match context.linker.instantiate(&mut store, module) {
             Ok(inst_pre) => match inst_pre.ensure_no_start(&mut store) {
                 Ok(inst) => inst,
                 Err(_) => {
@@ -77,9 +125,117 @@ impl WasmiRuntime {
         Some(Self {
             store: store,
             instance: instance,
+            prepared: Vec::new(),
+            prepared_funcs: Vec::new(),
         })
     }
 
+    fn handle_call_error(err: wasmi::Error) -> FFIInvokeResult {
+        match err.as_trap_code() {
+            Some(trap_code) => {
+                return handle_trap_code(trap_code);
+            }
+            _ => {}
+        };
+        let my_error = match err
+            .downcast_ref::<external_call::TrampolineError>()
+        {
+            Some(trampoline_error) => trampoline_error.clone(),
+            None => {
+                return FFIInvokeResult::error(
+                    InvokeError::UNRECOVERABLE,
+                );
+            }
+        };
+
+        return FFIInvokeResult::from_host_error(my_error.error);
+    }
+
+    // method is only read the first time method_index is used
+    fn invoke_prepared(&mut self, method_index: u32, method: &[u8]) -> FFIInvokeResult {
+        let idx = method_index as usize;
+        if idx >= self.prepared.len() {
+            self.prepared.resize_with(idx + 1, || None);
+        }
+
+        let func = match &self.prepared[idx] {
+            Some(f) => f.clone(),
+            None => {
+                let name = match std::str::from_utf8(method) {
+                    Ok(v) => v,
+                    _ => return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR),
+                };
+                let f = match self.instance.get_typed_func::<(), i64>(&self.store, name) {
+                    Ok(f) => f,
+                    // Missing, or not () -> i64.  invoke() classifies
+                    // both (a missing export is a DETERMINISTIC_ERROR,
+                    // a call with the wrong arguments UNRECOVERABLE).
+                    // Not cached, as either is an error anyways.
+                    Err(_) => {
+                        return self.invoke(name);
+                    }
+                };
+                self.prepared[idx] = Some(f.clone());
+                f
+            }
+        };
+
+        match func.call(&mut self.store, ()) {
+            Ok(v) => FFIInvokeResult::success(v as u64),
+            Err(err) => Self::handle_call_error(err),
+        }
+    }
+
+    // method is only read the first time method_index is used
+    fn find_prepared_func(&mut self, method_index: u32, method: &[u8]) -> Option<Func> {
+        let idx = method_index as usize;
+        if idx >= self.prepared_funcs.len() {
+            self.prepared_funcs.resize_with(idx + 1, || None);
+        }
+
+        if self.prepared_funcs[idx].is_none() {
+            let name = std::str::from_utf8(method).ok()?;
+            self.prepared_funcs[idx] = Some(self.instance.get_func(&self.store, name)?);
+        }
+        self.prepared_funcs[idx].clone()
+    }
+
+    fn invoke_typed(&mut self, method_index: u32, method: &[u8], values: TypedInvokeValues) -> FFIInvokeResult {
+        let func = match self.find_prepared_func(method_index, method) {
+            Some(f) => f,
+            None => {
+                return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR);
+            }
+        };
+
+        let mut params: [Val; MAX_TYPED_INVOKE_VALUES] = core::array::from_fn(|_| Val::I64(0));
+        for (i, v) in values.args.iter().enumerate() {
+            params[i] = to_val(*v, values.arg_types[i]);
+        }
+        let mut res: [Val; MAX_TYPED_INVOKE_VALUES] = core::array::from_fn(|_| Val::I64(0));
+        for (i, ty) in values.result_types.iter().enumerate() {
+            res[i] = to_val(0, *ty);
+        }
+
+        let nresults = values.results.len();
+        match func.call(&mut self.store, &params[..values.args.len()], &mut res[..nresults]) {
+            Ok(_) => {}
+            Err(err) => {
+                return Self::handle_call_error(err);
+            }
+        };
+
+        for i in 0..nresults {
+            match from_val(&res[i]) {
+                Some(v) => { values.results[i] = v; }
+                None => {
+                    return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR);
+                }
+            }
+        }
+        FFIInvokeResult::success(0)
+    }
+
     fn invoke(&mut self, method: &str) -> FFIInvokeResult {
         let func = match self.instance.get_func(&self.store, method) {
             Some(v) => v,
@@ -104,24 +260,7 @@ impl WasmiRuntime {
                 }
             },
             Err(err) => {
-                match err.as_trap_code() {
-                    Some(trap_code) => {
-                        return handle_trap_code(trap_code);
-                    }
-                    _ => {}
-                };
-                let my_error = match err
-                    .downcast_ref::<external_call::TrampolineError>()
-                {
-                    Some(trampoline_error) => trampoline_error.clone(),
-                    None => {
-                        return FFIInvokeResult::error(
-                            InvokeError::UNRECOVERABLE,
-                        );
-                    }
-                };
-
-                return FFIInvokeResult::from_host_error(my_error.error);
+                return Self::handle_call_error(err);
             }
         };
     }
@@ -155,12 +294,154 @@ pub extern "C" fn wasmi_invoke(
     r.invoke(string)
 }
 
+// Same as wasmi_invoke, except that the function looked up for
+// method_index is kept, and later calls with the same index
+// skip the lookup (and the name is not read).
 #[no_mangle]
-pub extern "C" fn new_wasmi_runtime(
+pub extern "C" fn wasmi_invoke_prepared(
+    runtime_void: *mut c_void,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+) -> FFIInvokeResult {
+    let runtime: *mut WasmiRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    if method_name == core::ptr::null() {
+        return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR);
+    }
+
+    let method_name_slice =
+        unsafe { slice::from_raw_parts(method_name, method_name_len as usize) };
+
+    let r = unsafe { &mut *runtime };
+
+    r.invoke_prepared(method_index, method_name_slice)
+}
+
+// Same as wasmi_invoke_prepared, with gas_limit as the fuel
+// (and the fuel from before restored afterwards), in one FFI call.
+#[no_mangle]
+pub extern "C" fn wasmi_invoke_metered(
+    runtime_void: *mut c_void,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+    gas_limit: u64,
+) -> FFIMeteredResult {
+    let runtime: *mut WasmiRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    let r = unsafe { &mut *runtime };
+
+    run_metered(
+        r,
+        method_index,
+        method_name,
+        method_name_len,
+        gas_limit,
+        |r| r.store.get_fuel().unwrap(),
+        |r, fuel| r.store.set_fuel(fuel).unwrap(),
+        |r, method_index, method| r.invoke_prepared(method_index, method),
+    )
+}
+
+// Same as wasmi_invoke_prepared on each of calls in turn (see run_batch),
+// with one FFI call, and one save/restore of the fuel, for the whole batch.
+// Returns the number of calls run; results are written for each of those.
+#[no_mangle]
+pub extern "C" fn wasmi_invoke_batch(
+    runtime_void: *mut c_void,
+    calls: *const FFIBatchCall,
+    results: *mut FFIMeteredResult,
+    ncalls: u32,
+    policy: u8,
+) -> u32 {
+    let runtime: *mut WasmiRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    let r = unsafe { &mut *runtime };
+
+    run_batch(
+        r,
+        calls,
+        results,
+        ncalls,
+        policy,
+        |r| r.store.get_fuel().unwrap(),
+        |r, fuel| r.store.set_fuel(fuel).unwrap(),
+        |r, method_index, method| r.invoke_prepared(method_index, method),
+    )
+}
+
+// Same as wasmi_invoke_prepared, but for a function of any signature
+// (of i32s and i64s).  Each arg and result is in a u64 slot (i32s
+// zero-extended), with its WasmValueType in arg_types/result_types.
+// Runs with gas_limit as the fuel (and the fuel from before restored
+// afterwards), as in wasmi_invoke_metered.  The result field of the
+// return value is unused.
+#[no_mangle]
+pub extern "C" fn wasmi_invoke_typed(
+    runtime_void: *mut c_void,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+    args: *const u64,
+    arg_types: *const u8,
+    nargs: u32,
+    results: *mut u64,
+    result_types: *const u8,
+    nresults: u32,
+    gas_limit: u64,
+) -> FFIMeteredResult {
+    let runtime: *mut WasmiRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    if method_name == core::ptr::null() {
+        return FFIMeteredResult {
+            result: FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR),
+            gas_consumed: 0,
+        };
+    }
+
+    let values = match typed_invoke_values(args, arg_types, nargs, results, result_types, nresults) {
+        Some(v) => v,
+        None => {
+            return FFIMeteredResult {
+                result: FFIInvokeResult::error(InvokeError::UNRECOVERABLE),
+                gas_consumed: 0,
+            };
+        }
+    };
+
+    let method_name_slice =
+        unsafe { slice::from_raw_parts(method_name, method_name_len as usize) };
+
+    let r = unsafe { &mut *runtime };
+
+    let fuel_backup = r.store.get_fuel().unwrap();
+    r.store.set_fuel(gas_limit).unwrap();
+    let result = r.invoke_typed(method_index, method_name_slice, values);
+    let remaining = r.store.get_fuel().unwrap();
+    r.store.set_fuel(fuel_backup).unwrap();
+
+    metered_result(result, gas_limit, remaining)
+}
+
+#[no_mangle]
+pub extern "C" fn wasmi_compile(
     bytes: *const u8,
     bytes_len: u32,
-    userctx: *mut c_void,
     wasmi_context_ptr: *const c_void,
+    script_identifier_ptr: *const u8
 ) -> *mut c_void {
     if bytes == core::ptr::null() {
         return core::ptr::null_mut();
@@ -172,9 +453,48 @@ pub extern "C" fn new_wasmi_runtime(
         &*core::mem::transmute::<_, *mut WasmiContext>(wasmi_context_ptr)
     };
 
+    let script_id = cache_key_from_ptr(script_identifier_ptr);
+
     let slice = unsafe { slice::from_raw_parts(bytes, bytes_len as usize) };
 
-    let b = match WasmiRuntime::new(&slice, &wasmi_context, userctx) {
+    let b = match WasmiCompiled::new(&slice, &wasmi_context, &script_id) {
+        Some(res) => Box::new(res),
+        None => {
+            return core::ptr::null_mut();
+        }
+    };
+
+    return unsafe { core::mem::transmute(Box::into_raw(b)) };
+}
+
+#[no_mangle]
+pub extern "C" fn free_wasmi_compiled(p: *mut c_void) {
+    assert!(p != core::ptr::null_mut());
+
+    let compiled: *mut WasmiCompiled = unsafe { core::mem::transmute(p) };
+
+    unsafe { drop(Box::from_raw(compiled)) };
+}
+
+// Threadsafe: many runtimes can be created concurrently from one WasmiCompiled
+#[no_mangle]
+pub extern "C" fn new_wasmi_runtime(
+    compiled_ptr: *const c_void,
+    userctx: *mut c_void,
+    wasmi_context_ptr: *const c_void,
+) -> *mut c_void {
+    assert!(compiled_ptr != core::ptr::null());
+    assert!(wasmi_context_ptr != core::ptr::null());
+
+    let compiled: &WasmiCompiled = unsafe {
+        &*core::mem::transmute::<_, *const WasmiCompiled>(compiled_ptr)
+    };
+
+    let wasmi_context: &WasmiContext = unsafe {
+        &*core::mem::transmute::<_, *mut WasmiContext>(wasmi_context_ptr)
+    };
+
+    let b = match WasmiRuntime::new(&compiled.module, &wasmi_context, userctx) {
         Some(res) => Box::new(res),
         None => {
             return core::ptr::null_mut();
@@ -2,24 +2,24 @@ use wasmtime::{Caller, Config, Engine, Error, Linker, InstanceAllocationStrategy
 
 use core::ffi::c_void;
 
-use crate::external_call::{HostFnError, TrampolineResult, TrampolineError};
+use crate::external_call::{HostCallContext, HostFnError, HostFnGasCost, TrampolineResult, TrampolineError};
 use crate::external_call;
-use crate::common::{string_from_parts, BorrowBypass, WasmValueType};
+use crate::common::{string_from_parts, BorrowBypass, WasmValueType, CacheKey};
+use crate::wasmtime_disk_cache::DiskCache;
+use crate::module_cache::{ModuleCache, FFICacheStats, DEFAULT_MODULE_CACHE_BYTES};
 
-use lru::LruCache;
-use std::num::NonZeroUsize;
-use std::sync::Mutex;
 use std::sync::Arc;
 
-pub type CacheKey = [u8; 32]; // sha256(unmetered contract code)
-
 // A WasmtimeContext provides shared data structures
 // for multiple Wasmtime runtimes.
 
 pub struct WasmtimeContext {
     pub engine: Engine,
     pub linker: Linker<*mut c_void>,
-    pub instance_pre_cache : Mutex<LruCache<CacheKey, Arc<InstancePre<*mut c_void>>>>,
+    // bounded by bytes of compiled code
+    pub instance_pre_cache : ModuleCache<Arc<InstancePre<*mut c_void>>>,
+    // opt-in, see wasmtime_set_disk_cache_dir
+    pub disk_cache : Option<DiskCache>,
 }
 
 fn wasmtime_handle_trampoline_error(result: TrampolineResult) -> Result<u64, wasmtime::Error> {
@@ -38,6 +38,49 @@ fn wasmtime_handle_trampoline_error_noret(result: TrampolineResult) -> Result<()
     }
 }
 
+// Charges a host function's gas from the store's fuel, and copies
+// the rest into its HostCallContext, where the host function can consume
+// it without calling back into rust.  Returns the gas copied.
+// Out of gas traps the same way as a host function returning OUT_OF_GAS,
+// without calling into the host function.
+#[inline(always)]
+fn wasmtime_enter_host_fn(caller: &mut Caller<'_, *mut c_void>, gas: u64) -> Result<u64, wasmtime::Error> {
+    let fuel = caller.get_fuel().unwrap();
+    if fuel < gas {
+        caller.set_fuel(0).unwrap();
+        return Err(wasmtime::Error::new(TrampolineError { error : HostFnError::OUT_OF_GAS }));
+    }
+    if gas != 0 {
+        caller.set_fuel(fuel - gas).unwrap();
+    }
+    let host_call_context = *caller.data() as *mut HostCallContext;
+    unsafe { (*host_call_context).available_gas = fuel - gas; }
+    Ok(fuel - gas)
+}
+
+// Deducts whatever the host function consumed through its HostCallContext
+// from the store's fuel (which the host function may also have changed
+// directly, through the runtime).  If that is more than is left,
+// a successful call becomes OUT_OF_GAS.
+#[inline(always)]
+fn wasmtime_exit_host_fn(caller: &mut Caller<'_, *mut c_void>, available_gas: u64, res: TrampolineResult) -> TrampolineResult {
+    let host_call_context = *caller.data() as *const HostCallContext;
+    let consumed = available_gas.saturating_sub(unsafe { (*host_call_context).available_gas });
+    if consumed == 0 {
+        return res;
+    }
+    let fuel = caller.get_fuel().unwrap();
+    if fuel < consumed {
+        caller.set_fuel(0).unwrap();
+        if res.panic == HostFnError::NONE_OR_RECOVERABLE as u8 {
+            return TrampolineResult { result : 0, panic : HostFnError::OUT_OF_GAS as u8 };
+        }
+        return res;
+    }
+    caller.set_fuel(fuel - consumed).unwrap();
+    res
+}
+
 impl WasmtimeContext {
     fn new_cranelift() -> Option<Self> {
         let mut pool = PoolingAllocationConfig::default();
@@ -66,16 +109,11 @@ impl WasmtimeContext {
         Some(Self {
             engine: engine.clone(),
             linker: Linker::new(&engine),
-            instance_pre_cache: Mutex::new(LruCache::new(NonZeroUsize::new(10).unwrap())),
+            instance_pre_cache: ModuleCache::new(DEFAULT_MODULE_CACHE_BYTES),
+            disk_cache: None,
         })
     }
 
-    pub fn get_inst_pre(&mut self, key : &CacheKey) -> Option<Arc<InstancePre<*mut c_void>>>
-    {
-        let mut cache = self.instance_pre_cache.lock().unwrap();
-        cache.get(key).cloned()
-    }
-
     fn new_winch() -> Option<Self> {
         let engine = Engine::new(
             &Config::default()
@@ -89,29 +127,38 @@ impl WasmtimeContext {
         Some(Self {
             engine: engine.clone(),
             linker: Linker::new(&engine),
-            instance_pre_cache: Mutex::new(LruCache::new(NonZeroUsize::new(10).unwrap())),
+            instance_pre_cache: ModuleCache::new(DEFAULT_MODULE_CACHE_BYTES),
+            disk_cache: None,
         })
     }
 
     fn link_function_0args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>| -> Result<u64, wasmtime::Error> {
+            move |mut caller: Caller<'_, *mut c_void>| -> Result<u64, wasmtime::Error> {
+
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[]))?;
 
                 let res = unsafe {
-                    external_call::c_call_0args(x.clone().fn_pointer, caller.data().clone())
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline0>(x.trampoline)(x.clone().fn_pointer, caller.data().clone())
                 };
 
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmtime_handle_trampoline_error(res);
         }) {
             Ok(_) => Ok(()),
@@ -122,27 +169,34 @@ impl WasmtimeContext {
     fn link_function_1args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1]))?;
                 let res = unsafe {
-                    external_call::c_call_1args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline1>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                     )
                 };
 
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -154,28 +208,34 @@ impl WasmtimeContext {
     fn link_function_2args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2]))?;
                 let res = unsafe {
-                    external_call::c_call_2args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline2>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                         arg2,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -187,23 +247,28 @@ impl WasmtimeContext {
     fn link_function_3args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3]))?;
                 let res = unsafe {
-                    external_call::c_call_3args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline3>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -211,6 +276,7 @@ impl WasmtimeContext {
                         arg3,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -222,24 +288,29 @@ impl WasmtimeContext {
     fn link_function_4args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4]))?;
                 let res = unsafe {
-                    external_call::c_call_4args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline4>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -248,6 +319,7 @@ impl WasmtimeContext {
                         arg4,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -259,25 +331,30 @@ impl WasmtimeContext {
     fn link_function_5args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64,
                   arg5: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5]))?;
                 let res = unsafe {
-                    external_call::c_call_5args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline5>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -287,6 +364,7 @@ impl WasmtimeContext {
                         arg5,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -298,17 +376,21 @@ impl WasmtimeContext {
     fn link_function_6args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -316,8 +398,9 @@ impl WasmtimeContext {
                   arg5: u64,
                   arg6: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6]))?;
                 let res = unsafe {
-                    external_call::c_call_6args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline6>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -328,6 +411,7 @@ impl WasmtimeContext {
                         arg6
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -339,17 +423,21 @@ impl WasmtimeContext {
     fn link_function_7args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -358,8 +446,9 @@ impl WasmtimeContext {
                   arg6: u64,
                   arg7: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7]))?;
                 let res = unsafe {
-                    external_call::c_call_7args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline7>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -371,6 +460,7 @@ impl WasmtimeContext {
                         arg7
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -382,17 +472,21 @@ impl WasmtimeContext {
     fn link_function_8args(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -402,8 +496,9 @@ impl WasmtimeContext {
                   arg7: u64,
                   arg8: u64|
                   -> Result<u64, wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8]))?;
                 let res = unsafe {
-                    external_call::c_call_8args(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline8>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -416,6 +511,7 @@ impl WasmtimeContext {
                         arg8
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error(res);
             },
         ) {
@@ -427,22 +523,30 @@ impl WasmtimeContext {
     fn link_function_0args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>| -> Result<(), wasmtime::Error> {
+            move |mut caller: Caller<'_, *mut c_void>| -> Result<(), wasmtime::Error> {
+
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[]))?;
 
                 let res = unsafe {
-                    external_call::c_call_0args_noret(x.clone().fn_pointer, caller.data().clone())
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline0>(x.trampoline)(x.clone().fn_pointer, caller.data().clone())
                 };
 
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmtime_handle_trampoline_error_noret(res);
         }) {
             Ok(_) => Ok(()),
@@ -453,27 +557,34 @@ impl WasmtimeContext {
     fn link_function_1args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1]))?;
                 let res = unsafe {
-                    external_call::c_call_1args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline1>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                     )
                 };
 
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
+
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -485,28 +596,34 @@ impl WasmtimeContext {
     fn link_function_2args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2]))?;
                 let res = unsafe {
-                    external_call::c_call_2args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline2>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
                         arg2,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -518,23 +635,28 @@ impl WasmtimeContext {
     fn link_function_3args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3]))?;
                 let res = unsafe {
-                    external_call::c_call_3args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline3>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -542,6 +664,7 @@ impl WasmtimeContext {
                         arg3,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -553,24 +676,29 @@ impl WasmtimeContext {
     fn link_function_4args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4]))?;
                 let res = unsafe {
-                    external_call::c_call_4args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline4>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -579,6 +707,7 @@ impl WasmtimeContext {
                         arg4,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -590,25 +719,30 @@ impl WasmtimeContext {
     fn link_function_5args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
                   arg4: u64,
                   arg5: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5]))?;
                 let res = unsafe {
-                    external_call::c_call_5args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline5>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -618,6 +752,7 @@ impl WasmtimeContext {
                         arg5,
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -628,17 +763,21 @@ impl WasmtimeContext {
     fn link_function_6args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -646,8 +785,9 @@ impl WasmtimeContext {
                   arg5: u64,
                   arg6: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6]))?;
                 let res = unsafe {
-                    external_call::c_call_6args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline6>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -658,6 +798,7 @@ impl WasmtimeContext {
                         arg6
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -669,17 +810,21 @@ impl WasmtimeContext {
     fn link_function_7args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -688,8 +833,9 @@ impl WasmtimeContext {
                   arg6: u64,
                   arg7: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7]))?;
                 let res = unsafe {
-                    external_call::c_call_7args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline7>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -701,6 +847,7 @@ impl WasmtimeContext {
                         arg7
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -712,17 +859,21 @@ impl WasmtimeContext {
     fn link_function_8args_noret(
         &mut self,
         fn_pointer: *mut c_void,
+        trampoline: *mut c_void,
+        gas: HostFnGasCost,
         import_name: &str,
         fn_name: &str,
     ) -> Result<(), Error> {
         let x = BorrowBypass {
             fn_pointer: fn_pointer.clone(),
+            trampoline: trampoline,
+            gas: gas,
         };
 
         match self.linker.func_wrap(
             import_name,
             fn_name,
-            move |caller: Caller<'_, *mut c_void>,
+            move |mut caller: Caller<'_, *mut c_void>,
                   arg1: u64,
                   arg2: u64,
                   arg3: u64,
@@ -732,8 +883,9 @@ impl WasmtimeContext {
                   arg7: u64,
                   arg8: u64|
                   -> Result<(), wasmtime::Error> {
+                let available_gas = wasmtime_enter_host_fn(&mut caller, x.gas.cost(&[arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8]))?;
                 let res = unsafe {
-                    external_call::c_call_8args_noret(
+                    core::mem::transmute::<*mut c_void, external_call::Trampoline8>(x.trampoline)(
                         x.clone().fn_pointer,
                         caller.data().clone(),
                         arg1,
@@ -746,6 +898,7 @@ impl WasmtimeContext {
                         arg8
                     )
                 };
+                let res = wasmtime_exit_host_fn(&mut caller, available_gas, res);
                 return wasmtime_handle_trampoline_error_noret(res);
             },
         ) {
@@ -763,8 +916,12 @@ pub extern "C" fn wasmtime_link_nargs(
     method_name: *const u8,
     method_name_len: u32,
     function_pointer: *mut c_void,
+    trampoline: *mut c_void,
     nargs: u8,
-    ret_type : u8 // WasmValueType
+    ret_type : u8, // WasmValueType
+    gas_base: u64,
+    gas_per_byte: u64,
+    gas_len_arg: u8,
 ) -> bool // true if success
 {
     let context: *mut WasmtimeContext =
@@ -782,6 +939,11 @@ pub extern "C" fn wasmtime_link_nargs(
         Some(x) => x
     };
 
+    let gas = HostFnGasCost::new(gas_base, gas_per_byte, gas_len_arg);
+    if !gas.valid_for(nargs) {
+        return false;
+    }
+
     let module = match string_from_parts(module_name, module_name_len) {
         Ok(x) => x,
         _ => {
@@ -801,15 +963,15 @@ pub extern "C" fn wasmtime_link_nargs(
     let res = match ret_type_enum {
         WasmValueType::U64 => {
             match nargs {
-                0 => c.link_function_0args(function_pointer, &module, &method),
-                1 => c.link_function_1args(function_pointer, &module, &method),
-                2 => c.link_function_2args(function_pointer, &module, &method),
-                3 => c.link_function_3args(function_pointer, &module, &method),
-                4 => c.link_function_4args(function_pointer, &module, &method),
-                5 => c.link_function_5args(function_pointer, &module, &method),
-                6 => c.link_function_6args(function_pointer, &module, &method),
-                7 => c.link_function_7args(function_pointer, &module, &method),
-                8 => c.link_function_8args(function_pointer, &module, &method),
+                0 => c.link_function_0args(function_pointer, trampoline, gas, &module, &method),
+                1 => c.link_function_1args(function_pointer, trampoline, gas, &module, &method),
+                2 => c.link_function_2args(function_pointer, trampoline, gas, &module, &method),
+                3 => c.link_function_3args(function_pointer, trampoline, gas, &module, &method),
+                4 => c.link_function_4args(function_pointer, trampoline, gas, &module, &method),
+                5 => c.link_function_5args(function_pointer, trampoline, gas, &module, &method),
+                6 => c.link_function_6args(function_pointer, trampoline, gas, &module, &method),
+                7 => c.link_function_7args(function_pointer, trampoline, gas, &module, &method),
+                8 => c.link_function_8args(function_pointer, trampoline, gas, &module, &method),
                 _ => {
                     return false;
                 }
@@ -817,20 +979,24 @@ pub extern "C" fn wasmtime_link_nargs(
         },
         WasmValueType::VOID => {
             match nargs {
-                0 => c.link_function_0args_noret(function_pointer, &module, &method),
-                1 => c.link_function_1args_noret(function_pointer, &module, &method),
-                2 => c.link_function_2args_noret(function_pointer, &module, &method),
-                3 => c.link_function_3args_noret(function_pointer, &module, &method),
-                4 => c.link_function_4args_noret(function_pointer, &module, &method),
-                5 => c.link_function_5args_noret(function_pointer, &module, &method),
-                6 => c.link_function_6args_noret(function_pointer, &module, &method),
-                7 => c.link_function_7args_noret(function_pointer, &module, &method),
-                8 => c.link_function_8args_noret(function_pointer, &module, &method),
+                0 => c.link_function_0args_noret(function_pointer, trampoline, gas, &module, &method),
+                1 => c.link_function_1args_noret(function_pointer, trampoline, gas, &module, &method),
+                2 => c.link_function_2args_noret(function_pointer, trampoline, gas, &module, &method),
+                3 => c.link_function_3args_noret(function_pointer, trampoline, gas, &module, &method),
+                4 => c.link_function_4args_noret(function_pointer, trampoline, gas, &module, &method),
+                5 => c.link_function_5args_noret(function_pointer, trampoline, gas, &module, &method),
+                6 => c.link_function_6args_noret(function_pointer, trampoline, gas, &module, &method),
+                7 => c.link_function_7args_noret(function_pointer, trampoline, gas, &module, &method),
+                8 => c.link_function_8args_noret(function_pointer, trampoline, gas, &module, &method),
                 _ => {
                     return false;
                 }
             }
         },
+        // host functions do not return i32
+        WasmValueType::I32 => {
+            return false;
+        },
     };
 
     match res {
@@ -860,6 +1026,54 @@ pub extern "C" fn new_wasmtime_context_winch() -> *mut c_void {
     return unsafe { core::mem::transmute(Box::into_raw(b)) };
 }
 
+#[no_mangle]
+pub extern "C" fn wasmtime_get_cache_stats(wasmtime_context_ptr: *const c_void) -> FFICacheStats {
+    assert!(wasmtime_context_ptr != core::ptr::null());
+
+    let wasmtime_context: &WasmtimeContext = unsafe {
+        &*core::mem::transmute::<_, *const WasmtimeContext>(wasmtime_context_ptr)
+    };
+
+    wasmtime_context.instance_pre_cache.stats()
+}
+
+#[no_mangle]
+pub extern "C" fn wasmtime_set_cache_budget(wasmtime_context_ptr: *const c_void, budget_bytes: u64) {
+    assert!(wasmtime_context_ptr != core::ptr::null());
+
+    let wasmtime_context: &WasmtimeContext = unsafe {
+        &*core::mem::transmute::<_, *const WasmtimeContext>(wasmtime_context_ptr)
+    };
+
+    wasmtime_context.instance_pre_cache.set_budget(budget_bytes);
+}
+
+// Not threadsafe -- call before creating any runtimes.
+// Returns false (and leaves the disk cache disabled) if the directory
+// cannot be created.
+#[no_mangle]
+pub extern "C" fn wasmtime_set_disk_cache_dir(
+    wasmtime_context_ptr: *mut c_void,
+    dir: *const u8,
+    dir_len: u32,
+) -> bool {
+    assert!(wasmtime_context_ptr != core::ptr::null_mut());
+
+    let wasmtime_context: &mut WasmtimeContext = unsafe {
+        &mut *core::mem::transmute::<_, *mut WasmtimeContext>(wasmtime_context_ptr)
+    };
+
+    let dir_str = match string_from_parts(dir, dir_len) {
+        Ok(s) => s,
+        Err(_) => {
+            return false;
+        }
+    };
+
+    wasmtime_context.disk_cache = DiskCache::new(&wasmtime_context.engine, std::path::Path::new(&dir_str));
+    wasmtime_context.disk_cache.is_some()
+}
+
 #[no_mangle]
 pub extern "C" fn free_wasmtime_context(p: *mut c_void) {
     assert!(p != core::ptr::null_mut());
@@ -0,0 +1,88 @@
+use wasmtime::{Engine, Module};
+
+use crate::common::CacheKey;
+
+use std::collections::hash_map::DefaultHasher;
+use std::hash::{Hash, Hasher};
+use std::path::{Path, PathBuf};
+
+// Directory-backed cache of compiled wasmtime artifacts,
+// so that a restarted process does not have to recompile
+// every contract it has seen before.
+//
+// Files are named by the script identifier and a fingerprint
+// of the engine configuration (wasmtime version, compiler, tunables),
+// so artifacts from an incompatible engine are never loaded.
+//
+// Artifacts are loaded with Module::deserialize_file, which mmaps the file
+// and trusts its contents.  The directory must only be writable
+// by this process (or other trusted processes with the same configuration).
+pub struct DiskCache {
+    dir: PathBuf,
+    fingerprint: u64,
+}
+
+impl DiskCache {
+    pub fn new(engine: &Engine, dir: &Path) -> Option<DiskCache> {
+        std::fs::create_dir_all(dir).ok()?;
+
+        let mut hasher = DefaultHasher::new();
+        engine.precompile_compatibility_hash().hash(&mut hasher);
+
+        Some(Self {
+            dir: dir.to_path_buf(),
+            fingerprint: hasher.finish(),
+        })
+    }
+
+    fn path_for(&self, key: &CacheKey) -> PathBuf {
+        let mut name = String::with_capacity(2 * key.len() + 24);
+        for b in key.iter() {
+            name.push_str(&format!("{:02x}", b));
+        }
+        name.push_str(&format!("-{:016x}.cwasm", self.fingerprint));
+        self.dir.join(name)
+    }
+
+    // Returns None if there is no (usable) artifact on disk.
+    pub fn load(&self, engine: &Engine, key: &CacheKey) -> Option<Module> {
+        let path = self.path_for(key);
+        if !path.exists() {
+            return None;
+        }
+        // Safety: see the comment on DiskCache --
+        // we only read files that we (or a trusted peer) wrote.
+        // A corrupt or incompatible file is reported as an error
+        // and recompiled (and overwritten) by the caller.
+        unsafe { Module::deserialize_file(engine, &path).ok() }
+    }
+
+    // Best-effort: failure to persist an artifact is not an error.
+    //
+    // Write to a temporary file and then rename, so that concurrent
+    // readers (in this or another process) never observe a partial file,
+    // and so that existing mmaps of an old artifact remain valid.
+    pub fn store(&self, key: &CacheKey, module: &Module) {
+        let bytes = match module.serialize() {
+            Ok(b) => b,
+            Err(_) => {
+                return;
+            }
+        };
+
+        let path = self.path_for(key);
+        let tmp = path.with_extension(format!(
+            "tmp.{}.{:?}",
+            std::process::id(),
+            std::thread::current().id()
+        ));
+
+        if std::fs::write(&tmp, &bytes).is_err() {
+            let _ = std::fs::remove_file(&tmp);
+            return;
+        }
+        if std::fs::rename(&tmp, &path).is_err() {
+            let _ = std::fs::remove_file(&tmp);
+        }
+    }
+}
@@ -1,17 +1,32 @@
 use core::ffi::c_void;
 use core::slice;
-use wasmtime::{Instance, Module, Store, Val};
+use wasmtime::{Func, Instance, InstancePre, Module, Store, TypedFunc, Val};
 
-use crate::wasmtime_context::{WasmtimeContext, CacheKey};
+use crate::wasmtime_context::WasmtimeContext;
+use crate::common::{CacheKey, cache_key_from_ptr, typed_invoke_values, TypedInvokeValues, WasmValueType, MAX_TYPED_INVOKE_VALUES};
 use crate::external_call;
-use crate::invoke_result::{InvokeError, FFIInvokeResult};
+use crate::invoke_result::{InvokeError, FFIInvokeResult, FFIBatchCall, FFIMeteredResult, metered_result, run_batch, run_metered};
 use std::sync::Arc;
+use std::time::Instant;
 
 pub struct WasmtimeRuntime {
     pub store: Store<*mut c_void>,
     pub instance: Instance,
+    // for reset()
+    instance_pre: Arc<InstancePre<*mut c_void>>,
+    // by MethodHandle index (index in the module's export table).
+    // Functions belong to the store, so reset() clears these.
+    prepared: Vec<Option<TypedFunc<(), i64>>>,
+    // same, for invoke_typed (whose signatures are only known at runtime)
+    prepared_funcs: Vec<Option<Func>>,
 }
 
+// The store's data is the HostCallContext of the WasmRuntime that owns
+// this runtime, which moves with it, and nothing here is thread-local.
+// A runtime may be created on one thread (e.g. by a RuntimePool)
+// and used on another, but only by one thread at a time.
+unsafe impl Send for WasmtimeRuntime {}
+
 fn assert_runtime_not_null(runtime: *const WasmtimeRuntime) {
     assert!(runtime != core::ptr::null());
 }
@@ -75,41 +90,92 @@ fn handle_trap_code(code: &wasmtime::Trap) -> FFIInvokeResult {
     }
 }
 
-impl WasmtimeRuntime {
+// Returns the InstancePre, the size of its compiled code,
+// and how long it took to produce (in microseconds).
+fn compile_instance_pre(
+    bytes: &[u8],
+    context: &WasmtimeContext,
+    script_id : &Option<CacheKey>
+) -> Option<(Arc<InstancePre<*mut c_void>>, u64, u64)> {
+    let compile_start = Instant::now();
+
+    let from_disk = match (&script_id, &context.disk_cache) {
+        (Some(key), Some(disk_cache)) => disk_cache.load(&context.engine, key),
+        _ => None,
+    };
+
+    let module = match from_disk {
+        Some(m) => m,
+        None => {
+            let m = match Module::new(&context.engine, &bytes) {
+                Ok(m) => m,
+                Err(x) => {
+                    println!("Error: {}", x);
+                    return None;
+                }
+            };
+            if let (Some(key), Some(disk_cache)) = (&script_id, &context.disk_cache) {
+                disk_cache.store(key, &m);
+            }
+            m
+        }
+    };
+
+    let instance_pre = context.linker.instantiate_pre(&module).ok()?;
+
+    let compile_micros = compile_start.elapsed().as_micros() as u64;
+    let image = module.image_range();
+    let image_bytes = (image.end as usize - image.start as usize) as u64;
+
+    Some((Arc::new(instance_pre), image_bytes, compile_micros))
+}
+
+// Compiled and linked module, shared between runtimes
+// (and between threads).
+pub struct WasmtimeCompiled {
+    pub instance_pre: Arc<InstancePre<*mut c_void>>,
+}
+
+impl WasmtimeCompiled {
     fn new(
         bytes: &[u8],
-        context: &mut WasmtimeContext,
-        userctx: *mut c_void,
+        context: &WasmtimeContext,
         script_id : &Option<CacheKey>
-    ) -> Option<WasmtimeRuntime> {
+    ) -> Option<WasmtimeCompiled> {
 
-        if let Some(key) = &script_id {
-            //let mut cache = context.instance_pre_cache.lock().unwrap();
-            if let Some(inst_pre) = context.get_inst_pre(key) {
-                let mut store = Store::new(&context.engine, userctx);
-                let instance = inst_pre.instantiate(&mut store).ok()?;
-                return Some(Self {
-                    store : store,
-                    instance: instance
-                });
-            };
+        // Concurrent misses on the same script wait for one compilation
+        let instance_pre = match &script_id {
+            Some(key) => context.instance_pre_cache.get_or_insert_with(key,
+                || compile_instance_pre(bytes, context, script_id))?,
+            None => compile_instance_pre(bytes, context, script_id)?.0,
         };
 
-        let module = match Module::new(&context.engine, &bytes) {
-            Ok(m) => m,
-            Err(x) => {
-                println!("Error: {}", x);
-                return None;
-            }
-        };
+        Some(Self { instance_pre: instance_pre })
+    }
+}
 
-        let instance_pre = context.linker.instantiate_pre(&module).ok()?;
+fn to_val(v: u64, ty: u8) -> Val {
+    if ty == WasmValueType::I32 as u8 {
+        Val::I32(v as u32 as i32)
+    } else {
+        Val::I64(v as i64)
+    }
+}
 
-        if let Some(key) = &script_id {
-            let mut cache = context.instance_pre_cache.lock().unwrap();
-            cache.put(*key, Arc::new(instance_pre.clone()));
-        }
+fn from_val(v: &Val) -> Option<u64> {
+    match v {
+        Val::I32(x) => Some(*x as u32 as u64),
+        Val::I64(x) => Some(*x as u64),
+        _ => None,
+    }
+}
 
+impl WasmtimeRuntime {
+    fn new(
+        instance_pre: &Arc<InstancePre<*mut c_void>>,
+        context: &WasmtimeContext,
+        userctx: *mut c_void,
+    ) -> Option<WasmtimeRuntime> {
         let mut store = Store::new(&context.engine, userctx);
 
         // TODO(geoff): test to ensure start() function doesn't run
@@ -117,9 +183,151 @@ impl WasmtimeRuntime {
         Some(Self {
             store: store,
             instance: instance,
+            instance_pre: instance_pre.clone(),
+            prepared: Vec::new(),
+            prepared_funcs: Vec::new(),
         })
     }
 
+    // Swap in a new store and instance, keeping the fuel and userctx.
+    //
+    // The old store is dropped before instantiating, so its slot
+    // goes back to the pooling allocator, which hands the same (warm) slot
+    // back for the same module and only has to reset the pages
+    // that were touched (up to linear_memory_keep_resident, and madvise
+    // beyond that).
+    fn reset(&mut self) -> bool {
+        let userctx = *self.store.data();
+        let fuel = self.store.get_fuel().unwrap();
+
+        self.store = Store::new(self.instance_pre.module().engine(), userctx);
+        self.store.set_fuel(fuel).unwrap();
+        self.prepared.clear();
+        self.prepared_funcs.clear();
+
+        match self.instance_pre.instantiate(&mut self.store) {
+            Ok(instance) => {
+                self.instance = instance;
+                true
+            }
+            Err(_) => false,
+        }
+    }
+
+    fn handle_call_error(err: wasmtime::Error) -> FFIInvokeResult {
+        // wasmtime docs:
+        // The “base” error or anyhow::Error::root_cause is a Trap whenever WebAssembly hits a trap, 
+        // or otherwise it’s whatever the host created the error 
+        // with when returning an error for a host call.
+
+        match err.downcast_ref::<wasmtime::Trap>() {
+            Some (trap) => {
+                return handle_trap_code(trap);
+            }
+            _ => {}
+        };
+
+        let my_error = match err
+            .downcast_ref::<external_call::TrampolineError>()
+        {
+            Some(trampoline_error) => trampoline_error.clone(),
+            None => {
+                return FFIInvokeResult::error(
+                    InvokeError::UNRECOVERABLE,
+                );
+            }
+        };
+
+        return FFIInvokeResult::from_host_error(my_error.error);
+    }
+
+    // method is only read the first time method_index is used
+    // (after each reset())
+    fn invoke_prepared(&mut self, method_index: u32, method: &[u8]) -> FFIInvokeResult {
+        let idx = method_index as usize;
+        if idx >= self.prepared.len() {
+            self.prepared.resize_with(idx + 1, || None);
+        }
+
+        let func = match &self.prepared[idx] {
+            Some(f) => f.clone(),
+            None => {
+                let name = match std::str::from_utf8(method) {
+                    Ok(v) => v,
+                    _ => return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR),
+                };
+                let f = match self.instance.get_typed_func::<(), i64>(&mut self.store, name) {
+                    Ok(f) => f,
+                    // Missing, or not () -> i64.  invoke() classifies
+                    // both (a missing export is a DETERMINISTIC_ERROR,
+                    // a call with the wrong arguments UNRECOVERABLE).
+                    // Not cached, as either is an error anyways.
+                    Err(_) => {
+                        return self.invoke(name);
+                    }
+                };
+                self.prepared[idx] = Some(f.clone());
+                f
+            }
+        };
+
+        match func.call(&mut self.store, ()) {
+            Ok(v) => FFIInvokeResult::success(v as u64),
+            Err(err) => Self::handle_call_error(err),
+        }
+    }
+
+    // method is only read the first time method_index is used
+    // (after each reset())
+    fn find_prepared_func(&mut self, method_index: u32, method: &[u8]) -> Option<Func> {
+        let idx = method_index as usize;
+        if idx >= self.prepared_funcs.len() {
+            self.prepared_funcs.resize_with(idx + 1, || None);
+        }
+
+        if self.prepared_funcs[idx].is_none() {
+            let name = std::str::from_utf8(method).ok()?;
+            self.prepared_funcs[idx] = Some(self.instance.get_func(&mut self.store, name)?);
+        }
+        self.prepared_funcs[idx].clone()
+    }
+
+    fn invoke_typed(&mut self, method_index: u32, method: &[u8], values: TypedInvokeValues) -> FFIInvokeResult {
+        let func = match self.find_prepared_func(method_index, method) {
+            Some(f) => f,
+            None => {
+                return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR);
+            }
+        };
+
+        let mut params: [Val; MAX_TYPED_INVOKE_VALUES] = core::array::from_fn(|_| Val::I64(0));
+        for (i, v) in values.args.iter().enumerate() {
+            params[i] = to_val(*v, values.arg_types[i]);
+        }
+        let mut res: [Val; MAX_TYPED_INVOKE_VALUES] = core::array::from_fn(|_| Val::I64(0));
+        for (i, ty) in values.result_types.iter().enumerate() {
+            res[i] = to_val(0, *ty);
+        }
+
+        let nresults = values.results.len();
+        match func.call(&mut self.store, &params[..values.args.len()], &mut res[..nresults]) {
+            Ok(_) => {}
+            Err(err) => {
+                return Self::handle_call_error(err);
+            }
+        };
+
+        for i in 0..nresults {
+            match from_val(&res[i]) {
+                Some(v) => { values.results[i] = v; }
+                None => {
+                    return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR);
+                }
+            }
+        }
+        FFIInvokeResult::success(0)
+    }
+
     fn invoke(&mut self, method: &str) -> FFIInvokeResult {
         let func = match self.instance.get_func(&mut self.store, method) {
             Some(v) => v,
@@ -144,30 +352,7 @@ impl WasmtimeRuntime {
                 }
             },
             Err(err) => {
-                // wasmtime docs:
-                // The “base” error or anyhow::Error::root_cause is a Trap whenever WebAssembly hits a trap, 
-                // or otherwise it’s whatever the host created the error 
-                // with when returning an error for a host call.
-
-                match err.downcast_ref::<wasmtime::Trap>() {
-                    Some (trap) => {
-                        return handle_trap_code(trap);
-                    }
-                    _ => {}
-                };
-
-                let my_error = match err
-                    .downcast_ref::<external_call::TrampolineError>()
-                {
-                    Some(trampoline_error) => trampoline_error.clone(),
-                    None => {
-                        return FFIInvokeResult::error(
-                            InvokeError::UNRECOVERABLE,
-                        );
-                    }
-                };
-
-                return FFIInvokeResult::from_host_error(my_error.error);
+                return Self::handle_call_error(err);
             }
         };
     }
@@ -201,11 +386,152 @@ pub extern "C" fn wasmtime_invoke(
     r.invoke(string)
 }
 
+// Same as wasmtime_invoke, except that the function looked up for
+// method_index is kept, and later calls with the same index
+// skip the lookup (and the name is not read).
 #[no_mangle]
-pub extern "C" fn new_wasmtime_runtime(
+pub extern "C" fn wasmtime_invoke_prepared(
+    runtime_void: *mut c_void,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+) -> FFIInvokeResult {
+    let runtime: *mut WasmtimeRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    if method_name == core::ptr::null() {
+        return FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR);
+    }
+
+    let method_name_slice =
+        unsafe { slice::from_raw_parts(method_name, method_name_len as usize) };
+
+    let r = unsafe { &mut *runtime };
+
+    r.invoke_prepared(method_index, method_name_slice)
+}
+
+// Same as wasmtime_invoke_prepared, with gas_limit as the fuel
+// (and the fuel from before restored afterwards), in one FFI call.
+#[no_mangle]
+pub extern "C" fn wasmtime_invoke_metered(
+    runtime_void: *mut c_void,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+    gas_limit: u64,
+) -> FFIMeteredResult {
+    let runtime: *mut WasmtimeRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    let r = unsafe { &mut *runtime };
+
+    run_metered(
+        r,
+        method_index,
+        method_name,
+        method_name_len,
+        gas_limit,
+        |r| r.store.get_fuel().unwrap(),
+        |r, fuel| r.store.set_fuel(fuel).unwrap(),
+        |r, method_index, method| r.invoke_prepared(method_index, method),
+    )
+}
+
+// Same as wasmtime_invoke_prepared on each of calls in turn (see run_batch),
+// with one FFI call, and one save/restore of the fuel, for the whole batch.
+// Returns the number of calls run; results are written for each of those.
+#[no_mangle]
+pub extern "C" fn wasmtime_invoke_batch(
+    runtime_void: *mut c_void,
+    calls: *const FFIBatchCall,
+    results: *mut FFIMeteredResult,
+    ncalls: u32,
+    policy: u8,
+) -> u32 {
+    let runtime: *mut WasmtimeRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    let r = unsafe { &mut *runtime };
+
+    run_batch(
+        r,
+        calls,
+        results,
+        ncalls,
+        policy,
+        |r| r.store.get_fuel().unwrap(),
+        |r, fuel| r.store.set_fuel(fuel).unwrap(),
+        |r, method_index, method| r.invoke_prepared(method_index, method),
+    )
+}
+
+// Same as wasmtime_invoke_prepared, but for a function of any signature
+// (of i32s and i64s).  Each arg and result is in a u64 slot (i32s
+// zero-extended), with its WasmValueType in arg_types/result_types.
+// Runs with gas_limit as the fuel (and the fuel from before restored
+// afterwards), as in wasmtime_invoke_metered.  The result field of the
+// return value is unused.
+#[no_mangle]
+pub extern "C" fn wasmtime_invoke_typed(
+    runtime_void: *mut c_void,
+    method_index: u32,
+    method_name: *const u8,
+    method_name_len: u32,
+    args: *const u64,
+    arg_types: *const u8,
+    nargs: u32,
+    results: *mut u64,
+    result_types: *const u8,
+    nresults: u32,
+    gas_limit: u64,
+) -> FFIMeteredResult {
+    let runtime: *mut WasmtimeRuntime =
+        unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    if method_name == core::ptr::null() {
+        return FFIMeteredResult {
+            result: FFIInvokeResult::error(InvokeError::DETERMINISTIC_ERROR),
+            gas_consumed: 0,
+        };
+    }
+
+    let values = match typed_invoke_values(args, arg_types, nargs, results, result_types, nresults) {
+        Some(v) => v,
+        None => {
+            return FFIMeteredResult {
+                result: FFIInvokeResult::error(InvokeError::UNRECOVERABLE),
+                gas_consumed: 0,
+            };
+        }
+    };
+
+    let method_name_slice =
+        unsafe { slice::from_raw_parts(method_name, method_name_len as usize) };
+
+    let r = unsafe { &mut *runtime };
+
+    let fuel_backup = r.store.get_fuel().unwrap();
+    r.store.set_fuel(gas_limit).unwrap();
+    let result = r.invoke_typed(method_index, method_name_slice, values);
+    let remaining = r.store.get_fuel().unwrap();
+    r.store.set_fuel(fuel_backup).unwrap();
+
+    metered_result(result, gas_limit, remaining)
+}
+
+#[no_mangle]
+pub extern "C" fn wasmtime_compile(
     bytes: *const u8,
     bytes_len: u32,
-    userctx: *mut c_void,
     wasmtime_context_ptr: *mut c_void,
     script_identifier_ptr: *const u8
 ) -> *mut c_void {
@@ -213,25 +539,54 @@ pub extern "C" fn new_wasmtime_runtime(
         return core::ptr::null_mut();
     }
 
-    let script_id = if script_identifier_ptr == core::ptr::null() {
-        None
-    } else {
-        let mut out : CacheKey = [0; 32];
-        unsafe {
-            core::ptr::copy_nonoverlapping(script_identifier_ptr, out.as_mut_ptr(), 32);
+    let script_id = cache_key_from_ptr(script_identifier_ptr);
+
+    assert!(wasmtime_context_ptr != core::ptr::null_mut());
+
+    let wasmtime_context: &WasmtimeContext = unsafe {
+        &*core::mem::transmute::<_, *const WasmtimeContext>(wasmtime_context_ptr)
+    };
+
+    let slice = unsafe { slice::from_raw_parts(bytes, bytes_len as usize) };
+
+    let b = match WasmtimeCompiled::new(&slice, wasmtime_context, &script_id) {
+        Some(res) => Box::new(res),
+        None => {
+            return core::ptr::null_mut();
         }
-        Some(out)
     };
 
+    return unsafe { core::mem::transmute(Box::into_raw(b)) };
+}
+
+#[no_mangle]
+pub extern "C" fn free_wasmtime_compiled(p: *mut c_void) {
+    assert!(p != core::ptr::null_mut());
+
+    let compiled: *mut WasmtimeCompiled = unsafe { core::mem::transmute(p) };
+
+    unsafe { drop(Box::from_raw(compiled)) };
+}
+
+// Threadsafe: many runtimes can be created concurrently from one WasmtimeCompiled
+#[no_mangle]
+pub extern "C" fn new_wasmtime_runtime(
+    compiled_ptr: *const c_void,
+    userctx: *mut c_void,
+    wasmtime_context_ptr: *mut c_void,
+) -> *mut c_void {
+    assert!(compiled_ptr != core::ptr::null());
     assert!(wasmtime_context_ptr != core::ptr::null_mut());
 
-    let wasmtime_context: &mut WasmtimeContext = unsafe {
-        &mut *core::mem::transmute::<_, *mut WasmtimeContext>(wasmtime_context_ptr)
+    let compiled: &WasmtimeCompiled = unsafe {
+        &*core::mem::transmute::<_, *const WasmtimeCompiled>(compiled_ptr)
     };
 
-    let slice = unsafe { slice::from_raw_parts(bytes, bytes_len as usize) };
+    let wasmtime_context: &WasmtimeContext = unsafe {
+        &*core::mem::transmute::<_, *const WasmtimeContext>(wasmtime_context_ptr)
+    };
 
-    let b = match WasmtimeRuntime::new(&slice, wasmtime_context, userctx, &script_id) {
+    let b = match WasmtimeRuntime::new(&compiled.instance_pre, wasmtime_context, userctx) {
         Some(res) => Box::new(res),
         None => {
             return core::ptr::null_mut();
@@ -241,6 +596,17 @@ pub extern "C" fn new_wasmtime_runtime(
     return unsafe { core::mem::transmute(Box::into_raw(b)) };
 }
 
+#[no_mangle]
+pub extern "C" fn wasmtime_reset(runtime_void: *mut c_void) -> bool {
+    let runtime: *mut WasmtimeRuntime = unsafe { core::mem::transmute(runtime_void) };
+
+    assert_runtime_not_null(runtime);
+
+    let r = unsafe { &mut *runtime };
+
+    r.reset()
+}
+
 #[no_mangle]
 pub extern "C" fn free_wasmtime_runtime(p: *mut c_void) {
     let runtime: *mut WasmtimeRuntime = unsafe { core::mem::transmute(p) };